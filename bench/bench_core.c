@@ -0,0 +1,510 @@
+// Headless benchmarks of the editor core: loading, typing, line edits,
+// highlighting, multi-cursor edits, saving, journaling to a swap file and
+// recovering from it, copying and pasting the whole file and moving a screen
+// of glyphs through the camera, on generated text so every run sees the same
+// input.
+//
+//   make bench && ./build/bench/bench_core [SIZE-MB] [SEED]
+//
+// Each scenario prints one JSON object per line with its throughput, the
+// latency percentiles of single operations, the peak RSS of the process so
+// far and how many allocations the core made, so runs can be diffed against a
+// baseline. SIZE-MB (default 10) is the size of the loaded file, e.g. 1024 for
+// the 1 GB case.
+#define _DEFAULT_SOURCE
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "editor.h"
+#include "la.h"
+#include "save.h"
+
+#define DEFAULT_SIZE_MB 10
+#define DEFAULT_SEED 69
+#define TYPE_OPS 100000
+#define BIG_LINES (1000 * 1000)
+#define LINE_OPS 10000
+// Cursors of the multi-cursor scenarios, and the keys typed at all of them
+#define BULK_CURSORS 5000
+#define BULK_OPS 100
+// Rows of a screen
+#define VIEW_LINES 60
+// Glyphs of a full screen, and how many times they are laid out
+#define VIEW_GLYPHS (VIEW_LINES * 200)
+#define LAYOUT_FRAMES 10000
+
+// On Linux the core is linked with --wrap, so every malloc it makes goes
+// through here first (see the Makefile)
+#ifdef BENCH_COUNT_ALLOCS
+static atomic_size_t allocs = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+    atomic_fetch_add_explicit(&allocs, 1, memory_order_relaxed);
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+    atomic_fetch_add_explicit(&allocs, 1, memory_order_relaxed);
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    atomic_fetch_add_explicit(&allocs, 1, memory_order_relaxed);
+    return __real_realloc(ptr, size);
+}
+
+static long allocs_so_far(void)
+{
+    return (long) atomic_load(&allocs);
+}
+#else
+static long allocs_so_far(void)
+{
+    return -1;
+}
+#endif
+
+typedef struct {
+    double *items;
+    size_t count;
+    size_t cap;
+} Samples;
+
+typedef struct {
+    const char *name;
+    double start_ms;
+    long start_allocs;
+    Samples latencies;
+} Scenario;
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static double peak_rss_mb(void)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss / (1024.0 * 1024.0);
+#else
+    return usage.ru_maxrss / 1024.0;
+#endif
+}
+
+static uint64_t rng_state = DEFAULT_SEED;
+
+// xorshift64, the same on every platform unlike rand()
+static uint64_t rng_next(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static void samples_push(Samples *samples, double value)
+{
+    if (samples->count == samples->cap) {
+        samples->cap = samples->cap == 0 ? 1024 : samples->cap * 2;
+        samples->items = realloc(samples->items, samples->cap * sizeof(samples->items[0]));
+        if (samples->items == NULL) {
+            fprintf(stderr, "ERROR: could not allocate samples\n");
+            exit(1);
+        }
+    }
+    samples->items[samples->count++] = value;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    const double x = *(const double *) a;
+    const double y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+static double percentile_us(const Samples *samples, double p)
+{
+    if (samples->count == 0) {
+        return 0.0;
+    }
+    size_t index = (size_t) (p * (double) samples->count);
+    if (index >= samples->count) {
+        index = samples->count - 1;
+    }
+    return samples->items[index] * 1e3;
+}
+
+static Scenario scenario_begin(const char *name)
+{
+    return (Scenario) {
+        .name = name,
+        .start_allocs = allocs_so_far(),
+        .start_ms = now_ms(),
+    };
+}
+
+// Times one operation of the scenario
+#define SCENARIO_OP(scenario, op)                                   \
+    do {                                                            \
+        const double op_start = now_ms();                           \
+        op;                                                         \
+        samples_push(&(scenario)->latencies, now_ms() - op_start);  \
+    } while (0)
+
+// Prints the scenario as one JSON line. `ops` counts operations, `bytes` is
+// what they went through; either may be 0.
+static void scenario_end(Scenario *scenario, size_t ops, size_t bytes)
+{
+    const double elapsed = now_ms() - scenario->start_ms;
+    const long allocs_now = allocs_so_far();
+    qsort(scenario->latencies.items, scenario->latencies.count, sizeof(double), compare_double);
+
+    printf("{\"scenario\":\"%s\",\"ms\":%.3f", scenario->name, elapsed);
+    if (ops > 0) {
+        printf(",\"ops\":%zu,\"ops_per_s\":%.1f", ops, (double) ops / (elapsed / 1e3));
+    }
+    if (bytes > 0) {
+        printf(",\"bytes\":%zu,\"mb_per_s\":%.1f", bytes, (double) bytes / (1024.0 * 1024.0) / (elapsed / 1e3));
+    }
+    if (scenario->latencies.count > 0) {
+        printf(",\"p50_us\":%.2f,\"p90_us\":%.2f,\"p99_us\":%.2f,\"max_us\":%.2f",
+               percentile_us(&scenario->latencies, 0.50), percentile_us(&scenario->latencies, 0.90),
+               percentile_us(&scenario->latencies, 0.99), percentile_us(&scenario->latencies, 1.0));
+    }
+    printf(",\"allocs\":%ld,\"peak_rss_mb\":%.1f}\n",
+           allocs_now >= 0 ? allocs_now - scenario->start_allocs : -1, peak_rss_mb());
+    fflush(stdout);
+
+    free(scenario->latencies.items);
+}
+
+// Source-like lines of 0..99 bytes, about one in 500 bytes not ASCII
+static void generate_file(const char *file_path, size_t size)
+{
+    FILE *f = fopen(file_path, "wb");
+    if (f == NULL) {
+        fprintf(stderr, "ERROR: could not create %s\n", file_path);
+        exit(1);
+    }
+
+    char line[128];
+    size_t written = 0;
+    while (written < size) {
+        const size_t len = rng_next() % 100;
+        for (size_t i = 0; i < len; ++i) {
+            if (i + 1 < len && rng_next() % 500 == 0) {
+                line[i++] = (char) 0xC3;
+                line[i] = (char) 0xA9;
+            } else {
+                line[i] = (char) (' ' + rng_next() % 95);
+            }
+        }
+        line[len] = '\n';
+        const size_t n = written + len + 1 > size ? size - written : len + 1;
+        if (fwrite(line, 1, n, f) != n) {
+            fprintf(stderr, "ERROR: could not write %s\n", file_path);
+            exit(1);
+        }
+        written += n;
+    }
+    fclose(f);
+}
+
+static void open_file(Editor *editor, const char *file_path)
+{
+    FILE *f = fopen(file_path, "r");
+    if (f == NULL) {
+        fprintf(stderr, "ERROR: could not open %s\n", file_path);
+        exit(1);
+    }
+    editor_load_from_file(editor, f);
+    fclose(f);
+}
+
+int main(int argc, char *argv[])
+{
+    const size_t size_mb = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_SIZE_MB;
+    rng_state = argc > 2 ? strtoull(argv[2], NULL, 10) : DEFAULT_SEED;
+    if (rng_state == 0) {
+        rng_state = DEFAULT_SEED;
+    }
+    const size_t size = size_mb * 1024 * 1024;
+
+    char file_path[] = "/tmp/grive-bench-XXXXXX";
+    const int fd = mkstemp(file_path);
+    if (fd < 0) {
+        fprintf(stderr, "ERROR: could not create a temporary file\n");
+        return 1;
+    }
+    close(fd);
+    char save_path[sizeof(file_path) + 8];
+    snprintf(save_path, sizeof(save_path), "%s.saved", file_path);
+
+    generate_file(file_path, size);
+
+    Editor editor = {0};
+    {
+        Scenario scenario = scenario_begin("load");
+        open_file(&editor, file_path);
+        scenario_end(&scenario, editor.lines.len, size);
+    }
+
+    {
+        Jobs jobs;
+        jobs_init(&jobs, 0);
+        Editor opened = {0};
+        Scenario scenario = scenario_begin("open first screen");
+        FILE *f = fopen(file_path, "r");
+        editor_open_file(&opened, f, &jobs);
+        fclose(f);
+        scenario_end(&scenario, opened.lines.len, 0);
+
+        scenario = scenario_begin("open background index");
+        editor_load_wait(&opened, EDITOR_DIRTY_END);
+        scenario_end(&scenario, opened.lines.len, size);
+        editor_free(&opened);
+        jobs_free(&jobs);
+    }
+
+    {
+        // Every keystroke lands on a random row and column
+        Scenario scenario = scenario_begin("type random");
+        for (size_t i = 0; i < TYPE_OPS; ++i) {
+            const size_t row = rng_next() % editor.lines.len;
+            const size_t col = rng_next() % (lines_at(&editor.lines, row)->len + 1);
+            const char text[2] = {(char) ('a' + rng_next() % 26), '\0'};
+            SCENARIO_OP(&scenario, {
+                editor_move_cursor_to(&editor, row, col);
+                editor_insert_text_before_cursor(&editor, text);
+            });
+        }
+        scenario_end(&scenario, TYPE_OPS, 0);
+    }
+
+    {
+        // Lexing every line of the file once, like after jumping to its end
+        editor.highlight.language = HIGHLIGHT_C;
+        Scenario scenario = scenario_begin("highlight whole file");
+        while (highlight_update(&editor.highlight, &editor.lines, editor.lines.len, 1000.0)) {}
+        scenario_end(&scenario, editor.lines.len, size + TYPE_OPS);
+        editor.highlight.language = HIGHLIGHT_NONE;
+    }
+
+    {
+        Scenario scenario = scenario_begin("save");
+        if (!editor_save_to_file(&editor, save_path)) {
+            fprintf(stderr, "ERROR: could not save to %s\n", save_path);
+            return 1;
+        }
+        scenario_end(&scenario, 0, size + TYPE_OPS);
+    }
+
+    {
+        // What a background save or swap checkpoint takes on the UI thread,
+        // the writing is left out
+        Scenario scenario = scenario_begin("save snapshot");
+        for (size_t i = 0; i < 10; ++i) {
+            Save snapshot = {0};
+            SCENARIO_OP(&scenario, save_snapshot(&snapshot, &editor, save_path));
+            save_free(&snapshot);
+        }
+        scenario_end(&scenario, 10, 0);
+    }
+
+    {
+        // Typing into the saved copy with a swap file, then replaying it on a
+        // fresh load as if the process had died
+        Editor journaled = {0};
+        open_file(&journaled, save_path);
+        size_t recovered = 0;
+        if (editor_swap_open(&journaled, save_path, &recovered) != SWAP_MISSING) {
+            fprintf(stderr, "ERROR: could not create the swap file of %s\n", save_path);
+            return 1;
+        }
+        Scenario scenario = scenario_begin("type random journaled");
+        for (size_t i = 0; i < TYPE_OPS; ++i) {
+            const size_t row = rng_next() % journaled.lines.len;
+            const size_t col = rng_next() % (lines_at(&journaled.lines, row)->len + 1);
+            const char text[2] = {(char) ('a' + rng_next() % 26), '\0'};
+            SCENARIO_OP(&scenario, {
+                editor_move_cursor_to(&journaled, row, col);
+                editor_insert_text_before_cursor(&journaled, text);
+            });
+        }
+        scenario_end(&scenario, TYPE_OPS, 0);
+        // Closing without removing it is all a crash leaves behind
+        editor_free(&journaled);
+
+        open_file(&journaled, save_path);
+        scenario = scenario_begin("recover swap");
+        const Swap_Status status = editor_swap_open(&journaled, save_path, &recovered);
+        scenario_end(&scenario, recovered, 0);
+        editor_swap_close(&journaled, true);
+        editor_free(&journaled);
+        if (status != SWAP_FOUND || recovered != TYPE_OPS) {
+            fprintf(stderr, "ERROR: expected %d recovered edits, got %zu\n", TYPE_OPS, recovered);
+            return 1;
+        }
+    }
+
+    {
+        // The whole file to the clipboard, into the middle of itself and out again
+        const size_t lines = editor.lines.len;
+        Scenario scenario = scenario_begin("copy all");
+        editor_select_all(&editor);
+        size_t len = 0;
+        char *text = editor_copy(&editor, &len);
+        scenario_end(&scenario, 0, len);
+
+        const size_t middle = lines / 2;
+        editor_move_cursor_to(&editor, middle, 0);
+        scenario = scenario_begin("paste all");
+        editor_paste(&editor, text, len);
+        scenario_end(&scenario, 0, len);
+
+        const Cursor end = {editor.cursor_row, editor.cursor_col};
+        editor_move_cursor_to(&editor, middle, 0);
+        editor_select(&editor);
+        editor.cursor_row = end.row;
+        editor.cursor_col = end.col;
+        scenario = scenario_begin("cut all");
+        free(text);
+        text = editor_cut(&editor, &len);
+        scenario_end(&scenario, 0, len);
+        free(text);
+
+        if (editor.lines.len != lines) {
+            fprintf(stderr, "ERROR: expected %zu lines, got %zu\n", lines, editor.lines.len);
+            return 1;
+        }
+    }
+    editor_free(&editor);
+
+    {
+        // A buffer of 1M short lines, then lines go in and out at the top
+        Editor big = {0};
+        for (size_t row = 0; row < BIG_LINES; ++row) {
+            Line *line = lines_append(&big.lines);
+            line_append_text(&big.pool, line, "int x = 0;");
+        }
+
+        Scenario scenario = scenario_begin("insert line top");
+        for (size_t i = 0; i < LINE_OPS; ++i) {
+            SCENARIO_OP(&scenario, {
+                editor_move_cursor_to(&big, 1, 0);
+                editor_insert_new_line(&big);
+            });
+        }
+        scenario_end(&scenario, LINE_OPS, 0);
+
+        // The lines inserted above are empty, each one is joined into row 0
+        scenario = scenario_begin("delete line top");
+        for (size_t i = 0; i < LINE_OPS; ++i) {
+            SCENARIO_OP(&scenario, {
+                editor_move_cursor_to(&big, 1, 0);
+                editor_remove_line(&big);
+            });
+        }
+        scenario_end(&scenario, LINE_OPS, 0);
+
+        // Keystrokes in the first screen of a highlighted buffer, every one
+        // followed by the update a frame does before painting
+        big.highlight.language = HIGHLIGHT_C;
+        highlight_update(&big.highlight, &big.lines, VIEW_LINES, 1000.0);
+        scenario = scenario_begin("type highlighted");
+        for (size_t i = 0; i < TYPE_OPS; ++i) {
+            const size_t row = rng_next() % VIEW_LINES;
+            const char *text = rng_next() % 2 == 0 ? "/*" : "*/";
+            SCENARIO_OP(&scenario, {
+                editor_move_cursor_to(&big, row, 0);
+                editor_insert_text_before_cursor(&big, text);
+                highlight_update(&big.highlight, &big.lines, VIEW_LINES, 1000.0);
+            });
+        }
+        scenario_end(&scenario, TYPE_OPS, 0);
+        for (size_t i = 0; i < TYPE_OPS; ++i) {
+            editor_undo(&big);
+        }
+
+        // A cursor on every 200th line, every keystroke lands on all of them
+        editor_move_cursor_to(&big, 0, 4);
+        for (size_t i = 1; i < BULK_CURSORS; ++i) {
+            editor_add_cursor(&big, i * (BIG_LINES / BULK_CURSORS), 4);
+        }
+        scenario = scenario_begin("type multi-cursor");
+        for (size_t i = 0; i < BULK_OPS; ++i) {
+            SCENARIO_OP(&scenario, editor_insert_text_before_cursor(&big, "x"));
+        }
+        scenario_end(&scenario, BULK_OPS * BULK_CURSORS, 0);
+
+        scenario = scenario_begin("backspace multi-cursor");
+        for (size_t i = 0; i < BULK_OPS; ++i) {
+            SCENARIO_OP(&scenario, editor_backspace(&big));
+        }
+        scenario_end(&scenario, BULK_OPS * BULK_CURSORS, 0);
+
+        // Every cursor breaks its line and lands at the start of the new one,
+        // the backspace then joins them all back
+        scenario = scenario_begin("join multi-cursor");
+        for (size_t i = 0; i < BULK_OPS; ++i) {
+            SCENARIO_OP(&scenario, {
+                editor_insert_new_line(&big);
+                editor_backspace(&big);
+            });
+        }
+        scenario_end(&scenario, 2 * BULK_OPS * BULK_CURSORS, 0);
+        editor_clear_cursors(&big);
+
+        if (big.lines.len != BIG_LINES) {
+            fprintf(stderr, "ERROR: expected %d lines, got %zu\n", BIG_LINES, big.lines.len);
+            return 1;
+        }
+        editor_free(&big);
+    }
+
+    {
+        // The cells of a full screen into window pixels, once per frame
+        float *xs = malloc(VIEW_GLYPHS * sizeof(xs[0]));
+        float *ys = malloc(VIEW_GLYPHS * sizeof(ys[0]));
+        if (xs == NULL || ys == NULL) {
+            fprintf(stderr, "ERROR: could not allocate glyphs\n");
+            return 1;
+        }
+        Scenario scenario = scenario_begin("layout transform");
+        for (size_t frame = 0; frame < LAYOUT_FRAMES; ++frame) {
+            for (size_t i = 0; i < VIEW_GLYPHS; ++i) {
+                xs[i] = (float) (i % 200);
+                ys[i] = (float) (i / 200);
+            }
+            const Vec2_Transform cells = {
+                .scale = vec2s(10.0f, 20.0f),
+                .offset = vec2s(400.0f, 300.0f - (float) frame),
+            };
+            SCENARIO_OP(&scenario, vec2_transform_soa(cells, xs, ys, VIEW_GLYPHS));
+        }
+        scenario_end(&scenario, (size_t) LAYOUT_FRAMES * VIEW_GLYPHS, 0);
+        free(xs);
+        free(ys);
+    }
+
+    unlink(file_path);
+    unlink(save_path);
+    return 0;
+}
@@ -0,0 +1,294 @@
+// Benchmark of the line index built on load.
+//
+//   make bench && ./build/bench/bench_scan [FILE-PATH]
+//
+// Without a file a synthetic buffer of source-like lines is generated.
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "editor.h"
+#include "scan.h"
+#include "search.h"
+
+#define SV_IMPLEMENTATION
+#include "sv.h"
+
+#define SYNTHETIC_SIZE (256 * 1024 * 1024)
+#define RUNS 5
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static char *generate(size_t size)
+{
+    char *data = malloc(size);
+    if (data == NULL) {
+        fprintf(stderr, "ERROR: could not allocate %zu bytes\n", size);
+        exit(1);
+    }
+
+    srand(69);
+    size_t i = 0;
+    while (i < size) {
+        size_t len = rand() % 80;
+        for (size_t j = 0; j < len && i < size; ++j, ++i) {
+            data[i] = (rand() % 500 == 0) ? (char) 0xC3 : (char) (' ' + rand() % 95);
+        }
+        if (i < size) {
+            data[i++] = '\n';
+        }
+    }
+
+    return data;
+}
+
+// The loader as it was before the vectorized scanner: one byte at a time
+static void legacy_split(const char *data, size_t size, Scan_Lines *lines)
+{
+    String_View sv = { .data = data, .count = size };
+    for (;;) {
+        String_View line = {0};
+        if (sv_try_chop_by_delim(&sv, '\n', &line)) {
+            Scan_Line item = { .offset = (size_t) (line.data - data), .len = line.count, .ascii = true };
+            if (lines->count == lines->cap) {
+                lines->cap = lines->cap ? lines->cap * 2 : 1024;
+                lines->items = realloc(lines->items, lines->cap * sizeof(lines->items[0]));
+            }
+            lines->items[lines->count++] = item;
+        } else {
+            break;
+        }
+    }
+}
+
+static void report(const char *name, size_t size, size_t count, double best)
+{
+    printf("%-16s %10zu lines %9.2f ms %9.1f MB/s\n",
+           name, count, best, (double) size / (1024.0 * 1024.0) / (best / 1e3));
+}
+
+int main(int argc, char *argv[])
+{
+    const char *file_path = argc > 1 ? argv[1] : NULL;
+    char *data = NULL;
+    size_t size = 0;
+
+    if (file_path) {
+        FILE *f = fopen(file_path, "rb");
+        if (f == NULL) {
+            fprintf(stderr, "ERROR: could not open %s\n", file_path);
+            return 1;
+        }
+        fseek(f, 0, SEEK_END);
+        size = (size_t) ftell(f);
+        fseek(f, 0, SEEK_SET);
+        data = malloc(size);
+        if (data == NULL || fread(data, 1, size, f) != size) {
+            fprintf(stderr, "ERROR: could not read %s\n", file_path);
+            return 1;
+        }
+        fclose(f);
+    } else {
+        size = SYNTHETIC_SIZE;
+        data = generate(size);
+    }
+
+    printf("input: %s, %zu bytes\n", file_path ? file_path : "synthetic", size);
+
+    {
+        double best = 1e30;
+        size_t count = 0;
+        for (int run = 0; run < RUNS; ++run) {
+            Scan_Lines lines = {0};
+            double start = now_ms();
+            legacy_split(data, size, &lines);
+            double elapsed = now_ms() - start;
+            if (elapsed < best) best = elapsed;
+            count = lines.count;
+            scan_lines_free(&lines);
+        }
+        report("legacy sv", size, count, best);
+    }
+
+    for (Scan_Impl impl = SCAN_SCALAR; impl < COUNT_SCAN_IMPLS; ++impl) {
+        if (!scan_impl_supported(impl)) {
+            continue;
+        }
+        double best = 1e30;
+        size_t count = 0;
+        for (int run = 0; run < RUNS; ++run) {
+            Scan_Lines lines = {0};
+            double start = now_ms();
+            scan_lines_impl(impl, data, size, &lines);
+            double elapsed = now_ms() - start;
+            if (elapsed < best) best = elapsed;
+            count = lines.count;
+            scan_lines_free(&lines);
+        }
+        report(scan_impl_name(impl), size, count, best);
+    }
+
+    {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        size_t threads = online > 0 ? (size_t) online : 1;
+        double best = 1e30;
+        size_t count = 0;
+        for (int run = 0; run < RUNS; ++run) {
+            Scan_Lines lines = {0};
+            double start = now_ms();
+            scan_lines_parallel(scan_best_impl(), data, size, threads, &lines);
+            double elapsed = now_ms() - start;
+            if (elapsed < best) best = elapsed;
+            count = lines.count;
+            scan_lines_free(&lines);
+        }
+        char name[32];
+        snprintf(name, sizeof(name), "parallel x%zu", threads);
+        report(name, size, count, best);
+    }
+
+    // A needle that is rare in both source code and the synthetic text, so the
+    // filters run over almost all of the input
+    const char needle[] = "#~needle";
+    for (Scan_Impl impl = SCAN_SCALAR; impl < COUNT_SCAN_IMPLS; ++impl) {
+        if (!scan_impl_supported(impl)) {
+            continue;
+        }
+        double best = 1e30;
+        size_t count = 0;
+        for (int run = 0; run < RUNS; ++run) {
+            count = 0;
+            double start = now_ms();
+            for (size_t i = 0; i < size; ) {
+                i += search_literal_impl(impl, data + i, size - i, needle, sizeof(needle) - 1);
+                if (i < size) {
+                    count += 1;
+                    i += 1;
+                }
+            }
+            double elapsed = now_ms() - start;
+            if (elapsed < best) best = elapsed;
+        }
+        char name[32];
+        snprintf(name, sizeof(name), "find %s", scan_impl_name(impl));
+        report(name, size, count, best);
+    }
+
+    {
+        // Cursor moves over two long lines of mixed 1 to 4 byte code points
+        const char *pieces[] = {"a", "\xC3\xA9", "\xE2\x82\xAC", "\xF0\x9F\x98\x80"};
+        const size_t columns = 1024 * 1024;
+        Editor cursor = {0};
+        for (int row = 0; row < 2; ++row) {
+            Line *line = lines_append(&cursor.lines);
+            for (size_t col = 0; col < columns; ++col) {
+                line_append_text(&cursor.pool, line, pieces[(col + row) % 4]);
+            }
+        }
+
+        double start = now_ms();
+        while (cursor.cursor_col < lines_at(&cursor.lines, 0)->len) {
+            editor_move_cursor_right(&cursor);
+        }
+        double elapsed = now_ms() - start;
+        printf("%-16s %10zu steps %9.2f ms %9.1f ns/step\n", "cursor right", columns, elapsed,
+               elapsed * 1e6 / (double) columns);
+
+        const size_t moves = 100000;
+        start = now_ms();
+        for (size_t i = 0; i < moves; ++i) {
+            editor_move_cursor_to(&cursor, 0, lines_at(&cursor.lines, 0)->len * (i % 64) / 64);
+            editor_move_cursor_down(&cursor);
+            editor_move_cursor_up(&cursor);
+        }
+        elapsed = now_ms() - start;
+        printf("%-16s %10zu steps %9.2f ms %9.1f ns/step\n", "cursor up/down", moves * 2, elapsed,
+               elapsed * 1e6 / (double) (moves * 2));
+        editor_free(&cursor);
+    }
+
+    if (file_path) {
+        FILE *f = fopen(file_path, "r");
+        Editor editor = {0};
+        double start = now_ms();
+        editor_load_from_file(&editor, f);
+        double elapsed = now_ms() - start;
+        fclose(f);
+        report("editor load", size, editor.lines.len, elapsed);
+
+        {
+            // Time to the first screen, then until the background index is in
+            Jobs jobs;
+            jobs_init(&jobs, 0);
+            Editor opened = {0};
+            f = fopen(file_path, "r");
+            start = now_ms();
+            editor_open_file(&opened, f, &jobs);
+            elapsed = now_ms() - start;
+            fclose(f);
+            report("first screen", size, opened.lines.len, elapsed);
+            editor_load_wait(&opened, EDITOR_DIRTY_END);
+            elapsed = now_ms() - start;
+            report("open + index", size, opened.lines.len, elapsed);
+            editor_free(&opened);
+            jobs_free(&jobs);
+        }
+
+        const char *queries[][2] = {
+            {"search literal", "return"},
+            {"search regex", "[A-Za-z_]+\\(void\\)"},
+        };
+        for (size_t i = 0; i < sizeof(queries) / sizeof(queries[0]); ++i) {
+            Search search = {0};
+            const bool regex_mode = i > 0;
+            search_set_query(&search, queries[i][1], strlen(queries[i][1]), regex_mode);
+            start = now_ms();
+            while (!search_step(&search, &editor, 0, 0, 1e9)) {}
+            elapsed = now_ms() - start;
+            report(queries[i][0], size, search_count(&search), elapsed);
+            search_free(&search);
+        }
+
+        {
+            // Typing a second letter narrows the matches of the first one down
+            Search search = {0};
+            search_set_query(&search, "r", 1, false);
+            while (!search_step(&search, &editor, 0, 0, 1e9)) {}
+            search_set_query(&search, "re", 2, false);
+            start = now_ms();
+            while (!search_step(&search, &editor, 0, 0, 1e9)) {}
+            elapsed = now_ms() - start;
+            report("search refine", size, search_count(&search), elapsed);
+            search_free(&search);
+        }
+
+        // Touch every line so each one needs a buffer of its own
+        start = now_ms();
+        for (size_t row = 0; row < editor.lines.len; ++row) {
+            editor.cursor_row = row;
+            editor.cursor_col = 0;
+            editor_insert_text_before_cursor(&editor, "x");
+        }
+        elapsed = now_ms() - start;
+        report("edit every line", size, editor.lines.len, elapsed);
+        printf("%-16s %10.1f MB used, %10.1f MB reserved\n", "line pool",
+               pool_bytes_used(&editor.pool) / (1024.0 * 1024.0),
+               pool_bytes_reserved(&editor.pool) / (1024.0 * 1024.0));
+
+        start = now_ms();
+        editor_free(&editor);
+        elapsed = now_ms() - start;
+        printf("%-16s %10.2f ms\n", "editor free", elapsed);
+    }
+
+    free(data);
+    return 0;
+}
@@ -0,0 +1,337 @@
+#include "atlas.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "utf8.h"
+
+#define ATLAS_EMPTY_SLOT UINT32_MAX
+
+// Looked for when no font is given, the first one that opens is used
+static const char *atlas_system_fonts[] = {
+    "font/grive.ttf",
+    "/usr/share/fonts/truetype/dejavu/DejaVuSansMono.ttf",
+    "/usr/share/fonts/TTF/DejaVuSansMono.ttf",
+    "/usr/share/fonts/dejavu/DejaVuSansMono.ttf",
+    "/usr/share/fonts/truetype/liberation/LiberationMono-Regular.ttf",
+    "/System/Library/Fonts/Menlo.ttc",
+    "/Library/Fonts/Courier New.ttf",
+    "C:/Windows/Fonts/consola.ttf",
+};
+
+static void *atlas_alloc(size_t size)
+{
+    void *ptr = malloc(size);
+    if (ptr == NULL) {
+        fprintf(stderr, "ERROR: could not allocate glyph atlas\n");
+        exit(1);
+    }
+    return ptr;
+}
+
+// Opens the font at the biggest size whose glyphs still fit in a cell
+static TTF_Font *atlas_open_font(const char *path, int cell_w, int cell_h)
+{
+    TTF_Font *font = TTF_OpenFont(path, cell_h);
+    if (font == NULL) {
+        return NULL;
+    }
+
+    int advance = 0;
+    TTF_GlyphMetrics32(font, 'M', NULL, NULL, NULL, NULL, &advance);
+    const int height = TTF_FontHeight(font);
+    int size = cell_h;
+    if (height > cell_h) {
+        size = size * cell_h / height;
+    }
+    if (advance > 0 && advance * size / cell_h > cell_w) {
+        size = cell_w * cell_h / advance;
+    }
+    if (size != cell_h) {
+        TTF_CloseFont(font);
+        font = TTF_OpenFont(path, size > 1 ? size : 1);
+    }
+    return font;
+}
+
+static Atlas_Slot *atlas_find_slot(Atlas *atlas, uint32_t codepoint)
+{
+    uint32_t i = (codepoint * 2654435761u) & atlas->slots_mask;
+    while (atlas->slots[i].codepoint != ATLAS_EMPTY_SLOT && atlas->slots[i].codepoint != codepoint) {
+        i = (i + 1) & atlas->slots_mask;
+    }
+    return &atlas->slots[i];
+}
+
+// Linear probing without tombstones: the entries after the removed one are
+// moved back into the hole if it's on their probe path
+static void atlas_remove_slot(Atlas *atlas, uint32_t codepoint)
+{
+    Atlas_Slot *slot = atlas_find_slot(atlas, codepoint);
+    if (slot->codepoint == ATLAS_EMPTY_SLOT) {
+        return;
+    }
+
+    uint32_t hole = (uint32_t) (slot - atlas->slots);
+    uint32_t i = hole;
+    for (;;) {
+        i = (i + 1) & atlas->slots_mask;
+        if (atlas->slots[i].codepoint == ATLAS_EMPTY_SLOT) {
+            break;
+        }
+        const uint32_t home = (atlas->slots[i].codepoint * 2654435761u) & atlas->slots_mask;
+        // Can the entry at `i` move to `hole`? Only if `home` isn't in (hole, i]
+        const bool between = hole <= i ? (hole < home && home <= i) : (hole < home || home <= i);
+        if (!between) {
+            atlas->slots[hole] = atlas->slots[i];
+            hole = i;
+        }
+    }
+    atlas->slots[hole].codepoint = ATLAS_EMPTY_SLOT;
+}
+
+static void atlas_mark_dirty(Atlas *atlas, int begin, int end)
+{
+    if (atlas->dirty_begin >= atlas->dirty_end) {
+        atlas->dirty_begin = begin;
+        atlas->dirty_end = end;
+        return;
+    }
+    if (begin < atlas->dirty_begin) atlas->dirty_begin = begin;
+    if (end > atlas->dirty_end) atlas->dirty_end = end;
+}
+
+// Blank pixels are white with no coverage, so filtering never darkens edges
+static void atlas_clear_rows(Atlas *atlas, int begin, int end)
+{
+    for (int y = begin; y < end; ++y) {
+        uint8_t *row = &atlas->pixels[(size_t) y * atlas->width * 4];
+        for (int x = 0; x < atlas->width; ++x) {
+            row[x * 4 + 0] = 0xFF;
+            row[x * 4 + 1] = 0xFF;
+            row[x * 4 + 2] = 0xFF;
+            row[x * 4 + 3] = 0x00;
+        }
+    }
+}
+
+static void atlas_rasterize(Atlas *atlas, uint32_t cell, uint32_t codepoint)
+{
+    const int x0 = (int) (cell % ATLAS_COLS) * atlas->cell_w;
+    const int y0 = (int) (cell / ATLAS_COLS) * atlas->cell_h;
+    for (int y = 0; y < atlas->cell_h; ++y) {
+        uint8_t *row = &atlas->pixels[((size_t) (y0 + y) * atlas->width + x0) * 4];
+        for (int x = 0; x < atlas->cell_w; ++x) {
+            row[x * 4 + 3] = 0x00;
+        }
+    }
+
+    if (atlas->ttf != NULL) {
+        if (!TTF_GlyphIsProvided32(atlas->ttf, codepoint)) {
+            codepoint = TTF_GlyphIsProvided32(atlas->ttf, UTF8_REPLACEMENT) ? UTF8_REPLACEMENT : '?';
+        }
+        const SDL_Color white = {0xFF, 0xFF, 0xFF, 0xFF};
+        SDL_Surface *rendered = TTF_RenderGlyph32_Blended(atlas->ttf, codepoint, white);
+        SDL_Surface *glyph = rendered ? SDL_ConvertSurfaceFormat(rendered, SDL_PIXELFORMAT_RGBA32, 0) : NULL;
+        if (glyph != NULL) {
+            const int dx = glyph->w < atlas->cell_w ? (atlas->cell_w - glyph->w) / 2 : 0;
+            const int w = glyph->w < atlas->cell_w ? glyph->w : atlas->cell_w;
+            const int h = glyph->h < atlas->cell_h ? glyph->h : atlas->cell_h;
+            for (int y = 0; y < h; ++y) {
+                const uint8_t *src = (const uint8_t *) glyph->pixels + (size_t) y * glyph->pitch;
+                uint8_t *dst = &atlas->pixels[((size_t) (y0 + y) * atlas->width + x0 + dx) * 4];
+                for (int x = 0; x < w; ++x) {
+                    dst[x * 4 + 3] = src[x * 4 + 3];
+                }
+            }
+            SDL_FreeSurface(glyph);
+        }
+        SDL_FreeSurface(rendered);
+    } else {
+        // The charmap only has ASCII 32..126, white glyphs on black
+        if (codepoint < 32 || codepoint > 126) {
+            codepoint = '?';
+        }
+        const int index = (int) codepoint - 32;
+        const int sx0 = (index % atlas->charmap_cols) * atlas->charmap_cell_w;
+        const int sy0 = (index / atlas->charmap_cols) * atlas->charmap_cell_h;
+        const SDL_Surface *charmap = atlas->charmap;
+        for (int y = 0; y < atlas->cell_h; ++y) {
+            const int sy = sy0 + y * atlas->charmap_cell_h / atlas->cell_h;
+            const uint8_t *src = (const uint8_t *) charmap->pixels + (size_t) sy * charmap->pitch;
+            uint8_t *dst = &atlas->pixels[((size_t) (y0 + y) * atlas->width + x0) * 4];
+            for (int x = 0; x < atlas->cell_w; ++x) {
+                const int sx = sx0 + x * atlas->charmap_cell_w / atlas->cell_w;
+                dst[x * 4 + 3] = src[sx * 4 + 0];
+            }
+        }
+    }
+
+    atlas_mark_dirty(atlas, y0, y0 + atlas->cell_h);
+}
+
+static void atlas_grow(Atlas *atlas)
+{
+    const int old_height = atlas->height;
+    atlas->rows = atlas->rows * 2 < atlas->max_rows ? atlas->rows * 2 : atlas->max_rows;
+    atlas->height = atlas->rows * atlas->cell_h;
+
+    atlas->pixels = realloc(atlas->pixels, (size_t) atlas->width * atlas->height * 4);
+    const size_t cells = (size_t) atlas->rows * ATLAS_COLS;
+    atlas->cell_codepoints = realloc(atlas->cell_codepoints, cells * sizeof(atlas->cell_codepoints[0]));
+    atlas->cell_frames = realloc(atlas->cell_frames, cells * sizeof(atlas->cell_frames[0]));
+    if (atlas->pixels == NULL || atlas->cell_codepoints == NULL || atlas->cell_frames == NULL) {
+        fprintf(stderr, "ERROR: could not allocate glyph atlas\n");
+        exit(1);
+    }
+
+    atlas_clear_rows(atlas, old_height, atlas->height);
+    atlas->resized = true;
+}
+
+// A free cell, growing the atlas or evicting the least recently used glyph if
+// there is none. Returns ATLAS_FALLBACK_CELL when every glyph is in use by the
+// current frame.
+static uint32_t atlas_take_cell(Atlas *atlas)
+{
+    if (atlas->cells_used == (uint32_t) (atlas->rows * ATLAS_COLS) && atlas->rows < atlas->max_rows) {
+        atlas_grow(atlas);
+    }
+    if (atlas->cells_used < (uint32_t) (atlas->rows * ATLAS_COLS)) {
+        return atlas->cells_used++;
+    }
+
+    uint32_t oldest = ATLAS_FALLBACK_CELL;
+    for (uint32_t cell = ATLAS_FALLBACK_CELL + 1; cell < atlas->cells_used; ++cell) {
+        if (oldest == ATLAS_FALLBACK_CELL || atlas->cell_frames[cell] < atlas->cell_frames[oldest]) {
+            oldest = cell;
+        }
+    }
+    if (oldest == ATLAS_FALLBACK_CELL || atlas->cell_frames[oldest] == atlas->frame) {
+        return ATLAS_FALLBACK_CELL;
+    }
+
+    atlas_remove_slot(atlas, atlas->cell_codepoints[oldest]);
+    return oldest;
+}
+
+static void atlas_insert(Atlas *atlas, uint32_t codepoint, uint32_t cell)
+{
+    Atlas_Slot *slot = atlas_find_slot(atlas, codepoint);
+    slot->codepoint = codepoint;
+    slot->cell = cell;
+    atlas->cell_codepoints[cell] = codepoint;
+    atlas->cell_frames[cell] = atlas->frame;
+    atlas_rasterize(atlas, cell, codepoint);
+}
+
+void atlas_init(Atlas *atlas, int cell_w, int cell_h, const char *ttf_path,
+                SDL_Surface *charmap, int charmap_cols, int charmap_cell_w, int charmap_cell_h)
+{
+    memset(atlas, 0, sizeof(*atlas));
+    atlas->cell_w = cell_w;
+    atlas->cell_h = cell_h;
+
+    if (TTF_WasInit() == 0 && TTF_Init() < 0) {
+        RAISE("TTF", "Could not initialize SDL_ttf: %s", TTF_GetError());
+    } else {
+        if (ttf_path != NULL) {
+            atlas->ttf = atlas_open_font(ttf_path, cell_w, cell_h);
+            if (atlas->ttf == NULL) {
+                RAISE("TTF", "Could not open font `%s`: %s", ttf_path, TTF_GetError());
+            }
+        }
+        for (size_t i = 0; atlas->ttf == NULL && i < sizeof(atlas_system_fonts) / sizeof(atlas_system_fonts[0]); ++i) {
+            atlas->ttf = atlas_open_font(atlas_system_fonts[i], cell_w, cell_h);
+        }
+    }
+    if (atlas->ttf == NULL) {
+        LOG("No TrueType font found, using the bitmap font");
+    }
+
+    atlas->charmap = scp(SDL_ConvertSurfaceFormat(charmap, SDL_PIXELFORMAT_RGBA32, 0));
+    SDL_FreeSurface(charmap);
+    atlas->charmap_cols = charmap_cols;
+    atlas->charmap_cell_w = charmap_cell_w;
+    atlas->charmap_cell_h = charmap_cell_h;
+
+    atlas->max_rows = ATLAS_MAX_SIZE / cell_h;
+    if (atlas->max_rows < ATLAS_INIT_ROWS) {
+        atlas->max_rows = ATLAS_INIT_ROWS;
+    }
+    atlas->rows = ATLAS_INIT_ROWS;
+    atlas->width = ATLAS_COLS * cell_w;
+    atlas->height = atlas->rows * cell_h;
+    atlas->pixels = atlas_alloc((size_t) atlas->width * atlas->height * 4);
+    atlas->cell_codepoints = atlas_alloc((size_t) atlas->rows * ATLAS_COLS * sizeof(atlas->cell_codepoints[0]));
+    atlas->cell_frames = atlas_alloc((size_t) atlas->rows * ATLAS_COLS * sizeof(atlas->cell_frames[0]));
+    atlas_clear_rows(atlas, 0, atlas->height);
+
+    // At most half full with every cell in use, which keeps the probes short
+    uint32_t slots = 1;
+    while (slots < (uint32_t) (atlas->max_rows * ATLAS_COLS) * 2) {
+        slots *= 2;
+    }
+    atlas->slots = atlas_alloc(slots * sizeof(atlas->slots[0]));
+    atlas->slots_mask = slots - 1;
+    for (uint32_t i = 0; i < slots; ++i) {
+        atlas->slots[i].codepoint = ATLAS_EMPTY_SLOT;
+    }
+
+    atlas->cells_used = ATLAS_FALLBACK_CELL + 1;
+    atlas_insert(atlas, '?', ATLAS_FALLBACK_CELL);
+    atlas->resized = true;
+}
+
+void atlas_free(Atlas *atlas)
+{
+    if (atlas->ttf != NULL) {
+        TTF_CloseFont(atlas->ttf);
+    }
+    if (TTF_WasInit() > 0) {
+        TTF_Quit();
+    }
+    SDL_FreeSurface(atlas->charmap);
+    free(atlas->pixels);
+    free(atlas->cell_codepoints);
+    free(atlas->cell_frames);
+    free(atlas->slots);
+    memset(atlas, 0, sizeof(*atlas));
+}
+
+void atlas_begin_frame(Atlas *atlas)
+{
+    atlas->frame += 1;
+}
+
+uint32_t atlas_glyph(Atlas *atlas, uint32_t codepoint)
+{
+    const Atlas_Slot *slot = atlas_find_slot(atlas, codepoint);
+    if (slot->codepoint == codepoint) {
+        atlas->cell_frames[slot->cell] = atlas->frame;
+        return slot->cell;
+    }
+
+    const uint32_t cell = atlas_take_cell(atlas);
+    if (cell == ATLAS_FALLBACK_CELL) {
+        return cell;
+    }
+    atlas_insert(atlas, codepoint, cell);
+    return cell;
+}
+
+bool atlas_take_dirty(Atlas *atlas, int *begin, int *end, bool *resized)
+{
+    if (atlas->dirty_begin >= atlas->dirty_end && !atlas->resized) {
+        return false;
+    }
+    *begin = atlas->dirty_begin;
+    *end = atlas->dirty_end;
+    *resized = atlas->resized;
+    atlas->dirty_begin = 0;
+    atlas->dirty_end = 0;
+    atlas->resized = false;
+    return true;
+}
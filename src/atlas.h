@@ -0,0 +1,77 @@
+#ifndef ATLAS_H_
+#define ATLAS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <SDL.h>
+#include <SDL_ttf.h>
+
+// Cells per row of the atlas. Only the number of rows grows, so a glyph keeps
+// its cell index (and its place in the pixels) when the atlas gets bigger.
+#define ATLAS_COLS 32
+#define ATLAS_INIT_ROWS 4
+#define ATLAS_MAX_SIZE 4096
+
+// Cell every lookup that can't be served falls back to, it is never evicted
+#define ATLAS_FALLBACK_CELL 0
+
+typedef struct {
+    uint32_t codepoint;
+    uint32_t cell;
+} Atlas_Slot;
+
+// Glyphs rasterized on first use into cells of one RGBA texture, white with the
+// coverage in alpha. Code points are looked up in an open addressing hash
+// table; once the atlas can't grow anymore the least recently used cell is
+// given to the new glyph.
+typedef struct {
+    // Where glyphs come from: a TrueType font, or when none could be opened
+    // the ASCII cells of the bitmap charmap, scaled up to the cell size
+    TTF_Font *ttf;
+    SDL_Surface *charmap;
+    int charmap_cols;
+    int charmap_cell_w;
+    int charmap_cell_h;
+
+    int cell_w;
+    int cell_h;
+    int rows;
+    int max_rows;
+    uint8_t *pixels;
+    int width;
+    int height;
+
+    // Code point held by every cell and the frame it was last drawn in
+    uint32_t *cell_codepoints;
+    uint64_t *cell_frames;
+    uint32_t cells_used;
+    uint64_t frame;
+
+    Atlas_Slot *slots;
+    uint32_t slots_mask;
+
+    // Pixel rows rasterized since the last atlas_take_dirty
+    int dirty_begin;
+    int dirty_end;
+    bool resized;
+} Atlas;
+
+// Cells are cell_w x cell_h pixels. Tries the TTF at `ttf_path` first (may be
+// NULL) and then a few common monospace fonts before falling back to
+// `charmap`, a grid of `charmap_cols` cells covering ASCII 32..126. The atlas
+// owns the charmap surface from then on.
+void atlas_init(Atlas *atlas, int cell_w, int cell_h, const char *ttf_path,
+                SDL_Surface *charmap, int charmap_cols, int charmap_cell_w, int charmap_cell_h);
+void atlas_free(Atlas *atlas);
+
+// Glyphs looked up after this are the most recently used ones
+void atlas_begin_frame(Atlas *atlas);
+// Cell holding `codepoint`, rasterizing it first if needed
+uint32_t atlas_glyph(Atlas *atlas, uint32_t codepoint);
+
+// Pixel rows [begin, end) that changed since the last call, and whether the
+// atlas grew, in which case the texture has to be created again
+bool atlas_take_dirty(Atlas *atlas, int *begin, int *end, bool *resized);
+
+#endif // ATLAS_H_
@@ -0,0 +1,155 @@
+#include "columns.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utf8.h"
+
+static void columns_push(Columns_Index *index, size_t offset)
+{
+    if (index->count == index->cap) {
+        index->cap = index->cap == 0 ? 16 : index->cap * 2;
+        index->offsets = realloc(index->offsets, index->cap * sizeof(index->offsets[0]));
+        if (index->offsets == NULL) {
+            fprintf(stderr, "ERROR: could not allocate column index\n");
+            exit(1);
+        }
+    }
+    index->offsets[index->count++] = offset;
+}
+
+// The index of `row`, built over the least recently used entry if it isn't
+// cached
+static Columns_Index *columns_lookup(Columns *columns, size_t row, const Line *line)
+{
+    columns->clock += 1;
+
+    Columns_Index *oldest = &columns->entries[0];
+    for (size_t i = 0; i < COLUMNS_CACHE_SIZE; ++i) {
+        Columns_Index *index = &columns->entries[i];
+        if (index->used != 0 && index->row == row) {
+            index->used = columns->clock;
+            return index;
+        }
+        if (index->used < oldest->used) {
+            oldest = index;
+        }
+    }
+
+    Columns_Index *index = oldest;
+    index->row = row;
+    index->count = 0;
+    index->used = columns->clock;
+
+    size_t col = 0;
+    for (size_t i = 0; i < line->len; i = utf8_next(line->chars, line->len, i)) {
+        if (col % COLUMNS_STRIDE == 0) {
+            columns_push(index, i);
+        }
+        col += 1;
+    }
+    index->columns = col;
+    return index;
+}
+
+size_t columns_col_at(Columns *columns, size_t row, const Line *line, size_t offset)
+{
+    if (offset > line->len) {
+        offset = line->len;
+    }
+    if (!line->non_ascii) {
+        return offset;
+    }
+
+    const Columns_Index *index = columns_lookup(columns, row, line);
+    if (index->count == 0) {
+        return 0;
+    }
+
+    // Last indexed code point at or before `offset`, then walk the rest
+    size_t lo = 0;
+    size_t hi = index->count;
+    while (hi - lo > 1) {
+        const size_t mid = lo + (hi - lo) / 2;
+        if (index->offsets[mid] <= offset) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+
+    size_t col = lo * COLUMNS_STRIDE;
+    for (size_t i = index->offsets[lo]; i < offset; i = utf8_next(line->chars, line->len, i)) {
+        col += 1;
+    }
+    return col;
+}
+
+size_t columns_offset_at(Columns *columns, size_t row, const Line *line, size_t col)
+{
+    if (!line->non_ascii) {
+        return col < line->len ? col : line->len;
+    }
+
+    const Columns_Index *index = columns_lookup(columns, row, line);
+    if (col >= index->columns) {
+        return line->len;
+    }
+
+    size_t offset = index->offsets[col / COLUMNS_STRIDE];
+    for (size_t i = 0; i < col % COLUMNS_STRIDE; ++i) {
+        offset = utf8_next(line->chars, line->len, offset);
+    }
+    return offset;
+}
+
+void columns_invalidate(Columns *columns, size_t row)
+{
+    for (size_t i = 0; i < COLUMNS_CACHE_SIZE; ++i) {
+        if (columns->entries[i].used != 0 && columns->entries[i].row == row) {
+            columns->entries[i].used = 0;
+        }
+    }
+}
+
+void columns_insert_row(Columns *columns, size_t row)
+{
+    columns_insert_rows(columns, row, 1);
+}
+
+void columns_remove_row(Columns *columns, size_t row)
+{
+    columns_remove_rows(columns, row, 1);
+}
+
+void columns_insert_rows(Columns *columns, size_t row, size_t count)
+{
+    for (size_t i = 0; i < COLUMNS_CACHE_SIZE; ++i) {
+        if (columns->entries[i].used != 0 && columns->entries[i].row >= row) {
+            columns->entries[i].row += count;
+        }
+    }
+}
+
+void columns_remove_rows(Columns *columns, size_t row, size_t count)
+{
+    for (size_t i = 0; i < COLUMNS_CACHE_SIZE; ++i) {
+        Columns_Index *entry = &columns->entries[i];
+        if (entry->used != 0 && entry->row >= row) {
+            if (entry->row < row + count) {
+                entry->used = 0;
+            } else {
+                entry->row -= count;
+            }
+        }
+    }
+}
+
+void columns_free(Columns *columns)
+{
+    for (size_t i = 0; i < COLUMNS_CACHE_SIZE; ++i) {
+        free(columns->entries[i].offsets);
+    }
+    memset(columns, 0, sizeof(*columns));
+}
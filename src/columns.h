@@ -0,0 +1,49 @@
+#ifndef COLUMNS_H_
+#define COLUMNS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "lines.h"
+
+// Code points between two offsets kept in an index
+#define COLUMNS_STRIDE 64
+#define COLUMNS_CACHE_SIZE 8
+
+// Byte offset of every COLUMNS_STRIDE-th code point of one line
+typedef struct {
+    size_t row;
+    size_t *offsets;
+    size_t count;
+    size_t cap;
+    // Code points in the whole line
+    size_t columns;
+    // Value of the clock when last looked up, 0 while the entry is unused
+    uint64_t used;
+} Columns_Index;
+
+// Maps between byte offsets and columns (one per code point) of the lines the
+// cursor goes through. Pure ASCII lines need no index. Others get one the
+// first time they are asked about, and it's kept for the few most recently
+// used lines until that line is edited, so stepping through a long line
+// never scans it from the start again.
+typedef struct {
+    Columns_Index entries[COLUMNS_CACHE_SIZE];
+    uint64_t clock;
+} Columns;
+
+// Column of the code point at byte `offset` of `line`, which is row `row`
+size_t columns_col_at(Columns *columns, size_t row, const Line *line, size_t offset);
+// Byte offset of column `col` of `line`, the end of the line past its last column
+size_t columns_offset_at(Columns *columns, size_t row, const Line *line, size_t col);
+
+// The text of `row` changed
+void columns_invalidate(Columns *columns, size_t row);
+// A line was inserted before / removed at `row`, moving the rows after it
+void columns_insert_row(Columns *columns, size_t row);
+void columns_remove_row(Columns *columns, size_t row);
+void columns_insert_rows(Columns *columns, size_t row, size_t count);
+void columns_remove_rows(Columns *columns, size_t row, size_t count);
+void columns_free(Columns *columns);
+
+#endif // COLUMNS_H_
@@ -1,55 +1,75 @@
+#define _DEFAULT_SOURCE
 #include "editor.h"
 
 #include <assert.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <errno.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
-#include "sv.h"
+#include "scan.h"
+#include "save.h"
+#include "prof.h"
+#include "utf8.h"
 
-#define LINE_INIT_CAPACITY 1024
-#define EDITOR_INIT_CAPACITY 128
+#define SOURCE_INIT_CAPACITY (640 * 1024)
+#define CURSORS_INIT_CAPACITY 16
+// Time editor_load_update may spend appending lines on the main thread
+#define EDITOR_LOAD_BUDGET_MS 4.0
 
-static void editor_create_first_new_line(Editor *editor);
-
-static void line_grow(Line *line, size_t n)
+static void line_grow(Pool *pool, Line *line, size_t n)
 {
-    size_t new_capacity = line->cap;
-
-    assert(new_capacity >= line->len);
-    while (new_capacity - line->len < n) {
-        if (new_capacity == 0) {
-            new_capacity = LINE_INIT_CAPACITY;
-        } else {
-            new_capacity *= 2;
-        }
+    // A save in flight may still be reading the buffer of a pinned pool
+    const bool pinned = line->cap > 0 && pool_pinned(pool);
+    if ((line->len + n <= line->cap && !pinned) || line->len + n == 0) {
+        return;
     }
 
-    if (new_capacity != line->cap) {
-        line->chars = realloc(line->chars, new_capacity);
-        line->cap = new_capacity;
+    size_t new_capacity = 0;
+    if (line->cap == 0 || pinned) {
+        // The text still lives in the source or is being saved, copy it out
+        // before editing
+        char *chars = pool_alloc(pool, line->len + n, &new_capacity);
+        if (line->len > 0) {
+            memcpy(chars, line->chars, line->len);
+        }
+        pool_release(pool, line->chars, line->cap);
+        line->chars = chars;
+    } else {
+        // Size classes double, which keeps appending a character at a time cheap
+        line->chars = pool_realloc(pool, line->chars, line->cap, line->len,
+                                   line->len + n, &new_capacity);
     }
+    line->cap = new_capacity;
 }
 
-void line_append_text(Line *line, const char *text)
+void line_append_text(Pool *pool, Line *line, const char *text)
 {
-    line_append_text_sized(line, text, strlen(text));
+    line_append_text_sized(pool, line, text, strlen(text));
 }
 
-void line_append_text_sized(Line *line, const char *text, size_t text_size)
+void line_append_text_sized(Pool *pool, Line *line, const char *text, size_t text_size)
 {
     size_t col = line->len;
-    line_insert_text_sized_before(line, text, text_size, &col);
+    line_insert_text_sized_before(pool, line, text, text_size, &col);
 }
 
-void line_insert_text_sized_before(Line *line, const char *text, size_t text_size, size_t *col)
+void line_insert_text_sized_before(Pool *pool, Line *line, const char *text, size_t text_size, size_t *col)
 {
     if (*col > line->len) {
         *col = line->len;
     }
 
-    line_grow(line, text_size);
+    line_grow(pool, line, text_size);
+    if (!line->non_ascii && !scan_is_ascii(text, text_size)) {
+        line->non_ascii = true;
+    }
 
     memmove(line->chars + *col + text_size,
             line->chars + *col,
@@ -59,18 +79,19 @@ void line_insert_text_sized_before(Line *line, const char *text, size_t text_siz
     *col += text_size;
 }
 
-void line_insert_text_before(Line *line, const char *text, size_t *col)
+void line_insert_text_before(Pool *pool, Line *line, const char *text, size_t *col)
 {
-    line_insert_text_sized_before(line, text, strlen(text), col);
+    line_insert_text_sized_before(pool, line, text, strlen(text), col);
 }
 
-void line_backspace(Line *line, size_t *col)
+void line_backspace(Pool *pool, Line *line, size_t *col)
 {
     if (*col > line->len) {
         *col = line->len;
     }
 
     if (*col > 0 && line->len > 0) {
+        line_grow(pool, line, 0);
         memmove(line->chars + *col - 1,
                 line->chars + *col,
                 line->len - *col);
@@ -79,197 +100,1691 @@ void line_backspace(Line *line, size_t *col)
     }
 }
 
-void line_delete(Line *line, size_t *col)
+void line_delete(Pool *pool, Line *line, size_t *col)
 {
     if (*col > line->len) {
         *col = line->len;
     }
 
     if (*col < line->len && line->len > 0) {
+        line_grow(pool, line, 0);
         memmove(line->chars + *col,
                 line->chars + *col + 1,
-                line->len - *col);
+                line->len - *col - 1);
         line->len -= 1;
     }
 }
 
-static void editor_grow(Editor *editor, size_t n)
+// Inserts `text` before each of the sorted byte offsets of `cursors`, which
+// are all in the line. The bytes after every offset are moved once, no matter
+// how many cursors there are.
+static void line_insert_text_at_cursors(Pool *pool, Line *line, const Cursor *cursors, size_t count,
+                                        const char *text, size_t text_size)
+{
+    line_grow(pool, line, count * text_size);
+    if (!line->non_ascii && !scan_is_ascii(text, text_size)) {
+        line->non_ascii = true;
+    }
+
+    // Back to front, so nothing is overwritten before it's moved
+    size_t src_end = line->len;
+    size_t dst_end = line->len + count * text_size;
+    for (size_t i = count; i-- > 0;) {
+        const size_t col = cursors[i].col;
+        memmove(line->chars + dst_end - (src_end - col), line->chars + col, src_end - col);
+        dst_end -= src_end - col;
+        memcpy(line->chars + dst_end - text_size, text, text_size);
+        dst_end -= text_size;
+        src_end = col;
+    }
+    line->len += count * text_size;
+}
+
+static Line *editor_current_line(const Editor *editor)
+{
+    return lines_at(&editor->lines, editor->cursor_row);
+}
+
+void editor_mark_dirty(Editor *editor, size_t begin, size_t end)
+{
+    if (begin >= end) {
+        return;
+    }
+
+    if (!editor_is_dirty(editor)) {
+        editor->dirty_begin = begin;
+        editor->dirty_end = end;
+        return;
+    }
+
+    if (begin < editor->dirty_begin) {
+        editor->dirty_begin = begin;
+    }
+    if (end > editor->dirty_end) {
+        editor->dirty_end = end;
+    }
+}
+
+void editor_clear_dirty(Editor *editor)
 {
-    size_t new_capacity = editor->cap;
+    editor->dirty_begin = 0;
+    editor->dirty_end = 0;
+}
 
-    assert(new_capacity >= editor->len);
-    while (new_capacity - editor->len < n) {
-        if (new_capacity == 0) {
-            new_capacity = EDITOR_INIT_CAPACITY;
+bool editor_is_dirty(const Editor *editor)
+{
+    return editor->dirty_begin < editor->dirty_end;
+}
+
+static void editor_changed(Editor *editor, size_t begin, size_t end)
+{
+    editor->version += 1;
+    editor_mark_dirty(editor, begin, end);
+}
+
+// Visual rows `line` takes past its first one. A line that fills its last
+// visual row exactly gets an empty one after it, for the cursor at its end.
+static uint32_t editor_wraps(const Editor *editor, const Line *line)
+{
+    // There are at most as many columns as bytes
+    if (editor->wrap_width == 0 || line->len < editor->wrap_width) {
+        return 0;
+    }
+    const size_t columns = line->non_ascii ? utf8_count(line->chars, line->len) : line->len;
+    return (uint32_t) (columns / editor->wrap_width);
+}
+
+// Lays out `row` again, returns true if it takes another number of visual
+// rows now, which moves every row below it on screen
+static bool editor_wrap_row(Editor *editor, size_t row)
+{
+    const uint32_t wraps = editor_wraps(editor, lines_at(&editor->lines, row));
+    if (wraps == lines_at(&editor->lines, row)->wraps) {
+        return false;
+    }
+    lines_set_wraps(&editor->lines, row, wraps);
+    return true;
+}
+
+// The text of `row` changed, but no row came or went
+static void editor_row_changed(Editor *editor, size_t row)
+{
+    columns_invalidate(&editor->columns, row);
+    highlight_edit(&editor->highlight, row);
+    const bool wrapped = editor_wrap_row(editor, row);
+    editor_changed(editor, row, wrapped ? EDITOR_DIRTY_END : row + 1);
+}
+
+// Primitive edits shared by the editor operations and undo/redo. They keep the
+// dirty rows up to date, but leave the cursor and the undo journal alone.
+static void editor_insert_at(Editor *editor, size_t row, size_t col, const char *text, size_t len)
+{
+    line_insert_text_sized_before(&editor->pool, lines_at(&editor->lines, row), text, len, &col);
+    editor_row_changed(editor, row);
+}
+
+static void editor_delete_at(Editor *editor, size_t row, size_t col, size_t len)
+{
+    Line *line = lines_at(&editor->lines, row);
+    assert(col + len <= line->len);
+
+    line_grow(&editor->pool, line, 0);
+    memmove(line->chars + col,
+            line->chars + col + len,
+            line->len - col - len);
+    line->len -= len;
+    editor_row_changed(editor, row);
+}
+
+static void editor_split_at(Editor *editor, size_t row, size_t col)
+{
+    // The pointer into the chunk is only valid until the next insertion
+    Line head = *lines_at(&editor->lines, row);
+    assert(col <= head.len);
+
+    Line *tail = lines_insert(&editor->lines, row + 1);
+    // The tail ends where the whole line did, for the highlighter to compare with
+    tail->highlight = head.highlight;
+    if (head.cap == 0) {
+        // Both halves of an untouched line keep pointing into the source
+        tail->chars = head.chars + col;
+        tail->len = head.len - col;
+        tail->non_ascii = head.non_ascii;
+    } else if (head.len > col) {
+        size_t tail_col = 0;
+        line_insert_text_sized_before(&editor->pool, tail, head.chars + col, head.len - col, &tail_col);
+    }
+    head.len = col;
+    if (head.cap > 0 && head.len * 4 < head.cap) {
+        // Splitting a long line leaves the head mostly empty, give the space back
+        head.chars = pool_realloc(&editor->pool, head.chars, head.cap, head.len, head.len, &head.cap);
+    }
+    *lines_at(&editor->lines, row) = head;
+    columns_invalidate(&editor->columns, row);
+    columns_insert_row(&editor->columns, row + 1);
+    highlight_edit(&editor->highlight, row);
+    highlight_insert_row(&editor->highlight, row + 1);
+    editor_wrap_row(editor, row);
+    editor_wrap_row(editor, row + 1);
+    editor_changed(editor, row, EDITOR_DIRTY_END);
+}
+
+static void editor_join_at(Editor *editor, size_t row)
+{
+    Line next = *lines_at(&editor->lines, row + 1);
+    lines_remove(&editor->lines, row + 1);
+
+    if (next.len > 0) {
+        Line *line = lines_at(&editor->lines, row);
+        size_t col = line->len;
+        line_insert_text_sized_before(&editor->pool, line, next.chars, next.len, &col);
+    }
+    lines_at(&editor->lines, row)->highlight = next.highlight;
+    pool_release(&editor->pool, next.chars, next.cap);
+    columns_remove_row(&editor->columns, row + 1);
+    columns_invalidate(&editor->columns, row);
+    highlight_remove_row(&editor->highlight, row + 1);
+    highlight_edit(&editor->highlight, row);
+    editor_wrap_row(editor, row);
+    editor_changed(editor, row, EDITOR_DIRTY_END);
+}
+
+static char *editor_block_alloc(Editor *editor, size_t size)
+{
+    Editor_Block *block = malloc(sizeof(*block) + size);
+    if (block == NULL) {
+        fprintf(stderr, "ERROR: could not allocate memory for the pasted text\n");
+        exit(1);
+    }
+    block->next = editor->blocks;
+    editor->blocks = block;
+    return block->data;
+}
+
+// Inserts `text` at row:col and stores where it ends in `end`. Text with
+// newlines is split in one scan, the lines in between are added in one go and
+// point into a copy of it.
+static void editor_insert_range_at(Editor *editor, size_t row, size_t col, const char *text, size_t len, Cursor *end)
+{
+    Scan_Lines index = {0};
+    scan_lines(text, len, &index);
+    if (index.count == 1) {
+        scan_lines_free(&index);
+        editor_insert_at(editor, row, col, text, len);
+        *end = (Cursor) {row, col + len};
+        return;
+    }
+
+    char *data = editor_block_alloc(editor, len);
+    memcpy(data, text, len);
+    const size_t count = index.count - 1;
+    const Scan_Line *first = &index.items[0];
+    const Scan_Line *last = &index.items[count];
+    const size_t last_len = last->len;
+
+    // The last new line goes on with what came after `col`
+    Line head = *lines_at(&editor->lines, row);
+    assert(col <= head.len);
+    Line tail = {
+        .chars = data + last->offset,
+        .len = last->len,
+        .non_ascii = !last->ascii,
+        .highlight = head.highlight,
+    };
+    if (col < head.len) {
+        size_t tail_col = tail.len;
+        line_insert_text_sized_before(&editor->pool, &tail, head.chars + col, head.len - col, &tail_col);
+    }
+
+    if (col == 0) {
+        pool_release(&editor->pool, head.chars, head.cap);
+        // Wraps stay as they are for editor_wrap_row to update
+        head = (Line) {
+            .chars = data + first->offset,
+            .len = first->len,
+            .non_ascii = !first->ascii,
+            .wraps = head.wraps,
+        };
+    } else {
+        head.len = col;
+        line_insert_text_sized_before(&editor->pool, &head, data + first->offset, first->len, &col);
+    }
+    *lines_at(&editor->lines, row) = head;
+
+    lines_insert_range(&editor->lines, row + 1, count);
+    for (size_t i = 1, next = row + 1; i <= count;) {
+        size_t n = 0;
+        Line *span = lines_span(&editor->lines, next, &n);
+        for (size_t j = 0; j < n && i <= count; ++j, ++i, ++next) {
+            const Scan_Line *scanned = &index.items[i];
+            if (i < count) {
+                span[j].chars = data + scanned->offset;
+                span[j].len = scanned->len;
+                span[j].non_ascii = !scanned->ascii;
+            } else {
+                span[j] = tail;
+            }
+            if (editor->wrap_width > 0 && span[j].len >= editor->wrap_width) {
+                lines_set_wraps(&editor->lines, next, editor_wraps(editor, &span[j]));
+            }
+        }
+    }
+    scan_lines_free(&index);
+
+    columns_invalidate(&editor->columns, row);
+    columns_insert_rows(&editor->columns, row + 1, count);
+    highlight_edit(&editor->highlight, row);
+    highlight_insert_rows(&editor->highlight, row + 1, count);
+    editor_wrap_row(editor, row);
+    editor_changed(editor, row, EDITOR_DIRTY_END);
+    *end = (Cursor) {row + count, last_len};
+}
+
+// Removes the text from `begin` up to `end`, the lines in between in one go
+static void editor_delete_range_at(Editor *editor, Cursor begin, Cursor end)
+{
+    if (begin.row == end.row) {
+        editor_delete_at(editor, begin.row, begin.col, end.col - begin.col);
+        return;
+    }
+
+    // The first line goes on with what came after `end`
+    const Line tail = *lines_at(&editor->lines, end.row);
+    Line *head = lines_at(&editor->lines, begin.row);
+    assert(begin.col <= head->len && end.col <= tail.len);
+    head->len = begin.col;
+    if (end.col < tail.len) {
+        size_t col = begin.col;
+        line_insert_text_sized_before(&editor->pool, head, tail.chars + end.col, tail.len - end.col, &col);
+    }
+    head->highlight = tail.highlight;
+
+    const size_t count = end.row - begin.row;
+    for (size_t row = begin.row + 1; row <= end.row;) {
+        size_t n = 0;
+        Line *span = lines_span(&editor->lines, row, &n);
+        for (size_t j = 0; j < n && row <= end.row; ++j, ++row) {
+            pool_release(&editor->pool, span[j].chars, span[j].cap);
+        }
+    }
+    lines_remove_range(&editor->lines, begin.row + 1, count);
+
+    columns_invalidate(&editor->columns, begin.row);
+    columns_remove_rows(&editor->columns, begin.row + 1, count);
+    highlight_edit(&editor->highlight, begin.row);
+    highlight_remove_rows(&editor->highlight, begin.row + 1, count);
+    editor_wrap_row(editor, begin.row);
+    editor_changed(editor, begin.row, EDITOR_DIRTY_END);
+}
+
+// Where `text` ends once it's inserted at row:col
+static Cursor editor_range_end(size_t row, size_t col, const char *text, size_t len)
+{
+    Cursor end = {row, col + len};
+    for (const char *p = text; (p = memchr(p, '\n', (size_t) (text + len - p))) != NULL; ++p) {
+        end.row += 1;
+        end.col = (size_t) (text + len - p) - 1;
+    }
+    return end;
+}
+
+// Text from `begin` up to `end`, lines joined with '\n' and NUL terminated
+static char *editor_range_text(const Editor *editor, Cursor begin, Cursor end, size_t *len)
+{
+    // Sized first, so it's copied only once
+    size_t size = 0;
+    for (size_t row = begin.row; row <= end.row;) {
+        size_t n = 0;
+        const Line *span = lines_span(&editor->lines, row, &n);
+        for (size_t j = 0; j < n && row <= end.row; ++j, ++row) {
+            const size_t from = row == begin.row ? begin.col : 0;
+            const size_t to = row == end.row ? end.col : span[j].len;
+            size += to - from + (row < end.row);
+        }
+    }
+
+    char *text = malloc(size + 1);
+    if (text == NULL) {
+        fprintf(stderr, "ERROR: could not allocate memory for the selected text\n");
+        exit(1);
+    }
+    char *out = text;
+    for (size_t row = begin.row; row <= end.row;) {
+        size_t n = 0;
+        const Line *span = lines_span(&editor->lines, row, &n);
+        for (size_t j = 0; j < n && row <= end.row; ++j, ++row) {
+            const size_t from = row == begin.row ? begin.col : 0;
+            const size_t to = row == end.row ? end.col : span[j].len;
+            if (to > from) {
+                memcpy(out, span[j].chars + from, to - from);
+                out += to - from;
+            }
+            if (row < end.row) {
+                *out++ = '\n';
+            }
+        }
+    }
+    *out = '\0';
+    *len = size;
+    return text;
+}
+
+static int compare_cursors(const void *a, const void *b)
+{
+    const Cursor *x = a;
+    const Cursor *y = b;
+    if (x->row != y->row) {
+        return (x->row > y->row) - (x->row < y->row);
+    }
+    return (x->col > y->col) - (x->col < y->col);
+}
+
+// Index of the first cursor at or after row:col
+static size_t cursors_lower_bound(const Cursors *cursors, size_t row, size_t col)
+{
+    size_t low = 0;
+    size_t high = cursors->count;
+    while (low < high) {
+        const size_t mid = low + (high - low) / 2;
+        const Cursor *c = &cursors->items[mid];
+        if (c->row < row || (c->row == row && c->col < col)) {
+            low = mid + 1;
         } else {
-            new_capacity *= 2;
+            high = mid;
         }
     }
+    return low;
+}
 
-    if (new_capacity != editor->cap) {
-        editor->lines = realloc(editor->lines, new_capacity * sizeof(editor->lines[0]));
-        editor->cap = new_capacity;
+static void cursors_insert(Cursors *cursors, size_t index, Cursor cursor)
+{
+    if (cursors->count == cursors->cap) {
+        cursors->cap = cursors->cap == 0 ? CURSORS_INIT_CAPACITY : cursors->cap * 2;
+        cursors->items = realloc(cursors->items, cursors->cap * sizeof(cursors->items[0]));
+        if (cursors->items == NULL) {
+            fprintf(stderr, "ERROR: could not allocate cursors\n");
+            exit(1);
+        }
+    }
+    memmove(cursors->items + index + 1, cursors->items + index,
+            (cursors->count - index) * sizeof(cursors->items[0]));
+    cursors->items[index] = cursor;
+    cursors->count += 1;
+}
+
+// Puts the cursor among the extra ones, so an edit can go through all of them
+// in order. Returns where it went.
+static size_t editor_cursors_gather(Editor *editor)
+{
+    const size_t index = cursors_lower_bound(&editor->cursors, editor->cursor_row, editor->cursor_col);
+    cursors_insert(&editor->cursors, index, (Cursor) {editor->cursor_row, editor->cursor_col});
+    return index;
+}
+
+// Takes the cursor at `primary` back out of the sorted cursors, merging the
+// ones that ended up on the same place
+static void editor_cursors_scatter(Editor *editor, size_t primary)
+{
+    Cursor *items = editor->cursors.items;
+    size_t kept = 0;
+    size_t found = 0;
+    for (size_t i = 0; i < editor->cursors.count; ++i) {
+        const bool same = kept > 0 && items[kept - 1].row == items[i].row && items[kept - 1].col == items[i].col;
+        if (!same) {
+            items[kept++] = items[i];
+        }
+        if (i == primary) {
+            found = kept - 1;
+        }
+    }
+
+    editor->cursor_row = items[found].row;
+    editor->cursor_col = items[found].col;
+    memmove(items + found, items + found + 1, (kept - found - 1) * sizeof(items[0]));
+    editor->cursors.count = kept - 1;
+}
+
+void editor_add_cursor(Editor *editor, size_t row, size_t col)
+{
+    undo_seal(&editor->undo);
+    editor_clear_selection(editor);
+    editor_load_wait(editor, row);
+    if (editor->lines.len == 0) {
+        return;
+    }
+    row = row < editor->lines.len ? row : editor->lines.len - 1;
+    const Line *line = lines_at(&editor->lines, row);
+    col = utf8_floor(line->chars, line->len, col);
+    if (row == editor->cursor_row && col == editor->cursor_col) {
+        return;
+    }
+
+    // Cursors added top to bottom, like at every match, go to the end
+    Cursors *cursors = &editor->cursors;
+    const size_t index = cursors_lower_bound(cursors, row, col);
+    if (index < cursors->count && cursors->items[index].row == row && cursors->items[index].col == col) {
+        return;
+    }
+    cursors_insert(cursors, index, (Cursor) {row, col});
+}
+
+void editor_clear_cursors(Editor *editor)
+{
+    editor->cursors.count = 0;
+}
+
+void editor_select(Editor *editor)
+{
+    editor_clear_cursors(editor);
+    if (!editor->selecting) {
+        undo_seal(&editor->undo);
+        editor->selecting = true;
+        editor->anchor = (Cursor) {editor->cursor_row, editor->cursor_col};
+    }
+}
+
+void editor_select_all(Editor *editor)
+{
+    editor_load_wait(editor, EDITOR_DIRTY_END);
+    if (editor->lines.len == 0) {
+        return;
+    }
+    editor_clear_cursors(editor);
+    undo_seal(&editor->undo);
+    editor->selecting = true;
+    editor->anchor = (Cursor) {0, 0};
+    editor->cursor_row = editor->lines.len - 1;
+    editor->cursor_col = editor_current_line(editor)->len;
+    editor_mark_dirty(editor, 0, EDITOR_DIRTY_END);
+}
+
+void editor_clear_selection(Editor *editor)
+{
+    Cursor begin, end;
+    if (editor_selection(editor, &begin, &end)) {
+        editor_mark_dirty(editor, begin.row, end.row + 1);
+    }
+    editor->selecting = false;
+}
+
+bool editor_selection(const Editor *editor, Cursor *begin, Cursor *end)
+{
+    const Cursor cursor = {editor->cursor_row, editor->cursor_col};
+    if (!editor->selecting || editor->cursor_row >= editor->lines.len ||
+        editor->anchor.row >= editor->lines.len || compare_cursors(&cursor, &editor->anchor) == 0) {
+        return false;
+    }
+    const bool forward = compare_cursors(&editor->anchor, &cursor) < 0;
+    *begin = forward ? editor->anchor : cursor;
+    *end = forward ? cursor : editor->anchor;
+    return true;
+}
+
+// Every edit made by the user goes through here before it's applied: into the
+// undo journal, and into the swap file for crash recovery
+static void editor_record(Editor *editor, Undo_Kind kind, size_t row, size_t col,
+                          const char *text, size_t len, size_t cursor_row, size_t cursor_col)
+{
+    undo_push(&editor->undo, kind, row, col, text, len, cursor_row, cursor_col);
+    if (editor->swap != NULL) {
+        swap_append(editor->swap, kind, row, col, text, len);
+    }
+}
+
+// Removes the text from `begin` up to `end`, which is `text`, leaving the cursor at `begin`
+static void editor_delete_range(Editor *editor, Cursor begin, Cursor end, const char *text, size_t len)
+{
+    editor_record(editor, UNDO_DELETE_RANGE, begin.row, begin.col, text, len,
+                  editor->cursor_row, editor->cursor_col);
+    editor_delete_range_at(editor, begin, end);
+    editor->cursor_row = begin.row;
+    editor->cursor_col = begin.col;
+}
+
+bool editor_delete_selection(Editor *editor)
+{
+    Cursor begin, end;
+    const bool selected = editor_selection(editor, &begin, &end);
+    editor->selecting = false;
+    if (!selected) {
+        return false;
+    }
+
+    PROF_ZONE("editor_delete_selection");
+    size_t len = 0;
+    char *text = editor_range_text(editor, begin, end, &len);
+    editor_delete_range(editor, begin, end, text, len);
+    free(text);
+    return true;
+}
+
+char *editor_copy(const Editor *editor, size_t *len)
+{
+    PROF_ZONE("editor_copy");
+    Cursor begin, end;
+    if (!editor_selection(editor, &begin, &end)) {
+        return NULL;
+    }
+    return editor_range_text(editor, begin, end, len);
+}
+
+char *editor_cut(Editor *editor, size_t *len)
+{
+    PROF_ZONE("editor_cut");
+    Cursor begin, end;
+    const bool selected = editor_selection(editor, &begin, &end);
+    editor->selecting = false;
+    if (!selected) {
+        return NULL;
+    }
+    char *text = editor_range_text(editor, begin, end, len);
+    editor_delete_range(editor, begin, end, text, *len);
+    return text;
+}
+
+// Inserts `text` at every cursor. Every line is moved once for all of its
+// cursors, which then move past their text in the same sweep.
+static void editor_insert_at_cursors(Editor *editor, const char *text, size_t len)
+{
+    const size_t primary = editor_cursors_gather(editor);
+    Cursor *cursors = editor->cursors.items;
+    const size_t count = editor->cursors.count;
+
+    undo_batch_begin(&editor->undo);
+    for (size_t begin = 0, end = 0; begin < count; begin = end) {
+        const size_t row = cursors[begin].row;
+        for (end = begin; end < count && cursors[end].row == row; ++end) {
+            // Recorded as if the cursors typed one after another, left to right
+            const size_t col = cursors[end].col + (end - begin) * len;
+            editor_record(editor, UNDO_INSERT, row, col, text, len, row, col);
+        }
+
+        line_insert_text_at_cursors(&editor->pool, lines_at(&editor->lines, row),
+                                    cursors + begin, end - begin, text, len);
+        for (size_t i = begin; i < end; ++i) {
+            cursors[i].col += (i - begin + 1) * len;
+        }
+        editor_row_changed(editor, row);
+    }
+    undo_batch_end(&editor->undo);
+
+    editor_cursors_scatter(editor, primary);
+}
+
+// Deletes the code point before (backspace) or after the cursors of one line.
+// The line is moved once for all of them, front to back.
+static void editor_delete_in_line(Editor *editor, size_t row, Cursor *cursors, size_t count, bool before)
+{
+    Line *line = lines_at(&editor->lines, row);
+    bool deletes = false;
+    for (size_t i = 0; i < count; ++i) {
+        deletes = deletes || (before ? cursors[i].col > 0 : cursors[i].col < line->len);
+    }
+    if (!deletes) {
+        return;
+    }
+    line_grow(&editor->pool, line, 0);
+
+    // Bytes [next, from) move down to `kept`, then [from, to) is dropped
+    size_t kept = 0;
+    size_t next = 0;
+    for (size_t i = 0; i < count; ++i) {
+        const size_t col = cursors[i].col;
+        size_t from = before ? utf8_prev(line->chars, line->len, col) : col;
+        const size_t to = before ? col : utf8_next(line->chars, line->len, col);
+        from = from > next ? from : next;
+
+        memmove(line->chars + kept, line->chars + next, from - next);
+        kept += from - next;
+        if (to > from) {
+            // Recorded as if the cursors deleted one after another, left to right
+            editor_record(editor, UNDO_DELETE, row, kept, line->chars + from, to - from,
+                          row, kept + (col - from));
+        }
+        cursors[i].col = kept;
+        next = to > from ? to : from;
+    }
+    memmove(line->chars + kept, line->chars + next, line->len - next);
+    line->len = kept + line->len - next;
+    editor_row_changed(editor, row);
+}
+
+// Deletes the code point before (backspace) or after every cursor. A cursor at
+// the start (end) of its line joins it to the previous (next) one instead.
+// Lines go top to bottom, the rows of the cursors still to go moving up by the
+// lines joined above them.
+static void editor_delete_at_cursors(Editor *editor, bool before)
+{
+    const size_t primary = editor_cursors_gather(editor);
+    Cursor *cursors = editor->cursors.items;
+    const size_t count = editor->cursors.count;
+
+    // Lines joined away so far, and the last line joined to the one above it
+    // by a delete, with where it starts in there
+    size_t joined = 0;
+    size_t pulled_row = SIZE_MAX;
+    size_t pulled_col = 0;
+
+    undo_batch_begin(&editor->undo);
+    for (size_t begin = 0, end = 0; begin < count; begin = end) {
+        const size_t old_row = cursors[begin].row;
+        for (end = begin; end < count && cursors[end].row == old_row; ++end) {}
+        size_t row = old_row - joined;
+        size_t shift = old_row == pulled_row ? pulled_col : 0;
+
+        size_t first = begin;
+        if (before && cursors[begin].col == 0 && row > 0) {
+            row -= 1;
+            shift = lines_at(&editor->lines, row)->len;
+            editor_record(editor, UNDO_JOIN, row, shift, NULL, 0, row + 1, 0);
+            editor_join_at(editor, row);
+            joined += 1;
+            first += 1;
+        }
+        for (size_t i = begin; i < end; ++i) {
+            cursors[i].row = row;
+            cursors[i].col += shift;
+        }
+
+        const bool joins_next = !before && row + 1 < editor->lines.len &&
+            cursors[end - 1].col == lines_at(&editor->lines, row)->len;
+        editor_delete_in_line(editor, row, cursors + first, end - first, before);
+        if (joins_next) {
+            pulled_row = old_row + 1;
+            pulled_col = lines_at(&editor->lines, row)->len;
+            editor_record(editor, UNDO_JOIN, row, pulled_col, NULL, 0, row, pulled_col);
+            editor_join_at(editor, row);
+            joined += 1;
+        }
+    }
+    undo_batch_end(&editor->undo);
+
+    editor_cursors_scatter(editor, primary);
+}
+
+// Breaks the line at every cursor, bottom up so the rows of the cursors still
+// to go stay where they are
+static void editor_split_at_cursors(Editor *editor)
+{
+    const size_t primary = editor_cursors_gather(editor);
+    Cursor *cursors = editor->cursors.items;
+    const size_t count = editor->cursors.count;
+
+    undo_batch_begin(&editor->undo);
+    for (size_t i = count; i-- > 0;) {
+        editor_record(editor, UNDO_SPLIT, cursors[i].row, cursors[i].col,
+                      NULL, 0, cursors[i].row, cursors[i].col);
+        editor_split_at(editor, cursors[i].row, cursors[i].col);
+    }
+    undo_batch_end(&editor->undo);
+
+    // Every split above a cursor moved it down a row, its own one more
+    for (size_t i = 0; i < count; ++i) {
+        cursors[i].row += i + 1;
+        cursors[i].col = 0;
+    }
+    editor_cursors_scatter(editor, primary);
+}
+
+static void editor_clamp_cursor_col(Editor *editor)
+{
+    const Line *line = editor_current_line(editor);
+    if (editor->cursor_col > line->len) {
+        editor->cursor_col = line->len;
+    }
+}
+
+static void editor_create_first_new_line(Editor *editor)
+{
+    if (editor->cursor_row >= editor->lines.len) {
+        if (editor->lines.len > 0) {
+            editor->cursor_row = editor->lines.len - 1;
+        } else {
+            lines_append(&editor->lines);
+            editor_changed(editor, 0, EDITOR_DIRTY_END);
+        }
     }
 }
 
 void editor_insert_new_line(Editor *editor)
 {
-    if (editor->cursor_row > editor->len) {
-        editor->cursor_row = editor->len;
+    PROF_ZONE("editor_insert_new_line");
+    Cursor begin, end;
+    if (editor_selection(editor, &begin, &end)) {
+        editor_paste(editor, "\n", 1);
+        return;
+    }
+    editor->selecting = false;
+    editor_create_first_new_line(editor);
+    editor_clamp_cursor_col(editor);
+    if (editor->cursors.count > 0) {
+        editor_split_at_cursors(editor);
+        return;
     }
 
-    editor_grow(editor, 1);
+    editor_record(editor, UNDO_SPLIT, editor->cursor_row, editor->cursor_col,
+                  NULL, 0, editor->cursor_row, editor->cursor_col);
+    editor_split_at(editor, editor->cursor_row, editor->cursor_col);
 
-    const size_t line_size = sizeof(editor->lines[0]);
-    memmove(editor->lines + editor->cursor_row + 1,
-            editor->lines + editor->cursor_row,
-            (editor->len - editor->cursor_row) * line_size);
-    memset(&editor->lines[editor->cursor_row + 1], 0, line_size);
     editor->cursor_row += 1;
     editor->cursor_col = 0;
-    editor->len += 1;
 }
 
-static void editor_create_first_new_line(Editor *editor)
+static void editor_insert_text_sized_before_cursor(Editor *editor, const char *text, size_t text_size)
 {
-    if (editor->cursor_row >= editor->len) {
-        if (editor->len > 0) {
-            editor->cursor_row = editor->len - 1;
-        } else {
-            editor_grow(editor, 1);
-            memset(&editor->lines[editor->len], 0, sizeof(editor->lines[0]));
-            editor->len += 1;
+    PROF_ZONE("editor_insert_text");
+    Cursor begin, end;
+    if (editor_selection(editor, &begin, &end)) {
+        editor_paste(editor, text, text_size);
+        return;
+    }
+    editor->selecting = false;
+    editor_create_first_new_line(editor);
+    editor_clamp_cursor_col(editor);
+    if (editor->cursors.count > 0) {
+        if (text_size > 0) {
+            editor_insert_at_cursors(editor, text, text_size);
         }
+        return;
     }
+
+    editor_record(editor, UNDO_INSERT, editor->cursor_row, editor->cursor_col,
+                  text, text_size, editor->cursor_row, editor->cursor_col);
+    editor_insert_at(editor, editor->cursor_row, editor->cursor_col, text, text_size);
+    editor->cursor_col += text_size;
 }
 
 void editor_insert_text_before_cursor(Editor *editor, const char *text)
 {
-    editor_create_first_new_line(editor);
-    line_insert_text_before(&editor->lines[editor->cursor_row], text, &editor->cursor_col);
+    editor_insert_text_sized_before_cursor(editor, text, strlen(text));
+}
+
+void editor_paste(Editor *editor, const char *text, size_t len)
+{
+    PROF_ZONE("editor_paste");
+    // A single line goes in at every cursor, like typing it
+    if (editor->cursors.count > 0 && memchr(text, '\n', len) == NULL) {
+        editor_insert_text_sized_before_cursor(editor, text, len);
+        return;
+    }
+    editor_clear_cursors(editor);
+
+    // The selection and the text replacing it are undone together
+    undo_batch_begin(&editor->undo);
+    editor_delete_selection(editor);
+    if (len > 0) {
+        editor_create_first_new_line(editor);
+        editor_clamp_cursor_col(editor);
+        editor_record(editor, UNDO_INSERT_RANGE, editor->cursor_row, editor->cursor_col,
+                      text, len, editor->cursor_row, editor->cursor_col);
+        Cursor end;
+        editor_insert_range_at(editor, editor->cursor_row, editor->cursor_col, text, len, &end);
+        editor->cursor_row = end.row;
+        editor->cursor_col = end.col;
+    }
+    undo_batch_end(&editor->undo);
 }
 
 void editor_backspace(Editor *editor)
 {
+    PROF_ZONE("editor_backspace");
+    if (editor_delete_selection(editor)) {
+        return;
+    }
     editor_create_first_new_line(editor);
-    line_backspace(&editor->lines[editor->cursor_row], &editor->cursor_col);
+    editor_clamp_cursor_col(editor);
+    if (editor->cursors.count > 0) {
+        editor_delete_at_cursors(editor, true);
+        return;
+    }
+
+    if (editor->cursor_col > 0) {
+        // The whole code point before the cursor
+        const Line *line = editor_current_line(editor);
+        const size_t col = utf8_prev(line->chars, line->len, editor->cursor_col);
+        const size_t len = editor->cursor_col - col;
+        editor_record(editor, UNDO_DELETE, editor->cursor_row, col,
+                      line->chars + col, len,
+                      editor->cursor_row, editor->cursor_col);
+        editor_delete_at(editor, editor->cursor_row, col, len);
+        editor->cursor_col = col;
+    }
 }
 
 void editor_delete(Editor *editor)
 {
+    PROF_ZONE("editor_delete");
+    if (editor_delete_selection(editor)) {
+        return;
+    }
     editor_create_first_new_line(editor);
-    line_delete(&editor->lines[editor->cursor_row], &editor->cursor_col);
+    editor_clamp_cursor_col(editor);
+    if (editor->cursors.count > 0) {
+        editor_delete_at_cursors(editor, false);
+        return;
+    }
+
+    const Line *line = editor_current_line(editor);
+    if (editor->cursor_col < line->len) {
+        const size_t len = utf8_next(line->chars, line->len, editor->cursor_col) - editor->cursor_col;
+        editor_record(editor, UNDO_DELETE, editor->cursor_row, editor->cursor_col,
+                      line->chars + editor->cursor_col, len,
+                      editor->cursor_row, editor->cursor_col);
+        editor_delete_at(editor, editor->cursor_row, editor->cursor_col, len);
+    }
 }
 
 void editor_tab_space(Editor *editor) {
     const char *tab_space = "    ";
-    line_insert_text_before(&editor->lines[editor->cursor_row], tab_space, &editor->cursor_col);
+    editor_insert_text_before_cursor(editor, tab_space);
 }
 
 void editor_remove_line(Editor *editor) {
     /* For removing empty line only for now (Problem integrating with backspace) */
     if (editor->cursor_col == 0 && 
         editor->cursor_row > 0 && 
-        editor->lines[editor->cursor_row].len == 0) {
-            
-        size_t line_mem_sz = sizeof(editor->lines[0]);
-        memmove(editor->lines + (editor->cursor_row), 
-            editor->lines + (editor->cursor_row + 1), 
-            (editor->len - editor->cursor_row) * line_mem_sz);
+        editor->cursor_row < editor->lines.len &&
+        editor_current_line(editor)->len == 0) {
+
+        const size_t row = editor->cursor_row - 1;
+        const size_t col = lines_at(&editor->lines, row)->len;
+        editor_record(editor, UNDO_JOIN, row, col, NULL, 0,
+                      editor->cursor_row, editor->cursor_col);
+        editor_join_at(editor, row);
+
+        editor->cursor_row = row;
+        editor->cursor_col = col;
+
+        // The other cursors below moved up with the text, one may be on this one now
+        for (size_t i = 0; i < editor->cursors.count; ++i) {
+            Cursor *cursor = &editor->cursors.items[i];
+            if (cursor->row == row + 1) {
+                cursor->row = row;
+                cursor->col += col;
+            } else if (cursor->row > row + 1) {
+                cursor->row -= 1;
+            }
+        }
+        if (editor->cursors.count > 0) {
+            editor_cursors_scatter(editor, editor_cursors_gather(editor));
+        }
+    }
+}
+
+// The inverse of every edit undone, so replaying the swap file goes through
+// the same steps
+static const Undo_Kind editor_inverse_kinds[] = {
+    [UNDO_INSERT] = UNDO_DELETE,
+    [UNDO_DELETE] = UNDO_INSERT,
+    [UNDO_SPLIT] = UNDO_JOIN,
+    [UNDO_JOIN] = UNDO_SPLIT,
+    [UNDO_INSERT_RANGE] = UNDO_DELETE_RANGE,
+    [UNDO_DELETE_RANGE] = UNDO_INSERT_RANGE,
+};
+
+static void editor_undo_record(Editor *editor, const Undo_Record *record)
+{
+    if (editor->swap != NULL) {
+        swap_append(editor->swap, editor_inverse_kinds[record->kind], record->row, record->col,
+                    undo_record_text(record), record->len);
+    }
+    switch (record->kind) {
+    case UNDO_INSERT:
+        editor_delete_at(editor, record->row, record->col, record->len);
+        break;
+    case UNDO_DELETE:
+        editor_insert_at(editor, record->row, record->col, undo_record_text(record), record->len);
+        break;
+    case UNDO_SPLIT:
+        editor_join_at(editor, record->row);
+        break;
+    case UNDO_JOIN:
+        editor_split_at(editor, record->row, record->col);
+        break;
+    case UNDO_INSERT_RANGE: {
+        const Cursor begin = {record->row, record->col};
+        editor_delete_range_at(editor, begin,
+                               editor_range_end(record->row, record->col, undo_record_text(record), record->len));
+    }
+    break;
+    case UNDO_DELETE_RANGE: {
+        Cursor end;
+        editor_insert_range_at(editor, record->row, record->col, undo_record_text(record), record->len, &end);
+    }
+    break;
+    }
+
+    editor->cursor_row = record->cursor_row;
+    editor->cursor_col = record->cursor_col;
+}
+
+static void editor_redo_record(Editor *editor, const Undo_Record *record)
+{
+    if (editor->swap != NULL) {
+        swap_append(editor->swap, record->kind, record->row, record->col, undo_record_text(record), record->len);
+    }
+    editor->cursor_row = record->row;
+    editor->cursor_col = record->col;
 
-        editor->cursor_row -= 1;
-        editor->cursor_col = editor->lines[editor->cursor_row].len;
+    switch (record->kind) {
+    case UNDO_INSERT:
+        editor_insert_at(editor, record->row, record->col, undo_record_text(record), record->len);
+        editor->cursor_col += record->len;
+        break;
+    case UNDO_DELETE:
+        editor_delete_at(editor, record->row, record->col, record->len);
+        break;
+    case UNDO_SPLIT:
+        editor_split_at(editor, record->row, record->col);
+        editor->cursor_row += 1;
+        editor->cursor_col = 0;
+        break;
+    case UNDO_JOIN:
+        editor_join_at(editor, record->row);
+        break;
+    case UNDO_INSERT_RANGE: {
+        Cursor end;
+        editor_insert_range_at(editor, record->row, record->col, undo_record_text(record), record->len, &end);
+        editor->cursor_row = end.row;
+        editor->cursor_col = end.col;
+    }
+    break;
+    case UNDO_DELETE_RANGE: {
+        const Cursor begin = {record->row, record->col};
+        editor_delete_range_at(editor, begin,
+                               editor_range_end(record->row, record->col, undo_record_text(record), record->len));
+    }
+    break;
     }
 }
 
+void editor_undo(Editor *editor)
+{
+    PROF_ZONE("editor_undo");
+    editor_clear_cursors(editor);
+    editor_clear_selection(editor);
+    // A batch is undone from its last record back to its first one
+    const Undo_Record *record = NULL;
+    do {
+        record = undo_step_back(&editor->undo);
+        if (record == NULL) {
+            return;
+        }
+        editor_undo_record(editor, record);
+    } while (record->batch);
+}
+
+void editor_redo(Editor *editor)
+{
+    PROF_ZONE("editor_redo");
+    editor_clear_cursors(editor);
+    editor_clear_selection(editor);
+    do {
+        const Undo_Record *record = undo_step_forward(&editor->undo);
+        if (record == NULL) {
+            return;
+        }
+        editor_redo_record(editor, record);
+    } while (undo_forward_continues(&editor->undo));
+}
+
 const char *editor_char_under_cursor(const Editor *editor)
 {
-    if (editor->cursor_row < editor->len) {
-        if (editor->cursor_col < editor->lines[editor->cursor_row].len) {
-            return &editor->lines[editor->cursor_row].chars[editor->cursor_col];
+    return editor_char_at(editor, editor->cursor_row, editor->cursor_col);
+}
+
+const char *editor_char_at(const Editor *editor, size_t row, size_t col)
+{
+    if (row < editor->lines.len) {
+        const Line *line = lines_at(&editor->lines, row);
+        if (col < line->len) {
+            return &line->chars[col];
         }
     }
     return NULL;
 }
 
-void editor_save_to_file(const Editor *editor, const char *file_path)
+bool editor_save_to_file(Editor *editor, const char *file_path)
 {
-    FILE *f = fopen(file_path, "w");
-    if (f == NULL) {
-        fprintf(stdout, "ERROR: could not open file `%s`: %s\n",
-                file_path, strerror(errno));
+    PROF_ZONE("editor_save_to_file");
+    Save save = {0};
+    save_snapshot(&save, editor, file_path);
+    const bool ok = save_run(&save);
+    if (!ok) {
+        fprintf(stderr, "ERROR: %s\n", save.error);
+    }
+    save_free(&save);
+    return ok;
+}
+
+static void editor_read_source(Editor *editor, FILE *f)
+{
+    size_t cap = SOURCE_INIT_CAPACITY;
+    char *data = malloc(cap);
+    size_t size = 0;
+
+    while (data != NULL && !feof(f)) {
+        if (size == cap) {
+            cap *= 2;
+            data = realloc(data, cap);
+            if (data == NULL) {
+                break;
+            }
+        }
+        size += fread(data + size, 1, cap - size, f);
+        if (ferror(f)) {
+            fprintf(stderr, "ERROR: could not read file: %s\n", strerror(errno));
+            exit(1);
+        }
+    }
+
+    if (data == NULL) {
+        fprintf(stderr, "ERROR: could not allocate memory for the file\n");
         exit(1);
     }
 
-    for (size_t row = 0; row < editor->len; ++row) {
-        fwrite(editor->lines[row].chars, 1, editor->lines[row].len, f);
-        fputc('\n', f);
+    editor->source.data = data;
+    editor->source.size = size;
+}
+
+// Maps regular files instead of reading them, so opening costs one pass over
+// the pages for the newline scan and untouched lines are served by the page
+// cache. Pipes and empty files fall back to editor_read_source.
+static bool editor_map_source(Editor *editor, FILE *f)
+{
+    struct stat st;
+    int fd = fileno(f);
+    if (fd < 0 || fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size <= 0) {
+        return false;
+    }
+
+    const size_t size = (size_t) st.st_size;
+    void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        return false;
     }
+    const int source_fd = dup(fd);
+    if (source_fd < 0) {
+        munmap(data, size);
+        return false;
+    }
+
+    editor->source.data = data;
+    editor->source.size = size;
+    editor->source.mapped = true;
+    editor->source.fd = source_fd;
+    return true;
+}
 
-    fclose(f);
+// Lines only reference the bytes they were indexed in, the source or what
+// follow mode read, until they are edited
+static void editor_append_index(Editor *editor, char *data, const Scan_Lines *index)
+{
+    const size_t first = editor->lines.len;
+    for (size_t i = 0; i < index->count; ++i) {
+        Line *line = lines_append(&editor->lines);
+        line->chars = data + index->items[i].offset;
+        line->len = index->items[i].len;
+        line->non_ascii = !index->items[i].ascii;
+        if (editor->wrap_width > 0 && line->len >= editor->wrap_width) {
+            lines_set_wraps(&editor->lines, editor->lines.len - 1, editor_wraps(editor, line));
+        }
+    }
+    editor_changed(editor, first, EDITOR_DIRTY_END);
 }
 
 void editor_load_from_file(Editor *editor, FILE *f)
 {
-    assert(editor->lines == NULL && "You can only load files into an empty editor");
-    editor_create_first_new_line(editor);
+    PROF_ZONE("editor_load_from_file");
+    assert(editor->lines.len == 0 && "You can only load files into an empty editor");
+    if (!editor_map_source(editor, f)) {
+        editor_read_source(editor, f);
+    }
+    if (editor->source.mapped) {
+        madvise(editor->source.data, editor->source.size, MADV_SEQUENTIAL);
+    }
 
-    static char chunk[640 * 1024];
+    Scan_Lines index = {0};
+    scan_lines(editor->source.data, editor->source.size, &index);
+    editor_append_index(editor, editor->source.data, &index);
+    scan_lines_free(&index);
 
-    while (!feof(f)) {
-        size_t n = fread(chunk, 1, sizeof(chunk), f);
+    if (editor->source.mapped) {
+        madvise(editor->source.data, editor->source.size, MADV_NORMAL);
+    }
 
-        String_View chunk_sv = {
-            .data = chunk,
-            .count = n
-        };
+    editor->cursor_row = 0;
+}
 
-        while (chunk_sv.count > 0) {
-            String_View chunk_line = {0};
-            Line *line = &editor->lines[editor->len - 1];
-            if (sv_try_chop_by_delim(&chunk_sv, '\n', &chunk_line)) {
-                line_append_text_sized(line, chunk_line.data, chunk_line.count);
-                editor_insert_new_line(editor);
-            } else {
-                line_append_text_sized(line, chunk_sv.data, chunk_sv.count);
-                chunk_sv = SV_NULL;
-            }
+void editor_open_file(Editor *editor, FILE *f, Jobs *jobs)
+{
+    PROF_ZONE("editor_open_file");
+    assert(editor->lines.len == 0 && "You can only load files into an empty editor");
+    if (!editor_map_source(editor, f)) {
+        editor_read_source(editor, f);
+    }
+    if (!editor->source.mapped || editor->source.size <= LOAD_FIRST_SIZE * 4) {
+        // Not worth a worker, index it like editor_load_from_file does
+        Scan_Lines index = {0};
+        scan_lines(editor->source.data, editor->source.size, &index);
+        editor_append_index(editor, editor->source.data, &index);
+        scan_lines_free(&index);
+        return;
+    }
+
+    madvise(editor->source.data, editor->source.size, MADV_SEQUENTIAL);
+
+    // The first screen, up to the last complete line of it
+    Scan_Lines index = {0};
+    scan_lines_impl(scan_best_impl(), editor->source.data, LOAD_FIRST_SIZE, &index);
+    index.count -= 1;
+    size_t begin = 0;
+    if (index.count > 0) {
+        const Scan_Line *last = &index.items[index.count - 1];
+        begin = last->offset + last->len + 1;
+    }
+    editor_append_index(editor, editor->source.data, &index);
+    scan_lines_free(&index);
+
+    editor->load = malloc(sizeof(*editor->load));
+    if (editor->load == NULL) {
+        fprintf(stderr, "ERROR: could not allocate memory for loading\n");
+        exit(1);
+    }
+    load_start(editor->load, jobs, editor->source.data, editor->source.size, begin);
+}
+
+static double editor_now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+bool editor_load_update(Editor *editor)
+{
+    PROF_ZONE("editor_load_update");
+    if (editor->load == NULL) {
+        return false;
+    }
+
+    // The worker may be several blocks ahead, catch up a frame's worth at a time
+    const double start = editor_now_ms();
+    Load_Block *block;
+    while (editor_now_ms() - start < EDITOR_LOAD_BUDGET_MS && (block = load_take(editor->load)) != NULL) {
+        editor_append_index(editor, editor->source.data, &block->lines);
+    }
+
+    if (!load_done(editor->load)) {
+        return true;
+    }
+    editor_load_stop(editor);
+    madvise(editor->source.data, editor->source.size, MADV_NORMAL);
+    return false;
+}
+
+void editor_load_wait(Editor *editor, size_t row)
+{
+    const struct timespec pause = {.tv_sec = 0, .tv_nsec = 100 * 1000};
+    while (editor_load_update(editor) && row >= editor->lines.len) {
+        nanosleep(&pause, NULL);
+    }
+}
+
+void editor_load_stop(Editor *editor)
+{
+    if (editor->load != NULL) {
+        load_free(editor->load);
+        free(editor->load);
+        editor->load = NULL;
+    }
+}
+
+float editor_load_progress(const Editor *editor)
+{
+    return editor->load != NULL ? load_progress(editor->load) : 1.0f;
+}
+
+bool editor_follow_start(Editor *editor, const char *file_path)
+{
+    // The lines appended to a followed file aren't journaled, so edits can't be
+    // replayed on it either. Edits the file doesn't have would be left without
+    // their journal.
+    if (editor->swap != NULL && swap_has_edits(editor->swap)) {
+        return false;
+    }
+    if (editor->follow == NULL) {
+        editor->follow = calloc(1, sizeof(*editor->follow));
+        if (editor->follow == NULL) {
+            fprintf(stderr, "ERROR: could not allocate memory for following\n");
+            exit(1);
         }
+        // After a save the source is what was loaded before it, the journal
+        // knows the size of the file the text is now
+        editor->follow->size = editor->swap != NULL ? editor->swap->header.file_size : editor->source.size;
     }
+    editor_swap_close(editor, true);
+    // Stopping and starting again goes on from where it stopped
+    return follow_start(editor->follow, file_path, editor->follow->size);
+}
 
-    editor->cursor_row = 0;
+void editor_follow_stop(Editor *editor)
+{
+    if (editor->follow != NULL) {
+        follow_stop(editor->follow);
+    }
+}
+
+bool editor_is_following(const Editor *editor)
+{
+    return editor->follow != NULL && editor->follow->active;
 }
 
+// Bytes that came after the end of the text: the first line of them goes on
+// the end of the last line, the others are appended pointing into `data`
+static void editor_append_bytes(Editor *editor, char *data, size_t len)
+{
+    Scan_Lines index = {0};
+    scan_lines(data, len, &index);
+    if (editor->lines.len == 0) {
+        lines_append(&editor->lines);
+    }
 
-void editor_move_cursor_left(Editor *editor) {
-    if (editor->cursor_col > 0) {
-        editor->cursor_col -= 1;
+    const size_t last = editor->lines.len - 1;
+    Line *line = lines_at(&editor->lines, last);
+    const Scan_Line *head = &index.items[0];
+    if (head->len > 0 && line->len == 0 && line->cap == 0) {
+        // The text ended with a newline, which is how logs are written
+        line->chars = data + head->offset;
+        line->len = head->len;
+        line->non_ascii = !head->ascii;
+        editor_row_changed(editor, last);
+    } else if (head->len > 0) {
+        editor_insert_at(editor, last, line->len, data + head->offset, head->len);
+    }
+
+    if (index.count > 1) {
+        const Scan_Lines rest = {.items = index.items + 1, .count = index.count - 1};
+        editor_append_index(editor, data, &rest);
     }
+    scan_lines_free(&index);
 }
 
-void editor_move_cursor_right(Editor *editor) {
-    if (editor->cursor_col < editor->lines[editor->cursor_row].len) {
-        editor->cursor_col += 1;
+Follow_Event editor_follow_update(Editor *editor)
+{
+    // Appended lines go after all of the loaded ones
+    if (!editor_is_following(editor) || editor->load != NULL) {
+        return FOLLOW_NONE;
     }
+
+    char *data = NULL;
+    size_t len = 0;
+    const Follow_Event event = follow_poll(editor->follow, &data, &len);
+    if (event == FOLLOW_APPENDED) {
+        PROF_ZONE("editor_follow_update");
+        editor_append_bytes(editor, data, len);
+    }
+    return event;
 }
 
-void editor_move_cursor_up(Editor *editor) {
-    if (editor->cursor_row > 0) {
-        // Move cursor row up by one
-        editor->cursor_row -= 1;    
-        // If lenght of upper line is smaller than cursor_col, snap the cursor to the end of the line on moving up
-        if (editor->lines[editor->cursor_row].len < editor->cursor_col) {
-            editor->cursor_col = editor->lines[editor->cursor_row].len;
+// Applies a recorded edit like the user made it, undo journal included.
+// Returns false if it doesn't fit the text, which happens only if the base the
+// journal applies to isn't the text it was recorded on.
+static bool editor_replay_record(Editor *editor, const Swap_Record *record)
+{
+    if (editor->lines.len == 0) {
+        lines_append(&editor->lines);
+        editor_changed(editor, 0, EDITOR_DIRTY_END);
+    }
+    if (record->row >= editor->lines.len) {
+        return false;
+    }
+    const Line *line = lines_at(&editor->lines, record->row);
+    const size_t row = record->row;
+    const size_t col = record->col;
+    if (col > line->len) {
+        return false;
+    }
+
+    editor->cursor_row = row;
+    editor->cursor_col = col;
+    switch (record->kind) {
+    case UNDO_INSERT:
+        undo_push(&editor->undo, UNDO_INSERT, row, col, record->text, record->len, row, col);
+        editor_insert_at(editor, row, col, record->text, record->len);
+        editor->cursor_col += record->len;
+        break;
+    case UNDO_DELETE:
+        if (record->len > line->len - col) {
+            return false;
+        }
+        undo_push(&editor->undo, UNDO_DELETE, row, col, line->chars + col, record->len, row, col);
+        editor_delete_at(editor, row, col, record->len);
+        break;
+    case UNDO_SPLIT:
+        undo_push(&editor->undo, UNDO_SPLIT, row, col, NULL, 0, row, col);
+        editor_split_at(editor, row, col);
+        editor->cursor_row += 1;
+        editor->cursor_col = 0;
+        break;
+    case UNDO_JOIN:
+        if (row + 1 >= editor->lines.len || col != line->len) {
+            return false;
+        }
+        undo_push(&editor->undo, UNDO_JOIN, row, col, NULL, 0, row + 1, 0);
+        editor_join_at(editor, row);
+        break;
+    case UNDO_INSERT_RANGE: {
+        undo_push(&editor->undo, UNDO_INSERT_RANGE, row, col, record->text, record->len, row, col);
+        Cursor end;
+        editor_insert_range_at(editor, row, col, record->text, record->len, &end);
+        editor->cursor_row = end.row;
+        editor->cursor_col = end.col;
+    }
+    break;
+    case UNDO_DELETE_RANGE: {
+        const Cursor begin = {row, col};
+        const Cursor end = {record->end_row, record->end_col};
+        if (end.row >= editor->lines.len || end.col > lines_at(&editor->lines, end.row)->len ||
+            compare_cursors(&begin, &end) > 0) {
+            return false;
+        }
+        size_t len = 0;
+        char *text = editor_range_text(editor, begin, end, &len);
+        undo_push(&editor->undo, UNDO_DELETE_RANGE, row, col, text, len, row, col);
+        free(text);
+        editor_delete_range_at(editor, begin, end);
+    }
+    break;
+    default:
+        return false;
+    }
+    return true;
+}
+
+Swap_Status editor_swap_open(Editor *editor, const char *file_path, size_t *recovered)
+{
+    PROF_ZONE("editor_swap_open");
+    assert(editor->swap == NULL);
+    Swap *swap = calloc(1, sizeof(*swap));
+    if (swap == NULL) {
+        fprintf(stderr, "ERROR: could not allocate memory for the swap file\n");
+        exit(1);
+    }
+
+    *recovered = 0;
+    const Swap_Status status = swap_open(swap, file_path);
+    if (status == SWAP_BUSY) {
+        free(swap);
+        return status;
+    }
+    if (status != SWAP_FOUND) {
+        // The records of a changed file can't be replayed, but they are kept
+        char *stale_path = NULL;
+        if (status == SWAP_CHANGED && (stale_path = swap_set_aside(file_path)) == NULL) {
+            free(swap);
+            return SWAP_FAILED;
+        }
+        if (!swap_create(swap, file_path)) {
+            free(stale_path);
+            free(swap);
+            return SWAP_FAILED;
+        }
+        swap->stale_path = stale_path;
+        editor->swap = swap;
+        return status;
+    }
+
+    if (swap->header.base != SWAP_BASE_FILE) {
+        // The text was checkpointed, it's loaded from there instead of the file
+        FILE *f = fopen(swap_base_path(swap), "r");
+        if (f == NULL) {
+            swap_close(swap, false);
+            free(swap);
+            return SWAP_FAILED;
+        }
+        editor_free(editor);
+        editor_load_from_file(editor, f);
+        fclose(f);
+    }
+    // The records may go anywhere in the text, all of it has to be in
+    editor_load_wait(editor, EDITOR_DIRTY_END);
+
+    Swap_Record record;
+    while (swap_read(swap, &record)) {
+        if (!editor_replay_record(editor, &record)) {
+            swap_unread(swap);
+            break;
         }
+        *recovered += 1;
+    }
+    undo_seal(&editor->undo);
+    // Further edits are appended to the same journal, on top of the same base
+    editor->swap = swap;
+    return status;
+}
+
+void editor_swap_close(Editor *editor, bool remove)
+{
+    if (editor->swap != NULL) {
+        swap_close(editor->swap, remove);
+        free(editor->swap);
+        editor->swap = NULL;
+    }
+}
+
+void editor_free(Editor *editor)
+{
+    editor_swap_close(editor, false);
+    editor_load_stop(editor);
+    if (editor->follow != NULL) {
+        follow_free(editor->follow);
+        free(editor->follow);
+    }
+
+    // Line buffers all live in the pool, there is no need to walk the lines
+    pool_free(&editor->pool);
+    lines_free(&editor->lines);
+    undo_free(&editor->undo);
+    columns_free(&editor->columns);
+    free(editor->cursors.items);
+    while (editor->blocks != NULL) {
+        Editor_Block *next = editor->blocks->next;
+        free(editor->blocks);
+        editor->blocks = next;
+    }
+
+    if (editor->source.mapped) {
+        munmap(editor->source.data, editor->source.size);
+        close(editor->source.fd);
+    } else {
+        free(editor->source.data);
+    }
+
+    memset(editor, 0, sizeof(*editor));
+}
+
+
+size_t editor_cursor_column(Editor *editor)
+{
+    if (editor->cursor_row >= editor->lines.len) {
+        return editor->cursor_col;
+    }
+    return columns_col_at(&editor->columns, editor->cursor_row, editor_current_line(editor),
+                          editor->cursor_col);
+}
+
+// Moves of the cursor alone, editor_move_cursors makes them at every cursor
+static void editor_step_left(Editor *editor, long delta)
+{
+    (void) delta;
+    if (editor->cursor_row < editor->lines.len) {
+        const Line *line = editor_current_line(editor);
+        editor->cursor_col = utf8_prev(line->chars, line->len, editor->cursor_col);
+    } else if (editor->cursor_col > 0) {
+        editor->cursor_col -= 1;
+    }
+}
+
+static void editor_step_right(Editor *editor, long delta)
+{
+    (void) delta;
+    if (editor->cursor_row < editor->lines.len) {
+        const Line *line = editor_current_line(editor);
+        editor->cursor_col = utf8_next(line->chars, line->len, editor->cursor_col);
+    }
+}
+
+static void editor_step_visual(Editor *editor, long delta)
+{
+    if (editor->lines.len == 0 || editor->cursor_row >= editor->lines.len) {
+        return;
+    }
+
+    size_t visual_row, visual_col;
+    editor_cursor_visual(editor, &visual_row, &visual_col);
+    size_t target = 0;
+    if (delta < 0) {
+        target = (size_t) -delta < visual_row ? visual_row - (size_t) -delta : 0;
+    } else {
+        target = visual_row + (size_t) delta;
+        // Only the lines down to the target have to be there, not the rest of the file
+        size_t segment = 0;
+        editor_load_wait(editor, lines_at_visual(&editor->lines, target, &segment));
+        const size_t last = lines_visual_len(&editor->lines) - 1;
+        target = target < last ? target : last;
+    }
+    if (target == visual_row) {
+        return;
+    }
+
+    // A line that isn't wrapped has a single segment
+    size_t segment = 0;
+    const size_t row = lines_at_visual(&editor->lines, target, &segment);
+    const size_t col = segment * editor->wrap_width + visual_col;
+    editor->cursor_row = row;
+    editor->cursor_col = columns_offset_at(&editor->columns, row, editor_current_line(editor), col);
+}
+
+// Makes the move at every cursor as if it was the only one
+static void editor_move_cursors(Editor *editor, void (*step)(Editor *editor, long delta), long delta)
+{
+    undo_seal(&editor->undo);
+    const Cursor cursor = {editor->cursor_row, editor->cursor_col};
+    for (size_t i = 0; i < editor->cursors.count; ++i) {
+        editor->cursor_row = editor->cursors.items[i].row;
+        editor->cursor_col = editor->cursors.items[i].col;
+        step(editor, delta);
+        editor->cursors.items[i] = (Cursor) {editor->cursor_row, editor->cursor_col};
+    }
+    editor->cursor_row = cursor.row;
+    editor->cursor_col = cursor.col;
+    step(editor, delta);
+    if (editor->selecting) {
+        // The rows the selection grew or shrank by are drawn again
+        const size_t from = cursor.row < editor->cursor_row ? cursor.row : editor->cursor_row;
+        const size_t to = cursor.row > editor->cursor_row ? cursor.row : editor->cursor_row;
+        editor_mark_dirty(editor, from, to + 1);
+    }
+
+    if (editor->cursors.count > 0) {
+        // Cursors stopped by the start or end of the text may have passed others
+        qsort(editor->cursors.items, editor->cursors.count, sizeof(Cursor), compare_cursors);
+        editor_cursors_scatter(editor, editor_cursors_gather(editor));
+    }
+}
+
+void editor_move_cursor_left(Editor *editor)
+{
+    editor_move_cursors(editor, editor_step_left, 0);
+}
+
+void editor_move_cursor_right(Editor *editor)
+{
+    editor_move_cursors(editor, editor_step_right, 0);
+}
+
+void editor_move_cursor_visual(Editor *editor, long delta)
+{
+    editor_move_cursors(editor, editor_step_visual, delta);
+}
+
+void editor_add_cursor_visual(Editor *editor, long delta)
+{
+    undo_seal(&editor->undo);
+    const Cursor cursor = {editor->cursor_row, editor->cursor_col};
+    editor_step_visual(editor, delta);
+    if (editor->cursor_row == cursor.row && editor->cursor_col == cursor.col) {
+        return;
     }
+    // It may have landed on one of the others
+    editor_cursors_scatter(editor, editor_cursors_gather(editor));
+    editor_add_cursor(editor, cursor.row, cursor.col);
+}
+
+void editor_move_cursor_up(Editor *editor) {
+    editor_move_cursor_visual(editor, -1);
 }
 
 void editor_move_cursor_down(Editor *editor) {
-    if (editor->cursor_row < editor->len - 1) {
-        editor->cursor_row += 1;
-        // If lenght of lower line is smaller than cursor_col, snap the cursor to the end of the line on moving down
-        if (editor->lines[editor->cursor_row].len < editor->cursor_col) {
-            editor->cursor_col = editor->lines[editor->cursor_row].len;
+    editor_move_cursor_visual(editor, 1);
+}
+
+void editor_move_cursor_to(Editor *editor, size_t row, size_t col)
+{
+    undo_seal(&editor->undo);
+    editor_clear_cursors(editor);
+    editor_clear_selection(editor);
+    editor_load_wait(editor, row);
+    if (editor->lines.len == 0) {
+        return;
+    }
+    editor->cursor_row = row < editor->lines.len ? row : editor->lines.len - 1;
+    const Line *line = editor_current_line(editor);
+    editor->cursor_col = utf8_floor(line->chars, line->len, col);
+}
+
+void editor_set_wrap(Editor *editor, size_t width)
+{
+    if (width == editor->wrap_width) {
+        return;
+    }
+    PROF_ZONE("editor_set_wrap");
+    editor->wrap_width = width;
+
+    // One pass over every line, the sums are updated once at the end
+    for (size_t row = 0; row < editor->lines.len;) {
+        size_t count = 0;
+        Line *span = lines_span(&editor->lines, row, &count);
+        for (size_t i = 0; i < count; ++i) {
+            span[i].wraps = editor_wraps(editor, &span[i]);
         }
+        row += count;
+    }
+    lines_sum_wraps(&editor->lines);
+    editor_mark_dirty(editor, 0, EDITOR_DIRTY_END);
+}
+
+size_t editor_visual_rows(const Editor *editor)
+{
+    return lines_visual_len(&editor->lines);
+}
+
+void editor_cursor_visual(Editor *editor, size_t *row, size_t *col)
+{
+    editor_visual_at(editor, editor->cursor_row, editor->cursor_col, row, col);
+}
+
+void editor_visual_at(Editor *editor, size_t row, size_t col, size_t *visual_row, size_t *visual_col)
+{
+    size_t column = col;
+    if (row < editor->lines.len) {
+        column = columns_col_at(&editor->columns, row, lines_at(&editor->lines, row), col);
+    }
+    *visual_row = lines_visual_row(&editor->lines, row);
+    *visual_col = column;
+    if (editor->wrap_width > 0) {
+        *visual_row += column / editor->wrap_width;
+        *visual_col = column % editor->wrap_width;
     }
 }
@@ -1,38 +1,186 @@
 #ifndef EDITOR_H_
 #define EDITOR_H_
 
+#include <stdbool.h>
 #include <stdio.h>
 
+#include "columns.h"
+#include "follow.h"
+#include "highlight.h"
+#include "jobs.h"
+#include "lines.h"
+#include "load.h"
+#include "pool.h"
+#include "swap.h"
+#include "undo.h"
+
+// Line buffers come from `pool`, the pool of the editor owning the line
+void line_append_text(Pool *pool, Line *line, const char *text);
+void line_append_text_sized(Pool *pool, Line *line, const char *text, size_t text_size);
+void line_insert_text_before(Pool *pool, Line *line, const char *text, size_t *col);
+void line_insert_text_sized_before(Pool *pool, Line *line, const char *text, size_t text_size, size_t *col);
+void line_backspace(Pool *pool, Line *line, size_t *col);
+void line_delete(Pool *pool, Line *line, size_t *col);
+
+// Original bytes of the loaded file. They are never modified, edits go to the
+// buffers of the lines that were touched. Regular files are mapped read-only
+// (`mapped`) and keep `fd` open so saves can copy untouched ranges straight
+// from it, anything else is read into a heap buffer.
 typedef struct {
-    size_t cap;
-    size_t len;
-    char *chars;
-} Line;
+    char *data;
+    size_t size;
+    bool mapped;
+    int fd;
+} Source;
 
-void line_append_text(Line *line, const char *text);
-void line_append_text_sized(Line *line, const char *text, size_t text_size);
-void line_insert_text_before(Line *line, const char *text, size_t *col);
-void line_insert_text_sized_before(Line *line, const char *text, size_t text_size, size_t *col);
-void line_backspace(Line *line, size_t *col);
-void line_delete(Line *line, size_t *col);
+// A place in the text, `col` is a byte offset at the start of a code point
+typedef struct {
+    size_t row;
+    size_t col;
+} Cursor;
 
 typedef struct {
+    Cursor *items;
+    size_t count;
     size_t cap;
-    size_t len;
-    Line *lines;
+} Cursors;
+
+// Copy of text that came in at once, see editor_paste
+typedef struct Editor_Block {
+    struct Editor_Block *next;
+    char data[];
+} Editor_Block;
+
+typedef struct {
+    Lines lines;
+    // Owns the buffers of every edited line
+    Pool pool;
+    Source source;
+    // Lines of the source still being indexed in the background, appended
+    // by editor_load_update. NULL once every line is in.
+    Load *load;
+    // Follow mode, see editor_follow_start. The bytes it read stay here until
+    // the editor is freed, the lines appended from them point into them.
+    Follow *follow;
+    // Pasted text. The lines it was split into point into it until they are
+    // edited, like loaded lines point into the source.
+    Editor_Block *blocks;
+    Undo undo;
+    // Crash journal every edit is appended to as well, NULL without one. See
+    // editor_swap_open.
+    Swap *swap;
     size_t cursor_row;
+    // Byte offset in the cursor row, always at the start of a code point.
+    // `columns` maps it to the column it's drawn in.
     size_t cursor_col;
+    // More cursors besides the one above, sorted by position and never on
+    // the same place. Edits are made at all of them in one pass, the camera
+    // only follows cursor_row:cursor_col.
+    Cursors cursors;
+    // The text between `anchor` and the cursor is selected while `selecting`
+    // is set. There are no extra cursors then.
+    bool selecting;
+    Cursor anchor;
+    Columns columns;
+    // Syntax highlighting, off until a language is set
+    Highlight highlight;
+    // Columns lines are soft wrapped at, 0 when they aren't. The visual rows
+    // every line takes are kept in `lines`, see editor_set_wrap.
+    size_t wrap_width;
+
+    // Rows [dirty_begin, dirty_end) changed since the last editor_clear_dirty.
+    // Edits that shift the rows below them mark up to EDITOR_DIRTY_END.
+    size_t dirty_begin;
+    size_t dirty_end;
+
+    // Bumped by every change to the text, so data derived from it (search
+    // results) can tell it went stale
+    size_t version;
 } Editor;
 
+#define EDITOR_DIRTY_END ((size_t) -1)
+
 // Editor file I/O operations
-void editor_save_to_file(const Editor *editor, const char *file_path);
+// Saves synchronously, see save.h for saving in the background
+bool editor_save_to_file(Editor *editor, const char *file_path);
 void editor_load_from_file(Editor *editor, FILE *f);
+// Like editor_load_from_file, but big mapped files only get their first
+// screen indexed right away, the rest is indexed on a worker of `jobs`
+void editor_open_file(Editor *editor, FILE *f, Jobs *jobs);
+// Appends the lines indexed since the last call. Returns true while loading.
+bool editor_load_update(Editor *editor);
+// Waits until `row` is indexed, or the whole file with EDITOR_DIRTY_END
+void editor_load_wait(Editor *editor, size_t row);
+// Stops indexing, the lines not in yet are left out of the editor
+void editor_load_stop(Editor *editor);
+float editor_load_progress(const Editor *editor);
+// Follow mode: bytes appended to `file_path`, the file the editor was loaded
+// from, are read as they come. The first line of them goes on the end of the
+// last line, the others are added after it without being copied. Refused
+// while the text has edits not saved to the file, recovered ones included.
+bool editor_follow_start(Editor *editor, const char *file_path);
+void editor_follow_stop(Editor *editor);
+bool editor_is_following(const Editor *editor);
+// Takes in what was appended since the last call. FOLLOW_TRUNCATED and
+// FOLLOW_ROTATED mean the file has to be loaded again.
+Follow_Event editor_follow_update(Editor *editor);
+// Crash recovery for the text loaded from `file_path`. A journal the last
+// session left for it is replayed on top of it, or of the checkpoint it was
+// taken from, and `recovered` gets how many edits came back (SWAP_FOUND).
+// Otherwise a new one is started (SWAP_MISSING, SWAP_CHANGED when the file
+// changed under the old one, which is set aside to `swap->stale_path`), unless
+// it can't be (SWAP_BUSY, SWAP_FAILED).
+Swap_Status editor_swap_open(Editor *editor, const char *file_path, size_t *recovered);
+// `remove` deletes the journal as well, on a clean exit
+void editor_swap_close(Editor *editor, bool remove);
+// Releases the document, its line buffers in bulk and its history. The swap
+// file is closed but kept.
+void editor_free(Editor *editor);
 
-// Editor cursor navigation
+// Editor cursor navigation, left and right step over whole code points
 void editor_move_cursor_left(Editor *editor);
 void editor_move_cursor_right(Editor *editor);
 void editor_move_cursor_up(Editor *editor);
 void editor_move_cursor_down(Editor *editor);
+void editor_move_cursor_to(Editor *editor, size_t row, size_t col);
+// Column the cursor is drawn in, in code points from the start of the row
+size_t editor_cursor_column(Editor *editor);
+// Moves `delta` visual rows down, or up when it's negative, staying in the
+// same visual column. Up and down move one.
+void editor_move_cursor_visual(Editor *editor, long delta);
+
+// Extra cursors. Moving them all and every edit below go through all of them,
+// editor_move_cursor_to and undo/redo go back to a single cursor and drop the
+// selection.
+void editor_add_cursor(Editor *editor, size_t row, size_t col);
+// Leaves a cursor where the cursor is and moves it `delta` visual rows
+void editor_add_cursor_visual(Editor *editor, long delta);
+void editor_clear_cursors(Editor *editor);
+
+// Selection: starts where the cursor is, moving the cursor then extends it.
+// Editing replaces it, editor_select drops the extra cursors.
+void editor_select(Editor *editor);
+void editor_select_all(Editor *editor);
+void editor_clear_selection(Editor *editor);
+// The selected text goes from `begin` up to `end`, false if there is none
+bool editor_selection(const Editor *editor, Cursor *begin, Cursor *end);
+bool editor_delete_selection(Editor *editor);
+// The selected text, lines joined with '\n' and NUL terminated, in a buffer
+// the caller frees. NULL when nothing is selected.
+char *editor_copy(const Editor *editor, size_t *len);
+char *editor_cut(Editor *editor, size_t *len);
+// Puts `text` in place of the selection, or at the cursor. However many lines
+// it has, they are inserted at once and point into a single copy of it.
+void editor_paste(Editor *editor, const char *text, size_t len);
+
+// Soft wrap: lines longer than `width` columns take several visual rows, 0
+// turns it off. Changing the width lays out every line again, edits only
+// the lines they touch.
+void editor_set_wrap(Editor *editor, size_t width);
+size_t editor_visual_rows(const Editor *editor);
+// Visual row and column the cursor, or any row:col, is drawn in
+void editor_cursor_visual(Editor *editor, size_t *row, size_t *col);
+void editor_visual_at(Editor *editor, size_t row, size_t col, size_t *visual_row, size_t *visual_col);
 
 // Editor operations
 void editor_insert_text_before_cursor(Editor *editor, const char *text);
@@ -41,6 +189,17 @@ void editor_backspace(Editor *editor);
 void editor_tab_space(Editor *editor);
 void editor_delete(Editor *editor);
 void editor_remove_line(Editor *editor);
+// First byte of the code point under the cursor, NULL past the end of the row
 const char *editor_char_under_cursor(const Editor *editor);
+const char *editor_char_at(const Editor *editor, size_t row, size_t col);
+
+// Undo history
+void editor_undo(Editor *editor);
+void editor_redo(Editor *editor);
+
+// Damage tracking
+void editor_mark_dirty(Editor *editor, size_t begin, size_t end);
+void editor_clear_dirty(Editor *editor);
+bool editor_is_dirty(const Editor *editor);
 
 #endif // EDITOR_H_
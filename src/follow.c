@@ -0,0 +1,188 @@
+#define _DEFAULT_SOURCE
+#include "follow.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#include "prof.h"
+
+bool follow_start(Follow *follow, const char *file_path, size_t size)
+{
+    follow_stop(follow);
+
+    const int fd = open(file_path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return false;
+    }
+
+    free(follow->path);
+    follow->path = strdup(file_path);
+    if (follow->path == NULL) {
+        fprintf(stderr, "ERROR: could not allocate memory for following\n");
+        exit(1);
+    }
+    follow->fd = fd;
+    follow->dev = st.st_dev;
+    follow->ino = st.st_ino;
+    follow->size = size;
+    // Whatever was appended before the watch was set has to be read too
+    follow->pending = true;
+    follow->moved = false;
+
+    follow->inotify = -1;
+#ifdef __linux__
+    follow->inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (follow->inotify >= 0 &&
+        inotify_add_watch(follow->inotify, file_path, IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF) < 0) {
+        close(follow->inotify);
+        follow->inotify = -1;
+    }
+#endif
+
+    follow->active = true;
+    return true;
+}
+
+// Whether anything happened to the file since the last call
+static bool follow_take_events(Follow *follow)
+{
+    if (follow->inotify < 0) {
+        return true;
+    }
+
+    bool changed = false;
+#ifdef __linux__
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t n;
+    while ((n = read(follow->inotify, events, sizeof(events))) > 0) {
+        for (char *p = events; p < events + n;) {
+            const struct inotify_event *event = (const struct inotify_event *) p;
+            if (event->mask & (IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF)) {
+                follow->moved = true;
+            }
+            changed = true;
+            p += sizeof(*event) + event->len;
+        }
+    }
+#endif
+    return changed;
+}
+
+// Another file is at the path now. Until one shows up there, the old one may
+// still be written to and is followed as before.
+static bool follow_rotated(Follow *follow)
+{
+    struct stat st;
+    if (stat(follow->path, &st) < 0) {
+        return false;
+    }
+    return st.st_dev != follow->dev || st.st_ino != follow->ino;
+}
+
+static bool follow_read(Follow *follow, size_t len, char **data)
+{
+    Follow_Block *block = malloc(sizeof(*block) + len);
+    if (block == NULL) {
+        fprintf(stderr, "ERROR: could not allocate memory for following\n");
+        exit(1);
+    }
+
+    size_t done = 0;
+    while (done < len) {
+        const ssize_t n = pread(follow->fd, block->data + done, len - done, (off_t) (follow->size + done));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        done += (size_t) n;
+    }
+    if (done < len) {
+        // Shrunk under the read, the next poll sees it
+        free(block);
+        return false;
+    }
+
+    block->next = follow->blocks;
+    follow->blocks = block;
+    follow->size += len;
+    *data = block->data;
+    return true;
+}
+
+Follow_Event follow_poll(Follow *follow, char **data, size_t *len)
+{
+    if (!follow->active) {
+        return FOLLOW_NONE;
+    }
+    const bool changed = follow_take_events(follow);
+    if (!changed && !follow->pending && !follow->moved) {
+        return FOLLOW_NONE;
+    }
+    PROF_ZONE("follow_poll");
+
+    struct stat st;
+    if (fstat(follow->fd, &st) < 0) {
+        return FOLLOW_NONE;
+    }
+    const size_t size = (size_t) st.st_size;
+    if (size < follow->size) {
+        return FOLLOW_TRUNCATED;
+    }
+
+    // The last lines written to a rotated file still come first
+    if (size > follow->size) {
+        const size_t n = size - follow->size < FOLLOW_READ_MAX ? size - follow->size : FOLLOW_READ_MAX;
+        follow->pending = follow->size + n < size;
+        if (follow_read(follow, n, data)) {
+            *len = n;
+            return FOLLOW_APPENDED;
+        }
+        follow->pending = true;
+        return FOLLOW_NONE;
+    }
+    follow->pending = false;
+
+    if (follow->moved && follow_rotated(follow)) {
+        return FOLLOW_ROTATED;
+    }
+    return FOLLOW_NONE;
+}
+
+void follow_stop(Follow *follow)
+{
+    if (!follow->active) {
+        return;
+    }
+    close(follow->fd);
+    if (follow->inotify >= 0) {
+        close(follow->inotify);
+    }
+    follow->active = false;
+}
+
+void follow_free(Follow *follow)
+{
+    follow_stop(follow);
+    for (Follow_Block *block = follow->blocks; block != NULL;) {
+        Follow_Block *next = block->next;
+        free(block);
+        block = next;
+    }
+    free(follow->path);
+    memset(follow, 0, sizeof(*follow));
+}
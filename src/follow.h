@@ -0,0 +1,61 @@
+#ifndef FOLLOW_H_
+#define FOLLOW_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+// Watches a file that grows at its end, like a log being written, and reads
+// only the bytes appended to it. On Linux inotify tells when to look, elsewhere
+// the size is checked on every poll.
+
+// Most bytes read by one follow_poll, the rest is left for the next ones
+#define FOLLOW_READ_MAX (16 * 1024 * 1024)
+
+typedef enum {
+    FOLLOW_NONE = 0,
+    FOLLOW_APPENDED,
+    // The file got shorter than what was read (truncated in place), or the
+    // path names another file now (rotated). Either way the bytes read so far
+    // don't match it anymore and it has to be opened again.
+    FOLLOW_TRUNCATED,
+    FOLLOW_ROTATED,
+} Follow_Event;
+
+typedef struct Follow_Block Follow_Block;
+struct Follow_Block {
+    Follow_Block *next;
+    char data[];
+};
+
+typedef struct {
+    char *path;
+    int fd;
+    // -1 without inotify
+    int inotify;
+    dev_t dev;
+    ino_t ino;
+    bool active;
+
+    // Bytes of the file read so far
+    size_t size;
+    // More than FOLLOW_READ_MAX was there at the last poll
+    bool pending;
+    // The file was moved or unlinked, the path is looked up on every poll
+    // until another file shows up there
+    bool moved;
+
+    // Everything read, the lines of the editor point into it
+    Follow_Block *blocks;
+} Follow;
+
+// Starts watching `file_path`, whose first `size` bytes were read already
+bool follow_start(Follow *follow, const char *file_path, size_t size);
+// Reads what was appended since the last call. On FOLLOW_APPENDED `data` and
+// `len` are the new bytes, they stay valid until follow_free.
+Follow_Event follow_poll(Follow *follow, char **data, size_t *len);
+// Stops watching, what was read stays valid
+void follow_stop(Follow *follow);
+void follow_free(Follow *follow);
+
+#endif // FOLLOW_H_
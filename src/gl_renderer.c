@@ -0,0 +1,217 @@
+#include "gl_renderer.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "common.h"
+
+#define GL_INSTANCES_INIT_CAPACITY 16384
+// x, y, glyph and color, 4 bytes each
+#define GL_INSTANCE_SIZE 16
+
+static const char *vertex_shader_source =
+    "#version 330 core\n"
+    "layout(location = 0) in float glyph_x;\n"
+    "layout(location = 1) in float glyph_y;\n"
+    "layout(location = 2) in uint glyph_index;\n"
+    "layout(location = 3) in vec4 glyph_color;\n"
+    "uniform vec2 resolution;\n"
+    "uniform vec2 glyph_size;\n"
+    "uniform vec2 atlas_cell;\n"
+    "uniform int atlas_cols;\n"
+    "out vec2 uv;\n"
+    "out vec4 color;\n"
+    "flat out int solid;\n"
+    "void main() {\n"
+    "    vec2 corner = vec2(float(gl_VertexID & 1), float((gl_VertexID >> 1) & 1));\n"
+    "    vec2 p = vec2(glyph_x, glyph_y) + corner * glyph_size;\n"
+    "    gl_Position = vec4(2.0 * p.x / resolution.x - 1.0, 1.0 - 2.0 * p.y / resolution.y, 0.0, 1.0);\n"
+    "    uint cols = uint(atlas_cols);\n"
+    "    vec2 cell = vec2(float(glyph_index % cols), float(glyph_index / cols));\n"
+    "    uv = (cell + corner) * atlas_cell;\n"
+    "    color = glyph_color;\n"
+    "    solid = glyph_index == 0xFFFFFFFFu ? 1 : 0;\n"
+    "}\n";
+
+// Glyphs are white, their coverage is in the alpha channel
+static const char *fragment_shader_source =
+    "#version 330 core\n"
+    "uniform sampler2D atlas;\n"
+    "in vec2 uv;\n"
+    "in vec4 color;\n"
+    "flat in int solid;\n"
+    "out vec4 frag_color;\n"
+    "void main() {\n"
+    "    if (solid == 1) {\n"
+    "        frag_color = color;\n"
+    "    } else {\n"
+    "        frag_color = vec4(color.rgb, color.a * texture(atlas, uv).a);\n"
+    "    }\n"
+    "}\n";
+
+static GLuint compile_shader(GLenum type, const char *source)
+{
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &source, NULL);
+    glCompileShader(shader);
+
+    GLint compiled = 0;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+    if (!compiled) {
+        GLchar message[1024];
+        glGetShaderInfoLog(shader, sizeof(message), NULL, message);
+        RAISE("GL", "could not compile %s shader: %s",
+              type == GL_VERTEX_SHADER ? "vertex" : "fragment", message);
+        exit(1);
+    }
+
+    return shader;
+}
+
+static GLuint link_program(GLuint vert, GLuint frag)
+{
+    GLuint program = glCreateProgram();
+    glAttachShader(program, vert);
+    glAttachShader(program, frag);
+    glLinkProgram(program);
+
+    GLint linked = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if (!linked) {
+        GLchar message[1024];
+        glGetProgramInfoLog(program, sizeof(message), NULL, message);
+        RAISE("GL", "could not link shader program: %s", message);
+        exit(1);
+    }
+
+    glDeleteShader(vert);
+    glDeleteShader(frag);
+    return program;
+}
+
+// The buffer holds the arrays of Glyphs one after the other, each one
+// `instances_cap` long, so every attribute starts at its own offset
+static void gl_renderer_reserve(Gl_Renderer *gl, size_t count)
+{
+    if (count <= gl->instances_cap) {
+        return;
+    }
+
+    size_t new_capacity = gl->instances_cap == 0 ? GL_INSTANCES_INIT_CAPACITY : gl->instances_cap;
+    while (new_capacity < count) {
+        new_capacity *= 2;
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, gl->instances);
+    glBufferData(GL_ARRAY_BUFFER, new_capacity * GL_INSTANCE_SIZE, NULL, GL_DYNAMIC_DRAW);
+    gl->instances_cap = new_capacity;
+
+    // The quad corners come from gl_VertexID, only the instances have attributes
+    const size_t section = new_capacity * 4;
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 1, GL_FLOAT, GL_FALSE, 0, (void *) 0);
+    glVertexAttribDivisor(0, 1);
+
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, 0, (void *) section);
+    glVertexAttribDivisor(1, 1);
+
+    glEnableVertexAttribArray(2);
+    glVertexAttribIPointer(2, 1, GL_UNSIGNED_INT, 0, (void *) (2 * section));
+    glVertexAttribDivisor(2, 1);
+
+    glEnableVertexAttribArray(3);
+    glVertexAttribPointer(3, 4, GL_UNSIGNED_BYTE, GL_TRUE, 0, (void *) (3 * section));
+    glVertexAttribDivisor(3, 1);
+}
+
+void gl_renderer_init(Gl_Renderer *gl, const void *pixels, int width, int height,
+                      int cols, int cell_w, int cell_h)
+{
+    gl->program = link_program(compile_shader(GL_VERTEX_SHADER, vertex_shader_source),
+                               compile_shader(GL_FRAGMENT_SHADER, fragment_shader_source));
+    gl->u_resolution = glGetUniformLocation(gl->program, "resolution");
+    gl->u_glyph_size = glGetUniformLocation(gl->program, "glyph_size");
+    gl->u_atlas_cell = glGetUniformLocation(gl->program, "atlas_cell");
+    gl->u_atlas_cols = glGetUniformLocation(gl->program, "atlas_cols");
+
+    gl->atlas_cols = cols;
+    gl->atlas_cell_w = (float) cell_w / (float) width;
+    gl->atlas_cell_h = (float) cell_h / (float) height;
+    gl->atlas_height = height;
+
+    glGenTextures(1, &gl->atlas);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, gl->atlas);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+
+    glGenVertexArrays(1, &gl->vao);
+    glBindVertexArray(gl->vao);
+    glGenBuffers(1, &gl->instances);
+    gl_renderer_reserve(gl, GL_INSTANCES_INIT_CAPACITY);
+
+    glUseProgram(gl->program);
+    glUniform1i(glGetUniformLocation(gl->program, "atlas"), 0);
+}
+
+void gl_renderer_update_atlas(Gl_Renderer *gl, const void *pixels, int width, int height,
+                              int row_begin, int row_end, bool resized)
+{
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, gl->atlas);
+    if (resized) {
+        // Cells keep their place, only the rows are more
+        gl->atlas_cell_h = gl->atlas_cell_h * (float) gl->atlas_height / (float) height;
+        gl->atlas_height = height;
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+    } else if (row_begin < row_end) {
+        const unsigned char *rows = (const unsigned char *) pixels + (size_t) row_begin * width * 4;
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, row_begin, width, row_end - row_begin,
+                        GL_RGBA, GL_UNSIGNED_BYTE, rows);
+    }
+}
+
+void gl_renderer_draw(Gl_Renderer *gl, const Glyphs *glyphs,
+                      int viewport_w, int viewport_h, float glyph_w, float glyph_h)
+{
+    glBindVertexArray(gl->vao);
+    gl_renderer_reserve(gl, glyphs->count);
+
+    glBindBuffer(GL_ARRAY_BUFFER, gl->instances);
+    if (glyphs->count > 0) {
+        // Orphan last frame's storage so the upload never waits on the GPU
+        glBufferData(GL_ARRAY_BUFFER, gl->instances_cap * GL_INSTANCE_SIZE, NULL, GL_DYNAMIC_DRAW);
+        const size_t section = gl->instances_cap * 4;
+        const size_t len = glyphs->count * 4;
+        glBufferSubData(GL_ARRAY_BUFFER, 0 * section, len, glyphs->xs);
+        glBufferSubData(GL_ARRAY_BUFFER, 1 * section, len, glyphs->ys);
+        glBufferSubData(GL_ARRAY_BUFFER, 2 * section, len, glyphs->glyphs);
+        glBufferSubData(GL_ARRAY_BUFFER, 3 * section, len, glyphs->colors);
+    }
+
+    glUseProgram(gl->program);
+    glUniform2f(gl->u_resolution, (float) viewport_w, (float) viewport_h);
+    glUniform2f(gl->u_glyph_size, glyph_w, glyph_h);
+    glUniform2f(gl->u_atlas_cell, gl->atlas_cell_w, gl->atlas_cell_h);
+    glUniform1i(gl->u_atlas_cols, gl->atlas_cols);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, gl->atlas);
+
+    if (glyphs->count > 0) {
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, (GLsizei) glyphs->count);
+    }
+}
+
+void gl_renderer_free(Gl_Renderer *gl)
+{
+    glDeleteBuffers(1, &gl->instances);
+    glDeleteVertexArrays(1, &gl->vao);
+    glDeleteTextures(1, &gl->atlas);
+    glDeleteProgram(gl->program);
+}
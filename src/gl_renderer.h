@@ -0,0 +1,45 @@
+#ifndef GL_RENDERER_H_
+#define GL_RENDERER_H_
+
+#include <stdbool.h>
+
+#include <GL/glew.h>
+
+#include "glyphs.h"
+
+// Glyph cell drawn as a filled rectangle of its color, used for the cursor
+#define GL_GLYPH_SOLID 0xFFFFFFFFu
+
+// Instanced text renderer: the font atlas is uploaded as it fills up, every
+// glyph is one instance in a vertex buffer that lives as long as the renderer
+// and the whole screen is a single glDrawArraysInstanced call.
+typedef struct {
+    GLuint program;
+    GLuint vao;
+    GLuint instances;
+    GLuint atlas;
+    size_t instances_cap;
+
+    GLint u_resolution;
+    GLint u_glyph_size;
+    GLint u_atlas_cell;
+    GLint u_atlas_cols;
+
+    int atlas_cols;
+    float atlas_cell_w;
+    float atlas_cell_h;
+    int atlas_height;
+} Gl_Renderer;
+
+// `pixels` is RGBA, glyphs are laid out left to right in cells of cell_w x cell_h
+void gl_renderer_init(Gl_Renderer *gl, const void *pixels, int width, int height,
+                      int cols, int cell_w, int cell_h);
+// Uploads rows [row_begin, row_end) of the atlas, or all of it when it grew to
+// `height` pixels
+void gl_renderer_update_atlas(Gl_Renderer *gl, const void *pixels, int width, int height,
+                              int row_begin, int row_end, bool resized);
+void gl_renderer_draw(Gl_Renderer *gl, const Glyphs *glyphs,
+                      int viewport_w, int viewport_h, float glyph_w, float glyph_h);
+void gl_renderer_free(Gl_Renderer *gl);
+
+#endif // GL_RENDERER_H_
@@ -0,0 +1,38 @@
+#include "glyphs.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define GLYPHS_INIT_CAPACITY 4096
+
+static void *glyphs_grow(void *items, size_t cap, size_t size)
+{
+    items = realloc(items, cap * size);
+    if (items == NULL) {
+        fprintf(stderr, "ERROR: could not allocate glyphs\n");
+        exit(1);
+    }
+    return items;
+}
+
+void glyphs_push(Glyphs *glyphs, float x, float y, uint32_t glyph, uint32_t color)
+{
+    if (glyphs->count == glyphs->cap) {
+        glyphs->cap = glyphs->cap == 0 ? GLYPHS_INIT_CAPACITY : glyphs->cap * 2;
+        glyphs->xs = glyphs_grow(glyphs->xs, glyphs->cap, sizeof(glyphs->xs[0]));
+        glyphs->ys = glyphs_grow(glyphs->ys, glyphs->cap, sizeof(glyphs->ys[0]));
+        glyphs->glyphs = glyphs_grow(glyphs->glyphs, glyphs->cap, sizeof(glyphs->glyphs[0]));
+        glyphs->colors = glyphs_grow(glyphs->colors, glyphs->cap, sizeof(glyphs->colors[0]));
+    }
+
+    glyphs->xs[glyphs->count] = x;
+    glyphs->ys[glyphs->count] = y;
+    glyphs->glyphs[glyphs->count] = glyph;
+    glyphs->colors[glyphs->count] = color;
+    glyphs->count += 1;
+}
+
+void glyphs_clear(Glyphs *glyphs)
+{
+    glyphs->count = 0;
+}
@@ -0,0 +1,23 @@
+#ifndef GLYPHS_H_
+#define GLYPHS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Glyphs laid out on screen: top-left corner in window pixels, cell of the
+// font atlas and color as 0xAABBGGRR. Both renderers draw from a list of
+// these. Every field is its own array, so positions can be transformed in
+// bulk (see vec2_transform_soa) and uploaded as they are.
+typedef struct {
+    float *xs;
+    float *ys;
+    uint32_t *glyphs;
+    uint32_t *colors;
+    size_t count;
+    size_t cap;
+} Glyphs;
+
+void glyphs_push(Glyphs *glyphs, float x, float y, uint32_t glyph, uint32_t color);
+void glyphs_clear(Glyphs *glyphs);
+
+#endif // GLYPHS_H_
@@ -1,6 +1,8 @@
+#define _DEFAULT_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
 #include <errno.h>
 
 #include <SDL.h>
@@ -12,8 +14,18 @@
 #include <GLFW/glfw3.h>
 
 #include "la.h"
+#include "atlas.h"
 #include "common.h"
 #include "editor.h"
+#include "save.h"
+#include "search.h"
+#include "glyphs.h"
+#include "highlight.h"
+#include "jobs.h"
+#include "gl_renderer.h"
+#include "prof.h"
+#include "replay.h"
+#include "utf8.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
@@ -32,6 +44,19 @@ size_t FONT_SCALE = 5.0f;
 
 #define COLOR_WHITE (Uint32)0xffffffff
 #define COLOR_CREME (Uint32)0xf2ebebff
+// Glyph colors are 0xAABBGGRR
+#define COLOR_MATCH (Uint32)0xff00ffff
+#define COLOR_SELECTION (Uint32)0xffffa050
+
+static const Uint32 token_colors[COUNT_HIGHLIGHT_TOKENS] = {
+    [HIGHLIGHT_PLAIN]   = 0xFFFFFFFF,
+    [HIGHLIGHT_KEYWORD] = 0xFF5FC8F0,
+    [HIGHLIGHT_TYPE]    = 0xFFB0D070,
+    [HIGHLIGHT_PREPROC] = 0xFFD080C0,
+    [HIGHLIGHT_STRING]  = 0xFF70C890,
+    [HIGHLIGHT_NUMBER]  = 0xFFE0A070,
+    [HIGHLIGHT_COMMENT] = 0xFF808080,
+};
 
 // #define THIN_CURSOR
 #ifdef THIN_CURSOR
@@ -47,14 +72,28 @@ size_t FONT_SCALE = 5.0f;
 
 #define CURSOR_COLOR UNHEX(0xf2ebebff)
 
-#define ASCII_DISPLAY_LOW  32
-#define ASCII_DISPLAY_HIGH 126
+// Bitmap font, only used when no TrueType font could be opened
+#define FONT_CHARMAP_PATH "font/charmap-oldschool_white.png"
 
+// Every glyph drawn goes through the atlas, both renderers upload its pixels
+Atlas atlas;
+
+// The atlas as an SDL texture, brought up to date before every draw
 typedef struct {
-    SDL_Texture *spritesheet;
-    SDL_Rect glyph_table[ASCII_DISPLAY_HIGH - ASCII_DISPLAY_LOW + 1];
+    SDL_Texture *texture;
+    int width;
+    int height;
 } Font;
 
+// Quads of the glyphs of a frame, submitted with one SDL_RenderGeometry
+typedef struct {
+    SDL_Vertex *verts;
+    int *indices;
+    size_t cap;
+} Glyph_Batch;
+
+#define GLYPH_BATCH_INIT_CAPACITY 4096
+
 
 #define FPS 30
 #define DELTA_TIME (1.0f / FPS)
@@ -90,45 +129,69 @@ SDL_Surface *surface_from_file(const char *file_path)
 }
 
 
-Font font_load_from_file(SDL_Renderer *renderer, const char *file_path)
+// Cells are rasterized at the size they are drawn at, glyphs are never scaled
+void atlas_load(void)
 {
-    Font font = {0};
+    atlas_init(&atlas, FONT_CHAR_WIDTH * FONT_SCALE, FONT_CHAR_HEIGHT * FONT_SCALE, getenv("GRIVE_FONT"),
+               surface_from_file(FONT_CHARMAP_PATH), FONT_COLS, FONT_CHAR_WIDTH, FONT_CHAR_HEIGHT);
+}
 
-    SDL_Surface *font_surface = surface_from_file(file_path);
-    scc(SDL_SetColorKey(font_surface, SDL_TRUE, 0xFF000000));
-    font.spritesheet = scp(SDL_CreateTextureFromSurface(renderer, font_surface));
-    SDL_FreeSurface(font_surface);
-
-    for (size_t ascii = ASCII_DISPLAY_LOW; ascii <= ASCII_DISPLAY_HIGH; ++ascii) {
-        const size_t index = ascii - ASCII_DISPLAY_LOW;
-        const size_t col = index % FONT_COLS;
-        const size_t row = index / FONT_COLS;
-        font.glyph_table[index] = (SDL_Rect) {
-            .x = (int) col * FONT_CHAR_WIDTH,
-            .y = (int) row * FONT_CHAR_HEIGHT,
-            .w = FONT_CHAR_WIDTH,
-            .h = FONT_CHAR_HEIGHT,
-        };
-    }
+static uint32_t glyph_index(uint32_t codepoint)
+{
+    return atlas_glyph(&atlas, codepoint);
+}
 
-    return font;
+// Code point under a cursor at row:col, 0 if it's past the end of the line
+static uint32_t cursor_codepoint(const Editor *editor, size_t row, size_t col)
+{
+    const char *c = editor_char_at(editor, row, col);
+    if (c == NULL) {
+        return 0;
+    }
+    const Line *line = lines_at(&editor->lines, row);
+    uint32_t codepoint = 0;
+    utf8_decode(c, line->len - col, &codepoint);
+    return codepoint;
 }
 
-void render_char(SDL_Renderer *renderer, const Font *font, char c, Vec2 pos, float scale)
+// Uploads the atlas rows rasterized since the last call, the texture is made
+// again when the atlas grew
+void font_update(SDL_Renderer *renderer, Font *font)
 {
-    const SDL_Rect dst = {
-        .x = (int) floorf(pos.x),
-        .y = (int) floorf(pos.y),
-        .w = (int) floorf(FONT_CHAR_WIDTH * scale),
-        .h = (int) floorf(FONT_CHAR_HEIGHT * scale),
-    };
+    int begin, end;
+    bool resized;
+    if (!atlas_take_dirty(&atlas, &begin, &end, &resized)) {
+        return;
+    }
+
+    if (resized || font->texture == NULL) {
+        if (font->texture != NULL) {
+            SDL_DestroyTexture(font->texture);
+        }
+        font->texture = scp(SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_STATIC,
+                                              atlas.width, atlas.height));
+        scc(SDL_SetTextureBlendMode(font->texture, SDL_BLENDMODE_BLEND));
+        font->width = atlas.width;
+        font->height = atlas.height;
+        begin = 0;
+        end = atlas.height;
+    }
 
-    size_t index = '?' - ASCII_DISPLAY_LOW;
-    if (ASCII_DISPLAY_LOW <= c && c <= ASCII_DISPLAY_HIGH) {
-        index = c - ASCII_DISPLAY_LOW;
+    if (begin < end) {
+        const SDL_Rect rows = {.x = 0, .y = begin, .w = atlas.width, .h = end - begin};
+        scc(SDL_UpdateTexture(font->texture, &rows, &atlas.pixels[(size_t) begin * atlas.width * 4],
+                              atlas.width * 4));
     }
+}
 
-    scc(SDL_RenderCopy(renderer, font->spritesheet, &font->glyph_table[index], &dst));
+static SDL_Rect font_cell_rect(uint32_t cell)
+{
+    return (SDL_Rect) {
+        .x = (int) (cell % ATLAS_COLS) * atlas.cell_w,
+        .y = (int) (cell / ATLAS_COLS) * atlas.cell_h,
+        .w = atlas.cell_w,
+        .h = atlas.cell_h,
+    };
 }
 
 void set_texture_color(SDL_Texture *texture, Uint32 color)
@@ -142,13 +205,103 @@ void set_texture_color(SDL_Texture *texture, Uint32 color)
     scc(SDL_SetTextureAlphaMod(texture, (color >> (8 * 3)) & 0xff));
 }
 
-void render_text_sized(SDL_Renderer *renderer, Font *font, const char *text, size_t text_size, Vec2 pos, Uint32 color, float scale)
+void render_char(SDL_Renderer *renderer, Font *font, uint32_t codepoint, Vec2 pos, float scale, Uint32 color)
+{
+    const SDL_Rect dst = {
+        .x = (int) floorf(pos.x),
+        .y = (int) floorf(pos.y),
+        .w = (int) floorf(FONT_CHAR_WIDTH * scale),
+        .h = (int) floorf(FONT_CHAR_HEIGHT * scale),
+    };
+
+    const SDL_Rect src = font_cell_rect(glyph_index(codepoint));
+    font_update(renderer, font);
+    set_texture_color(font->texture, color);
+    scc(SDL_RenderCopy(renderer, font->texture, &src, &dst));
+    prof_count(PROF_DRAW_CALLS, 1);
+    prof_count(PROF_GLYPHS, 1);
+}
+
+static void glyph_batch_reserve(Glyph_Batch *batch, size_t n)
+{
+    if (n <= batch->cap) {
+        return;
+    }
+
+    size_t new_capacity = batch->cap == 0 ? GLYPH_BATCH_INIT_CAPACITY : batch->cap;
+    while (new_capacity < n) {
+        new_capacity *= 2;
+    }
+
+    batch->verts = scp(realloc(batch->verts, new_capacity * 4 * sizeof(batch->verts[0])));
+    batch->indices = scp(realloc(batch->indices, new_capacity * 6 * sizeof(batch->indices[0])));
+
+    // Every quad is two triangles over its own four vertices, so the index
+    // buffer never changes between frames
+    for (size_t i = batch->cap; i < new_capacity; ++i) {
+        const int v = (int) i * 4;
+        int *quad = &batch->indices[i * 6];
+        quad[0] = v + 0; quad[1] = v + 1; quad[2] = v + 2;
+        quad[3] = v + 2; quad[4] = v + 1; quad[5] = v + 3;
+    }
+    batch->cap = new_capacity;
+}
+
+// Draws the glyphs with the font atlas and empties the list
+void glyph_batch_flush(SDL_Renderer *renderer, Glyph_Batch *batch, Font *font, Glyphs *glyphs, float scale)
 {
-    set_texture_color(font->spritesheet, color);
+    if (glyphs->count == 0) {
+        return;
+    }
+
+    // The glyphs laid out since the last flush may have rasterized new cells
+    font_update(renderer, font);
+    glyph_batch_reserve(batch, glyphs->count);
+
+    const float w = floorf(FONT_CHAR_WIDTH * scale);
+    const float h = floorf(FONT_CHAR_HEIGHT * scale);
+    for (size_t i = 0; i < glyphs->count; ++i) {
+        const uint32_t color = glyphs->colors[i];
+        const SDL_Rect src = font_cell_rect(glyphs->glyphs[i]);
+        const float u0 = (float) src.x / font->width;
+        const float v0 = (float) src.y / font->height;
+        const float u1 = (float) (src.x + src.w) / font->width;
+        const float v1 = (float) (src.y + src.h) / font->height;
+
+        const float x0 = floorf(glyphs->xs[i]);
+        const float y0 = floorf(glyphs->ys[i]);
+
+        const SDL_Color tint = {
+            .r = (color >> (8 * 0)) & 0xff,
+            .g = (color >> (8 * 1)) & 0xff,
+            .b = (color >> (8 * 2)) & 0xff,
+            .a = (color >> (8 * 3)) & 0xff,
+        };
+
+        SDL_Vertex *quad = &batch->verts[i * 4];
+        quad[0] = (SDL_Vertex) { .position = {x0,     y0    }, .color = tint, .tex_coord = {u0, v0} };
+        quad[1] = (SDL_Vertex) { .position = {x0 + w, y0    }, .color = tint, .tex_coord = {u1, v0} };
+        quad[2] = (SDL_Vertex) { .position = {x0,     y0 + h}, .color = tint, .tex_coord = {u0, v1} };
+        quad[3] = (SDL_Vertex) { .position = {x0 + w, y0 + h}, .color = tint, .tex_coord = {u1, v1} };
+    }
+
+    set_texture_color(font->texture, 0xFFFFFFFF);
+    scc(SDL_RenderGeometry(renderer, font->texture,
+                           batch->verts, (int) glyphs->count * 4,
+                           batch->indices, (int) glyphs->count * 6));
+    prof_count(PROF_DRAW_CALLS, 1);
+    prof_count(PROF_GLYPHS, glyphs->count);
+    glyphs_clear(glyphs);
+}
 
+// One cell per code point of the UTF-8 `text`
+void render_text_sized(Glyphs *glyphs, const char *text, size_t text_size, Vec2 pos, Uint32 color, float scale)
+{
     Vec2 p = pos;
-    for (size_t i = 0; i < text_size; ++i) {
-        render_char(renderer, font, text[i], p, scale);
+    for (size_t i = 0; i < text_size;) {
+        uint32_t codepoint = 0;
+        i += utf8_decode(text + i, text_size - i, &codepoint);
+        glyphs_push(glyphs, p.x, p.y, glyph_index(codepoint), color);
         p.x += FONT_CHAR_WIDTH * scale;
     }
 }
@@ -160,10 +313,9 @@ void render_text_sized(SDL_Renderer *renderer, Font *font, const char *text, siz
 typedef struct {
     Vec2 pos;
     Vec2 vel;
+    Vec2 target;
 } Camera;
 
-Camera camera = {0};
-
 
 Vec2 window_size(SDL_Window *window) {
     int w, h;
@@ -171,272 +323,1644 @@ Vec2 window_size(SDL_Window *window) {
     return vec2s((float)w, (float)h);
 }
 
-Vec2 camera_project_point(SDL_Window *window, Vec2 point) {
-    // Add half of window dimension to properly project on screen 
-    return vec2_add(vec2_sub(point, camera.pos), vec2_mul(window_size(window), vec2c(0.75)));
-}
+// Size of the window for the frame being laid out, queried once by frame_begin
+Vec2 frame_window = {0};
+// Document cells (column, visual row) to window pixels through the camera of
+// the frame, set by frame_project once the camera moved
+Vec2_Transform frame_cells = {0};
 
-void render_cursor(SDL_Renderer *renderer, const Font *font, Editor *editor, Camera *camera, SDL_Window *window)
+void frame_begin(SDL_Window *window)
 {
-    Vec2 pos =
-        vec2_sub(vec2s((float) editor->cursor_col * FONT_CHAR_WIDTH * FONT_SCALE,
-              (float) editor->cursor_row * FONT_CHAR_HEIGHT * FONT_SCALE), camera->pos);
-    pos = camera_project_point(window, pos);
+    frame_window = window_size(window);
+}
 
-    const SDL_Rect rect = {
-        .x = (int) floorf(pos.x),
-        .y = (int) floorf(pos.y),
-        .w = FONT_CHAR_WIDTH * FONT_SCALE,
-        .h = FONT_CHAR_HEIGHT * FONT_SCALE,
+void frame_project(const Camera *camera)
+{
+    // Add half of window dimension to properly project on screen
+    frame_cells = (Vec2_Transform) {
+        .scale = vec2s(FONT_CHAR_WIDTH * FONT_SCALE, FONT_CHAR_HEIGHT * FONT_SCALE),
+        .offset = vec2_sub(vec2_mul(frame_window, vec2c(0.5)), camera->pos),
     };
+}
 
-    scc(SDL_SetRenderDrawColor(renderer, UNHEX(0xFFFFFFFF)));
-    scc(SDL_RenderFillRect(renderer, &rect));
+// Visual rows and columns of the document that intersect the window, and the
+// lines shown on those rows. Without soft wrap rows and lines are the same.
+typedef struct {
+    size_t row_begin, row_end;
+    size_t col_begin, col_end;
+    size_t line_begin, line_end;
+} Viewport;
 
-    const char *c = editor_char_under_cursor(editor);
-    if (c) {
-        set_texture_color(font->spritesheet, 0xFF000000);
-        render_char(renderer, font, *c, pos, FONT_SCALE);
+Viewport camera_viewport(const Camera *camera, const Editor *editor)
+{
+    const size_t rows = editor_visual_rows(editor);
+    const Vec2 char_size = vec2s(FONT_CHAR_WIDTH * FONT_SCALE, FONT_CHAR_HEIGHT * FONT_SCALE);
+    const Vec2 top_left = vec2_sub(camera->pos, vec2_mul(frame_window, vec2c(0.5)));
+    const Vec2 first = vec2_div(top_left, char_size);
+    const Vec2 last = vec2_div(vec2_add(top_left, frame_window), char_size);
+
+    Viewport viewport = {0};
+    viewport.row_begin = first.y > 0.0f ? (size_t) floorf(first.y) : 0;
+    viewport.row_end = last.y > 0.0f ? (size_t) ceilf(last.y) + 1 : 0;
+    viewport.col_begin = first.x > 0.0f ? (size_t) floorf(first.x) : 0;
+    viewport.col_end = last.x > 0.0f ? (size_t) ceilf(last.x) + 1 : 0;
+
+    if (viewport.row_end > rows) {
+        viewport.row_end = rows;
+    }
+    if (viewport.row_begin > viewport.row_end) {
+        viewport.row_begin = viewport.row_end;
     }
-}
 
-void usage(FILE *stream)
-{
-    fprintf(stream, "Usage: ./grive [FILE-PATH]\n");
+    size_t segment = 0;
+    viewport.line_begin = lines_at_visual(&editor->lines, viewport.row_begin, &segment);
+    viewport.line_end = viewport.line_begin;
+    if (viewport.row_end > viewport.row_begin) {
+        viewport.line_end = lines_at_visual(&editor->lines, viewport.row_end - 1, &segment) + 1;
+    }
+
+    return viewport;
 }
 
-// Main editor struct 
-Editor editor = {0};
+// Colors of the row being laid out, reused for every row
+Highlight_Spans spans = {0};
 
-// Courtesy: https://github.com/tsoding/opengl-template
-void MessageCallback(GLenum source,
-    GLenum type,
-    GLuint id,
-    GLenum severity,
-    GLsizei length,
-    const GLchar* message,
-    const void* userParam)
+// Lays out the lines [row_begin, row_end) that are inside of the viewport, one
+// cell per code point, in the colors of their tokens and highlighting the
+// selection and the matches of `search` unless it's NULL. Soft wrapped lines go on in the first
+// column of the visual rows below. Glyphs are laid out in cells and moved
+// into the window all at once through frame_cells.
+void render_rows(Glyphs *glyphs, Editor *editor, const Search *search,
+                 const Viewport *viewport, size_t row_begin, size_t row_end)
 {
-    (void) source;
-    (void) id;
-    (void) length;
-    (void) userParam;
-    fprintf(stderr, "GL CALLBACK: %s type = 0x%x, severity = 0x%x, message = %s\n",
-    (type == GL_DEBUG_TYPE_ERROR ? "** GL ERROR **" : ""),
-    type, severity, message);
-}
+    PROF_ZONE("layout");
+    if (row_begin < viewport->line_begin) {
+        row_begin = viewport->line_begin;
+    }
+    if (row_end > viewport->line_end) {
+        row_end = viewport->line_end;
+    }
+    if (row_begin >= row_end) {
+        return;
+    }
 
-// #define OPENGL_RENDERER
-#if defined(OPENGL_RENDERER)
-// OPEN GL RENDERER
-int main(int argc, char *argv[]) {
-    (void) argc;
-    (void) argv;
+    // Without wrapping every line is a single segment as wide as it needs
+    const size_t width = editor->wrap_width > 0 ? editor->wrap_width : (size_t) -1;
+    const size_t visible = viewport->col_end < width ? viewport->col_end : width;
+    const size_t first_glyph = glyphs->count;
+    size_t visual = lines_visual_row(&editor->lines, row_begin);
+    Cursor selection_begin = {0}, selection_end = {0};
+    const bool selected = editor_selection(editor, &selection_begin, &selection_end);
+    for (size_t row = row_begin; row < row_end; ++row) {
+        Line *line = lines_at(&editor->lines, row);
+        const size_t first_visual = visual;
+        visual += 1 + line->wraps;
+
+        // Segments of the line on visual rows of the viewport
+        size_t segment = first_visual < viewport->row_begin ? viewport->row_begin - first_visual : 0;
+        size_t segment_end = viewport->row_end - first_visual;
+        if (segment_end > (size_t) line->wraps + 1) {
+            segment_end = (size_t) line->wraps + 1;
+        }
+        if (segment >= segment_end) {
+            continue;
+        }
 
-    scc(SDL_Init(SDL_INIT_VIDEO));
+        // Only the visible part is colorized, a code point is at most 4 bytes
+        const size_t last_col = (segment_end - 1) * width + visible;
+        const size_t stop = line->non_ascii ? last_col * 4 : last_col;
+        if (!highlight_row(&editor->highlight, &editor->lines, row, stop, &spans)) {
+            spans.count = 0;
+        }
+        size_t span = 0;
 
-    Uint32 windowFlags = SDL_WINDOW_ALLOW_HIGHDPI | SDL_WINDOW_RESIZABLE | SDL_WINDOW_OPENGL;
+        // Bytes [selected_from, selected_to) of the line are selected
+        size_t selected_from = 0, selected_to = 0;
+        if (selected && row >= selection_begin.row && row <= selection_end.row) {
+            selected_from = row == selection_begin.row ? selection_begin.col : 0;
+            selected_to = row == selection_end.row ? selection_end.col : line->len;
+        }
 
-    // Window 
-    SDL_Window *window = scp(SDL_CreateWindow("Grive", 
-        SDL_WINDOWPOS_CENTERED, 
-        SDL_WINDOWPOS_CENTERED, 
-        WWIDTH, 
-        WHEIGHT, 
-        windowFlags
-    ));
+        // Matches are byte ranges sorted by where they start
+        size_t match = search != NULL ? search_lower_bound(search, row, 0) : 0;
+        const size_t matches = search != NULL ? search_count(search) : 0;
 
-    {   // Set attributes and gl profile 
-        SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
-        SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
-        SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
-        int debugFlag = SDL_GL_CONTEXT_DEBUG_FLAG;
-        SDL_GL_GetAttribute(SDL_GL_CONTEXT_FLAGS, &debugFlag);
+        for (; segment < segment_end; ++segment) {
+            // Pure ASCII lines start at the column, others look it up
+            size_t col = segment * width + viewport->col_begin;
+            const size_t col_end = segment * width + visible;
+            size_t i = columns_offset_at(&editor->columns, row, line, col);
 
-        int major, minor;
-        SDL_GL_GetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, &major);
-        SDL_GL_GetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, &minor);
-        fprintf(stdout, "[INFO] GL Version: %d.%d\n", major, minor);    
+            const float y = (float) (first_visual + segment);
+            float x = (float) viewport->col_begin;
+
+            while (i < line->len && col < col_end) {
+                uint32_t codepoint = 0;
+                const size_t n = utf8_decode(line->chars + i, line->len - i, &codepoint);
+
+                while (span + 1 < spans.count && spans.items[span + 1].begin <= i) {
+                    span += 1;
+                }
+                Uint32 color = spans.count > 0 ? token_colors[spans.items[span].token] : 0xFFFFFFFF;
+                for (; match < matches; ++match) {
+                    const Search_Match *m = search_match_at(search, match);
+                    if (m->row != row || m->col > i) {
+                        break;
+                    }
+                    if (i < m->col + m->len) {
+                        color = COLOR_MATCH;
+                        break;
+                    }
+                }
+                if (i >= selected_from && i < selected_to) {
+                    color = COLOR_SELECTION;
+                }
+
+                glyphs_push(glyphs, x, y, glyph_index(codepoint), color);
+                x += 1.0f;
+                i += n;
+                col += 1;
+            }
+        }
     }
 
-    scp(SDL_GL_CreateContext(window));
+    vec2_transform_soa(frame_cells, glyphs->xs + first_glyph, glyphs->ys + first_glyph,
+                       glyphs->count - first_glyph);
+}
 
-    // Get version info
-    const GLubyte* renderer = glGetString(GL_RENDERER); // get renderer string
-    const GLubyte* version = glGetString(GL_VERSION); // version as a string
+// Top left corner of the cell of a cursor at row:col in the window
+Vec2 cursor_position(Editor *editor, size_t row, size_t col)
+{
+    size_t visual_row, visual_col;
+    editor_visual_at(editor, row, col, &visual_row, &visual_col);
+    return vec2_transform(frame_cells, vec2s((float) visual_col, (float) visual_row));
+}
 
-    printf("[INFO] Renderer: %s\n", renderer);
-    printf("[INFO] OpenGL Version Supported %s\n", version);
+void render_cursor(SDL_Renderer *renderer, Font *font, Editor *editor, size_t row, size_t col)
+{
+    const Vec2 pos = cursor_position(editor, row, col);
+
+    const SDL_Rect rect = {
+        .x = (int) floorf(pos.x),
+        .y = (int) floorf(pos.y),
+        .w = FONT_CHAR_WIDTH * FONT_SCALE,
+        .h = FONT_CHAR_HEIGHT * FONT_SCALE,
+    };
+
+    scc(SDL_SetRenderDrawColor(renderer, UNHEX(0xFFFFFFFF)));
+    scc(SDL_RenderFillRect(renderer, &rect));
+    prof_count(PROF_DRAW_CALLS, 1);
 
-    if (glewInit() != GLEW_OK) {
-    RAISE("GL", "Could not initialize GLEW!"); exit(1);
+    const uint32_t codepoint = cursor_codepoint(editor, row, col);
+    if (codepoint != 0) {
+        render_char(renderer, font, codepoint, pos, FONT_SCALE, 0xFF000000);
     }
+}
 
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+// The cursor and the extra cursors on the lines of the viewport
+void render_cursors(SDL_Renderer *renderer, Font *font, Editor *editor, const Viewport *viewport)
+{
+    for (size_t i = 0; i < editor->cursors.count; ++i) {
+        const Cursor *cursor = &editor->cursors.items[i];
+        if (cursor->row >= viewport->line_end) {
+            break;
+        }
+        if (cursor->row >= viewport->line_begin) {
+            render_cursor(renderer, font, editor, cursor->row, cursor->col);
+        }
+    }
+    render_cursor(renderer, font, editor, editor->cursor_row, editor->cursor_col);
+}
 
-    if (GLEW_ARB_debug_output) {
-        glEnable(GL_DEBUG_OUTPUT);
-        glDebugMessageCallback(&MessageCallback, 0);
-    } else {
-        fprintf(stderr, "[WARNING] GL extension GLEW_ARB_debug_output is not available.\n");
-    }   
+void usage(FILE *stream)
+{
+    fprintf(stream, "Usage: ./grive [-f] [--record FILE | --replay FILE] [FILE-PATH...]\n");
+    fprintf(stream, "    -f               follow the files, like `tail -f`\n");
+    fprintf(stream, "    --record FILE    record the input of the session to FILE\n");
+    fprintf(stream, "    --replay FILE    replay a recorded session and print its latencies\n");
+}
 
-    return 0;
+// An open file. Everything else (window, renderer, font) is shared by all of
+// them, so an extra buffer only costs its text.
+typedef struct {
+    Editor editor;
+    Camera camera;
+    char *file_path;    // NULL for a scratch buffer
+
+    Search search;
+    bool searching;     // The search prompt is open
+    bool placing;       // Alt+Return was pressed, the cursors go on the matches once all are found
+
+    // Follow mode keeps the cursor on the last line, until it's moved off it
+    bool pinned;
+    size_t pinned_row;
+
+    // Snapshot of the text being written next to the swap file, so the edits
+    // journaled before it can be dropped. See buffers_swap_update.
+    Save checkpoint;
+    Swap_Mark checkpoint_mark;
+    bool checkpoint_failed;
+} Buffer;
+
+// Buffers are allocated one by one so switching only changes `current`
+typedef struct {
+    Buffer **items;
+    size_t count;
+    size_t cap;
+    size_t current;
+} Buffers;
+
+// Workers for everything that may take longer than a frame
+Jobs jobs = {0};
+
+Buffers buffers = {0};
+// The buffer being shown and edited, always buffers.items[buffers.current]
+Buffer *buffer = NULL;
+
+// Starts journaling the edits of a buffer, after bringing back the ones a
+// session that didn't quit left in its swap file
+void buffer_swap_open(Buffer *opened)
+{
+    size_t recovered = 0;
+    switch (editor_swap_open(&opened->editor, opened->file_path, &recovered)) {
+    case SWAP_FOUND:
+        fprintf(stdout, "[LOG] - Recovered %zu edits of `%s` from its swap file\n", recovered, opened->file_path);
+        break;
+    case SWAP_CHANGED:
+        fprintf(stderr, "[WARNING] `%s` changed since its swap file was written, the edits in it were kept in `%s`\n",
+                opened->file_path, opened->editor.swap->stale_path);
+        break;
+    case SWAP_BUSY:
+        fprintf(stderr, "[WARNING] `%s` is being edited by another process, edits are not journaled\n",
+                opened->file_path);
+        break;
+    case SWAP_FAILED:
+        fprintf(stderr, "[WARNING] Could not write the swap file of `%s`, edits are not journaled\n",
+                opened->file_path);
+        break;
+    case SWAP_MISSING:
+        break;
+    }
 }
 
-#else 
-// STANDARD SDL RENDERER 
-int main(int argc, char *argv[])
+// Opens a new buffer for `file_path`, starting empty if it doesn't exist yet.
+// Big files show up right away and finish loading in the background.
+Buffer *buffers_open(const char *file_path)
 {
-    const char *file_path = NULL;
+    if (buffers.count == buffers.cap) {
+        buffers.cap = buffers.cap == 0 ? 8 : buffers.cap * 2;
+        buffers.items = realloc(buffers.items, buffers.cap * sizeof(buffers.items[0]));
+        if (buffers.items == NULL) {
+            fprintf(stderr, "ERROR: could not allocate buffers\n");
+            exit(1);
+        }
+    }
 
-    if (argc > 1) {
-        file_path = argv[1];
+    Buffer *opened = calloc(1, sizeof(*opened));
+    if (opened == NULL) {
+        fprintf(stderr, "ERROR: could not allocate buffers\n");
+        exit(1);
     }
 
     if (file_path) {
+        opened->file_path = strdup(file_path);
         FILE *f = fopen(file_path, "r");
         if (f != NULL) {
-            editor_load_from_file(&editor, f);
-        } 
-        fclose(f);
+            editor_open_file(&opened->editor, f, &jobs);
+            fclose(f);
+        }
+        buffer_swap_open(opened);
+        opened->editor.highlight.language = highlight_language_for_path(file_path);
     }
 
-    scc(SDL_Init(SDL_INIT_VIDEO));
-
-    Uint32 windowFlags = SDL_WINDOW_ALLOW_HIGHDPI | SDL_WINDOW_METAL | SDL_WINDOW_RESIZABLE;
-
-    // Window 
-    SDL_Window *window = scp(SDL_CreateWindow("Grive", 
-        SDL_WINDOWPOS_CENTERED, 
-        SDL_WINDOWPOS_CENTERED, 
-        WWIDTH, 
-        WHEIGHT, 
-        windowFlags
-    ));
-
-    // Renderer
-    SDL_Renderer *renderer =
-        scp(SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED));
+    buffers.items[buffers.count++] = opened;
+    return opened;
+}
 
-    // Load font
-    Font font = font_load_from_file(renderer, "font/charmap-oldschool_white.png");
+void buffers_switch(size_t index)
+{
+    buffers.current = index % buffers.count;
+    buffer = buffers.items[buffers.current];
+}
 
-    const Uint32 start_time = SDL_GetTicks();
+// Only called on a clean exit, which takes the swap files along
+void buffers_free(void)
+{
+    for (size_t i = 0; i < buffers.count; ++i) {
+        save_free(&buffers.items[i]->checkpoint);
+        editor_swap_close(&buffers.items[i]->editor, true);
+        editor_free(&buffers.items[i]->editor);
+        search_free(&buffers.items[i]->search);
+        free(buffers.items[i]->file_path);
+        free(buffers.items[i]);
+    }
+    free(buffers.items);
+    memset(&buffers, 0, sizeof(buffers));
+    buffer = NULL;
+}
 
-    // Main Loop 
-    bool quit = false;
-    while (!quit) {
-        SDL_Event event = {0};
-        while (SDL_PollEvent(&event)) {
-            switch (event.type) {
-            case SDL_QUIT: {
-                quit = true;
-            }
-            break;
+// Starts or stops following the file of a buffer. Lines written to it show
+// up at the end, the cursor goes along if it's on the last line.
+void buffer_follow(Buffer *followed, bool follow)
+{
+    if (!follow) {
+        editor_follow_stop(&followed->editor);
+        return;
+    }
+    if (followed->file_path == NULL || !editor_follow_start(&followed->editor, followed->file_path)) {
+        const Swap *swap = followed->editor.swap;
+        fprintf(stderr, "[WARNING] Could not follow %s%s\n", followed->file_path ? followed->file_path : "*scratch*",
+                swap != NULL && swap_has_edits(swap) ? ", it has unsaved edits" : "");
+        return;
+    }
+    followed->pinned = true;
+    followed->pinned_row = followed->editor.cursor_row;
+}
 
-            case SDL_KEYDOWN: {
-                switch (event.key.keysym.sym) {
-                case SDLK_BACKSPACE: {
-                    editor_backspace(&editor);
-                    editor_remove_line(&editor);
-                }
-                break;
+// Input of the session being recorded, or the recording being replayed instead
+// of what comes in. See replay.h.
+Replay_Recorder recorder = {0};
+Replay replay = {0};
+bool replaying = false;
 
-                case SDLK_F2: {
-                    if (file_path) {
-                        editor_save_to_file(&editor, file_path);
-                    }
-                }
-                break;
+void input_open(const char *option, const char *file_path)
+{
+    if (strcmp(option, "--record") == 0) {
+        if (!replay_record_start(&recorder, file_path)) {
+            fprintf(stderr, "[WARNING] Could not record to %s: %s\n", file_path, strerror(errno));
+        }
+        return;
+    }
 
-                case SDLK_RETURN: {
-                    editor_insert_new_line(&editor);
-                }
-                break;
+    char error[512];
+    if (!replay_load(&replay, file_path, error, sizeof(error))) {
+        fprintf(stderr, "ERROR: %s\n", error);
+        exit(1);
+    }
+    replaying = true;
+}
 
-                case SDLK_ESCAPE: {
-                    editor_delete(&editor);
-                }
-                break;
+// Opens every file of the command line, or a scratch buffer when there is none.
+// With -f every one of them is followed.
+void buffers_open_args(int argc, char *argv[])
+{
+    bool follow = false;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-f") == 0) {
+            follow = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--record") == 0 || strcmp(argv[i], "--replay") == 0) {
+            if (i + 1 == argc) {
+                usage(stderr);
+                exit(1);
+            }
+            input_open(argv[i], argv[i + 1]);
+            i += 1;
+            continue;
+        }
+        Buffer *opened = buffers_open(argv[i]);
+        if (follow) {
+            buffer_follow(opened, true);
+        }
+    }
+    if (buffers.count == 0) {
+        buffers_open(NULL);
+    }
+    buffers_switch(0);
+}
 
-                case SDLK_TAB: {
-                    editor_tab_space(&editor);
-                }
-                break;
+void buffers_update_title(SDL_Window *window)
+{
+    char title[1024];
+    int n = snprintf(title, sizeof(title), "Grive - %s [%zu/%zu] %zu lines",
+                     buffer->file_path ? buffer->file_path : "*scratch*",
+                     buffers.current + 1, buffers.count, buffer->editor.lines.len);
+    if (buffer->editor.load != NULL && n > 0 && (size_t) n < sizeof(title)) {
+        n += snprintf(title + n, sizeof(title) - n, ", loading %d%%",
+                      (int) (editor_load_progress(&buffer->editor) * 100.0f));
+    }
+    if (editor_is_following(&buffer->editor) && n > 0 && (size_t) n < sizeof(title)) {
+        snprintf(title + n, sizeof(title) - n, ", following");
+    }
+    SDL_SetWindowTitle(window, title);
+}
 
-                case SDLK_UP: {
-                    editor_move_cursor_up(&editor);
-                }
-                break;
+// Takes in the lines indexed in the background since the last frame. Returns
+// true while any buffer is loading, including the frame it finished in.
+bool buffers_load_update(void)
+{
+    bool loading = false;
+    for (size_t i = 0; i < buffers.count; ++i) {
+        Editor *editor = &buffers.items[i]->editor;
+        loading = loading || editor->load != NULL;
+        editor_load_update(editor);
+    }
+    return loading;
+}
 
-                case SDLK_DOWN: {
-                    editor_move_cursor_down(&editor);
-                }
-                break;
+// The save being written in the background, if any, and where the journal of
+// the buffer it saves was at when it was snapshotted
+Save save = {0};
+Buffer *saving = NULL;
+Swap_Mark saving_mark = {0};
 
-                case SDLK_LEFT: {
-                    editor_move_cursor_left(&editor);
-                }
-                break;
+// How often followed files are looked at while nothing else wakes the editor up
+#define FOLLOW_POLL_MS 100
 
-                case SDLK_RIGHT: {
-                    editor_move_cursor_right(&editor);
-                }
-                break;
-                }
-            }
-            break;
+// Loads the file of a followed buffer again, after it was truncated or rotated
+void buffer_reload(Buffer *reloaded)
+{
+    fprintf(stdout, "[LOG] - `%s` was truncated or rotated, reloading it\n", reloaded->file_path);
+    const Highlight_Language language = reloaded->editor.highlight.language;
+    // Searches tell their matches are stale by the version
+    const size_t version = reloaded->editor.version;
+    editor_free(&reloaded->editor);
+    reloaded->editor.version = version + 1;
+
+    FILE *f = fopen(reloaded->file_path, "r");
+    if (f != NULL) {
+        editor_open_file(&reloaded->editor, f, &jobs);
+        fclose(f);
+    }
+    reloaded->editor.highlight.language = language;
+    buffer_follow(reloaded, true);
+}
 
-            case SDL_TEXTINPUT: {
-                editor_insert_text_before_cursor(&editor, event.text.text);
-            }
-            break;
-            }
+// Takes in the lines appended to followed files and keeps pinned cursors on
+// the last line. Returns true while any buffer is following.
+bool buffers_follow_update(void)
+{
+    bool following = false;
+    for (size_t i = 0; i < buffers.count; ++i) {
+        Buffer *followed = buffers.items[i];
+        Editor *editor = &followed->editor;
+        if (!editor_is_following(editor)) {
+            continue;
         }
+        following = true;
 
-        scc(SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0));
-        scc(SDL_RenderClear(renderer));
+        const size_t last = editor->lines.len > 0 ? editor->lines.len - 1 : 0;
+        if (followed->pinned && editor->cursor_row != followed->pinned_row) {
+            followed->pinned = false;
+        } else if (!followed->pinned && editor->cursor_row == last) {
+            followed->pinned = true;
+        }
 
+        // A reload would pull the source out from under a background save
+        const bool writing = save.running || followed->checkpoint.running;
+        const Follow_Event event = writing ? FOLLOW_NONE : editor_follow_update(editor);
+        if (event == FOLLOW_TRUNCATED || event == FOLLOW_ROTATED) {
+            buffer_reload(followed);
+        }
 
-        // Scrolling
-        {
-            Vec2 cursor_pos =
-                        vec2s((float) editor.cursor_col * FONT_CHAR_WIDTH * FONT_SCALE,
-                              (float) editor.cursor_row * FONT_CHAR_HEIGHT * FONT_SCALE);   
-            Vec2 velocity = vec2_sub(cursor_pos, camera.pos);       // direction or vel
-            // lower down the velocity by 50 %
-            velocity = vec2_mul(velocity, vec2c(0.5));
-            camera.pos = vec2_add(camera.pos, 
-                vec2_mul(velocity, vec2c(DELTA_TIME)));
-        }   
-
-        for (size_t row = 0; row < editor.len; ++row) {
-            const Line *line = editor.lines + row;
-            Vec2 line_pos = vec2_sub(vec2s(0.0f, (float) row * FONT_CHAR_HEIGHT * FONT_SCALE), camera.pos);
-            line_pos = camera_project_point(window, line_pos);
-
-            render_text_sized(renderer, 
-                &font, 
-                line->chars, 
-                line->len, 
-                line_pos, 
-                0xFFFFFFFF, 
-                FONT_SCALE);
-        }
-        render_cursor(renderer, &font, &editor, &camera, window);
-
-        SDL_RenderPresent(renderer);
-
-        // Set SDL_Delay
-        const Uint32 duration = SDL_GetTicks() - start_time;
-        const Uint32 delta_time_ms = 1000 / FPS;
-        if (duration < delta_time_ms) {
-            SDL_Delay(duration - delta_time_ms);
+        if (followed->pinned && editor->lines.len > 0 && editor->cursor_row != editor->lines.len - 1) {
+            editor_move_cursor_to(editor, editor->lines.len - 1, 0);
         }
+        followed->pinned_row = editor->cursor_row;
+    }
+    return following;
+}
+
+// Snapshots the buffer and hands the writing to a worker, so the editor keeps
+// taking input while big files are flushed
+void save_begin(Buffer *saved)
+{
+    if (save.running) {
+        LOG("Save already in progress");
+        return;
     }
 
+    save_free(&save);
+    save_snapshot(&save, &saved->editor, saved->file_path);
+    saving = saved;
+    if (saved->editor.swap != NULL) {
+        saving_mark = swap_mark(saved->editor.swap, SWAP_BASE_FILE);
+    }
+    save_start(&save, &jobs);
+}
+
+// Reports a finished background save, once jobs_poll has picked it up
+void save_update(void)
+{
+    if (save_poll(&save)) {
+        if (save.ok) {
+            fprintf(stdout, "[LOG] - Saved %zu bytes to `%s`\n", save.size, save.path);
+            // The file is the base of its journal now
+            if (saving->editor.swap != NULL) {
+                swap_rebase(saving->editor.swap, saving_mark);
+            }
+        } else {
+            RAISE("SAVE", "%s", save.error);
+        }
+        save_free(&save);
+    }
+}
+
+// Writes a checkpoint of the buffers whose journal grew long in the background,
+// and moves the journal on top of it once it's written. A failed one isn't
+// tried again, the journal then only drops edits when the file is saved.
+void buffers_swap_update(void)
+{
+    // Snapshots stay on the UI thread, one per call keeps several buffers from
+    // adding up in a single frame
+    bool snapshotted = false;
+    for (size_t i = 0; i < buffers.count; ++i) {
+        Buffer *checked = buffers.items[i];
+        Swap *swap = checked->editor.swap;
+        if (checked->checkpoint.running) {
+            if (!save_poll(&checked->checkpoint)) {
+                continue;
+            }
+            if (!checked->checkpoint.ok) {
+                fprintf(stderr, "[WARNING] Could not checkpoint the swap file of `%s`: %s\n",
+                        checked->file_path, checked->checkpoint.error);
+                checked->checkpoint_failed = true;
+            } else if (swap != NULL) {
+                swap_rebase(swap, checked->checkpoint_mark);
+            }
+            save_free(&checked->checkpoint);
+            continue;
+        }
+
+        if (snapshotted || swap == NULL || checked->checkpoint_failed || checked->editor.load != NULL ||
+            !swap_wants_checkpoint(swap)) {
+            continue;
+        }
+        PROF_ZONE("buffers_swap_update");
+        checked->checkpoint_mark = swap_mark(swap, swap_free_checkpoint(swap));
+        save_free(&checked->checkpoint);
+        save_snapshot(&checked->checkpoint, &checked->editor, swap_checkpoint_path(swap, checked->checkpoint_mark.base));
+        save_start(&checked->checkpoint, &jobs);
+        snapshotted = true;
+    }
+}
+
+// Lets the workers finish what was started, a save in particular, before quitting
+void jobs_shutdown(void)
+{
+    if (save.running) {
+        jobs_wait(&jobs, &save.job);
+        save_update();
+    }
+    // Files still indexing are cut short, there is no use waiting for them
+    for (size_t i = 0; i < buffers.count; ++i) {
+        save_free(&buffers.items[i]->checkpoint);
+        editor_load_stop(&buffers.items[i]->editor);
+    }
+    jobs_free(&jobs);
+}
+
+// Time the search may take out of every frame, the rest is left for input and
+// drawing
+#define SEARCH_BUDGET_MS 6.0
+
+// Highlights are only drawn while the prompt is open
+const Search *buffer_search(const Buffer *shown)
+{
+    return shown->searching ? &shown->search : NULL;
+}
+
+void search_prompt_close(void)
+{
+    buffer->searching = false;
+    buffer->placing = false;
+    editor_mark_dirty(&buffer->editor, 0, EDITOR_DIRTY_END);
+}
+
+void search_prompt_edit(const char *query, size_t query_len, bool regex_mode)
+{
+    // The cursors were asked for on the matches of the previous query
+    buffer->placing = false;
+    search_set_query(&buffer->search, query, query_len, regex_mode);
+}
+
+// Puts a cursor on every match, the one at or after the cursor becomes the
+// cursor the camera follows, and closes the prompt. Matches are only found a
+// slice of a frame at a time, until they all are search_update does it.
+void search_prompt_cursors(void)
+{
+    Editor *editor = &buffer->editor;
+    Search *search = &buffer->search;
+    if (!search->done) {
+        buffer->placing = true;
+        return;
+    }
+    buffer->placing = false;
+    const Search_Match *first = search_next(search, editor->cursor_row, editor->cursor_col, true);
+    if (first == NULL) {
+        return;
+    }
+
+    editor_move_cursor_to(editor, first->row, first->col);
+    for (size_t i = 0; i < search_count(search); ++i) {
+        const Search_Match *match = search_match_at(search, i);
+        editor_add_cursor(editor, match->row, match->col);
+    }
+    search_prompt_close();
+}
+
+void search_prompt_jump(bool forward)
+{
+    Editor *editor = &buffer->editor;
+    const Search_Match *match = search_next(&buffer->search, editor->cursor_row, editor->cursor_col, forward);
+    if (match != NULL) {
+        editor_move_cursor_to(editor, match->row, match->col);
+    }
+}
+
+// Keys go to the query while the prompt is open. Returns false for the ones
+// the editor should handle as usual.
+bool search_prompt_handle_event(const SDL_Event *event)
+{
+    Search *search = &buffer->search;
+
+    switch (event->type) {
+    case SDL_KEYDOWN: {
+        switch (event->key.keysym.sym) {
+        case SDLK_ESCAPE: {
+            search_prompt_close();
+        }
+        return true;
+
+        case SDLK_RETURN: {
+            if (event->key.keysym.mod & KMOD_ALT) {
+                search_prompt_cursors();
+            } else {
+                search_prompt_jump(!(event->key.keysym.mod & KMOD_SHIFT));
+            }
+        }
+        return true;
+
+        case SDLK_BACKSPACE: {
+            if (search->query_len > 0) {
+                search_prompt_edit(search->query, search->query_len - 1, search->regex_mode);
+            }
+        }
+        return true;
+
+        case SDLK_r: {
+            if (event->key.keysym.mod & KMOD_CTRL) {
+                search_prompt_edit(search->query, search->query_len, !search->regex_mode);
+                return true;
+            }
+        }
+        break;
+        }
+    }
+    break;
+
+    case SDL_TEXTINPUT: {
+        const size_t text_len = strlen(event->text.text);
+        char *query = malloc(search->query_len + text_len);
+        if (query == NULL) {
+            fprintf(stderr, "ERROR: could not allocate search query\n");
+            exit(1);
+        }
+        memcpy(query, search->query, search->query_len);
+        memcpy(query + search->query_len, event->text.text, text_len);
+        search_prompt_edit(query, search->query_len + text_len, search->regex_mode);
+        free(query);
+    }
+    return true;
+    }
+
+    return false;
+}
+
+// Searches the current buffer for a slice of the frame, viewport first.
+// Returns true while there is more to search.
+bool search_update(size_t view_begin, size_t view_end)
+{
+    PROF_ZONE("search_update");
+    if (!buffer->searching) {
+        return false;
+    }
+
+    Search *search = &buffer->search;
+    const bool done = search_step(search, &buffer->editor, view_begin, view_end, SEARCH_BUDGET_MS);
+    size_t begin, end;
+    if (search_take_dirty(search, &begin, &end)) {
+        editor_mark_dirty(&buffer->editor, begin, end);
+    }
+    if (done && buffer->placing) {
+        search_prompt_cursors();
+    }
+    return !done;
+}
+
+// Time the highlighter may take out of every frame to catch up with the
+// viewport, after a jump into a big file
+#define HIGHLIGHT_BUDGET_MS 4.0
+
+// Lexes what the viewport needs before it's painted, rows whose colors
+// changed are marked dirty. Returns true while some are still drawn plain.
+bool highlight_viewport_update(size_t view_end)
+{
+    Editor *editor = &buffer->editor;
+    const bool more = highlight_update(&editor->highlight, &editor->lines, view_end, HIGHLIGHT_BUDGET_MS);
+    size_t begin, end;
+    if (highlight_take_dirty(&editor->highlight, &begin, &end)) {
+        editor_mark_dirty(editor, begin, end);
+    }
+    return more;
+}
+
+// Text of the prompt line, e.g. `Find: foo  [12 matches]`
+size_t search_prompt_text(char *text, size_t text_cap)
+{
+    const Search *search = &buffer->search;
+    int n = 0;
+    if (!search->valid) {
+        n = snprintf(text, text_cap, "Regex: %s  [%s]", search->query ? search->query : "", search->regex.error);
+    } else {
+        n = snprintf(text, text_cap, "%s: %s  [%zu%s matches%s%s]",
+                     search->regex_mode ? "Regex" : "Find",
+                     search->query ? search->query : "",
+                     search_count(search), search->capped ? "+" : "", search->done ? "" : ", searching",
+                     buffer->placing ? ", cursors once done" : "");
+    }
+    if (n < 0) {
+        return 0;
+    }
+    return (size_t) n < text_cap ? (size_t) n : text_cap - 1;
+}
+
+// Lays out the prompt on the last line of the window, returns its top
+float search_prompt_layout(Glyphs *glyphs)
+{
+    char text[512];
+    const size_t text_len = search_prompt_text(text, sizeof(text));
+    const float y = frame_window.y - FONT_CHAR_HEIGHT * FONT_SCALE;
+    render_text_sized(glyphs, text, text_len, vec2s(0.0f, floorf(y)), COLOR_CREME, FONT_SCALE);
+    return floorf(y);
+}
+
+// Profiler overlay, F3 toggles it and Shift+F3 writes the trace
+bool prof_overlay = false;
+
+// Soft wrap at the right edge of the window, F4 toggles it for every buffer
+bool soft_wrap = false;
+// Visual rows of the last viewport, how far PageUp / PageDown move
+size_t page_rows = 1;
+
+// Wraps the current buffer at the width of the window. Only a resize (or
+// switching to a buffer laid out for another width) lays out every line again.
+void soft_wrap_update(void)
+{
+    size_t width = 0;
+    if (soft_wrap) {
+        const float columns = floorf(frame_window.x / (FONT_CHAR_WIDTH * FONT_SCALE));
+        width = columns > 1.0f ? (size_t) columns : 1;
+    }
+    editor_set_wrap(&buffer->editor, width);
+}
+
+#define TRACE_DEFAULT_PATH "grive-trace.json"
+
+// Writes the zones recorded so far to $GRIVE_TRACE, or TRACE_DEFAULT_PATH
+// when it isn't set. Done on Shift+F3, and on exit when $GRIVE_TRACE is set.
+void trace_dump(void)
+{
+    const char *file_path = getenv("GRIVE_TRACE") ? getenv("GRIVE_TRACE") : TRACE_DEFAULT_PATH;
+    if (prof_write_trace(file_path)) {
+        fprintf(stdout, "[LOG] - Wrote trace to `%s`\n", file_path);
+    } else {
+        fprintf(stderr, "[WARNING] Could not write trace to `%s`: %s\n", file_path, strerror(errno));
+    }
+}
+
+// Lays out the overlay in the top right corner and returns where it is. The
+// OpenGL renderer gets its background as solid cells, the SDL one fills the
+// returned rectangle before flushing the glyphs.
+SDL_Rect prof_overlay_layout(Glyphs *glyphs, bool solid_background)
+{
+    char text[256];
+    const size_t text_len = prof_overlay_text(text, sizeof(text));
+
+    size_t widest = 0;
+    size_t lines = 0;
+    for (size_t begin = 0, end = 0; end < text_len; begin = end + 1) {
+        for (end = begin; end < text_len && text[end] != '\n'; ++end) {}
+        widest = end - begin > widest ? end - begin : widest;
+        lines += 1;
+    }
+
+    const float cell_width = floorf(FONT_CHAR_WIDTH * FONT_SCALE);
+    const float cell_height = floorf(FONT_CHAR_HEIGHT * FONT_SCALE);
+    const float x = floorf(frame_window.x - (float) widest * cell_width);
+    if (solid_background) {
+        for (size_t row = 0; row < lines; ++row) {
+            for (size_t col = 0; col < widest; ++col) {
+                glyphs_push(glyphs, x + (float) col * cell_width, (float) row * cell_height,
+                            GL_GLYPH_SOLID, 0xFF000000);
+            }
+        }
+    }
+
+    size_t row = 0;
+    for (size_t begin = 0, end = 0; end < text_len; begin = end + 1, ++row) {
+        for (end = begin; end < text_len && text[end] != '\n'; ++end) {}
+        render_text_sized(glyphs, text + begin, end - begin, vec2s(x, (float) row * cell_height),
+                          COLOR_CREME, FONT_SCALE);
+    }
+
+    return (SDL_Rect) {
+        .x = (int) x,
+        .y = 0,
+        .w = (int) ((float) widest * cell_width),
+        .h = (int) ((float) lines * cell_height),
+    };
+}
+
+// Courtesy: https://github.com/tsoding/opengl-template
+void MessageCallback(GLenum source,
+    GLenum type,
+    GLuint id,
+    GLenum severity,
+    GLsizei length,
+    const GLchar* message,
+    const void* userParam)
+{
+    (void) source;
+    (void) id;
+    (void) length;
+    (void) userParam;
+    fprintf(stderr, "GL CALLBACK: %s type = 0x%x, severity = 0x%x, message = %s\n",
+    (type == GL_DEBUG_TYPE_ERROR ? "** GL ERROR **" : ""),
+    type, severity, message);
+}
+
+// Moves with Shift held extend the selection, the others drop it
+void selection_update(Editor *editor, const SDL_Event *event)
+{
+    if (event->key.keysym.mod & KMOD_SHIFT) {
+        editor_select(editor);
+    } else {
+        editor_clear_selection(editor);
+    }
+}
+
+void clipboard_copy(Editor *editor, bool cut)
+{
+    size_t len = 0;
+    char *text = cut ? editor_cut(editor, &len) : editor_copy(editor, &len);
+    if (text == NULL) {
+        return;
+    }
+    if (SDL_SetClipboardText(text) < 0) {
+        fprintf(stderr, "[WARNING] Could not copy to the clipboard: %s\n", SDL_GetError());
+    }
+    free(text);
+}
+
+void clipboard_paste(Editor *editor)
+{
+    char *text = SDL_GetClipboardText();
+    if (text == NULL) {
+        fprintf(stderr, "[WARNING] Could not paste from the clipboard: %s\n", SDL_GetError());
+        return;
+    }
+    editor_paste(editor, text, strlen(text));
+    SDL_free(text);
+}
+
+// Returns false once the editor should quit
+bool handle_event(const SDL_Event *event)
+{
+    Editor *editor = &buffer->editor;
+    if (buffer->searching && search_prompt_handle_event(event)) {
+        return true;
+    }
+
+    switch (event->type) {
+    case SDL_QUIT: {
+        return false;
+    }
+    break;
+
+    case SDL_KEYDOWN: {
+        switch (event->key.keysym.sym) {
+        case SDLK_f: {
+            if (event->key.keysym.mod & KMOD_CTRL) {
+                buffer->searching = true;
+                editor_mark_dirty(editor, 0, EDITOR_DIRTY_END);
+            }
+        }
+        break;
+
+        case SDLK_BACKSPACE: {
+            if (!editor_delete_selection(editor)) {
+                // Extra cursors join their lines in editor_backspace already
+                const bool single = editor->cursors.count == 0;
+                editor_backspace(editor);
+                if (single) {
+                    editor_remove_line(editor);
+                }
+            }
+        }
+        break;
+
+        case SDLK_a: {
+            if (event->key.keysym.mod & KMOD_CTRL) {
+                editor_select_all(editor);
+            }
+        }
+        break;
+
+        case SDLK_c:
+        case SDLK_x: {
+            if (event->key.keysym.mod & KMOD_CTRL) {
+                clipboard_copy(editor, event->key.keysym.sym == SDLK_x);
+            }
+        }
+        break;
+
+        case SDLK_v: {
+            if (event->key.keysym.mod & KMOD_CTRL) {
+                clipboard_paste(editor);
+            }
+        }
+        break;
+
+        case SDLK_F2: {
+            if (buffer->file_path) {
+                save_begin(buffer);
+            }
+        }
+        break;
+
+        case SDLK_F3: {
+            if (!PROF_ENABLED) {
+                fprintf(stderr, "[WARNING] The profiler is not compiled in, build with `make grive PROFILE=1`\n");
+            } else if (event->key.keysym.mod & KMOD_SHIFT) {
+                trace_dump();
+            } else {
+                prof_overlay = !prof_overlay;
+            }
+        }
+        break;
+
+        case SDLK_RETURN: {
+            editor_insert_new_line(editor);
+        }
+        break;
+
+        case SDLK_ESCAPE: {
+            Cursor begin, end;
+            if (editor_selection(editor, &begin, &end)) {
+                editor_clear_selection(editor);
+            } else if (editor->cursors.count > 0) {
+                editor_clear_cursors(editor);
+            } else {
+                editor_delete(editor);
+            }
+        }
+        break;
+
+        case SDLK_TAB: {
+            if (event->key.keysym.mod & KMOD_CTRL) {
+                const size_t step = event->key.keysym.mod & KMOD_SHIFT ? buffers.count - 1 : 1;
+                buffers_switch(buffers.current + step);
+            } else {
+                editor_tab_space(editor);
+            }
+        }
+        break;
+
+        case SDLK_F4: {
+            soft_wrap = !soft_wrap;
+        }
+        break;
+
+        case SDLK_F5: {
+            buffer_follow(buffer, !editor_is_following(editor));
+        }
+        break;
+
+        case SDLK_PAGEDOWN: {
+            if (event->key.keysym.mod & KMOD_CTRL) {
+                buffers_switch(buffers.current + 1);
+            } else {
+                selection_update(editor, event);
+                editor_move_cursor_visual(editor, (long) page_rows);
+            }
+        }
+        break;
+
+        case SDLK_PAGEUP: {
+            if (event->key.keysym.mod & KMOD_CTRL) {
+                buffers_switch(buffers.current + buffers.count - 1);
+            } else {
+                selection_update(editor, event);
+                editor_move_cursor_visual(editor, -(long) page_rows);
+            }
+        }
+        break;
+
+        case SDLK_UP: {
+            if (event->key.keysym.mod & KMOD_ALT) {
+                editor_add_cursor_visual(editor, -1);
+            } else {
+                selection_update(editor, event);
+                editor_move_cursor_up(editor);
+            }
+        }
+        break;
+
+        case SDLK_DOWN: {
+            if (event->key.keysym.mod & KMOD_ALT) {
+                editor_add_cursor_visual(editor, 1);
+            } else {
+                selection_update(editor, event);
+                editor_move_cursor_down(editor);
+            }
+        }
+        break;
+
+        case SDLK_LEFT: {
+            selection_update(editor, event);
+            editor_move_cursor_left(editor);
+        }
+        break;
+
+        case SDLK_RIGHT: {
+            selection_update(editor, event);
+            editor_move_cursor_right(editor);
+        }
+        break;
+
+        case SDLK_z: {
+            if (event->key.keysym.mod & KMOD_CTRL) {
+                if (event->key.keysym.mod & KMOD_SHIFT) {
+                    editor_redo(editor);
+                } else {
+                    editor_undo(editor);
+                }
+            }
+        }
+        break;
+
+        case SDLK_y: {
+            if (event->key.keysym.mod & KMOD_CTRL) {
+                editor_redo(editor);
+            }
+        }
+        break;
+        }
+    }
+    break;
+
+    case SDL_TEXTINPUT: {
+        editor_insert_text_before_cursor(editor, event->text.text);
+    }
+    break;
+    }
+
+    return true;
+}
+
+// The event loop takes its input through these, so a replayed session goes
+// down the same path as a live one
+bool input_wait(SDL_Event *event, int timeout_ms)
+{
+    if (replaying) {
+        return replay_wait_event(&replay, event, timeout_ms);
+    }
+    const bool woken = SDL_WaitEventTimeout(event, timeout_ms);
+    if (woken) {
+        replay_record(&recorder, event);
+    }
+    return woken;
+}
+
+bool input_poll(SDL_Event *event)
+{
+    if (replaying) {
+        return replay_poll_event(&replay, event);
+    }
+    const bool polled = SDL_PollEvent(event);
+    if (polled) {
+        replay_record(&recorder, event);
+    }
+    return polled;
+}
+
+bool input_handle(const SDL_Event *event)
+{
+    if (!replaying) {
+        return handle_event(event);
+    }
+    const uint64_t begin_ns = replay_now_ns();
+    const bool running = handle_event(event);
+    replay_handled(&replay, begin_ns);
+    return running;
+}
+
+// Called once the events taken so far are on screen
+void input_frame_presented(void)
+{
+    if (replaying) {
+        replay_frame_presented(&replay);
+    }
+}
+
+void input_close(void)
+{
+    if (replaying) {
+        replay_report(&replay, stdout);
+        replay_free(&replay);
+    }
+    replay_record_stop(&recorder);
+}
+
+// Moves the camera towards the cursor, returns true while it is still moving
+bool camera_update(Camera *camera, Editor *editor)
+{
+    const Vec2 char_size = vec2s(FONT_CHAR_WIDTH * FONT_SCALE, FONT_CHAR_HEIGHT * FONT_SCALE);
+    size_t cursor_row, cursor_col;
+    editor_cursor_visual(editor, &cursor_row, &cursor_col);
+    const Vec2 cursor_pos = vec2_mul(vec2s((float) cursor_col, (float) cursor_row), char_size);
+
+    // Only scroll once the cursor gets within CAM_BUFFER of the window edges,
+    // so typing inside the window does not move (and repaint) everything
+    const Vec2 half = vec2_sub(vec2_mul(frame_window, vec2c(0.5)), CAM_BUFFER);
+    const Vec2 low = vec2_sub(cursor_pos, vec2_sub(half, char_size));
+    const Vec2 high = vec2_add(cursor_pos, half);
+    if (camera->target.x < low.x) camera->target.x = low.x;
+    if (camera->target.x > high.x) camera->target.x = high.x;
+    if (camera->target.y < low.y) camera->target.y = low.y;
+    if (camera->target.y > high.y) camera->target.y = high.y;
+    if (editor->wrap_width > 0) {
+        // Wrapped lines start at the left edge of the window
+        camera->target.x = frame_window.x * 0.5f;
+    }
+
+    Vec2 velocity = vec2_sub(camera->target, camera->pos);       // direction or vel
+
+    // Snap once the remaining distance is not visible anymore
+    if (fabsf(velocity.x) < 0.5f && fabsf(velocity.y) < 0.5f) {
+        bool moved = camera->pos.x != camera->target.x || camera->pos.y != camera->target.y;
+        camera->pos = camera->target;
+        return moved;
+    }
+
+    // lower down the velocity by 50 %
+    velocity = vec2_mul(velocity, vec2c(0.5));
+    camera->pos = vec2_add(camera->pos, 
+        vec2_mul(velocity, vec2c(DELTA_TIME)));
+    return true;
+}
+
+// #define OPENGL_RENDERER
+#if defined(OPENGL_RENDERER)
+// OPEN GL RENDERER
+
+// A cursor is a solid cell with the glyph under it drawn inverted on top
+void cursor_layout(Glyphs *glyphs, Editor *editor, size_t row, size_t col)
+{
+    const Vec2 cursor = cursor_position(editor, row, col);
+    glyphs_push(glyphs, floorf(cursor.x), floorf(cursor.y), GL_GLYPH_SOLID, 0xFFFFFFFF);
+    const uint32_t codepoint = cursor_codepoint(editor, row, col);
+    if (codepoint != 0) {
+        glyphs_push(glyphs, floorf(cursor.x), floorf(cursor.y), glyph_index(codepoint), 0xFF000000);
+    }
+}
+void gl_render_frame(Gl_Renderer *gl, Glyphs *glyphs, SDL_Window *window)
+{
+    PROF_ZONE("render");
+    int w, h;
+    SDL_GL_GetDrawableSize(window, &w, &h);
+    glViewport(0, 0, w, h);
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    atlas_begin_frame(&atlas);
+    Editor *editor = &buffer->editor;
+    const Viewport viewport = camera_viewport(&buffer->camera, editor);
+    render_rows(glyphs, editor, buffer_search(buffer), &viewport, viewport.line_begin, viewport.line_end);
+
+    for (size_t i = 0; i < editor->cursors.count; ++i) {
+        const Cursor *cursor = &editor->cursors.items[i];
+        if (cursor->row >= viewport.line_end) {
+            break;
+        }
+        if (cursor->row >= viewport.line_begin) {
+            cursor_layout(glyphs, editor, cursor->row, cursor->col);
+        }
+    }
+    cursor_layout(glyphs, editor, editor->cursor_row, editor->cursor_col);
+
+    if (buffer->searching) {
+        // Blank out the text under the prompt line first
+        const float cell_width = floorf(FONT_CHAR_WIDTH * FONT_SCALE);
+        const float width = frame_window.x;
+        const float y = floorf(frame_window.y - FONT_CHAR_HEIGHT * FONT_SCALE);
+        for (float x = 0.0f; x < width; x += cell_width) {
+            glyphs_push(glyphs, x, y, GL_GLYPH_SOLID, 0xFF000000);
+        }
+        search_prompt_layout(glyphs);
+    }
+    if (prof_overlay) {
+        prof_overlay_layout(glyphs, true);
+    }
+
+    // Cells rasterized by the layout above
+    int atlas_begin, atlas_end;
+    bool atlas_resized;
+    if (atlas_take_dirty(&atlas, &atlas_begin, &atlas_end, &atlas_resized)) {
+        gl_renderer_update_atlas(gl, atlas.pixels, atlas.width, atlas.height,
+                                 atlas_begin, atlas_end, atlas_resized);
+    }
+
+    // Layout happens in window coordinates, the drawable may be bigger on HiDPI
+    gl_renderer_draw(gl, glyphs, (int) frame_window.x, (int) frame_window.y,
+                     floorf(FONT_CHAR_WIDTH * FONT_SCALE), floorf(FONT_CHAR_HEIGHT * FONT_SCALE));
+    prof_count(PROF_DRAW_CALLS, 1);
+    prof_count(PROF_GLYPHS, glyphs->count);
+    glyphs_clear(glyphs);
+
+    PROF_ZONE("swap");
+    SDL_GL_SwapWindow(window);
+}
+
+int main(int argc, char *argv[]) {
+    jobs_init(&jobs, 0);
+    buffers_open_args(argc, argv);
+
+    scc(SDL_Init(SDL_INIT_VIDEO));
+
+    {   // Set attributes and gl profile, they have to be known before the window is created
+        SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
+        SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
+        SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
+#ifdef __APPLE__
+        SDL_GL_SetAttribute(SDL_GL_CONTEXT_FLAGS, SDL_GL_CONTEXT_FORWARD_COMPATIBLE_FLAG);
+#else
+        SDL_GL_SetAttribute(SDL_GL_CONTEXT_FLAGS, SDL_GL_CONTEXT_DEBUG_FLAG);
+#endif
+    }
+
+    Uint32 windowFlags = SDL_WINDOW_ALLOW_HIGHDPI | SDL_WINDOW_RESIZABLE | SDL_WINDOW_OPENGL;
+
+    // Window 
+    SDL_Window *window = scp(SDL_CreateWindow("Grive", 
+        SDL_WINDOWPOS_CENTERED, 
+        SDL_WINDOWPOS_CENTERED, 
+        WWIDTH, 
+        WHEIGHT, 
+        windowFlags
+    ));
+
+    scp(SDL_GL_CreateContext(window));
+
+    {
+        int major, minor;
+        SDL_GL_GetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, &major);
+        SDL_GL_GetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, &minor);
+        fprintf(stdout, "[INFO] GL Version: %d.%d\n", major, minor);    
+    }
+
+    // Get version info
+    const GLubyte* renderer = glGetString(GL_RENDERER); // get renderer string
+    const GLubyte* version = glGetString(GL_VERSION); // version as a string
+
+    printf("[INFO] Renderer: %s\n", renderer);
+    printf("[INFO] OpenGL Version Supported %s\n", version);
+
+    // Core profiles need the experimental loader for VAOs and friends
+    glewExperimental = GL_TRUE;
+    GLenum glew_status = glewInit();
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+    // EGL contexts (headless llvmpipe, Wayland) have no GLX display, but the
+    // GL entry points are loaded by then
+    if (glew_status == GLEW_ERROR_NO_GLX_DISPLAY) {
+        glew_status = GLEW_OK;
+    }
+#endif
+    if (glew_status != GLEW_OK) {
+        RAISE("GL", "Could not initialize GLEW!"); exit(1);
+    }
+
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    if (GLEW_ARB_debug_output) {
+        glEnable(GL_DEBUG_OUTPUT);
+        glDebugMessageCallback(&MessageCallback, 0);
+    } else {
+        fprintf(stderr, "[WARNING] GL extension GLEW_ARB_debug_output is not available.\n");
+    }   
+
+    // Glyphs are rasterized on first use, the texture follows the atlas
+    atlas_load();
+    Gl_Renderer gl = {0};
+    gl_renderer_init(&gl, atlas.pixels, atlas.width, atlas.height, ATLAS_COLS, atlas.cell_w, atlas.cell_h);
+    Glyphs glyphs = {0};
+
+    SDL_EventState(SDL_MOUSEMOTION, SDL_IGNORE);
+
+    const Uint32 frame_ms = 1000 / FPS;
+    bool animating = true;
+    bool redraw = true;
+    bool loading = false;
+    bool following = false;
+    bool searching = false;
+    bool highlighting = false;
+    const Buffer *shown = NULL;
+
+    // Main Loop 
+    bool quit = false;
+    while (!quit) {
+        const Uint32 start_time = SDL_GetTicks();
+
+        SDL_Event event = {0};
+        // Finished jobs report back once per frame
+        const bool working = jobs_poll(&jobs) > 0;
+        save_update();
+        buffers_swap_update();
+        const bool busy = animating || redraw || working || loading || searching || highlighting;
+        const bool woken = input_wait(&event, busy ? (int) frame_ms : following ? FOLLOW_POLL_MS : -1);
+        // Time spent waiting for events doesn't count towards the frame
+        prof_frame_begin();
+        if (woken) {
+            PROF_ZONE("events");
+            do {
+                if (!input_handle(&event)) {
+                    quit = true;
+                }
+                redraw = true;
+            } while (input_poll(&event));
+        }
+
+        loading = buffers_load_update();
+        following = buffers_follow_update();
+        if (buffer != shown || loading || following) {
+            buffers_update_title(window);
+            shown = buffer;
+        }
+        frame_begin(window);
+        soft_wrap_update();
+        animating = camera_update(&buffer->camera, &buffer->editor);
+        frame_project(&buffer->camera);
+
+        const Viewport viewport = camera_viewport(&buffer->camera, &buffer->editor);
+        page_rows = viewport.row_end - viewport.row_begin;
+        // The match count on the prompt changes with every slice, the last one included
+        const bool was_searching = searching;
+        searching = search_update(viewport.line_begin, viewport.line_end);
+        redraw = redraw || searching || was_searching;
+        highlighting = highlight_viewport_update(viewport.line_end);
+
+        // The GPU redraws the whole screen, but only when something changed
+        if (animating || redraw || editor_is_dirty(&buffer->editor)) {
+            gl_render_frame(&gl, &glyphs, window);
+            editor_clear_dirty(&buffer->editor);
+            redraw = false;
+        }
+        input_frame_presented();
+        prof_frame_end();
+
+        const Uint32 duration = SDL_GetTicks() - start_time;
+        if (animating && duration < frame_ms) {
+            SDL_Delay(frame_ms - duration);
+        }
+    }
+
+    gl_renderer_free(&gl);
+    atlas_free(&atlas);
+    highlight_spans_free(&spans);
+    if (PROF_ENABLED && getenv("GRIVE_TRACE") != NULL) {
+        trace_dump();
+    }
+    input_close();
+    jobs_shutdown();
+    buffers_free();
+    SDL_Quit();
+
+    return 0;
+}
+
+#else 
+// STANDARD SDL RENDERER 
+
+// Text of the last frame, kept in a target texture so that only damaged rows
+// have to be drawn again. The cursor is drawn over it on every present.
+typedef struct {
+    SDL_Texture *texture;
+    int width;
+    int height;
+    bool valid;
+} Text_Layer;
+
+void text_layer_resize(SDL_Renderer *renderer, Text_Layer *layer, SDL_Window *window)
+{
+    int w, h;
+    SDL_GetWindowSize(window, &w, &h);
+    if (layer->texture != NULL && layer->width == w && layer->height == h) {
+        return;
+    }
+
+    if (layer->texture != NULL) {
+        SDL_DestroyTexture(layer->texture);
+    }
+    layer->texture = scp(SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA32,
+                                           SDL_TEXTUREACCESS_TARGET, w, h));
+    layer->width = w;
+    layer->height = h;
+    layer->valid = false;
+}
+
+// Draws the visual rows of lines [row_begin, row_end) of the viewport into the layer
+void text_layer_render_rows(SDL_Renderer *renderer, Text_Layer *layer, Glyph_Batch *batch, Glyphs *glyphs,
+                            Font *font, const Viewport *viewport, size_t row_begin, size_t row_end)
+{
+    PROF_ZONE("render_rows");
+    const Lines *lines = &buffer->editor.lines;
+    const Vec2 top = vec2_transform(frame_cells, vec2s(0.0f, (float) lines_visual_row(lines, row_begin)));
+
+    SDL_Rect clip = {
+        .x = 0,
+        .y = (int) floorf(top.y),
+        .w = layer->width,
+        .h = layer->height - (int) floorf(top.y),
+    };
+    if (row_end < viewport->line_end) {
+        const Vec2 bottom = vec2_transform(frame_cells, vec2s(0.0f, (float) lines_visual_row(lines, row_end)));
+        clip.h = (int) floorf(bottom.y) - clip.y;
+    }
+    // Otherwise rows past the end of the document are blank, clear them as well
+
+    scc(SDL_SetRenderTarget(renderer, layer->texture));
+    scc(SDL_RenderSetClipRect(renderer, &clip));
+    scc(SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0));
+    scc(SDL_RenderClear(renderer));
+
+    render_rows(glyphs, &buffer->editor, buffer_search(buffer), viewport, row_begin, row_end);
+    glyph_batch_flush(renderer, batch, font, glyphs, FONT_SCALE);
+
+    scc(SDL_RenderSetClipRect(renderer, NULL));
+    scc(SDL_SetRenderTarget(renderer, NULL));
+}
+
+int main(int argc, char *argv[])
+{
+    jobs_init(&jobs, 0);
+    buffers_open_args(argc, argv);
+
+    scc(SDL_Init(SDL_INIT_VIDEO));
+
+    Uint32 windowFlags = SDL_WINDOW_ALLOW_HIGHDPI | SDL_WINDOW_RESIZABLE;
+#ifdef __APPLE__
+    windowFlags |= SDL_WINDOW_METAL;
+#endif
+
+    // Window 
+    SDL_Window *window = scp(SDL_CreateWindow("Grive", 
+        SDL_WINDOWPOS_CENTERED, 
+        SDL_WINDOWPOS_CENTERED, 
+        WWIDTH, 
+        WHEIGHT, 
+        windowFlags
+    ));
+
+    // Renderer, in software when there is no GPU, like under SDL_VIDEODRIVER=dummy
+    SDL_Renderer *renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_TARGETTEXTURE);
+    if (renderer == NULL) {
+        fprintf(stderr, "[WARNING] No accelerated renderer (%s), drawing in software\n", SDL_GetError());
+        renderer = scp(SDL_CreateRenderer(window, -1, SDL_RENDERER_SOFTWARE | SDL_RENDERER_TARGETTEXTURE));
+    }
+
+    // Glyphs are rasterized on first use, the texture follows the atlas
+    atlas_load();
+    Font font = {0};
+    Glyph_Batch batch = {0};
+    Glyphs glyphs = {0};
+    Text_Layer layer = {0};
+
+    // The editor has no use for the mouse yet, don't wake up for it
+    SDL_EventState(SDL_MOUSEMOTION, SDL_IGNORE);
+
+    const Uint32 frame_ms = 1000 / FPS;
+    bool animating = true;
+    bool loading = false;
+    bool following = false;
+    bool searching = false;
+    bool highlighting = false;
+    const Buffer *shown = NULL;
+
+    // Main Loop 
+    bool quit = false;
+    while (!quit) {
+        const Uint32 start_time = SDL_GetTicks();
+        atlas_begin_frame(&atlas);
+
+        // Sleep until something happens, or until the next animation frame
+        SDL_Event event = {0};
+        // Finished jobs report back once per frame
+        const bool working = jobs_poll(&jobs) > 0;
+        save_update();
+        buffers_swap_update();
+        const bool busy = animating || working || loading || searching || highlighting;
+        const bool woken = input_wait(&event, busy ? (int) frame_ms : following ? FOLLOW_POLL_MS : -1);
+        // Time spent waiting for events doesn't count towards the frame
+        prof_frame_begin();
+        if (woken) {
+            PROF_ZONE("events");
+            do {
+                if (event.type == SDL_WINDOWEVENT) {
+                    // Resizes, exposes and restores may all have lost the contents
+                    layer.valid = false;
+                }
+                if (!input_handle(&event)) {
+                    quit = true;
+                }
+            } while (input_poll(&event));
+        }
+
+        loading = buffers_load_update();
+        following = buffers_follow_update();
+        if (buffer != shown) {
+            // The layer holds the text of the previous buffer
+            layer.valid = false;
+        }
+        if (buffer != shown || loading || following) {
+            buffers_update_title(window);
+            shown = buffer;
+        }
+        Editor *editor = &buffer->editor;
+
+        // Scrolling
+        frame_begin(window);
+        soft_wrap_update();
+        animating = camera_update(&buffer->camera, editor);
+        frame_project(&buffer->camera);
+
+        text_layer_resize(renderer, &layer, window);
+        const Viewport viewport = camera_viewport(&buffer->camera, editor);
+        page_rows = viewport.row_end - viewport.row_begin;
+        // Found matches and lexed rows mark their rows dirty, so they are
+        // repainted below
+        searching = search_update(viewport.line_begin, viewport.line_end);
+        highlighting = highlight_viewport_update(viewport.line_end);
+        if (animating || !layer.valid) {
+            // Every row moved on screen
+            text_layer_render_rows(renderer, &layer, &batch, &glyphs, &font, &viewport,
+                                   viewport.line_begin, EDITOR_DIRTY_END);
+            layer.valid = true;
+        } else if (editor_is_dirty(editor) &&
+                   editor->dirty_begin < viewport.line_end + 1 &&
+                   editor->dirty_end > viewport.line_begin) {
+            text_layer_render_rows(renderer, &layer, &batch, &glyphs, &font, &viewport,
+                                   editor->dirty_begin, editor->dirty_end);
+        }
+        editor_clear_dirty(editor);
+
+        scc(SDL_RenderCopy(renderer, layer.texture, NULL, NULL));
+        prof_count(PROF_DRAW_CALLS, 1);
+        render_cursors(renderer, &font, editor, &viewport);
+
+        if (buffer->searching) {
+            int w, h;
+            SDL_GetWindowSize(window, &w, &h);
+            const float y = search_prompt_layout(&glyphs);
+            const SDL_Rect prompt = {.x = 0, .y = (int) y, .w = w, .h = h - (int) y};
+            scc(SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255));
+            scc(SDL_RenderFillRect(renderer, &prompt));
+            glyph_batch_flush(renderer, &batch, &font, &glyphs, FONT_SCALE);
+        }
+        if (prof_overlay) {
+            const SDL_Rect overlay = prof_overlay_layout(&glyphs, false);
+            scc(SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255));
+            scc(SDL_RenderFillRect(renderer, &overlay));
+            glyph_batch_flush(renderer, &batch, &font, &glyphs, FONT_SCALE);
+        }
+
+        {
+            PROF_ZONE("present");
+            SDL_RenderPresent(renderer);
+        }
+        input_frame_presented();
+        prof_frame_end();
+
+        // Keep animation frames paced, idle frames never get here without an event
+        const Uint32 duration = SDL_GetTicks() - start_time;
+        if (animating && duration < frame_ms) {
+            SDL_Delay(frame_ms - duration);
+        }
+    }
+
+    if (font.texture != NULL) {
+        SDL_DestroyTexture(font.texture);
+    }
+    atlas_free(&atlas);
+    highlight_spans_free(&spans);
+    if (PROF_ENABLED && getenv("GRIVE_TRACE") != NULL) {
+        trace_dump();
+    }
+    input_close();
+    jobs_shutdown();
+    buffers_free();
     SDL_Quit();
 
     return 0;
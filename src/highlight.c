@@ -0,0 +1,578 @@
+#define _DEFAULT_SOURCE
+#include "highlight.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "prof.h"
+
+// Rows lexed between two looks at the clock
+#define HIGHLIGHT_CHECK_ROWS 256
+
+typedef struct {
+    const char *word;
+    Highlight_Token token;
+} Highlight_Word;
+
+// Sorted by strcmp for highlight_lookup
+static const Highlight_Word highlight_c_words[] = {
+    {"FILE", HIGHLIGHT_TYPE},
+    {"NULL", HIGHLIGHT_KEYWORD},
+    {"_Alignas", HIGHLIGHT_KEYWORD},
+    {"_Alignof", HIGHLIGHT_KEYWORD},
+    {"_Atomic", HIGHLIGHT_KEYWORD},
+    {"_Bool", HIGHLIGHT_TYPE},
+    {"_Complex", HIGHLIGHT_TYPE},
+    {"_Generic", HIGHLIGHT_KEYWORD},
+    {"_Noreturn", HIGHLIGHT_KEYWORD},
+    {"_Static_assert", HIGHLIGHT_KEYWORD},
+    {"_Thread_local", HIGHLIGHT_KEYWORD},
+    {"alignas", HIGHLIGHT_KEYWORD},
+    {"alignof", HIGHLIGHT_KEYWORD},
+    {"asm", HIGHLIGHT_KEYWORD},
+    {"auto", HIGHLIGHT_KEYWORD},
+    {"bool", HIGHLIGHT_TYPE},
+    {"break", HIGHLIGHT_KEYWORD},
+    {"case", HIGHLIGHT_KEYWORD},
+    {"catch", HIGHLIGHT_KEYWORD},
+    {"char", HIGHLIGHT_TYPE},
+    {"char16_t", HIGHLIGHT_TYPE},
+    {"char32_t", HIGHLIGHT_TYPE},
+    {"char8_t", HIGHLIGHT_TYPE},
+    {"class", HIGHLIGHT_KEYWORD},
+    {"const", HIGHLIGHT_KEYWORD},
+    {"const_cast", HIGHLIGHT_KEYWORD},
+    {"consteval", HIGHLIGHT_KEYWORD},
+    {"constexpr", HIGHLIGHT_KEYWORD},
+    {"constinit", HIGHLIGHT_KEYWORD},
+    {"continue", HIGHLIGHT_KEYWORD},
+    {"decltype", HIGHLIGHT_KEYWORD},
+    {"default", HIGHLIGHT_KEYWORD},
+    {"delete", HIGHLIGHT_KEYWORD},
+    {"do", HIGHLIGHT_KEYWORD},
+    {"double", HIGHLIGHT_TYPE},
+    {"dynamic_cast", HIGHLIGHT_KEYWORD},
+    {"else", HIGHLIGHT_KEYWORD},
+    {"enum", HIGHLIGHT_KEYWORD},
+    {"explicit", HIGHLIGHT_KEYWORD},
+    {"export", HIGHLIGHT_KEYWORD},
+    {"extern", HIGHLIGHT_KEYWORD},
+    {"false", HIGHLIGHT_KEYWORD},
+    {"final", HIGHLIGHT_KEYWORD},
+    {"float", HIGHLIGHT_TYPE},
+    {"for", HIGHLIGHT_KEYWORD},
+    {"friend", HIGHLIGHT_KEYWORD},
+    {"goto", HIGHLIGHT_KEYWORD},
+    {"if", HIGHLIGHT_KEYWORD},
+    {"inline", HIGHLIGHT_KEYWORD},
+    {"int", HIGHLIGHT_TYPE},
+    {"int16_t", HIGHLIGHT_TYPE},
+    {"int32_t", HIGHLIGHT_TYPE},
+    {"int64_t", HIGHLIGHT_TYPE},
+    {"int8_t", HIGHLIGHT_TYPE},
+    {"intptr_t", HIGHLIGHT_TYPE},
+    {"long", HIGHLIGHT_TYPE},
+    {"mutable", HIGHLIGHT_KEYWORD},
+    {"namespace", HIGHLIGHT_KEYWORD},
+    {"new", HIGHLIGHT_KEYWORD},
+    {"noexcept", HIGHLIGHT_KEYWORD},
+    {"nullptr", HIGHLIGHT_KEYWORD},
+    {"operator", HIGHLIGHT_KEYWORD},
+    {"override", HIGHLIGHT_KEYWORD},
+    {"private", HIGHLIGHT_KEYWORD},
+    {"protected", HIGHLIGHT_KEYWORD},
+    {"ptrdiff_t", HIGHLIGHT_TYPE},
+    {"public", HIGHLIGHT_KEYWORD},
+    {"register", HIGHLIGHT_KEYWORD},
+    {"reinterpret_cast", HIGHLIGHT_KEYWORD},
+    {"restrict", HIGHLIGHT_KEYWORD},
+    {"return", HIGHLIGHT_KEYWORD},
+    {"short", HIGHLIGHT_TYPE},
+    {"signed", HIGHLIGHT_TYPE},
+    {"size_t", HIGHLIGHT_TYPE},
+    {"sizeof", HIGHLIGHT_KEYWORD},
+    {"ssize_t", HIGHLIGHT_TYPE},
+    {"static", HIGHLIGHT_KEYWORD},
+    {"static_assert", HIGHLIGHT_KEYWORD},
+    {"static_cast", HIGHLIGHT_KEYWORD},
+    {"struct", HIGHLIGHT_KEYWORD},
+    {"switch", HIGHLIGHT_KEYWORD},
+    {"template", HIGHLIGHT_KEYWORD},
+    {"this", HIGHLIGHT_KEYWORD},
+    {"thread_local", HIGHLIGHT_KEYWORD},
+    {"throw", HIGHLIGHT_KEYWORD},
+    {"true", HIGHLIGHT_KEYWORD},
+    {"try", HIGHLIGHT_KEYWORD},
+    {"typedef", HIGHLIGHT_KEYWORD},
+    {"typeid", HIGHLIGHT_KEYWORD},
+    {"typename", HIGHLIGHT_KEYWORD},
+    {"uint16_t", HIGHLIGHT_TYPE},
+    {"uint32_t", HIGHLIGHT_TYPE},
+    {"uint64_t", HIGHLIGHT_TYPE},
+    {"uint8_t", HIGHLIGHT_TYPE},
+    {"uintptr_t", HIGHLIGHT_TYPE},
+    {"union", HIGHLIGHT_KEYWORD},
+    {"unsigned", HIGHLIGHT_TYPE},
+    {"using", HIGHLIGHT_KEYWORD},
+    {"virtual", HIGHLIGHT_KEYWORD},
+    {"void", HIGHLIGHT_TYPE},
+    {"volatile", HIGHLIGHT_KEYWORD},
+    {"wchar_t", HIGHLIGHT_TYPE},
+    {"while", HIGHLIGHT_KEYWORD},
+};
+
+#define HIGHLIGHT_C_WORDS (sizeof(highlight_c_words) / sizeof(highlight_c_words[0]))
+
+static const char *highlight_c_extensions[] = {
+    ".c", ".h", ".cc", ".cpp", ".cxx", ".c++", ".hh", ".hpp", ".hxx", ".h++", ".inl",
+};
+
+Highlight_Language highlight_language_for_path(const char *file_path)
+{
+    if (file_path == NULL) {
+        return HIGHLIGHT_NONE;
+    }
+    const char *extension = strrchr(file_path, '.');
+    if (extension == NULL || strchr(extension, '/') != NULL) {
+        return HIGHLIGHT_NONE;
+    }
+    for (size_t i = 0; i < sizeof(highlight_c_extensions) / sizeof(highlight_c_extensions[0]); ++i) {
+        if (strcasecmp(extension, highlight_c_extensions[i]) == 0) {
+            return HIGHLIGHT_C;
+        }
+    }
+    return HIGHLIGHT_NONE;
+}
+
+static Highlight_Token highlight_lookup(const char *word, size_t len)
+{
+    size_t lo = 0;
+    size_t hi = HIGHLIGHT_C_WORDS;
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+        const char *candidate = highlight_c_words[mid].word;
+        int cmp = strncmp(word, candidate, len);
+        if (cmp == 0 && candidate[len] != '\0') {
+            // `word` is a prefix of the candidate
+            cmp = -1;
+        }
+        if (cmp == 0) {
+            return highlight_c_words[mid].token;
+        }
+        if (cmp < 0) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return HIGHLIGHT_PLAIN;
+}
+
+static void highlight_push(Highlight_Spans *spans, size_t begin, Highlight_Token token)
+{
+    if (spans == NULL) {
+        return;
+    }
+    if (spans->count > 0 && spans->items[spans->count - 1].token == token) {
+        return;
+    }
+    if (spans->count == spans->cap) {
+        spans->cap = spans->cap == 0 ? 64 : spans->cap * 2;
+        spans->items = realloc(spans->items, spans->cap * sizeof(spans->items[0]));
+        if (spans->items == NULL) {
+            fprintf(stderr, "ERROR: could not allocate highlight spans\n");
+            exit(1);
+        }
+    }
+    spans->items[spans->count++] = (Highlight_Span) {.begin = begin, .token = token};
+}
+
+static bool highlight_is_word(char c)
+{
+    // Bytes of non-ASCII code points are taken as part of identifiers
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+           c == '_' || (unsigned char) c >= 0x80;
+}
+
+static bool highlight_is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+// Goes on to the next line if the line ends with a backslash
+static bool highlight_continues(const char *text, size_t len)
+{
+    return len > 0 && text[len - 1] == '\\';
+}
+
+// End of the `quote` literal whose body starts at `i`, just past the closing
+// quote, or `len` if the line ends first
+static size_t highlight_skip_quoted(const char *text, size_t len, size_t i, char quote, bool *closed)
+{
+    while (i < len) {
+        if (text[i] == '\\') {
+            i += 2;
+        } else if (text[i] == quote) {
+            *closed = true;
+            return i + 1;
+        } else {
+            i += 1;
+        }
+    }
+    *closed = false;
+    return len;
+}
+
+// End of the block comment whose body starts at `i`, just past `*/`, or `len`
+// if it goes on past the line
+static size_t highlight_skip_comment(const char *text, size_t len, size_t i, bool *closed)
+{
+    while (i + 1 < len) {
+        const char *star = memchr(text + i, '*', len - 1 - i);
+        if (star == NULL) {
+            break;
+        }
+        i = (size_t) (star - text);
+        if (text[i + 1] == '/') {
+            *closed = true;
+            return i + 2;
+        }
+        i += 1;
+    }
+    *closed = false;
+    return len;
+}
+
+static size_t highlight_skip_number(const char *text, size_t len, size_t i)
+{
+    while (i < len) {
+        const char c = text[i];
+        if ((c == '+' || c == '-') && (text[i - 1] == 'e' || text[i - 1] == 'E' ||
+                                       text[i - 1] == 'p' || text[i - 1] == 'P')) {
+            i += 1;
+        } else if (highlight_is_word(c) || c == '.' || c == '\'') {
+            i += 1;
+        } else {
+            break;
+        }
+    }
+    return i;
+}
+
+Highlight_State highlight_line(Highlight_Language language, Highlight_State state,
+                               const char *text, size_t len, size_t stop, Highlight_Spans *spans)
+{
+    if (spans != NULL) {
+        spans->count = 0;
+    }
+    if (language == HIGHLIGHT_NONE) {
+        highlight_push(spans, 0, HIGHLIGHT_PLAIN);
+        return HIGHLIGHT_STATE_NORMAL;
+    }
+
+    size_t i = 0;
+    bool closed = false;
+    switch (state) {
+    case HIGHLIGHT_STATE_NORMAL:
+        break;
+
+    case HIGHLIGHT_STATE_BLOCK_COMMENT:
+        highlight_push(spans, 0, HIGHLIGHT_COMMENT);
+        i = highlight_skip_comment(text, len, 0, &closed);
+        if (!closed) {
+            return HIGHLIGHT_STATE_BLOCK_COMMENT;
+        }
+        break;
+
+    case HIGHLIGHT_STATE_LINE_COMMENT:
+        highlight_push(spans, 0, HIGHLIGHT_COMMENT);
+        return highlight_continues(text, len) ? HIGHLIGHT_STATE_LINE_COMMENT : HIGHLIGHT_STATE_NORMAL;
+
+    case HIGHLIGHT_STATE_STRING:
+        highlight_push(spans, 0, HIGHLIGHT_STRING);
+        i = highlight_skip_quoted(text, len, 0, '"', &closed);
+        if (!closed) {
+            return highlight_continues(text, len) ? HIGHLIGHT_STATE_STRING : HIGHLIGHT_STATE_NORMAL;
+        }
+        break;
+    }
+
+    // Only blanks came before, so `#` starts a directive
+    bool line_start = state == HIGHLIGHT_STATE_NORMAL;
+    // `<...>` after #include is a path
+    bool include = false;
+    while (i < len) {
+        const char c = text[i];
+        const size_t begin = i;
+        if (i >= stop) {
+            // Past `stop` the rest of the line only matters for where it ends
+            spans = NULL;
+        }
+
+        if (c == ' ' || c == '\t' || c == '\r') {
+            highlight_push(spans, begin, HIGHLIGHT_PLAIN);
+            i += 1;
+            continue;
+        }
+
+        if (c == '/' && i + 1 < len && text[i + 1] == '/') {
+            highlight_push(spans, begin, HIGHLIGHT_COMMENT);
+            return highlight_continues(text, len) ? HIGHLIGHT_STATE_LINE_COMMENT : HIGHLIGHT_STATE_NORMAL;
+        } else if (c == '/' && i + 1 < len && text[i + 1] == '*') {
+            highlight_push(spans, begin, HIGHLIGHT_COMMENT);
+            i = highlight_skip_comment(text, len, i + 2, &closed);
+            if (!closed) {
+                return HIGHLIGHT_STATE_BLOCK_COMMENT;
+            }
+            continue;
+        } else if (c == '"' || c == '\'' || (c == '<' && include)) {
+            highlight_push(spans, begin, HIGHLIGHT_STRING);
+            i = highlight_skip_quoted(text, len, i + 1, c == '<' ? '>' : c, &closed);
+            if (!closed && c == '"' && highlight_continues(text, len)) {
+                return HIGHLIGHT_STATE_STRING;
+            }
+        } else if (c == '#' && line_start) {
+            highlight_push(spans, begin, HIGHLIGHT_PREPROC);
+            i += 1;
+            while (i < len && (text[i] == ' ' || text[i] == '\t')) {
+                i += 1;
+            }
+            const size_t word = i;
+            while (i < len && highlight_is_word(text[i])) {
+                i += 1;
+            }
+            include = (i - word == 7 && memcmp(text + word, "include", 7) == 0) ||
+                      (i - word == 6 && memcmp(text + word, "import", 6) == 0);
+        } else if (highlight_is_digit(c) || (c == '.' && i + 1 < len && highlight_is_digit(text[i + 1]))) {
+            highlight_push(spans, begin, HIGHLIGHT_NUMBER);
+            i = highlight_skip_number(text, len, i + 1);
+        } else if (highlight_is_word(c)) {
+            while (i < len && highlight_is_word(text[i])) {
+                i += 1;
+            }
+            if (spans != NULL) {
+                highlight_push(spans, begin, highlight_lookup(text + begin, i - begin));
+            }
+        } else {
+            highlight_push(spans, begin, HIGHLIGHT_PLAIN);
+            i += 1;
+        }
+        line_start = false;
+    }
+
+    return HIGHLIGHT_STATE_NORMAL;
+}
+
+static void highlight_mark_dirty(Highlight *highlight, size_t begin, size_t end)
+{
+    if (begin >= end) {
+        return;
+    }
+    if (highlight->dirty_begin >= highlight->dirty_end) {
+        highlight->dirty_begin = begin;
+        highlight->dirty_end = end;
+        return;
+    }
+    if (begin < highlight->dirty_begin) highlight->dirty_begin = begin;
+    if (end > highlight->dirty_end) highlight->dirty_end = end;
+}
+
+bool highlight_take_dirty(Highlight *highlight, size_t *begin, size_t *end)
+{
+    if (highlight->dirty_begin >= highlight->dirty_end) {
+        return false;
+    }
+    *begin = highlight->dirty_begin;
+    *end = highlight->dirty_end;
+    highlight->dirty_begin = 0;
+    highlight->dirty_end = 0;
+    return true;
+}
+
+void highlight_edit(Highlight *highlight, size_t row)
+{
+    // Rows past valid_end get lexed when they are reached anyway
+    if (highlight->language == HIGHLIGHT_NONE || row >= highlight->valid_end) {
+        return;
+    }
+    if (highlight->edit_begin >= highlight->edit_end) {
+        highlight->edit_begin = row;
+        highlight->edit_end = row + 1;
+        return;
+    }
+    if (row < highlight->edit_begin) highlight->edit_begin = row;
+    if (row + 1 > highlight->edit_end) highlight->edit_end = row + 1;
+}
+
+void highlight_insert_row(Highlight *highlight, size_t row)
+{
+    if (row >= highlight->valid_end) {
+        return;
+    }
+    highlight->valid_end += 1;
+    if (highlight->edit_begin < highlight->edit_end) {
+        if (highlight->edit_begin >= row) highlight->edit_begin += 1;
+        if (highlight->edit_end > row) highlight->edit_end += 1;
+    }
+    highlight_edit(highlight, row);
+}
+
+void highlight_remove_row(Highlight *highlight, size_t row)
+{
+    if (row >= highlight->valid_end) {
+        return;
+    }
+    highlight->valid_end -= 1;
+    if (highlight->edit_begin < highlight->edit_end) {
+        if (highlight->edit_begin > row) highlight->edit_begin -= 1;
+        if (highlight->edit_end > row) highlight->edit_end -= 1;
+    }
+    // The row now at `row` starts from another state
+    if (row < highlight->valid_end) {
+        highlight_edit(highlight, row);
+    }
+}
+
+void highlight_insert_rows(Highlight *highlight, size_t row, size_t count)
+{
+    if (row >= highlight->valid_end || count == 0) {
+        return;
+    }
+    // Everything from `row` on is up to date no more
+    highlight->valid_end = row;
+    if (highlight->edit_begin >= row) {
+        highlight->edit_begin = highlight->edit_end = 0;
+    } else if (highlight->edit_end > row) {
+        highlight->edit_end = row;
+    }
+}
+
+// Where row `at` went after the rows [row, row + count) were removed
+static size_t highlight_removed_at(size_t at, size_t row, size_t count)
+{
+    if (at <= row) {
+        return at;
+    }
+    return at < row + count ? row : at - count;
+}
+
+void highlight_remove_rows(Highlight *highlight, size_t row, size_t count)
+{
+    if (row >= highlight->valid_end || count == 0) {
+        return;
+    }
+    highlight->valid_end = highlight_removed_at(highlight->valid_end, row, count);
+    if (highlight->edit_begin < highlight->edit_end) {
+        highlight->edit_begin = highlight_removed_at(highlight->edit_begin, row, count);
+        highlight->edit_end = highlight_removed_at(highlight->edit_end, row, count);
+    }
+    // The row now at `row` starts from another state
+    if (row < highlight->valid_end) {
+        highlight_edit(highlight, row);
+    }
+}
+
+static Highlight_State highlight_state_before(const Lines *lines, size_t row)
+{
+    return row == 0 ? HIGHLIGHT_STATE_NORMAL : (Highlight_State) lines_at(lines, row - 1)->highlight;
+}
+
+static double highlight_now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// Re-lexes the edited rows, then the rows after them until one ends in the
+// state it did before: everything below it is still right. Rows past
+// `row_end` aren't visible, if they'd be next they are left to be lexed
+// when they are scrolled to.
+static void highlight_relex(Highlight *highlight, Lines *lines, size_t row_end)
+{
+    Highlight_State state = highlight_state_before(lines, highlight->edit_begin);
+    size_t row = highlight->edit_begin;
+    while (row < highlight->valid_end) {
+        size_t count = 0;
+        Line *span = lines_span(lines, row, &count);
+        for (size_t i = 0; i < count && row < highlight->valid_end; ++i, ++row) {
+            Line *line = &span[i];
+            state = highlight_line(highlight->language, state, line->chars, line->len, 0, NULL);
+            const bool same = state == line->highlight;
+            line->highlight = state;
+            if (row + 1 >= highlight->edit_end && (same || row + 1 >= row_end)) {
+                if (!same) {
+                    highlight->valid_end = row + 1;
+                }
+                highlight_mark_dirty(highlight, highlight->edit_begin, row + 1);
+                highlight->edit_begin = highlight->edit_end = 0;
+                return;
+            }
+        }
+    }
+    highlight_mark_dirty(highlight, highlight->edit_begin, row);
+    highlight->edit_begin = highlight->edit_end = 0;
+}
+
+bool highlight_update(Highlight *highlight, Lines *lines, size_t row_end, double budget_ms)
+{
+    PROF_ZONE("highlight_update");
+    if (highlight->language == HIGHLIGHT_NONE) {
+        return false;
+    }
+    if (row_end > lines->len) {
+        row_end = lines->len;
+    }
+
+    if (highlight->edit_begin < highlight->edit_end) {
+        highlight_relex(highlight, lines, row_end);
+    }
+
+    const double deadline = highlight_now_ms() + budget_ms;
+    const size_t begin = highlight->valid_end;
+    Highlight_State state = highlight_state_before(lines, begin);
+    while (highlight->valid_end < row_end) {
+        if (highlight->valid_end > begin && highlight_now_ms() >= deadline) {
+            break;
+        }
+        size_t count = 0;
+        Line *span = lines_span(lines, highlight->valid_end, &count);
+        if (count > row_end - highlight->valid_end) {
+            count = row_end - highlight->valid_end;
+        }
+        if (count > HIGHLIGHT_CHECK_ROWS) {
+            count = HIGHLIGHT_CHECK_ROWS;
+        }
+        for (size_t i = 0; i < count; ++i) {
+            state = highlight_line(highlight->language, state, span[i].chars, span[i].len, 0, NULL);
+            span[i].highlight = state;
+        }
+        highlight->valid_end += count;
+    }
+    highlight_mark_dirty(highlight, begin, highlight->valid_end);
+    return highlight->valid_end < row_end;
+}
+
+bool highlight_row(const Highlight *highlight, const Lines *lines, size_t row, size_t stop,
+                   Highlight_Spans *spans)
+{
+    if (highlight->language == HIGHLIGHT_NONE || row >= highlight->valid_end) {
+        return false;
+    }
+    // The text or the state it starts in changed since the last update
+    if (highlight->edit_begin < highlight->edit_end &&
+        row >= highlight->edit_begin && row <= highlight->edit_end) {
+        return false;
+    }
+    const Line *line = lines_at(lines, row);
+    highlight_line(highlight->language, highlight_state_before(lines, row), line->chars, line->len, stop, spans);
+    return true;
+}
+
+void highlight_spans_free(Highlight_Spans *spans)
+{
+    free(spans->items);
+    memset(spans, 0, sizeof(*spans));
+}
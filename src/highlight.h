@@ -0,0 +1,95 @@
+#ifndef HIGHLIGHT_H_
+#define HIGHLIGHT_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "lines.h"
+
+typedef enum {
+    HIGHLIGHT_NONE = 0,
+    HIGHLIGHT_C,
+} Highlight_Language;
+
+typedef enum {
+    HIGHLIGHT_PLAIN = 0,
+    HIGHLIGHT_KEYWORD,
+    HIGHLIGHT_TYPE,
+    HIGHLIGHT_PREPROC,
+    HIGHLIGHT_STRING,
+    HIGHLIGHT_NUMBER,
+    HIGHLIGHT_COMMENT,
+    COUNT_HIGHLIGHT_TOKENS,
+} Highlight_Token;
+
+// What the lexer is in the middle of at the end of a line, kept in
+// Line.highlight. Only constructs that can go on past a newline need one.
+typedef enum {
+    HIGHLIGHT_STATE_NORMAL = 0,
+    HIGHLIGHT_STATE_BLOCK_COMMENT,
+    // A `//` comment or a string whose line ends with a backslash
+    HIGHLIGHT_STATE_LINE_COMMENT,
+    HIGHLIGHT_STATE_STRING,
+} Highlight_State;
+
+// Bytes from `begin` up to the begin of the next span are `token`
+typedef struct {
+    size_t begin;
+    Highlight_Token token;
+} Highlight_Span;
+
+typedef struct {
+    Highlight_Span *items;
+    size_t count;
+    size_t cap;
+} Highlight_Spans;
+
+// Incremental highlighting of the lines of an editor. Every line stores the
+// state the lexer ends it in, so a line can be colorized on its own from the
+// state of the line above. An edit only re-lexes from the edited line until
+// the end state comes out the same as before; rows below the viewport are
+// lexed once they are scrolled to, a budget at a time.
+typedef struct {
+    Highlight_Language language;
+    // End states of rows [0, valid_end) are up to date, except for the rows
+    // of [edit_begin, edit_end) whose text changed since
+    size_t valid_end;
+    size_t edit_begin;
+    size_t edit_end;
+
+    // Rows whose colors changed since the last highlight_take_dirty
+    size_t dirty_begin;
+    size_t dirty_end;
+} Highlight;
+
+// The language of a file by its extension, HIGHLIGHT_NONE if there is none
+Highlight_Language highlight_language_for_path(const char *file_path);
+
+// Lexes one line starting in `state` and returns the state it ends in. With
+// `spans` it's colorized as well, up to the token going on at byte `stop`.
+Highlight_State highlight_line(Highlight_Language language, Highlight_State state,
+                               const char *text, size_t len, size_t stop, Highlight_Spans *spans);
+
+// The text of `row` changed
+void highlight_edit(Highlight *highlight, size_t row);
+// A line was inserted before / removed at `row`, moving the rows after it
+void highlight_insert_row(Highlight *highlight, size_t row);
+void highlight_remove_row(Highlight *highlight, size_t row);
+// Lines inserted or removed in bulk, like a paste. Inserted lines are lexed
+// like rows nobody lexed yet, a budget at a time from the first of them.
+void highlight_insert_rows(Highlight *highlight, size_t row, size_t count);
+void highlight_remove_rows(Highlight *highlight, size_t row, size_t count);
+
+// Brings the end states of rows [0, row_end) up to date, spending at most
+// `budget_ms` on rows nobody lexed yet. Returns true while some are left.
+bool highlight_update(Highlight *highlight, Lines *lines, size_t row_end, double budget_ms);
+// Colorizes `row` up to byte `stop`. Returns false if it can't be yet, the
+// row is then drawn plain until highlight_take_dirty reports it.
+bool highlight_row(const Highlight *highlight, const Lines *lines, size_t row, size_t stop,
+                   Highlight_Spans *spans);
+bool highlight_take_dirty(Highlight *highlight, size_t *begin, size_t *end);
+
+void highlight_spans_free(Highlight_Spans *spans);
+
+#endif // HIGHLIGHT_H_
@@ -0,0 +1,267 @@
+#define _DEFAULT_SOURCE
+#include "jobs.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define JOBS_DEQUE_INIT_CAPACITY 64
+
+// Deque of the worker running on this thread, so jobs submitted from inside a
+// job stay on the worker that made them until someone steals them
+static _Thread_local Jobs_Deque *jobs_own_deque = NULL;
+
+static void jobs_deque_push(Jobs_Deque *deque, Job *job)
+{
+    pthread_mutex_lock(&deque->lock);
+    if (deque->count == deque->cap) {
+        const size_t new_cap = deque->cap == 0 ? JOBS_DEQUE_INIT_CAPACITY : deque->cap * 2;
+        Job **items = malloc(new_cap * sizeof(items[0]));
+        if (items == NULL) {
+            fprintf(stderr, "ERROR: could not allocate job queue\n");
+            exit(1);
+        }
+        for (size_t i = 0; i < deque->count; ++i) {
+            items[i] = deque->items[(deque->head + i) % deque->cap];
+        }
+        free(deque->items);
+        deque->items = items;
+        deque->head = 0;
+        deque->cap = new_cap;
+    }
+    deque->items[(deque->head + deque->count) % deque->cap] = job;
+    deque->count += 1;
+    pthread_mutex_unlock(&deque->lock);
+}
+
+// The owner takes the newest job, its data is most likely still in cache
+static Job *jobs_deque_pop(Jobs_Deque *deque)
+{
+    Job *job = NULL;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->count > 0) {
+        deque->count -= 1;
+        job = deque->items[(deque->head + deque->count) % deque->cap];
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return job;
+}
+
+// Thieves take the oldest job, which tends to be the biggest piece of work
+static Job *jobs_deque_steal(Jobs_Deque *deque)
+{
+    Job *job = NULL;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->count > 0) {
+        job = deque->items[deque->head];
+        deque->head = (deque->head + 1) % deque->cap;
+        deque->count -= 1;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return job;
+}
+
+static Job *jobs_take(Jobs *jobs, size_t index)
+{
+    Job *job = jobs_deque_pop(&jobs->deques[index]);
+    for (size_t i = 1; job == NULL && i < jobs->count; ++i) {
+        job = jobs_deque_steal(&jobs->deques[(index + i) % jobs->count]);
+    }
+    if (job != NULL) {
+        atomic_fetch_sub(&jobs->pending, 1);
+    }
+    return job;
+}
+
+static void jobs_finish(Jobs *jobs, Job *job)
+{
+    atomic_store(&job->state, JOB_FINISHED);
+    Job *head = atomic_load(&jobs->finished);
+    do {
+        job->next = head;
+    } while (!atomic_compare_exchange_weak(&jobs->finished, &head, job));
+}
+
+static void *jobs_worker_run(void *arg)
+{
+    Jobs_Worker *worker = arg;
+    Jobs *jobs = worker->jobs;
+    jobs_own_deque = &jobs->deques[worker->index];
+
+    while (!atomic_load(&jobs->quit)) {
+        Job *job = jobs_take(jobs, worker->index);
+        if (job == NULL) {
+            pthread_mutex_lock(&jobs->sleep_lock);
+            while (atomic_load(&jobs->pending) == 0 && !atomic_load(&jobs->quit)) {
+                pthread_cond_wait(&jobs->wake, &jobs->sleep_lock);
+            }
+            pthread_mutex_unlock(&jobs->sleep_lock);
+            continue;
+        }
+
+        atomic_store(&job->state, JOB_RUNNING);
+        job->run(job);
+        jobs_finish(jobs, job);
+    }
+
+    return NULL;
+}
+
+void jobs_init(Jobs *jobs, size_t threads)
+{
+    memset(jobs, 0, sizeof(*jobs));
+    if (threads == 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = online > 1 ? (size_t) online - 1 : 1;
+    }
+    if (threads > JOBS_MAX_THREADS) {
+        threads = JOBS_MAX_THREADS;
+    }
+
+    pthread_mutex_init(&jobs->sleep_lock, NULL);
+    pthread_cond_init(&jobs->wake, NULL);
+    for (size_t i = 0; i < JOBS_MAX_THREADS; ++i) {
+        pthread_mutex_init(&jobs->deques[i].lock, NULL);
+    }
+
+    // A deque whose worker didn't start is still emptied by the others
+    jobs->count = threads;
+    for (size_t i = 0; i < threads; ++i) {
+        Jobs_Worker *worker = &jobs->workers[i];
+        worker->jobs = jobs;
+        worker->index = i;
+        worker->started = pthread_create(&worker->thread, NULL, jobs_worker_run, worker) == 0;
+        jobs->started += worker->started;
+    }
+    if (jobs->started == 0) {
+        fprintf(stderr, "ERROR: could not start any worker thread\n");
+        exit(1);
+    }
+}
+
+void jobs_free(Jobs *jobs)
+{
+    pthread_mutex_lock(&jobs->sleep_lock);
+    atomic_store(&jobs->quit, true);
+    pthread_cond_broadcast(&jobs->wake);
+    pthread_mutex_unlock(&jobs->sleep_lock);
+
+    for (size_t i = 0; i < jobs->count; ++i) {
+        if (jobs->workers[i].started) {
+            pthread_join(jobs->workers[i].thread, NULL);
+        }
+    }
+
+    // Jobs that never ran are cancelled and reported done with the finished
+    // ones, so their owners can still wait for them and free them
+    for (size_t i = 0; i < jobs->count; ++i) {
+        Job *job;
+        while ((job = jobs_deque_pop(&jobs->deques[i])) != NULL) {
+            job_cancel(job);
+            jobs_finish(jobs, job);
+        }
+    }
+    jobs_poll(jobs);
+
+    for (size_t i = 0; i < JOBS_MAX_THREADS; ++i) {
+        pthread_mutex_destroy(&jobs->deques[i].lock);
+        free(jobs->deques[i].items);
+    }
+    pthread_cond_destroy(&jobs->wake);
+    pthread_mutex_destroy(&jobs->sleep_lock);
+    memset(jobs, 0, sizeof(*jobs));
+}
+
+void jobs_submit(Jobs *jobs, Job *job)
+{
+    atomic_store(&job->state, JOB_QUEUED);
+    atomic_store(&job->cancelled, false);
+    atomic_store(&job->progress, 0);
+    atomic_store(&job->total, 0);
+    job->next = NULL;
+    atomic_fetch_add(&jobs->running, 1);
+    // Counted before it can be taken, so `pending` never drops below zero
+    atomic_fetch_add(&jobs->pending, 1);
+
+    Jobs_Deque *deque = jobs_own_deque;
+    if (deque == NULL) {
+        // Spread the jobs of the main thread, idle workers even them out
+        deque = &jobs->deques[jobs->next_deque];
+        jobs->next_deque = (jobs->next_deque + 1) % jobs->count;
+    }
+    jobs_deque_push(deque, job);
+
+    pthread_mutex_lock(&jobs->sleep_lock);
+    pthread_cond_signal(&jobs->wake);
+    pthread_mutex_unlock(&jobs->sleep_lock);
+}
+
+size_t jobs_poll(Jobs *jobs)
+{
+    Job *finished = atomic_exchange(&jobs->finished, NULL);
+
+    // The list is newest first, report them in the order they finished
+    Job *ordered = NULL;
+    while (finished != NULL) {
+        Job *next = finished->next;
+        finished->next = ordered;
+        ordered = finished;
+        finished = next;
+    }
+
+    while (ordered != NULL) {
+        Job *job = ordered;
+        ordered = job->next;
+        job->next = NULL;
+        atomic_store(&job->state, JOB_DONE);
+        atomic_fetch_sub(&jobs->running, 1);
+        if (job->done != NULL) {
+            job->done(job);
+        }
+    }
+
+    return atomic_load(&jobs->running);
+}
+
+void jobs_wait(Jobs *jobs, Job *job)
+{
+    const struct timespec pause = {.tv_sec = 0, .tv_nsec = 100 * 1000};
+    jobs_poll(jobs);
+    while (!job_is_done(job)) {
+        nanosleep(&pause, NULL);
+        jobs_poll(jobs);
+    }
+}
+
+void job_cancel(Job *job)
+{
+    atomic_store(&job->cancelled, true);
+}
+
+bool job_cancelled(const Job *job)
+{
+    return atomic_load(&job->cancelled);
+}
+
+void job_set_progress(Job *job, size_t progress, size_t total)
+{
+    atomic_store(&job->total, total);
+    atomic_store(&job->progress, progress);
+}
+
+float job_progress(const Job *job)
+{
+    const size_t total = atomic_load(&job->total);
+    if (total == 0) {
+        return 0.0f;
+    }
+    return (float) atomic_load(&job->progress) / (float) total;
+}
+
+bool job_is_done(const Job *job)
+{
+    return atomic_load(&job->state) == JOB_DONE;
+}
@@ -0,0 +1,100 @@
+#ifndef JOBS_H_
+#define JOBS_H_
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define JOBS_MAX_THREADS 64
+
+typedef enum {
+    JOB_IDLE = 0,
+    JOB_QUEUED,
+    JOB_RUNNING,
+    // Ran on a worker, waiting in the completion queue
+    JOB_FINISHED,
+    // Picked up by jobs_poll on the main thread
+    JOB_DONE,
+} Job_State;
+
+typedef struct Job Job;
+
+// A piece of work for the pool. Jobs are embedded in whatever they work on, the
+// pool never allocates or frees them, so a job has to outlive its run.
+struct Job {
+    // Runs on a worker thread
+    void (*run)(Job *job);
+    // Runs on the thread calling jobs_poll once `run` returned, may be NULL
+    void (*done)(Job *job);
+    void *data;
+
+    _Atomic int state;
+    atomic_bool cancelled;
+    atomic_size_t progress;
+    atomic_size_t total;
+
+    Job *next;
+};
+
+// Jobs of a worker. The worker takes the newest one, idle workers steal the
+// oldest ones from the others.
+typedef struct {
+    pthread_mutex_t lock;
+    Job **items;
+    size_t head;
+    size_t count;
+    size_t cap;
+} Jobs_Deque;
+
+typedef struct Jobs Jobs;
+
+typedef struct {
+    Jobs *jobs;
+    size_t index;
+    pthread_t thread;
+    bool started;
+} Jobs_Worker;
+
+struct Jobs {
+    Jobs_Worker workers[JOBS_MAX_THREADS];
+    Jobs_Deque deques[JOBS_MAX_THREADS];
+    size_t count;
+    size_t started;
+    size_t next_deque;
+
+    // Idle workers sleep until something is submitted
+    pthread_mutex_t sleep_lock;
+    pthread_cond_t wake;
+    atomic_size_t pending;
+    atomic_bool quit;
+
+    // Finished jobs, pushed by the workers and taken all at once by
+    // jobs_poll, so it needs no lock
+    _Atomic(Job *) finished;
+    // Submitted jobs that jobs_poll hasn't reported yet
+    atomic_size_t running;
+};
+
+// Starts `threads` workers, or one less than there are CPUs when it's 0
+void jobs_init(Jobs *jobs, size_t threads);
+// Cancels nothing: jobs already running are waited for, queued ones are
+// dropped. Either way every job is done afterwards, its `done` called.
+void jobs_free(Jobs *jobs);
+
+// Queues `job`, which must not be queued or running already
+void jobs_submit(Jobs *jobs, Job *job);
+// Calls `done` of every finished job. Returns how many are still queued or running.
+size_t jobs_poll(Jobs *jobs);
+// Polls until `job` is done, for the few places that can't go on without it
+void jobs_wait(Jobs *jobs, Job *job);
+
+// Asks a job to stop early, `run` has to check job_cancelled itself
+void job_cancel(Job *job);
+bool job_cancelled(const Job *job);
+void job_set_progress(Job *job, size_t progress, size_t total);
+// Fraction of the job that is done, 0 until it reports progress
+float job_progress(const Job *job);
+bool job_is_done(const Job *job);
+
+#endif // JOBS_H_
@@ -1,42 +1,44 @@
 #include "la.h"
 
-Vec2 vec2_one() {
-    return (Vec2){.x = 1, .y = 1};
+#if defined(__x86_64__) || defined(__SSE__)
+#define LA_SSE
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON)
+#define LA_NEON
+#include <arm_neon.h>
+#endif
+
+// values[i] = values[i] * scale + offset
+static void la_scale_offset(float *values, size_t count, float scale, float offset)
+{
+    size_t i = 0;
+#if defined(LA_SSE)
+    const __m128 s = _mm_set1_ps(scale);
+    const __m128 o = _mm_set1_ps(offset);
+    for (; i + 8 <= count; i += 8) {
+        const __m128 a = _mm_loadu_ps(values + i);
+        const __m128 b = _mm_loadu_ps(values + i + 4);
+        _mm_storeu_ps(values + i, _mm_add_ps(_mm_mul_ps(a, s), o));
+        _mm_storeu_ps(values + i + 4, _mm_add_ps(_mm_mul_ps(b, s), o));
+    }
+#elif defined(LA_NEON)
+    const float32x4_t s = vdupq_n_f32(scale);
+    const float32x4_t o = vdupq_n_f32(offset);
+    for (; i + 8 <= count; i += 8) {
+        const float32x4_t a = vld1q_f32(values + i);
+        const float32x4_t b = vld1q_f32(values + i + 4);
+        vst1q_f32(values + i, vmlaq_f32(o, a, s));
+        vst1q_f32(values + i + 4, vmlaq_f32(o, b, s));
+    }
+#endif
+    for (; i < count; ++i) {
+        values[i] = values[i] * scale + offset;
+    }
+}
+
+void vec2_transform_soa(Vec2_Transform t, float *xs, float *ys, size_t count)
+{
+    // One array at a time keeps every lane busy with the same scale
+    la_scale_offset(xs, count, t.scale.x, t.offset.x);
+    la_scale_offset(ys, count, t.scale.y, t.offset.y);
 }
-
-Vec2 vec2_zero() {
-    return (Vec2){.x = 0, .y = 0};
-}
-
-double vec2_norm(Vec2 v) {
-    return sqrtf(v.x * v.x + v.y * v.y);
-} 
-
-Vec2 vec2c(float x) {
-    return (Vec2){.x = x, .y = x};
-}
-
-Vec2 vec2s(float x, float y) {
-    return (Vec2){x, y};
-}
-
-Vec2 vec2_add(Vec2 a, Vec2 b) {
-    return (Vec2){a.x + b.x, a.y + b.y};
-}
-
-Vec2 vec2_sub(Vec2 a, Vec2 b) {
-    return (Vec2){a.x - b.x, a.y - b.y};
-}
-
-double vec2_dot(Vec2 a, Vec2 b) {
-    return (double){a.x * b.x + a.y * b.y};
-}
-
-Vec2 vec2_mul(Vec2 a, Vec2 b) {
-    return (Vec2){a.x * b.x, a.y * b.y};
-}
-
-Vec2 vec2_div(Vec2 a, Vec2 b) {
-    return (Vec2){a.x / b.x, a.y / b.y};
-}
-
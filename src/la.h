@@ -3,21 +3,67 @@
 #define LA_H_
 
 #include <math.h>
+#include <stddef.h>
 
 typedef struct {
     float x, y;
 } Vec2;
 
-Vec2 vec2_one();
-Vec2 vec2_zero();
+// Scales, then moves: p * scale + offset. The camera is one of these from
+// document cells to window pixels.
+typedef struct {
+    Vec2 scale;
+    Vec2 offset;
+} Vec2_Transform;
+
+// Small enough to live in the header, so layout loops can inline them
+
+static inline Vec2 vec2_one(void) {
+    return (Vec2){.x = 1, .y = 1};
+}
+
+static inline Vec2 vec2_zero(void) {
+    return (Vec2){.x = 0, .y = 0};
+}
+
+static inline double vec2_norm(Vec2 v) {
+    return sqrtf(v.x * v.x + v.y * v.y);
+}
+
+static inline double vec2_dot(Vec2 a, Vec2 b) {
+    return (double){a.x * b.x + a.y * b.y};
+}
+
+static inline Vec2 vec2c(float x) {
+    return (Vec2){.x = x, .y = x};
+}
+
+static inline Vec2 vec2s(float x, float y) {
+    return (Vec2){x, y};
+}
+
+static inline Vec2 vec2_add(Vec2 a, Vec2 b) {
+    return (Vec2){a.x + b.x, a.y + b.y};
+}
+
+static inline Vec2 vec2_sub(Vec2 a, Vec2 b) {
+    return (Vec2){a.x - b.x, a.y - b.y};
+}
+
+static inline Vec2 vec2_mul(Vec2 a, Vec2 b) {
+    return (Vec2){a.x * b.x, a.y * b.y};
+}
+
+static inline Vec2 vec2_div(Vec2 a, Vec2 b) {
+    return (Vec2){a.x / b.x, a.y / b.y};
+}
+
+static inline Vec2 vec2_transform(Vec2_Transform t, Vec2 p) {
+    return (Vec2){p.x * t.scale.x + t.offset.x, p.y * t.scale.y + t.offset.y};
+}
 
-double vec2_norm(Vec2 v); 
-double vec2_dot(Vec2 a, Vec2 b);
-Vec2 vec2c(float x);
-Vec2 vec2s(float x, float y);
-Vec2 vec2_add(Vec2 a, Vec2 b);
-Vec2 vec2_sub(Vec2 a, Vec2 b);
-Vec2 vec2_mul(Vec2 a, Vec2 b);
-Vec2 vec2_div(Vec2 a, Vec2 b);
+// Transforms `count` points kept as separate x and y arrays in place, several
+// at a time with SSE or NEON
+void vec2_transform_soa(Vec2_Transform t, float *xs, float *ys, size_t count);
 
-#endif // LA_H_
\ No newline at end of file
+#endif // LA_H_
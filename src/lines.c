@@ -0,0 +1,419 @@
+#include "lines.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LINES_INIT_CAPACITY 16
+
+static size_t lowbit(size_t i)
+{
+    return i & (~i + 1);
+}
+
+// Both trees are Fenwick trees over the chunks: `tree` sums their lines,
+// `visual_tree` the visual rows they take
+static size_t lines_prefix(const size_t *tree, size_t count)
+{
+    size_t sum = 0;
+    for (size_t i = count; i > 0; i -= lowbit(i)) {
+        sum += tree[i];
+    }
+    return sum;
+}
+
+static void lines_tree_add(Lines *lines, size_t chunk, long delta, long visual_delta)
+{
+    for (size_t i = chunk + 1; i <= lines->count; i += lowbit(i)) {
+        lines->tree[i] += delta;
+        lines->visual_tree[i] += visual_delta;
+    }
+}
+
+static void lines_tree_rebuild(Lines *lines)
+{
+    for (size_t i = 1; i <= lines->count; ++i) {
+        lines->tree[i] = lines->chunks[i - 1]->len;
+        lines->visual_tree[i] = lines->chunks[i - 1]->len + lines->chunks[i - 1]->wraps;
+    }
+    for (size_t i = 1; i <= lines->count; ++i) {
+        size_t parent = i + lowbit(i);
+        if (parent <= lines->count) {
+            lines->tree[parent] += lines->tree[i];
+            lines->visual_tree[parent] += lines->visual_tree[i];
+        }
+    }
+}
+
+// Finds the chunk holding the `n`th unit counted by `tree` and how many units
+// into the chunk it is
+static size_t lines_descend(const Lines *lines, const size_t *tree, size_t n, size_t *offset)
+{
+    size_t step = 1;
+    while (step * 2 <= lines->count) {
+        step *= 2;
+    }
+
+    size_t pos = 0;
+    for (; step > 0; step /= 2) {
+        if (pos + step <= lines->count && tree[pos + step] <= n) {
+            pos += step;
+            n -= tree[pos];
+        }
+    }
+
+    *offset = n;
+    return pos;
+}
+
+// Finds the chunk holding `row` and the offset of the row inside of it
+static size_t lines_locate(const Lines *lines, size_t row, size_t *offset)
+{
+    assert(row < lines->len);
+    return lines_descend(lines, lines->tree, row, offset);
+}
+
+static void lines_grow(Lines *lines, size_t n)
+{
+    size_t new_capacity = lines->cap;
+
+    while (new_capacity - lines->count < n) {
+        if (new_capacity == 0) {
+            new_capacity = LINES_INIT_CAPACITY;
+        } else {
+            new_capacity *= 2;
+        }
+    }
+
+    if (new_capacity != lines->cap) {
+        lines->chunks = realloc(lines->chunks, new_capacity * sizeof(lines->chunks[0]));
+        lines->tree = realloc(lines->tree, (new_capacity + 1) * sizeof(lines->tree[0]));
+        lines->visual_tree = realloc(lines->visual_tree, (new_capacity + 1) * sizeof(lines->visual_tree[0]));
+        if (lines->chunks == NULL || lines->tree == NULL || lines->visual_tree == NULL) {
+            fprintf(stderr, "ERROR: could not allocate line chunks\n");
+            exit(1);
+        }
+        lines->cap = new_capacity;
+    }
+}
+
+static Lines_Chunk *lines_alloc_chunk(void)
+{
+    Lines_Chunk *chunk = malloc(sizeof(*chunk));
+    if (chunk == NULL) {
+        fprintf(stderr, "ERROR: could not allocate line chunk\n");
+        exit(1);
+    }
+    chunk->len = 0;
+    chunk->wraps = 0;
+    return chunk;
+}
+
+static void lines_chunk_sum_wraps(Lines_Chunk *chunk)
+{
+    chunk->wraps = 0;
+    for (size_t i = 0; i < chunk->len; ++i) {
+        chunk->wraps += chunk->lines[i].wraps;
+    }
+}
+
+static Lines_Chunk *lines_new_chunk(Lines *lines, size_t index)
+{
+    lines_grow(lines, 1);
+
+    Lines_Chunk *chunk = lines_alloc_chunk();
+
+    memmove(lines->chunks + index + 1,
+            lines->chunks + index,
+            (lines->count - index) * sizeof(lines->chunks[0]));
+    lines->chunks[index] = chunk;
+    lines->count += 1;
+
+    if (index + 1 == lines->count) {
+        // Appending a leaf only needs the sum of the range it covers
+        size_t i = lines->count;
+        lines->tree[i] = lines_prefix(lines->tree, i - 1) - lines_prefix(lines->tree, i - lowbit(i));
+        lines->visual_tree[i] = lines_prefix(lines->visual_tree, i - 1) -
+                                lines_prefix(lines->visual_tree, i - lowbit(i));
+    } else {
+        lines_tree_rebuild(lines);
+    }
+
+    return chunk;
+}
+
+static void lines_split_chunk(Lines *lines, size_t index)
+{
+    Lines_Chunk *chunk = lines->chunks[index];
+    Lines_Chunk *next = lines_new_chunk(lines, index + 1);
+
+    const size_t half = chunk->len / 2;
+    next->len = chunk->len - half;
+    memcpy(next->lines, chunk->lines + half, next->len * sizeof(chunk->lines[0]));
+    chunk->len = half;
+    for (size_t i = 0; i < next->len; ++i) {
+        next->wraps += next->lines[i].wraps;
+    }
+    chunk->wraps -= next->wraps;
+
+    lines_tree_rebuild(lines);
+}
+
+Line *lines_at(const Lines *lines, size_t row)
+{
+    size_t offset = 0;
+    size_t index = lines_locate(lines, row, &offset);
+    return &lines->chunks[index]->lines[offset];
+}
+
+Line *lines_span(const Lines *lines, size_t row, size_t *count)
+{
+    size_t offset = 0;
+    size_t index = lines_locate(lines, row, &offset);
+    *count = lines->chunks[index]->len - offset;
+    return &lines->chunks[index]->lines[offset];
+}
+
+Line *lines_insert(Lines *lines, size_t row)
+{
+    assert(row <= lines->len);
+
+    size_t index, offset;
+    if (row == lines->len) {
+        if (lines->count == 0 || lines->chunks[lines->count - 1]->len == LINES_CHUNK_CAP) {
+            // Appending to a full chunk starts a new one so sequential loads
+            // keep the chunks packed
+            lines_new_chunk(lines, lines->count);
+        }
+        index = lines->count - 1;
+        offset = lines->chunks[index]->len;
+    } else {
+        index = lines_locate(lines, row, &offset);
+        if (lines->chunks[index]->len == LINES_CHUNK_CAP) {
+            lines_split_chunk(lines, index);
+            index = lines_locate(lines, row, &offset);
+        }
+    }
+
+    Lines_Chunk *chunk = lines->chunks[index];
+    memmove(chunk->lines + offset + 1,
+            chunk->lines + offset,
+            (chunk->len - offset) * sizeof(chunk->lines[0]));
+    memset(&chunk->lines[offset], 0, sizeof(chunk->lines[0]));
+    chunk->len += 1;
+    lines->len += 1;
+    lines_tree_add(lines, index, 1, 1);
+
+    return &chunk->lines[offset];
+}
+
+Line *lines_append(Lines *lines)
+{
+    return lines_insert(lines, lines->len);
+}
+
+void lines_remove(Lines *lines, size_t row)
+{
+    size_t offset = 0;
+    size_t index = lines_locate(lines, row, &offset);
+    Lines_Chunk *chunk = lines->chunks[index];
+    const size_t wraps = chunk->lines[offset].wraps;
+
+    memmove(chunk->lines + offset,
+            chunk->lines + offset + 1,
+            (chunk->len - offset - 1) * sizeof(chunk->lines[0]));
+    chunk->len -= 1;
+    chunk->wraps -= wraps;
+    lines->len -= 1;
+
+    if (chunk->len == 0) {
+        free(chunk);
+        memmove(lines->chunks + index,
+                lines->chunks + index + 1,
+                (lines->count - index - 1) * sizeof(lines->chunks[0]));
+        lines->count -= 1;
+        lines_tree_rebuild(lines);
+    } else {
+        lines_tree_add(lines, index, -1, -1 - (long) wraps);
+    }
+}
+
+void lines_insert_range(Lines *lines, size_t row, size_t count)
+{
+    assert(row <= lines->len);
+    if (count == 0) {
+        return;
+    }
+
+    size_t index, offset;
+    if (lines->count == 0) {
+        lines_new_chunk(lines, 0);
+        index = 0;
+        offset = 0;
+    } else if (row == lines->len) {
+        index = lines->count - 1;
+        offset = lines->chunks[index]->len;
+    } else {
+        index = lines_locate(lines, row, &offset);
+    }
+
+    Lines_Chunk *chunk = lines->chunks[index];
+    const size_t rest = chunk->len - offset;
+    const size_t total = chunk->len + count;
+    lines->len += count;
+    if (total <= LINES_CHUNK_CAP) {
+        memmove(chunk->lines + offset + count, chunk->lines + offset, rest * sizeof(chunk->lines[0]));
+        memset(chunk->lines + offset, 0, count * sizeof(chunk->lines[0]));
+        chunk->len = total;
+        lines_tree_add(lines, index, (long) count, (long) count);
+        return;
+    }
+
+    // The chunk and the ones after it are filled up in order. Line `p` of them
+    // is line p % LINES_CHUNK_CAP of chunk index + p / LINES_CHUNK_CAP.
+    const size_t added = (total + LINES_CHUNK_CAP - 1) / LINES_CHUNK_CAP - 1;
+    lines_grow(lines, added);
+    memmove(lines->chunks + index + 1 + added,
+            lines->chunks + index + 1,
+            (lines->count - index - 1) * sizeof(lines->chunks[0]));
+    for (size_t i = 1; i <= added; ++i) {
+        lines->chunks[index + i] = lines_alloc_chunk();
+    }
+    lines->count += added;
+
+    // The rest only moves forward, back to front nothing is overwritten before it's moved
+    for (size_t i = rest; i-- > 0;) {
+        const size_t p = offset + count + i;
+        lines->chunks[index + p / LINES_CHUNK_CAP]->lines[p % LINES_CHUNK_CAP] = chunk->lines[offset + i];
+    }
+    for (size_t p = offset; p < offset + count;) {
+        Lines_Chunk *filled = lines->chunks[index + p / LINES_CHUNK_CAP];
+        const size_t slot = p % LINES_CHUNK_CAP;
+        const size_t n = LINES_CHUNK_CAP - slot < offset + count - p ? LINES_CHUNK_CAP - slot : offset + count - p;
+        memset(filled->lines + slot, 0, n * sizeof(filled->lines[0]));
+        p += n;
+    }
+    for (size_t i = 0; i <= added; ++i) {
+        Lines_Chunk *filled = lines->chunks[index + i];
+        filled->len = i < added ? LINES_CHUNK_CAP : total - added * LINES_CHUNK_CAP;
+        lines_chunk_sum_wraps(filled);
+    }
+    lines_tree_rebuild(lines);
+}
+
+void lines_remove_range(Lines *lines, size_t row, size_t count)
+{
+    assert(row + count <= lines->len);
+    if (count == 0) {
+        return;
+    }
+
+    size_t first_offset, last_offset;
+    const size_t first = lines_locate(lines, row, &first_offset);
+    const size_t last = lines_locate(lines, row + count - 1, &last_offset);
+    Lines_Chunk *head = lines->chunks[first];
+    Lines_Chunk *tail = lines->chunks[last];
+    lines->len -= count;
+
+    // The first chunk keeps the lines before the range, the last one the
+    // lines after it, the chunks in between go as a whole
+    if (first == last) {
+        memmove(head->lines + first_offset,
+                head->lines + first_offset + count,
+                (head->len - first_offset - count) * sizeof(head->lines[0]));
+        head->len -= count;
+    } else {
+        head->len = first_offset;
+        memmove(tail->lines, tail->lines + last_offset + 1, (tail->len - last_offset - 1) * sizeof(tail->lines[0]));
+        tail->len -= last_offset + 1;
+    }
+
+    size_t kept = first;
+    for (size_t i = first; i <= last; ++i) {
+        Lines_Chunk *chunk = lines->chunks[i];
+        if ((chunk == head || chunk == tail) && chunk->len > 0) {
+            lines_chunk_sum_wraps(chunk);
+            lines->chunks[kept++] = chunk;
+        } else {
+            free(chunk);
+        }
+    }
+    memmove(lines->chunks + kept,
+            lines->chunks + last + 1,
+            (lines->count - last - 1) * sizeof(lines->chunks[0]));
+    lines->count = kept + lines->count - last - 1;
+    lines_tree_rebuild(lines);
+}
+
+void lines_set_wraps(Lines *lines, size_t row, uint32_t wraps)
+{
+    size_t offset = 0;
+    size_t index = lines_locate(lines, row, &offset);
+    Lines_Chunk *chunk = lines->chunks[index];
+    const long delta = (long) wraps - (long) chunk->lines[offset].wraps;
+    if (delta != 0) {
+        chunk->lines[offset].wraps = wraps;
+        chunk->wraps += delta;
+        lines_tree_add(lines, index, 0, delta);
+    }
+}
+
+void lines_sum_wraps(Lines *lines)
+{
+    for (size_t i = 0; i < lines->count; ++i) {
+        lines_chunk_sum_wraps(lines->chunks[i]);
+    }
+    lines_tree_rebuild(lines);
+}
+
+size_t lines_visual_len(const Lines *lines)
+{
+    return lines_prefix(lines->visual_tree, lines->count);
+}
+
+size_t lines_visual_row(const Lines *lines, size_t row)
+{
+    if (row >= lines->len) {
+        return lines_visual_len(lines) + (row - lines->len);
+    }
+    size_t offset = 0;
+    size_t index = lines_locate(lines, row, &offset);
+    const Lines_Chunk *chunk = lines->chunks[index];
+    size_t visual = lines_prefix(lines->visual_tree, index) + offset;
+    for (size_t i = 0; i < offset; ++i) {
+        visual += chunk->lines[i].wraps;
+    }
+    return visual;
+}
+
+size_t lines_at_visual(const Lines *lines, size_t visual, size_t *segment)
+{
+    const size_t visual_len = lines_visual_len(lines);
+    if (visual >= visual_len) {
+        *segment = 0;
+        return lines->len + (visual - visual_len);
+    }
+
+    size_t offset = 0;
+    size_t index = lines_descend(lines, lines->visual_tree, visual, &offset);
+    const Lines_Chunk *chunk = lines->chunks[index];
+    size_t row = lines_prefix(lines->tree, index);
+    for (size_t i = 0; offset > chunk->lines[i].wraps; ++i) {
+        offset -= chunk->lines[i].wraps + 1;
+        row += 1;
+    }
+    *segment = offset;
+    return row;
+}
+
+void lines_free(Lines *lines)
+{
+    for (size_t i = 0; i < lines->count; ++i) {
+        free(lines->chunks[i]);
+    }
+    free(lines->chunks);
+    free(lines->tree);
+    free(lines->visual_tree);
+    memset(lines, 0, sizeof(*lines));
+}
@@ -0,0 +1,75 @@
+#ifndef LINES_H_
+#define LINES_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A line of text. While `cap` is 0 and `len` is not, `chars` points into the
+// read-only bytes the editor was loaded from and must not be written to; the
+// line gets its own buffer the first time it is edited.
+//
+// `non_ascii` is cleared only when the line is known to be pure 7-bit ASCII,
+// which lets the renderer and the cursor treat bytes as columns.
+//
+// `highlight` is the Highlight_State the syntax highlighter ends the line in.
+// `wraps` is how many visual rows the line takes past its first one when it's
+// soft wrapped. It's set with lines_set_wraps, or written directly followed
+// by lines_sum_wraps.
+typedef struct {
+    size_t cap;
+    size_t len;
+    char *chars;
+    bool non_ascii;
+    uint8_t highlight;
+    uint32_t wraps;
+} Line;
+
+#define LINES_CHUNK_CAP 512
+
+typedef struct {
+    size_t len;
+    // Sum of the wraps of its lines
+    size_t wraps;
+    Line lines[LINES_CHUNK_CAP];
+} Lines_Chunk;
+
+// Sequence of lines stored as a rope of fixed-size chunks. A Fenwick tree over
+// the chunk lengths finds the chunk holding a row in O(log n), so inserting or
+// removing a line only moves the tail of one chunk instead of the whole file.
+// A second tree over the visual rows of the chunks maps between rows and
+// visual rows of soft wrapped lines the same way.
+typedef struct {
+    Lines_Chunk **chunks;
+    size_t count;
+    size_t cap;
+    size_t *tree;
+    size_t *visual_tree;
+    size_t len;
+} Lines;
+
+Line *lines_at(const Lines *lines, size_t row);
+// Returns `row` and stores in `count` how many rows from it on are stored
+// next to each other, for walking the lines without a lookup per row
+Line *lines_span(const Lines *lines, size_t row, size_t *count);
+Line *lines_insert(Lines *lines, size_t row);
+Line *lines_append(Lines *lines);
+void lines_remove(Lines *lines, size_t row);
+// Inserts `count` empty lines before `row`, or removes the `count` lines from
+// `row` on, moving the lines after them once. Inserted lines fill whole chunks.
+void lines_insert_range(Lines *lines, size_t row, size_t count);
+void lines_remove_range(Lines *lines, size_t row, size_t count);
+void lines_free(Lines *lines);
+
+void lines_set_wraps(Lines *lines, size_t row, uint32_t wraps);
+// Sums the wraps again after they were written directly, e.g. through
+// lines_span for every line at once
+void lines_sum_wraps(Lines *lines);
+// Visual rows of all lines, and the first visual row of `row`. Rows past the
+// end take one visual row each.
+size_t lines_visual_len(const Lines *lines);
+size_t lines_visual_row(const Lines *lines, size_t row);
+// Row shown on `visual` and which of its visual rows it is in `segment`
+size_t lines_at_visual(const Lines *lines, size_t visual, size_t *segment);
+
+#endif // LINES_H_
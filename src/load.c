@@ -0,0 +1,126 @@
+#include "load.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "prof.h"
+
+static void load_job_run(Job *job)
+{
+    Load *load = job->data;
+    size_t begin = load->begin;
+    size_t block_size = LOAD_BLOCK_SIZE;
+    const Scan_Impl impl = scan_best_impl();
+
+    while (begin < load->size && !job_cancelled(job)) {
+        PROF_ZONE("load_block");
+        const size_t end = load->size - begin > block_size ? begin + block_size : load->size;
+        Load_Block *block = calloc(1, sizeof(*block));
+        if (block == NULL) {
+            fprintf(stderr, "ERROR: could not allocate line index\n");
+            exit(1);
+        }
+        scan_lines_impl(impl, load->data + begin, end - begin, &block->lines);
+
+        if (end < load->size) {
+            if (block->lines.count == 1) {
+                // A line longer than the block, try again with a bigger one
+                scan_lines_free(&block->lines);
+                free(block);
+                block_size *= 2;
+                continue;
+            }
+            // The last line goes on in the next block, which starts with it
+            block->lines.count -= 1;
+        }
+
+        for (size_t i = 0; i < block->lines.count; ++i) {
+            block->lines.items[i].offset += begin;
+        }
+        if (end < load->size) {
+            begin = block->lines.items[block->lines.count - 1].offset +
+                    block->lines.items[block->lines.count - 1].len + 1;
+        } else {
+            begin = end;
+        }
+
+        atomic_store(&load->last->next, block);
+        load->last = block;
+        atomic_store(&load->scanned, begin);
+        job_set_progress(job, begin, load->size);
+        block_size = LOAD_BLOCK_SIZE;
+    }
+
+    atomic_store(&load->finished, true);
+}
+
+void load_start(Load *load, Jobs *jobs, const char *data, size_t size, size_t begin)
+{
+    memset(load, 0, sizeof(*load));
+    load->data = data;
+    load->size = size;
+    load->begin = begin;
+    load->jobs = jobs;
+    load->last = &load->head;
+    load->taken = &load->head;
+    load->taken_end = begin;
+    atomic_store(&load->scanned, begin);
+
+    load->job = (Job) {.run = load_job_run, .data = load};
+    jobs_submit(jobs, &load->job);
+}
+
+Load_Block *load_take(Load *load)
+{
+    Load_Block *next = atomic_load(&load->taken->next);
+    if (next == NULL) {
+        return NULL;
+    }
+
+    if (load->taken != &load->head) {
+        scan_lines_free(&load->taken->lines);
+        free(load->taken);
+    }
+    load->taken = next;
+    if (next->lines.count > 0) {
+        const Scan_Line *last = &next->lines.items[next->lines.count - 1];
+        const size_t end = last->offset + last->len;
+        load->taken_end = end < load->size ? end + 1 : load->size;
+    }
+    return next;
+}
+
+bool load_done(Load *load)
+{
+    // `finished` is set after the last block was linked, so once it's seen an
+    // empty list stays empty
+    return atomic_load(&load->finished) && atomic_load(&load->taken->next) == NULL;
+}
+
+float load_progress(const Load *load)
+{
+    if (load->size == 0) {
+        return 1.0f;
+    }
+    return (float) atomic_load(&load->scanned) / (float) load->size;
+}
+
+void load_free(Load *load)
+{
+    if (load->jobs != NULL && !job_is_done(&load->job)) {
+        job_cancel(&load->job);
+        jobs_wait(load->jobs, &load->job);
+    }
+
+    Load_Block *block = load->taken;
+    while (block != NULL) {
+        Load_Block *next = atomic_load(&block->next);
+        if (block != &load->head) {
+            scan_lines_free(&block->lines);
+            free(block);
+        }
+        block = next;
+    }
+    memset(load, 0, sizeof(*load));
+}
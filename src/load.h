@@ -0,0 +1,59 @@
+#ifndef LOAD_H_
+#define LOAD_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "jobs.h"
+#include "scan.h"
+
+// Bytes indexed on the calling thread before the rest goes to a worker, enough
+// for the first screen whatever the size of the file
+#define LOAD_FIRST_SIZE (64 * 1024)
+#define LOAD_BLOCK_SIZE (1024 * 1024)
+
+// Complete lines of one block of the source, offsets are from the start of it
+typedef struct Load_Block Load_Block;
+struct Load_Block {
+    Scan_Lines lines;
+    _Atomic(Load_Block *) next;
+};
+
+// Indexes a source in the background. The worker appends blocks to a list the
+// thread that started the load takes them from, one producer and one consumer,
+// so neither side ever waits for the other.
+typedef struct {
+    const char *data;
+    size_t size;
+    size_t begin;
+
+    Jobs *jobs;
+    Job job;
+    // Worker side: the block the next one is linked after
+    Load_Block *last;
+    // Consumer side: the block handed out by the previous load_take, and where
+    // the lines not handed out yet start in `data`
+    Load_Block *taken;
+    size_t taken_end;
+    Load_Block head;
+
+    atomic_size_t scanned;
+    // Set after the last block was linked
+    atomic_bool finished;
+} Load;
+
+// Indexes data[begin, size) on a worker of `jobs`. `begin` must be the start of
+// a line. The data must stay valid until load_free.
+void load_start(Load *load, Jobs *jobs, const char *data, size_t size, size_t begin);
+// Returns the next indexed block, or NULL if the worker isn't that far yet.
+// The block stays valid until the next call.
+Load_Block *load_take(Load *load);
+// True once every block was taken
+bool load_done(Load *load);
+// Fraction of the source indexed so far
+float load_progress(const Load *load);
+// Stops the worker early if it's still running
+void load_free(Load *load);
+
+#endif // LOAD_H_
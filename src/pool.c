@@ -0,0 +1,263 @@
+#include "pool.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define POOL_HELD_INIT_CAPACITY 256
+
+struct Pool_Slab {
+    Pool_Slab *next;
+    size_t padding;
+};
+
+struct Pool_Large {
+    Pool_Large *prev;
+    Pool_Large *next;
+    size_t size;
+    size_t padding;
+};
+
+struct Pool_Free {
+    Pool_Free *next;
+};
+
+static size_t pool_class_index(size_t size)
+{
+    if (size <= ((size_t) 1 << POOL_MIN_CLASS_SHIFT)) {
+        return 0;
+    }
+    const size_t shift = (size_t) (64 - __builtin_clzll((unsigned long long) (size - 1)));
+    return shift - POOL_MIN_CLASS_SHIFT;
+}
+
+static size_t pool_class_size(size_t index)
+{
+    return (size_t) 1 << (index + POOL_MIN_CLASS_SHIFT);
+}
+
+static void *pool_system_alloc(size_t size)
+{
+    void *ptr = malloc(size);
+    if (ptr == NULL) {
+        fprintf(stderr, "ERROR: could not allocate %zu bytes for lines\n", size);
+        exit(1);
+    }
+    return ptr;
+}
+
+static void pool_push_free(Pool *pool, char *ptr, size_t index)
+{
+    Pool_Free *block = (Pool_Free *) ptr;
+    block->next = pool->free_lists[index];
+    pool->free_lists[index] = block;
+}
+
+static void pool_new_slab(Pool *pool)
+{
+    // Hand the tail of the old slab to the free lists rather than wasting it
+    while (pool->cursor != NULL && (size_t) (pool->end - pool->cursor) >= pool_class_size(0)) {
+        size_t index = pool_class_index((size_t) (pool->end - pool->cursor));
+        if (pool_class_size(index) > (size_t) (pool->end - pool->cursor)) {
+            index -= 1;
+        }
+        pool_push_free(pool, pool->cursor, index);
+        pool->cursor += pool_class_size(index);
+    }
+
+    Pool_Slab *slab = pool_system_alloc(POOL_SLAB_SIZE);
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+    pool->cursor = (char *) (slab + 1);
+    pool->end = (char *) slab + POOL_SLAB_SIZE;
+    pool->reserved += POOL_SLAB_SIZE;
+}
+
+static char *pool_alloc_large(Pool *pool, size_t size, size_t *cap)
+{
+    size_t capacity = POOL_MAX_CLASS;
+    while (capacity < size) {
+        capacity *= 2;
+    }
+
+    Pool_Large *large = pool_system_alloc(sizeof(Pool_Large) + capacity);
+    large->prev = NULL;
+    large->next = pool->large;
+    large->size = capacity;
+    if (pool->large != NULL) {
+        pool->large->prev = large;
+    }
+    pool->large = large;
+
+    pool->used += capacity;
+    pool->reserved += sizeof(Pool_Large) + capacity;
+    *cap = capacity;
+    return (char *) (large + 1);
+}
+
+static void pool_unlink_large(Pool *pool, Pool_Large *large)
+{
+    if (large->prev != NULL) {
+        large->prev->next = large->next;
+    } else {
+        pool->large = large->next;
+    }
+    if (large->next != NULL) {
+        large->next->prev = large->prev;
+    }
+}
+
+char *pool_alloc(Pool *pool, size_t size, size_t *cap)
+{
+    if (size > POOL_MAX_CLASS) {
+        return pool_alloc_large(pool, size, cap);
+    }
+
+    const size_t index = pool_class_index(size);
+    const size_t class_size = pool_class_size(index);
+    char *ptr = NULL;
+
+    if (pool->free_lists[index] != NULL) {
+        ptr = (char *) pool->free_lists[index];
+        pool->free_lists[index] = pool->free_lists[index]->next;
+    } else {
+        if (pool->cursor == NULL || (size_t) (pool->end - pool->cursor) < class_size) {
+            pool_new_slab(pool);
+        }
+        ptr = pool->cursor;
+        pool->cursor += class_size;
+    }
+
+    pool->used += class_size;
+    *cap = class_size;
+    return ptr;
+}
+
+char *pool_realloc(Pool *pool, char *ptr, size_t old_cap, size_t len, size_t size, size_t *cap)
+{
+    assert(len <= old_cap && len <= size);
+
+    if (ptr != NULL && old_cap > POOL_MAX_CLASS && size > POOL_MAX_CLASS && pool->pins == 0) {
+        // Big lines grow in place when malloc can manage it
+        Pool_Large *large = (Pool_Large *) ptr - 1;
+        size_t capacity = large->size;
+        while (capacity < size) {
+            capacity *= 2;
+        }
+
+        pool_unlink_large(pool, large);
+        Pool_Large *moved = realloc(large, sizeof(Pool_Large) + capacity);
+        if (moved == NULL) {
+            fprintf(stderr, "ERROR: could not allocate %zu bytes for lines\n", capacity);
+            exit(1);
+        }
+        moved->prev = NULL;
+        moved->next = pool->large;
+        if (pool->large != NULL) {
+            pool->large->prev = moved;
+        }
+        pool->large = moved;
+
+        pool->used += capacity - moved->size;
+        pool->reserved += capacity - moved->size;
+        moved->size = capacity;
+        *cap = capacity;
+        return (char *) (moved + 1);
+    }
+
+    char *result = pool_alloc(pool, size, cap);
+    if (ptr != NULL) {
+        if (len > 0) {
+            memcpy(result, ptr, len);
+        }
+        pool_release(pool, ptr, old_cap);
+    }
+    return result;
+}
+
+void pool_release(Pool *pool, char *ptr, size_t cap)
+{
+    if (ptr == NULL || cap == 0) {
+        return;
+    }
+
+    if (pool->pins > 0) {
+        // The free list link would overwrite the start of the block
+        if (pool->held_count == pool->held_cap) {
+            pool->held_cap = pool->held_cap == 0 ? POOL_HELD_INIT_CAPACITY : pool->held_cap * 2;
+            pool->held = realloc(pool->held, pool->held_cap * sizeof(pool->held[0]));
+            if (pool->held == NULL) {
+                fprintf(stderr, "ERROR: could not allocate held line blocks\n");
+                exit(1);
+            }
+        }
+        pool->held[pool->held_count++] = (Pool_Block) {.ptr = ptr, .cap = cap};
+        return;
+    }
+
+    if (cap > POOL_MAX_CLASS) {
+        Pool_Large *large = (Pool_Large *) ptr - 1;
+        assert(large->size == cap);
+        pool_unlink_large(pool, large);
+        pool->used -= large->size;
+        pool->reserved -= sizeof(Pool_Large) + large->size;
+        free(large);
+        return;
+    }
+
+    const size_t index = pool_class_index(cap);
+    assert(pool_class_size(index) == cap);
+    pool_push_free(pool, ptr, index);
+    pool->used -= cap;
+}
+
+void pool_pin(Pool *pool)
+{
+    pool->pins += 1;
+}
+
+void pool_unpin(Pool *pool)
+{
+    assert(pool->pins > 0);
+    pool->pins -= 1;
+    if (pool->pins > 0) {
+        return;
+    }
+
+    for (size_t i = 0; i < pool->held_count; ++i) {
+        pool_release(pool, pool->held[i].ptr, pool->held[i].cap);
+    }
+    pool->held_count = 0;
+}
+
+bool pool_pinned(const Pool *pool)
+{
+    return pool->pins > 0;
+}
+
+void pool_free(Pool *pool)
+{
+    while (pool->slabs != NULL) {
+        Pool_Slab *next = pool->slabs->next;
+        free(pool->slabs);
+        pool->slabs = next;
+    }
+    while (pool->large != NULL) {
+        Pool_Large *next = pool->large->next;
+        free(pool->large);
+        pool->large = next;
+    }
+    free(pool->held);
+    memset(pool, 0, sizeof(*pool));
+}
+
+size_t pool_bytes_used(const Pool *pool)
+{
+    return pool->used;
+}
+
+size_t pool_bytes_reserved(const Pool *pool)
+{
+    return pool->reserved;
+}
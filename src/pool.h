@@ -0,0 +1,63 @@
+#ifndef POOL_H_
+#define POOL_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Size classes are powers of two from 16 bytes to 4 KiB
+#define POOL_MIN_CLASS_SHIFT 4
+#define POOL_CLASS_COUNT 9
+#define POOL_MAX_CLASS ((size_t) 1 << (POOL_MIN_CLASS_SHIFT + POOL_CLASS_COUNT - 1))
+#define POOL_SLAB_SIZE (256 * 1024)
+
+typedef struct Pool_Slab Pool_Slab;
+typedef struct Pool_Large Pool_Large;
+typedef struct Pool_Free Pool_Free;
+
+typedef struct {
+    char *ptr;
+    size_t cap;
+} Pool_Block;
+
+// Allocator for line buffers. Small blocks are carved back to back out of
+// big slabs and recycled through one free list per size class, so short lines
+// cost 16 or 32 bytes instead of a malloc each. Blocks above POOL_MAX_CLASS go
+// to malloc but are still tracked, so pool_free releases a whole document
+// at once.
+typedef struct {
+    Pool_Slab *slabs;
+    char *cursor;
+    char *end;
+    Pool_Free *free_lists[POOL_CLASS_COUNT];
+    Pool_Large *large;
+
+    // Bytes in blocks handed out, and bytes taken from the system
+    size_t used;
+    size_t reserved;
+
+    // Blocks released while the pool is pinned, given back by pool_unpin
+    size_t pins;
+    Pool_Block *held;
+    size_t held_count;
+    size_t held_cap;
+} Pool;
+
+// Returns a block of at least `size` bytes and stores its real size in `cap`
+char *pool_alloc(Pool *pool, size_t size, size_t *cap);
+// Moves a block to one of at least `size` bytes, keeping the first `len` bytes
+char *pool_realloc(Pool *pool, char *ptr, size_t old_cap, size_t len, size_t size, size_t *cap);
+void pool_release(Pool *pool, char *ptr, size_t cap);
+void pool_free(Pool *pool);
+
+// Keeps the blocks handed out so far as they are until the matching
+// pool_unpin, so another thread can go on reading them: released blocks are
+// held back instead of being reused, and lines are copied to new blocks
+// rather than edited in place while pool_pinned (see line_grow).
+void pool_pin(Pool *pool);
+void pool_unpin(Pool *pool);
+bool pool_pinned(const Pool *pool);
+
+size_t pool_bytes_used(const Pool *pool);
+size_t pool_bytes_reserved(const Pool *pool);
+
+#endif // POOL_H_
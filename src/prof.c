@@ -0,0 +1,182 @@
+#define _DEFAULT_SOURCE
+#include "prof.h"
+
+#ifdef GRIVE_PROFILE
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct {
+    const char *name;
+    uint64_t begin_ns;
+    uint64_t end_ns;
+} Prof_Event;
+
+// Zones of one thread. Only that thread writes them, `count` is published
+// after the event so prof_write_trace can read the thread while it runs.
+typedef struct {
+    Prof_Event *events;
+    atomic_size_t count;
+    atomic_bool ready;
+} Prof_Thread;
+
+static Prof_Thread prof_threads[PROF_MAX_THREADS];
+static atomic_size_t prof_thread_count = 0;
+static _Thread_local Prof_Thread *prof_thread = NULL;
+static _Thread_local bool prof_thread_full = false;
+static _Atomic uint64_t prof_epoch_ns = 0;
+
+// Frame times and counters, main thread only
+static float prof_frame_ms[PROF_FRAMES];
+static size_t prof_frames = 0;
+static Prof_Zone prof_frame_zone = {0};
+static size_t prof_counters[COUNT_PROF_COUNTERS];
+static size_t prof_last_counters[COUNT_PROF_COUNTERS];
+
+static const char *prof_counter_names[COUNT_PROF_COUNTERS] = {
+    [PROF_DRAW_CALLS] = "draws",
+    [PROF_GLYPHS] = "glyphs",
+};
+
+static uint64_t prof_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+static Prof_Thread *prof_this_thread(void)
+{
+    if (prof_thread != NULL || prof_thread_full) {
+        return prof_thread;
+    }
+
+    const size_t index = atomic_fetch_add(&prof_thread_count, 1);
+    if (index >= PROF_MAX_THREADS) {
+        prof_thread_full = true;
+        return NULL;
+    }
+    Prof_Thread *thread = &prof_threads[index];
+    thread->events = malloc(PROF_MAX_EVENTS * sizeof(thread->events[0]));
+    if (thread->events == NULL) {
+        fprintf(stderr, "ERROR: could not allocate profiler events\n");
+        exit(1);
+    }
+    atomic_store(&thread->ready, true);
+    prof_thread = thread;
+    return thread;
+}
+
+Prof_Zone prof_zone_begin(const char *name)
+{
+    const uint64_t now = prof_now_ns();
+    uint64_t epoch = 0;
+    atomic_compare_exchange_strong(&prof_epoch_ns, &epoch, now);
+    return (Prof_Zone) {.name = name, .begin_ns = now};
+}
+
+void prof_zone_end(Prof_Zone *zone)
+{
+    Prof_Thread *thread = prof_this_thread();
+    if (thread == NULL) {
+        return;
+    }
+    const size_t count = atomic_load_explicit(&thread->count, memory_order_relaxed);
+    if (count == PROF_MAX_EVENTS) {
+        return;
+    }
+    thread->events[count] = (Prof_Event) {
+        .name = zone->name,
+        .begin_ns = zone->begin_ns,
+        .end_ns = prof_now_ns(),
+    };
+    atomic_store_explicit(&thread->count, count + 1, memory_order_release);
+}
+
+void prof_frame_begin(void)
+{
+    prof_frame_zone = prof_zone_begin("frame");
+}
+
+void prof_frame_end(void)
+{
+    memcpy(prof_last_counters, prof_counters, sizeof(prof_counters));
+    memset(prof_counters, 0, sizeof(prof_counters));
+    prof_zone_end(&prof_frame_zone);
+    const uint64_t elapsed = prof_now_ns() - prof_frame_zone.begin_ns;
+    prof_frame_ms[prof_frames % PROF_FRAMES] = (float) elapsed / 1e6f;
+    prof_frames += 1;
+}
+
+void prof_count(Prof_Counter counter, size_t n)
+{
+    prof_counters[counter] += n;
+}
+
+static int prof_compare_ms(const void *a, const void *b)
+{
+    const float x = *(const float *) a;
+    const float y = *(const float *) b;
+    return (x > y) - (x < y);
+}
+
+size_t prof_overlay_text(char *text, size_t text_cap)
+{
+    const size_t frames = prof_frames < PROF_FRAMES ? prof_frames : PROF_FRAMES;
+    float sorted[PROF_FRAMES];
+    memcpy(sorted, prof_frame_ms, frames * sizeof(sorted[0]));
+    qsort(sorted, frames, sizeof(sorted[0]), prof_compare_ms);
+
+    size_t len = 0;
+    if (frames > 0) {
+        len += snprintf(text + len, text_cap - len,
+                        "p50 %.2fms\np95 %.2fms\np99 %.2fms\nmax %.2fms\n",
+                        sorted[frames / 2], sorted[frames * 95 / 100], sorted[frames * 99 / 100],
+                        sorted[frames - 1]);
+    }
+    for (size_t i = 0; i < COUNT_PROF_COUNTERS && len < text_cap; ++i) {
+        len += snprintf(text + len, text_cap - len, "%s %zu\n", prof_counter_names[i], prof_last_counters[i]);
+    }
+    return len < text_cap ? len : text_cap - 1;
+}
+
+bool prof_write_trace(const char *file_path)
+{
+    FILE *f = fopen(file_path, "w");
+    if (f == NULL) {
+        return false;
+    }
+
+    // Threads that started a zone right as the epoch was set may be a little
+    // before it
+    const uint64_t epoch = atomic_load(&prof_epoch_ns);
+    size_t threads = atomic_load(&prof_thread_count);
+    if (threads > PROF_MAX_THREADS) {
+        threads = PROF_MAX_THREADS;
+    }
+
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"grive\"}}");
+    for (size_t t = 0; t < threads; ++t) {
+        const Prof_Thread *thread = &prof_threads[t];
+        if (!atomic_load(&thread->ready)) {
+            continue;
+        }
+        const size_t count = atomic_load_explicit(&thread->count, memory_order_acquire);
+        for (size_t i = 0; i < count; ++i) {
+            const Prof_Event *event = &thread->events[i];
+            fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%zu,\"ts\":%.3f,\"dur\":%.3f}",
+                    event->name, t, (double) (int64_t) (event->begin_ns - epoch) / 1e3,
+                    (double) (event->end_ns - event->begin_ns) / 1e3);
+        }
+    }
+    fprintf(f, "\n]}\n");
+
+    const bool ok = !ferror(f);
+    return fclose(f) == 0 && ok;
+}
+
+#endif // GRIVE_PROFILE
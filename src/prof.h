@@ -0,0 +1,67 @@
+#ifndef PROF_H_
+#define PROF_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Built-in profiler, compiled in with -DGRIVE_PROFILE (`make grive PROFILE=1`).
+// Without it every zone and counter compiles to nothing.
+//
+// PROF_ZONE(name) times the rest of the enclosing block. Zones are kept per
+// thread, so workers can be timed as well, and are written out as a Chrome
+// trace (chrome://tracing, ui.perfetto.dev) by prof_write_trace. Once a
+// thread recorded PROF_MAX_EVENTS zones it records no more.
+
+#define PROF_MAX_EVENTS (256 * 1024)
+#define PROF_MAX_THREADS 72
+// Frames the percentiles of the overlay are over
+#define PROF_FRAMES 240
+
+typedef enum {
+    PROF_DRAW_CALLS = 0,
+    PROF_GLYPHS,
+    COUNT_PROF_COUNTERS,
+} Prof_Counter;
+
+typedef struct {
+    const char *name;
+    uint64_t begin_ns;
+} Prof_Zone;
+
+#ifdef GRIVE_PROFILE
+
+#define PROF_ENABLED true
+
+#define PROF_CONCAT_(a, b) a##b
+#define PROF_CONCAT(a, b) PROF_CONCAT_(a, b)
+#define PROF_ZONE(name) \
+    Prof_Zone PROF_CONCAT(prof_zone_, __LINE__) __attribute__((cleanup(prof_zone_end))) = prof_zone_begin(name)
+
+Prof_Zone prof_zone_begin(const char *name);
+void prof_zone_end(Prof_Zone *zone);
+
+// Frames are timed on the thread calling these, counters are per frame
+void prof_frame_begin(void);
+void prof_frame_end(void);
+void prof_count(Prof_Counter counter, size_t n);
+
+// Lines for the overlay: frame time percentiles and last frame's counters.
+// Returns how many bytes were written to `text`, lines end with '\n'.
+size_t prof_overlay_text(char *text, size_t text_cap);
+bool prof_write_trace(const char *file_path);
+
+#else
+
+#define PROF_ENABLED false
+#define PROF_ZONE(name)
+
+static inline void prof_frame_begin(void) {}
+static inline void prof_frame_end(void) {}
+static inline void prof_count(Prof_Counter counter, size_t n) { (void) counter; (void) n; }
+static inline size_t prof_overlay_text(char *text, size_t text_cap) { (void) text; (void) text_cap; return 0; }
+static inline bool prof_write_trace(const char *file_path) { (void) file_path; return false; }
+
+#endif // GRIVE_PROFILE
+
+#endif // PROF_H_
@@ -0,0 +1,654 @@
+#include "regexp.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define REGEX_MAX_DEPTH 256
+
+typedef struct {
+    Regex *regex;
+    const char *pattern;
+    size_t len;
+    size_t pos;
+    int depth;
+    bool failed;
+
+    // Run of plain characters the top level is matching right now
+    char run[REGEX_LITERAL_MAX];
+    size_t run_len;
+    bool top_level_alt;
+} Regex_Parser;
+
+static void regex_fail(Regex_Parser *parser, const char *message)
+{
+    if (!parser->failed) {
+        snprintf(parser->regex->error, sizeof(parser->regex->error),
+                 "%s at offset %zu", message, parser->pos);
+        parser->failed = true;
+    }
+}
+
+static void *regex_grow(void *items, size_t *cap, size_t need, size_t item_size)
+{
+    if (need <= *cap) {
+        return items;
+    }
+    size_t new_capacity = *cap == 0 ? 64 : *cap;
+    while (new_capacity < need) {
+        new_capacity *= 2;
+    }
+    items = realloc(items, new_capacity * item_size);
+    if (items == NULL) {
+        fprintf(stderr, "ERROR: could not allocate regex\n");
+        exit(1);
+    }
+    *cap = new_capacity;
+    return items;
+}
+
+static void class_set(Regex_Class *class, unsigned char c)
+{
+    class->bits[c >> 3] |= (uint8_t) (1u << (c & 7));
+}
+
+static bool class_has(const Regex_Class *class, unsigned char c)
+{
+    return (class->bits[c >> 3] >> (c & 7)) & 1;
+}
+
+static size_t regex_emit(Regex_Parser *parser, Regex_Inst inst)
+{
+    Regex *regex = parser->regex;
+    if (regex->count >= REGEX_MAX_INSTS) {
+        regex_fail(parser, "pattern too big");
+        return regex->count;
+    }
+    regex->insts = regex_grow(regex->insts, &regex->cap, regex->count + 1, sizeof(regex->insts[0]));
+    regex->insts[regex->count] = inst;
+    return regex->count++;
+}
+
+// Inserts an instruction in front of the code starting at `at`, which moves
+// that code (and every jump into it) one slot further
+static void regex_insert(Regex_Parser *parser, size_t at, Regex_Inst inst)
+{
+    Regex *regex = parser->regex;
+    regex_emit(parser, inst);
+    if (parser->failed) {
+        return;
+    }
+
+    memmove(&regex->insts[at + 1], &regex->insts[at], (regex->count - 1 - at) * sizeof(regex->insts[0]));
+    regex->insts[at] = inst;
+
+    for (size_t i = at + 1; i < regex->count; ++i) {
+        Regex_Inst *moved = &regex->insts[i];
+        if (moved->op == REGEX_JMP || moved->op == REGEX_SPLIT) {
+            if (moved->x >= at) moved->x += 1;
+            if (moved->op == REGEX_SPLIT && moved->y >= at) moved->y += 1;
+        }
+    }
+}
+
+static uint32_t regex_add_class(Regex *regex, const Regex_Class *class)
+{
+    regex->classes = regex_grow(regex->classes, &regex->classes_cap, regex->classes_count + 1,
+                                sizeof(regex->classes[0]));
+    regex->classes[regex->classes_count] = *class;
+    return (uint32_t) regex->classes_count++;
+}
+
+// \d \w \s and their negations, returns false for any other escape
+static bool regex_escape_class(char c, Regex_Class *class)
+{
+    Regex_Class set = {0};
+    switch (c) {
+    case 'd': case 'D':
+        for (int b = '0'; b <= '9'; ++b) class_set(&set, (unsigned char) b);
+        break;
+    case 'w': case 'W':
+        for (int b = '0'; b <= '9'; ++b) class_set(&set, (unsigned char) b);
+        for (int b = 'a'; b <= 'z'; ++b) class_set(&set, (unsigned char) b);
+        for (int b = 'A'; b <= 'Z'; ++b) class_set(&set, (unsigned char) b);
+        class_set(&set, '_');
+        break;
+    case 's': case 'S':
+        class_set(&set, ' ');
+        class_set(&set, '\t');
+        class_set(&set, '\r');
+        class_set(&set, '\v');
+        class_set(&set, '\f');
+        break;
+    default:
+        return false;
+    }
+
+    if (c == 'D' || c == 'W' || c == 'S') {
+        for (size_t i = 0; i < sizeof(set.bits); ++i) {
+            set.bits[i] = (uint8_t) ~set.bits[i];
+        }
+    }
+    for (size_t i = 0; i < sizeof(set.bits); ++i) {
+        class->bits[i] |= set.bits[i];
+    }
+    return true;
+}
+
+static unsigned char regex_escape_char(char c)
+{
+    switch (c) {
+    case 'n': return '\n';
+    case 't': return '\t';
+    case 'r': return '\r';
+    default: return (unsigned char) c;
+    }
+}
+
+static void regex_parse_class(Regex_Parser *parser)
+{
+    Regex_Class class = {0};
+    bool negate = false;
+
+    if (parser->pos < parser->len && parser->pattern[parser->pos] == '^') {
+        negate = true;
+        parser->pos += 1;
+    }
+
+    bool first = true;
+    while (parser->pos < parser->len && (first || parser->pattern[parser->pos] != ']')) {
+        first = false;
+        unsigned char lo = (unsigned char) parser->pattern[parser->pos++];
+        if (lo == '\\' && parser->pos < parser->len) {
+            const char escaped = parser->pattern[parser->pos++];
+            if (regex_escape_class(escaped, &class)) {
+                continue;
+            }
+            lo = regex_escape_char(escaped);
+        }
+
+        unsigned char hi = lo;
+        if (parser->pos + 1 < parser->len && parser->pattern[parser->pos] == '-' &&
+            parser->pattern[parser->pos + 1] != ']') {
+            hi = (unsigned char) parser->pattern[parser->pos + 1];
+            parser->pos += 2;
+            if (hi == '\\' && parser->pos < parser->len) {
+                hi = regex_escape_char(parser->pattern[parser->pos++]);
+            }
+            if (hi < lo) {
+                regex_fail(parser, "invalid range in character class");
+                return;
+            }
+        }
+        for (unsigned int b = lo; b <= hi; ++b) {
+            class_set(&class, (unsigned char) b);
+        }
+    }
+
+    if (parser->pos >= parser->len) {
+        regex_fail(parser, "unterminated character class");
+        return;
+    }
+    parser->pos += 1;
+
+    if (negate) {
+        for (size_t i = 0; i < sizeof(class.bits); ++i) {
+            class.bits[i] = (uint8_t) ~class.bits[i];
+        }
+    }
+    regex_emit(parser, (Regex_Inst) {.op = REGEX_CLASS, .x = regex_add_class(parser->regex, &class)});
+}
+
+static void regex_parse_alt(Regex_Parser *parser);
+
+static void regex_parse_atom(Regex_Parser *parser)
+{
+    const char c = parser->pattern[parser->pos++];
+    switch (c) {
+    case '(': {
+        if (++parser->depth > REGEX_MAX_DEPTH) {
+            regex_fail(parser, "groups nested too deep");
+            return;
+        }
+        regex_parse_alt(parser);
+        if (parser->pos >= parser->len || parser->pattern[parser->pos] != ')') {
+            regex_fail(parser, "missing )");
+            return;
+        }
+        parser->pos += 1;
+        parser->depth -= 1;
+    }
+    break;
+
+    case '[': {
+        regex_parse_class(parser);
+    }
+    break;
+
+    case '.': {
+        regex_emit(parser, (Regex_Inst) {.op = REGEX_ANY});
+    }
+    break;
+
+    case '^': {
+        regex_emit(parser, (Regex_Inst) {.op = REGEX_BOL});
+    }
+    break;
+
+    case '$': {
+        regex_emit(parser, (Regex_Inst) {.op = REGEX_EOL});
+    }
+    break;
+
+    case '*':
+    case '+':
+    case '?': {
+        parser->pos -= 1;
+        regex_fail(parser, "nothing to repeat");
+    }
+    break;
+
+    case '\\': {
+        if (parser->pos >= parser->len) {
+            regex_fail(parser, "trailing backslash");
+            return;
+        }
+        const char escaped = parser->pattern[parser->pos++];
+        Regex_Class class = {0};
+        if (regex_escape_class(escaped, &class)) {
+            regex_emit(parser, (Regex_Inst) {.op = REGEX_CLASS, .x = regex_add_class(parser->regex, &class)});
+        } else {
+            regex_emit(parser, (Regex_Inst) {.op = REGEX_CHAR, .c = regex_escape_char(escaped)});
+        }
+    }
+    break;
+
+    default: {
+        regex_emit(parser, (Regex_Inst) {.op = REGEX_CHAR, .c = (unsigned char) c});
+    }
+    }
+}
+
+static void regex_end_run(Regex_Parser *parser)
+{
+    if (parser->run_len > parser->regex->literal_len) {
+        memcpy(parser->regex->literal, parser->run, parser->run_len);
+        parser->regex->literal_len = parser->run_len;
+    }
+    parser->run_len = 0;
+}
+
+// Tracks the longest run of characters the pattern can't match without
+static void regex_track_literal(Regex_Parser *parser, size_t start)
+{
+    const bool plain = parser->depth == 0 && parser->regex->count == start + 1 &&
+        parser->regex->insts[start].op == REGEX_CHAR;
+
+    size_t quantifiers_end = parser->pos;
+    bool only_plus = true;
+    while (quantifiers_end < parser->len && strchr("*+?", parser->pattern[quantifiers_end]) != NULL) {
+        only_plus = only_plus && parser->pattern[quantifiers_end] == '+';
+        quantifiers_end += 1;
+    }
+    const bool repeated = quantifiers_end > parser->pos;
+
+    if (plain && only_plus && parser->run_len < REGEX_LITERAL_MAX) {
+        parser->run[parser->run_len++] = (char) parser->regex->insts[start].c;
+    }
+    if (!plain || repeated) {
+        regex_end_run(parser);
+    }
+    if (plain && repeated && only_plus) {
+        // `xa+y` needs "xa" and "ay", but not "xay"
+        parser->run[parser->run_len++] = (char) parser->regex->insts[start].c;
+    }
+}
+
+static void regex_parse_repeat(Regex_Parser *parser)
+{
+    const size_t start = parser->regex->count;
+    regex_parse_atom(parser);
+    if (!parser->failed) {
+        regex_track_literal(parser, start);
+    }
+
+    while (!parser->failed && parser->pos < parser->len) {
+        const char c = parser->pattern[parser->pos];
+        if (c == '*') {
+            // L: split L+1, out; atom; jmp L
+            regex_insert(parser, start, (Regex_Inst) {.op = REGEX_SPLIT, .x = (uint32_t) start + 1});
+            regex_emit(parser, (Regex_Inst) {.op = REGEX_JMP, .x = (uint32_t) start});
+            parser->regex->insts[start].y = (uint32_t) parser->regex->count;
+        } else if (c == '+') {
+            // L: atom; split L, out
+            const size_t split = parser->regex->count;
+            regex_emit(parser, (Regex_Inst) {.op = REGEX_SPLIT, .x = (uint32_t) start, .y = (uint32_t) split + 1});
+        } else if (c == '?') {
+            // split L+1, out; atom
+            regex_insert(parser, start, (Regex_Inst) {.op = REGEX_SPLIT, .x = (uint32_t) start + 1});
+            parser->regex->insts[start].y = (uint32_t) parser->regex->count;
+        } else {
+            break;
+        }
+        parser->pos += 1;
+    }
+}
+
+static void regex_parse_cat(Regex_Parser *parser)
+{
+    while (!parser->failed && parser->pos < parser->len &&
+           parser->pattern[parser->pos] != '|' && parser->pattern[parser->pos] != ')') {
+        regex_parse_repeat(parser);
+    }
+}
+
+static void regex_parse_alt(Regex_Parser *parser)
+{
+    const size_t start = parser->regex->count;
+    regex_parse_cat(parser);
+
+    while (!parser->failed && parser->pos < parser->len && parser->pattern[parser->pos] == '|') {
+        if (parser->depth == 0) {
+            // No single literal is shared by the branches
+            parser->top_level_alt = true;
+        }
+        parser->pos += 1;
+        // split L1, L2; L1: left; jmp out; L2: right
+        regex_insert(parser, start, (Regex_Inst) {.op = REGEX_SPLIT, .x = (uint32_t) start + 1});
+        const size_t jmp = regex_emit(parser, (Regex_Inst) {.op = REGEX_JMP});
+        if (parser->failed) {
+            return;
+        }
+        parser->regex->insts[start].y = (uint32_t) parser->regex->count;
+        regex_parse_cat(parser);
+        parser->regex->insts[jmp].x = (uint32_t) parser->regex->count;
+    }
+}
+
+// Walks the empty transitions from the start. With `through_bol` the BOL
+// assertions are assumed to hold, which gives the bytes a match may start
+// with; without it, whether anything is reachable away from a line start.
+static bool regex_start_closure(Regex *regex, bool through_bol, Regex_Class *first, bool *nullable)
+{
+    bool reachable = false;
+    size_t top = 0;
+    regex->mark += 1;
+    regex->stack[top++] = 0;
+    regex->marks[0] = regex->mark;
+
+    while (top > 0) {
+        const uint32_t pc = regex->stack[--top];
+        const Regex_Inst *inst = &regex->insts[pc];
+        uint32_t next[2];
+        size_t next_count = 0;
+
+        switch (inst->op) {
+        case REGEX_CHAR:
+            class_set(first, inst->c);
+            reachable = true;
+            break;
+        case REGEX_ANY:
+            memset(first->bits, 0xFF, sizeof(first->bits));
+            reachable = true;
+            break;
+        case REGEX_CLASS:
+            for (size_t i = 0; i < sizeof(first->bits); ++i) {
+                first->bits[i] |= regex->classes[inst->x].bits[i];
+            }
+            reachable = true;
+            break;
+        case REGEX_SPLIT:
+            next[next_count++] = inst->x;
+            next[next_count++] = inst->y;
+            break;
+        case REGEX_JMP:
+            next[next_count++] = inst->x;
+            break;
+        case REGEX_BOL:
+            if (through_bol) {
+                next[next_count++] = pc + 1;
+            }
+            break;
+        case REGEX_EOL:
+        case REGEX_MATCH:
+            *nullable = true;
+            reachable = true;
+            break;
+        }
+
+        for (size_t i = 0; i < next_count; ++i) {
+            if (regex->marks[next[i]] != regex->mark) {
+                regex->marks[next[i]] = regex->mark;
+                regex->stack[top++] = next[i];
+            }
+        }
+    }
+
+    return reachable;
+}
+
+bool regex_compile(Regex *regex, const char *pattern, size_t pattern_len)
+{
+    regex_free(regex);
+
+    Regex_Parser parser = {
+        .regex = regex,
+        .pattern = pattern,
+        .len = pattern_len,
+    };
+    regex_parse_alt(&parser);
+    if (!parser.failed && parser.pos < parser.len) {
+        regex_fail(&parser, "unmatched )");
+    }
+    regex_end_run(&parser);
+    if (parser.top_level_alt) {
+        regex->literal_len = 0;
+    }
+    regex_emit(&parser, (Regex_Inst) {.op = REGEX_MATCH});
+    if (parser.failed) {
+        char error[sizeof(regex->error)];
+        memcpy(error, regex->error, sizeof(error));
+        regex_free(regex);
+        memcpy(regex->error, error, sizeof(error));
+        return false;
+    }
+
+    regex->threads = malloc(2 * regex->count * sizeof(regex->threads[0]));
+    regex->starts = malloc(2 * regex->count * sizeof(regex->starts[0]));
+    regex->marks = calloc(regex->count, sizeof(regex->marks[0]));
+    regex->stack = malloc(regex->count * sizeof(regex->stack[0]));
+    if (regex->threads == NULL || regex->starts == NULL || regex->marks == NULL || regex->stack == NULL) {
+        fprintf(stderr, "ERROR: could not allocate regex\n");
+        exit(1);
+    }
+
+    Regex_Class unused = {0};
+    bool unused_nullable = false;
+    regex_start_closure(regex, true, &regex->first, &regex->nullable);
+    regex->anchored = !regex_start_closure(regex, false, &unused, &unused_nullable);
+
+    regex->first_byte = -1;
+    for (int c = 0; c < 256; ++c) {
+        if (class_has(&regex->first, (unsigned char) c)) {
+            if (regex->first_byte != -1) {
+                regex->first_byte = -1;
+                break;
+            }
+            regex->first_byte = c;
+        }
+    }
+
+    return true;
+}
+
+void regex_free(Regex *regex)
+{
+    free(regex->insts);
+    free(regex->classes);
+    free(regex->threads);
+    free(regex->starts);
+    free(regex->marks);
+    free(regex->stack);
+    memset(regex, 0, sizeof(*regex));
+}
+
+static uint32_t regex_next_mark(Regex *regex)
+{
+    regex->mark += 1;
+    if (regex->mark == 0) {
+        memset(regex->marks, 0, regex->count * sizeof(regex->marks[0]));
+        regex->mark = 1;
+    }
+    return regex->mark;
+}
+
+// Adds the thread at `pc` and everything reachable from it without consuming
+// a byte to `list`. Only the instructions that consume or match are kept.
+static void regex_add_thread(Regex *regex, uint32_t *list, size_t *starts, size_t *count,
+                             uint32_t mark, uint32_t pc, size_t start,
+                             size_t pos, size_t len)
+{
+    if (regex->marks[pc] == mark) {
+        return;
+    }
+
+    size_t top = 0;
+    regex->marks[pc] = mark;
+    regex->stack[top++] = pc;
+
+    while (top > 0) {
+        pc = regex->stack[--top];
+        const Regex_Inst *inst = &regex->insts[pc];
+        uint32_t next[2];
+        size_t next_count = 0;
+
+        switch (inst->op) {
+        case REGEX_SPLIT:
+            // Popped in reverse, so x goes first
+            next[next_count++] = inst->y;
+            next[next_count++] = inst->x;
+            break;
+        case REGEX_JMP:
+            next[next_count++] = inst->x;
+            break;
+        case REGEX_BOL:
+            if (pos == 0) next[next_count++] = pc + 1;
+            break;
+        case REGEX_EOL:
+            if (pos == len) next[next_count++] = pc + 1;
+            break;
+        default:
+            list[*count] = pc;
+            starts[*count] = start;
+            *count += 1;
+            break;
+        }
+
+        for (size_t i = 0; i < next_count; ++i) {
+            if (regex->marks[next[i]] != mark) {
+                regex->marks[next[i]] = mark;
+                regex->stack[top++] = next[i];
+            }
+        }
+    }
+}
+
+static size_t regex_skip(const Regex *regex, const char *text, size_t len, size_t pos)
+{
+    if (regex->first_byte >= 0) {
+        const char *found = memchr(text + pos, regex->first_byte, len - pos);
+        return found ? (size_t) (found - text) : len;
+    }
+    while (pos < len && !class_has(&regex->first, (unsigned char) text[pos])) {
+        pos += 1;
+    }
+    return pos;
+}
+
+bool regex_find(Regex *regex, const char *text, size_t len, size_t from,
+                size_t *match_begin, size_t *match_end)
+{
+    assert(regex->count > 0 && "The regex must be compiled");
+    if (from > len || (regex->anchored && from > 0)) {
+        return false;
+    }
+
+    uint32_t *clist = regex->threads;
+    uint32_t *nlist = regex->threads + regex->count;
+    size_t *cstarts = regex->starts;
+    size_t *nstarts = regex->starts + regex->count;
+    size_t ccount = 0;
+    uint32_t cmark = regex_next_mark(regex);
+
+    bool found = false;
+    size_t best_begin = 0;
+    size_t best_end = 0;
+
+    for (size_t pos = from; ; ++pos) {
+        if (!found) {
+            if (ccount == 0 && !regex->nullable) {
+                // Nothing in flight, jump to the next byte a match can start with
+                if (regex->anchored && pos > 0) break;
+                pos = regex_skip(regex, text, len, pos);
+                if (pos >= len) break;
+            }
+            if (!regex->anchored || pos == 0) {
+                // Seeded last, so threads that started earlier keep their priority
+                regex_add_thread(regex, clist, cstarts, &ccount, cmark, 0, pos, pos, len);
+            }
+        }
+
+        const uint32_t nmark = regex_next_mark(regex);
+        size_t ncount = 0;
+        for (size_t i = 0; i < ccount; ++i) {
+            const size_t start = cstarts[i];
+            if (found && start > best_begin) {
+                // Threads are ordered by start, the rest can't be leftmost
+                break;
+            }
+
+            const Regex_Inst *inst = &regex->insts[clist[i]];
+            bool consumes = false;
+            switch (inst->op) {
+            case REGEX_MATCH:
+                if (!found || start < best_begin || pos > best_end) {
+                    found = true;
+                    best_begin = start;
+                    best_end = pos;
+                }
+                break;
+            case REGEX_CHAR:
+                consumes = pos < len && (unsigned char) text[pos] == inst->c;
+                break;
+            case REGEX_ANY:
+                consumes = pos < len;
+                break;
+            case REGEX_CLASS:
+                consumes = pos < len && class_has(&regex->classes[inst->x], (unsigned char) text[pos]);
+                break;
+            default:
+                break;
+            }
+
+            if (consumes) {
+                regex_add_thread(regex, nlist, nstarts, &ncount, nmark, clist[i] + 1, start, pos + 1, len);
+            }
+        }
+
+        uint32_t *list = clist; clist = nlist; nlist = list;
+        size_t *starts = cstarts; cstarts = nstarts; nstarts = starts;
+        ccount = ncount;
+        cmark = nmark;
+
+        if (pos >= len || (found && ccount == 0)) {
+            break;
+        }
+    }
+
+    if (found) {
+        *match_begin = best_begin;
+        *match_end = best_end;
+    }
+    return found;
+}
@@ -0,0 +1,77 @@
+#ifndef REGEXP_H_
+#define REGEXP_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum {
+    REGEX_CHAR = 0,     // consumes `c`
+    REGEX_ANY,          // consumes any byte
+    REGEX_CLASS,        // consumes a byte of classes[arg]
+    REGEX_SPLIT,        // continues at both x and y, x first
+    REGEX_JMP,          // continues at x
+    REGEX_BOL,          // matches at the beginning of the line
+    REGEX_EOL,          // matches at the end of the line
+    REGEX_MATCH,
+} Regex_Op;
+
+typedef struct {
+    Regex_Op op;
+    unsigned char c;
+    uint32_t x;
+    uint32_t y;
+} Regex_Inst;
+
+typedef struct {
+    uint8_t bits[32];
+} Regex_Class;
+
+#define REGEX_LITERAL_MAX 64
+
+// A pattern compiled to a program for a Thompson NFA simulation, so matching
+// is linear in the length of the line whatever the pattern is. Supports
+// literals, `.`, `[...]` and `[^...]`, the escapes \d \w \s \D \W \S and
+// escaped metacharacters, `^`, `$`, `*`, `+`, `?`, `|` and groups.
+typedef struct {
+    Regex_Inst *insts;
+    size_t count;
+    size_t cap;
+
+    Regex_Class *classes;
+    size_t classes_count;
+    size_t classes_cap;
+
+    // Bytes a match can start with, used to skip ahead between matches.
+    // `nullable` patterns may match the empty string anywhere, `anchored` ones
+    // only at the beginning of a line.
+    Regex_Class first;
+    int first_byte;     // the only byte in `first`, or -1
+    bool nullable;
+    bool anchored;
+
+    // Bytes every match contains, lines without them can be skipped
+    char literal[REGEX_LITERAL_MAX];
+    size_t literal_len;
+
+    // Scratch space of the simulation
+    uint32_t *threads;
+    size_t *starts;
+    uint32_t *marks;
+    uint32_t mark;
+    uint32_t *stack;
+
+    char error[128];
+} Regex;
+
+#define REGEX_MAX_INSTS (64 * 1024)
+
+// Returns false and describes the problem in `error` if `pattern` is invalid
+bool regex_compile(Regex *regex, const char *pattern, size_t pattern_len);
+void regex_free(Regex *regex);
+
+// Finds the leftmost-longest match in `text` starting at or after `from`
+bool regex_find(Regex *regex, const char *text, size_t len, size_t from,
+                size_t *match_begin, size_t *match_end);
+
+#endif // REGEXP_H_
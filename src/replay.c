@@ -0,0 +1,282 @@
+#include "replay.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define REPLAY_MAGIC "GRIVEREC"
+#define REPLAY_VERSION 1
+// Histogram buckets double from 1us up to half a minute
+#define REPLAY_BUCKETS 26
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    // Recordings are raw events, they only replay on a build with the same layout
+    uint32_t event_size;
+} Replay_Header;
+
+uint64_t replay_now_ns(void)
+{
+    static uint64_t frequency = 0;
+    if (frequency == 0) {
+        frequency = SDL_GetPerformanceFrequency();
+    }
+    const uint64_t counter = SDL_GetPerformanceCounter();
+    return counter / frequency * 1000000000 + counter % frequency * 1000000000 / frequency;
+}
+
+static void replay_samples_push(Replay_Samples *samples, double value)
+{
+    if (samples->count == samples->cap) {
+        samples->cap = samples->cap == 0 ? 1024 : samples->cap * 2;
+        samples->items = realloc(samples->items, samples->cap * sizeof(samples->items[0]));
+        if (samples->items == NULL) {
+            fprintf(stderr, "ERROR: could not allocate replay samples\n");
+            exit(1);
+        }
+    }
+    samples->items[samples->count++] = value;
+}
+
+// Events whose fields are all values, anything pointing elsewhere can't be replayed
+static bool replay_recordable(const SDL_Event *event)
+{
+    switch (event->type) {
+    case SDL_QUIT:
+    case SDL_WINDOWEVENT:
+    case SDL_KEYDOWN:
+    case SDL_KEYUP:
+    case SDL_TEXTINPUT:
+    case SDL_MOUSEMOTION:
+    case SDL_MOUSEBUTTONDOWN:
+    case SDL_MOUSEBUTTONUP:
+    case SDL_MOUSEWHEEL:
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool replay_record_start(Replay_Recorder *recorder, const char *file_path)
+{
+    recorder->file = fopen(file_path, "wb");
+    if (recorder->file == NULL) {
+        return false;
+    }
+
+    Replay_Header header = {.version = REPLAY_VERSION, .event_size = sizeof(SDL_Event)};
+    memcpy(header.magic, REPLAY_MAGIC, sizeof(header.magic));
+    if (fwrite(&header, sizeof(header), 1, recorder->file) != 1) {
+        fclose(recorder->file);
+        recorder->file = NULL;
+        return false;
+    }
+    recorder->start_ns = replay_now_ns();
+    return true;
+}
+
+void replay_record(Replay_Recorder *recorder, const SDL_Event *event)
+{
+    if (recorder->file == NULL || !replay_recordable(event)) {
+        return;
+    }
+
+    const Replay_Event recorded = {
+        .time_ns = replay_now_ns() - recorder->start_ns,
+        .event = *event,
+    };
+    // Flushed right away, a session that crashed is the one most worth replaying
+    if (fwrite(&recorded, sizeof(recorded), 1, recorder->file) != 1 || fflush(recorder->file) != 0) {
+        fprintf(stderr, "[WARNING] Could not record the event, recording stopped: %s\n", strerror(errno));
+        replay_record_stop(recorder);
+    }
+}
+
+void replay_record_stop(Replay_Recorder *recorder)
+{
+    if (recorder->file != NULL) {
+        fclose(recorder->file);
+        recorder->file = NULL;
+    }
+}
+
+bool replay_load(Replay *replay, const char *file_path, char *error, size_t error_size)
+{
+    memset(replay, 0, sizeof(*replay));
+    FILE *f = fopen(file_path, "rb");
+    if (f == NULL) {
+        snprintf(error, error_size, "could not open %s: %s", file_path, strerror(errno));
+        return false;
+    }
+
+    Replay_Header header;
+    if (fread(&header, sizeof(header), 1, f) != 1 || memcmp(header.magic, REPLAY_MAGIC, sizeof(header.magic)) != 0) {
+        snprintf(error, error_size, "%s is not a recording", file_path);
+        fclose(f);
+        return false;
+    }
+    if (header.version != REPLAY_VERSION || header.event_size != sizeof(SDL_Event)) {
+        snprintf(error, error_size, "%s was recorded by another build (version %u, events of %u bytes)",
+                 file_path, header.version, header.event_size);
+        fclose(f);
+        return false;
+    }
+
+    size_t cap = 0;
+    Replay_Event event;
+    uint64_t recorded_ns = 0;
+    uint64_t replayed_ns = 0;
+    while (fread(&event, sizeof(event), 1, f) == 1) {
+        if (replay->count == cap) {
+            cap = cap == 0 ? 1024 : cap * 2;
+            replay->events = realloc(replay->events, cap * sizeof(replay->events[0]));
+            if (replay->events == NULL) {
+                fprintf(stderr, "ERROR: could not allocate the recorded events\n");
+                exit(1);
+            }
+        }
+        // Recorded times only go up, idle gaps are cut short
+        const uint64_t gap = event.time_ns > recorded_ns ? event.time_ns - recorded_ns : 0;
+        const uint64_t max_gap = (uint64_t) REPLAY_MAX_GAP_MS * 1000000;
+        recorded_ns = event.time_ns > recorded_ns ? event.time_ns : recorded_ns;
+        replayed_ns += gap < max_gap ? gap : max_gap;
+        event.time_ns = replayed_ns;
+        replay->events[replay->count++] = event;
+    }
+    fclose(f);
+    return true;
+}
+
+bool replay_poll_event(Replay *replay, SDL_Event *event)
+{
+    if (!replay->started) {
+        replay->start_ns = replay_now_ns();
+        replay->started = true;
+    }
+    // Live input would race the recorded one, the window only gets pumped
+    SDL_PumpEvents();
+    SDL_FlushEvents(SDL_FIRSTEVENT, SDL_LASTEVENT);
+
+    if (replay->next == replay->count) {
+        if (replay->ended) {
+            return false;
+        }
+        replay->ended = true;
+        memset(event, 0, sizeof(*event));
+        event->type = SDL_QUIT;
+        return true;
+    }
+
+    const Replay_Event *next = &replay->events[replay->next];
+    if (replay_now_ns() < replay->start_ns + next->time_ns) {
+        return false;
+    }
+    *event = next->event;
+    replay->next += 1;
+    return true;
+}
+
+bool replay_wait_event(Replay *replay, SDL_Event *event, int timeout_ms)
+{
+    if (replay_poll_event(replay, event)) {
+        return true;
+    }
+    if (replay->next == replay->count) {
+        return false;
+    }
+
+    const uint64_t due_ns = replay->start_ns + replay->events[replay->next].time_ns;
+    const uint64_t now_ns = replay_now_ns();
+    const uint64_t wait_ns = due_ns > now_ns ? due_ns - now_ns : 0;
+    if (timeout_ms >= 0 && wait_ns > (uint64_t) timeout_ms * 1000000) {
+        SDL_Delay((Uint32) timeout_ms);
+        return replay_poll_event(replay, event);
+    }
+    // The last fraction of a millisecond is spun, so the event is handed out
+    // on time and its latency isn't padded by the sleep
+    SDL_Delay((Uint32) (wait_ns / 1000000));
+    while (replay_now_ns() < due_ns) {}
+    return replay_poll_event(replay, event);
+}
+
+void replay_handled(Replay *replay, uint64_t begin_ns)
+{
+    // The closing SDL_QUIT wasn't recorded
+    if (!replay->ended) {
+        replay_samples_push(&replay->handle, (double) (replay_now_ns() - begin_ns) / 1e6);
+    }
+}
+
+void replay_frame_presented(Replay *replay)
+{
+    const uint64_t now_ns = replay_now_ns();
+    for (; replay->unpresented < replay->next; ++replay->unpresented) {
+        const uint64_t due_ns = replay->start_ns + replay->events[replay->unpresented].time_ns;
+        replay_samples_push(&replay->frame, (double) (now_ns - due_ns) / 1e6);
+    }
+}
+
+static int replay_compare_samples(const void *a, const void *b)
+{
+    const double x = *(const double *) a;
+    const double y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+static double replay_percentile_us(const Replay_Samples *samples, double p)
+{
+    if (samples->count == 0) {
+        return 0.0;
+    }
+    size_t index = (size_t) (p * (double) samples->count);
+    if (index >= samples->count) {
+        index = samples->count - 1;
+    }
+    return samples->items[index] * 1e3;
+}
+
+static void replay_report_samples(Replay_Samples *samples, const char *name, FILE *stream)
+{
+    qsort(samples->items, samples->count, sizeof(samples->items[0]), replay_compare_samples);
+
+    // Bucket i counts the samples of up to 2^i microseconds
+    size_t buckets[REPLAY_BUCKETS] = {0};
+    for (size_t i = 0; i < samples->count; ++i) {
+        const double us = samples->items[i] * 1e3;
+        size_t bucket = 0;
+        while (bucket + 1 < REPLAY_BUCKETS && us > (double) (1u << bucket)) {
+            bucket += 1;
+        }
+        buckets[bucket] += 1;
+    }
+
+    fprintf(stream, "{\"latency\":\"%s\",\"count\":%zu", name, samples->count);
+    fprintf(stream, ",\"p50_us\":%.2f,\"p90_us\":%.2f,\"p99_us\":%.2f,\"max_us\":%.2f",
+            replay_percentile_us(samples, 0.50), replay_percentile_us(samples, 0.90),
+            replay_percentile_us(samples, 0.99), replay_percentile_us(samples, 1.0));
+    fprintf(stream, ",\"histogram_us\":{");
+    bool first = true;
+    for (size_t i = 0; i < REPLAY_BUCKETS; ++i) {
+        if (buckets[i] > 0) {
+            fprintf(stream, "%s\"%u\":%zu", first ? "" : ",", 1u << i, buckets[i]);
+            first = false;
+        }
+    }
+    fprintf(stream, "}}\n");
+}
+
+void replay_report(Replay *replay, FILE *stream)
+{
+    replay_report_samples(&replay->handle, "handle_event", stream);
+    replay_report_samples(&replay->frame, "event_to_frame", stream);
+    fflush(stream);
+}
+
+void replay_free(Replay *replay)
+{
+    free(replay->events);
+    free(replay->handle.items);
+    free(replay->frame.items);
+    memset(replay, 0, sizeof(*replay));
+}
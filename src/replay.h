@@ -0,0 +1,79 @@
+#ifndef REPLAY_H_
+#define REPLAY_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <SDL.h>
+
+// Recording of the input of a session, and replaying it through the same
+// event loop to measure how long the editor takes to react.
+//
+// A recording is a header and then every event the loop took, with the time
+// it was taken at. Only events that carry no pointers are kept, the rest
+// can't be fed back. Replaying hands the events to the loop at the times they
+// came in, gaps longer than REPLAY_MAX_GAP_MS shortened, and times how long
+// every one of them took to handle and to show up in a presented frame.
+
+// Idle stretches of a session are replayed this long at most
+#define REPLAY_MAX_GAP_MS 1000
+
+typedef struct {
+    uint64_t time_ns;
+    SDL_Event event;
+} Replay_Event;
+
+typedef struct {
+    double *items;
+    size_t count;
+    size_t cap;
+} Replay_Samples;
+
+typedef struct {
+    FILE *file;
+    uint64_t start_ns;
+} Replay_Recorder;
+
+typedef struct {
+    Replay_Event *events;
+    size_t count;
+    // Next event to hand out, and the first one not presented yet
+    size_t next;
+    size_t unpresented;
+    // The SDL_QUIT after the last event was handed out
+    bool ended;
+    // The recording plays from here, set by the first wait
+    uint64_t start_ns;
+    bool started;
+
+    // Milliseconds in handle_event, and from when an event was due until the
+    // frame it went into was presented
+    Replay_Samples handle;
+    Replay_Samples frame;
+} Replay;
+
+uint64_t replay_now_ns(void);
+
+// Starts recording to `file_path`, false if it can't be written
+bool replay_record_start(Replay_Recorder *recorder, const char *file_path);
+// Appends an event the loop took, does nothing unless recording
+void replay_record(Replay_Recorder *recorder, const SDL_Event *event);
+void replay_record_stop(Replay_Recorder *recorder);
+
+// Reads a recording, false with a message in `error` if it isn't one
+bool replay_load(Replay *replay, const char *file_path, char *error, size_t error_size);
+// Like SDL_WaitEventTimeout and SDL_PollEvent, on the recorded events. Once
+// they run out an SDL_QUIT comes, so the loop ends like the session did.
+bool replay_wait_event(Replay *replay, SDL_Event *event, int timeout_ms);
+bool replay_poll_event(Replay *replay, SDL_Event *event);
+// The last event handed out was handled, it started at `begin_ns`
+void replay_handled(Replay *replay, uint64_t begin_ns);
+// A frame with every event handed out so far was presented
+void replay_frame_presented(Replay *replay);
+// Prints the percentiles and histogram of both latencies, one JSON line each
+void replay_report(Replay *replay, FILE *stream);
+void replay_free(Replay *replay);
+
+#endif // REPLAY_H_
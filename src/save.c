@@ -0,0 +1,306 @@
+#define _GNU_SOURCE
+#include "save.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "prof.h"
+
+#define SAVE_SEGMENTS_INIT_CAPACITY 256
+#define SAVE_IOV_MAX 1024
+
+static void save_push_segment(Save *save, bool from_source, const char *data, size_t len, bool newline)
+{
+    save->size += len + (newline ? 1 : 0);
+    if (save->count > 0) {
+        Save_Segment *last = &save->segments[save->count - 1];
+        if (!last->newline && (len == 0 || (last->from_source == from_source && last->data + last->len == data))) {
+            last->len += len;
+            last->newline = newline;
+            return;
+        }
+    }
+    if (len == 0 && !newline) {
+        return;
+    }
+
+    if (save->count == save->cap) {
+        save->cap = save->cap == 0 ? SAVE_SEGMENTS_INIT_CAPACITY : save->cap * 2;
+        save->segments = realloc(save->segments, save->cap * sizeof(save->segments[0]));
+        if (save->segments == NULL) {
+            fprintf(stderr, "ERROR: could not allocate save segments\n");
+            exit(1);
+        }
+    }
+
+    save->segments[save->count++] = (Save_Segment) {
+        .data = data,
+        .len = len,
+        .from_source = from_source,
+        .newline = newline,
+    };
+}
+
+void save_snapshot(Save *save, Editor *editor, const char *file_path)
+{
+    PROF_ZONE("save_snapshot");
+    const Source *source = &editor->source;
+    save->pool = &editor->pool;
+    pool_pin(save->pool);
+    save->source_data = source->data;
+    save->source_fd = source->mapped ? source->fd : -1;
+    save->path = strdup(file_path);
+
+    struct stat st;
+    if (stat(file_path, &st) == 0) {
+        save->mode = st.st_mode & 07777;
+    } else {
+        mode_t mask = umask(0);
+        umask(mask);
+        save->mode = 0666 & ~mask;
+    }
+
+    // Walking the chunks rather than looking each row up. Lines are joined
+    // with '\n', reusing the source newline keeps runs of untouched lines in
+    // a single segment.
+    const char *source_end = source->data + source->size;
+    const size_t count = editor->lines.len;
+    size_t span = 0;
+    for (size_t row = 0; row < count; row += span) {
+        const Line *lines = lines_span(&editor->lines, row, &span);
+        for (size_t i = 0; i < span; ++i) {
+            const Line *line = &lines[i];
+            const bool last = row + i + 1 == count;
+            const bool in_source = line->cap == 0 && line->len > 0 && source->data != NULL &&
+                line->chars >= source->data && line->chars + line->len < source_end;
+
+            if (in_source && !last && line->chars[line->len] == '\n') {
+                save_push_segment(save, true, line->chars, line->len + 1, false);
+            } else {
+                save_push_segment(save, false, line->chars, line->len, !last);
+            }
+        }
+    }
+
+    // Lines still being indexed are an untouched range at the end of the
+    // source, they go in as one segment instead of being waited for
+    const size_t tail = editor->load != NULL ? editor->load->taken_end : source->size;
+    if (tail < source->size) {
+        if (tail > 0) {
+            // Starting at the newline that ended the last indexed line
+            save_push_segment(save, true, source->data + tail - 1, source->size - tail + 1, false);
+        } else {
+            if (count > 0) {
+                save_push_segment(save, false, NULL, 0, true);
+            }
+            save_push_segment(save, true, source->data, source->size, false);
+        }
+    }
+}
+
+static bool save_fail(Save *save, const char *what)
+{
+    snprintf(save->error, sizeof(save->error), "could not %s `%s`: %s",
+             what, save->path, strerror(errno));
+    return false;
+}
+
+static bool write_all(int fd, const char *data, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        len -= (size_t) n;
+    }
+    return true;
+}
+
+// Copies a range of the source file, in the kernel when it can
+static bool save_copy_source(Save *save, int fd, const Save_Segment *segment)
+{
+#ifdef __linux__
+    if (save->source_fd >= 0) {
+        loff_t offset = (loff_t) (segment->data - save->source_data);
+        size_t left = segment->len;
+        while (left > 0) {
+            ssize_t n = copy_file_range(save->source_fd, &offset, fd, NULL, left, 0);
+            if (n <= 0) {
+                break;
+            }
+            left -= (size_t) n;
+        }
+        if (left == 0) {
+            return true;
+        }
+        // Cross-filesystem or unsupported, finish from the mapping
+        const size_t done = segment->len - left;
+        return write_all(fd, segment->data + done, left);
+    }
+#endif
+    return write_all(fd, segment->data, segment->len);
+}
+
+static bool save_write_segments(Save *save, int fd)
+{
+    struct iovec iov[SAVE_IOV_MAX];
+    size_t iov_count = 0;
+    size_t progress = 0;
+
+    for (size_t i = 0; i <= save->count; ++i) {
+        const Save_Segment *segment = i < save->count ? &save->segments[i] : NULL;
+        if (job_cancelled(&save->job)) {
+            errno = ECANCELED;
+            return false;
+        }
+
+        // Flush the gathered line buffers before anything else goes out
+        if (iov_count > 0 && (segment == NULL || segment->from_source || iov_count + 2 > SAVE_IOV_MAX)) {
+            size_t k = 0;
+            while (k < iov_count) {
+                int n_iov = (int) (iov_count - k);
+                ssize_t n = writev(fd, iov + k, n_iov);
+                if (n < 0) {
+                    if (errno == EINTR) continue;
+                    return false;
+                }
+                size_t written = (size_t) n;
+                while (k < iov_count && written >= iov[k].iov_len) {
+                    written -= iov[k].iov_len;
+                    k += 1;
+                }
+                if (k < iov_count) {
+                    iov[k].iov_base = (char *) iov[k].iov_base + written;
+                    iov[k].iov_len -= written;
+                }
+            }
+            iov_count = 0;
+        }
+
+        if (segment == NULL) {
+            break;
+        }
+        job_set_progress(&save->job, progress, save->size);
+        progress += segment->len + (segment->newline ? 1 : 0);
+
+        if (segment->from_source) {
+            if (!save_copy_source(save, fd, segment) ||
+                (segment->newline && !write_all(fd, "\n", 1))) {
+                return false;
+            }
+            continue;
+        }
+        if (segment->len > 0) {
+            iov[iov_count++] = (struct iovec) {
+                .iov_base = (char *) segment->data,
+                .iov_len = segment->len,
+            };
+        }
+        if (segment->newline) {
+            iov[iov_count++] = (struct iovec) {
+                .iov_base = "\n",
+                .iov_len = 1,
+            };
+        }
+    }
+
+    return true;
+}
+
+bool save_run(Save *save)
+{
+    PROF_ZONE("save_run");
+    const size_t path_len = strlen(save->path);
+    char *tmp_path = malloc(path_len + sizeof(".grive-XXXXXX"));
+    if (tmp_path == NULL) {
+        return save_fail(save, "allocate a temporary path for");
+    }
+    memcpy(tmp_path, save->path, path_len);
+    memcpy(tmp_path + path_len, ".grive-XXXXXX", sizeof(".grive-XXXXXX"));
+
+    int fd = mkstemp(tmp_path);
+    if (fd < 0) {
+        free(tmp_path);
+        return save_fail(save, "create a temporary file for");
+    }
+
+    bool ok = true;
+    if (!save_write_segments(save, fd)) {
+        ok = save_fail(save, "write");
+    } else if (fchmod(fd, (mode_t) save->mode) < 0) {
+        ok = save_fail(save, "set the permissions of");
+    } else if (fsync(fd) < 0) {
+        ok = save_fail(save, "flush");
+    }
+
+    if (close(fd) < 0 && ok) {
+        ok = save_fail(save, "close");
+    }
+    if (ok && rename(tmp_path, save->path) < 0) {
+        ok = save_fail(save, "replace");
+    }
+    if (!ok) {
+        unlink(tmp_path);
+    }
+    free(tmp_path);
+
+    if (ok) {
+        // Make the rename itself durable
+        char *dir_path = strdup(save->path);
+        int dir = open(dirname(dir_path), O_RDONLY);
+        if (dir >= 0) {
+            fsync(dir);
+            close(dir);
+        }
+        free(dir_path);
+    }
+
+    save->ok = ok;
+    return ok;
+}
+
+static void save_job_run(Job *job)
+{
+    save_run(job->data);
+}
+
+void save_start(Save *save, Jobs *jobs)
+{
+    save->jobs = jobs;
+    save->job = (Job) {.run = save_job_run, .data = save};
+    save->running = true;
+    jobs_submit(jobs, &save->job);
+}
+
+bool save_poll(Save *save)
+{
+    if (!save->running || !job_is_done(&save->job)) {
+        return false;
+    }
+
+    save->running = false;
+    return true;
+}
+
+void save_free(Save *save)
+{
+    if (save->running) {
+        jobs_wait(save->jobs, &save->job);
+    }
+    if (save->pool != NULL) {
+        pool_unpin(save->pool);
+    }
+    free(save->segments);
+    free(save->path);
+    memset(save, 0, sizeof(*save));
+}
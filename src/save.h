@@ -0,0 +1,58 @@
+#ifndef SAVE_H_
+#define SAVE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "editor.h"
+#include "jobs.h"
+#include "pool.h"
+
+// Run of output bytes, either a range of the source file to copy or the text
+// of a line to write, followed by a '\n' when `newline` is set
+typedef struct {
+    const char *data;
+    size_t len;
+    bool from_source;
+    bool newline;
+} Save_Segment;
+
+// A save in flight. save_snapshot captures the document on the calling thread
+// without copying any text: untouched lines and the part of the source still
+// being indexed are ranges of the source, edited lines are read from their
+// buffers, which the pinned pool of the editor keeps as they are until
+// save_free. The writing can then happen on any thread while the editor keeps
+// changing.
+typedef struct {
+    Save_Segment *segments;
+    size_t count;
+    size_t cap;
+
+    Pool *pool;
+    const char *source_data;
+    int source_fd;
+
+    char *path;
+    unsigned int mode;
+    size_t size;
+
+    Jobs *jobs;
+    Job job;
+    bool running;
+    bool ok;
+    char error[512];
+} Save;
+
+void save_snapshot(Save *save, Editor *editor, const char *file_path);
+// Writes the snapshot to a temporary file next to the target, fsyncs it and
+// renames it over the target. Returns false and fills `error` on failure.
+bool save_run(Save *save);
+
+// Runs save_run on a worker of `jobs`. Cancelling save->job stops it before the
+// target is touched.
+void save_start(Save *save, Jobs *jobs);
+// Returns true once, when jobs_poll reported the started save as done
+bool save_poll(Save *save);
+void save_free(Save *save);
+
+#endif // SAVE_H_
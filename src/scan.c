@@ -0,0 +1,313 @@
+#define _DEFAULT_SOURCE
+#include "scan.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SCAN_X86
+#include <immintrin.h>
+#endif
+
+#define SCAN_LINES_INIT_CAPACITY 1024
+
+static void scan_lines_push(Scan_Lines *lines, size_t offset, size_t len, bool ascii)
+{
+    if (lines->count == lines->cap) {
+        lines->cap = lines->cap == 0 ? SCAN_LINES_INIT_CAPACITY : lines->cap * 2;
+        lines->items = realloc(lines->items, lines->cap * sizeof(lines->items[0]));
+        if (lines->items == NULL) {
+            fprintf(stderr, "ERROR: could not allocate line index\n");
+            exit(1);
+        }
+    }
+
+    lines->items[lines->count++] = (Scan_Line) {
+        .offset = offset,
+        .len = len,
+        .ascii = ascii,
+    };
+}
+
+void scan_lines_free(Scan_Lines *lines)
+{
+    free(lines->items);
+    memset(lines, 0, sizeof(*lines));
+}
+
+bool scan_is_ascii(const char *data, size_t size)
+{
+    size_t i = 0;
+    uint64_t high = 0;
+
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        high |= word;
+    }
+    for (; i < size; ++i) {
+        high |= (uint8_t) data[i];
+    }
+
+    return (high & 0x8080808080808080ull) == 0;
+}
+
+// Every kernel scans [begin, end) and pushes one line per newline plus the
+// trailing piece after the last newline, even when it is empty. The ranges of
+// a parallel scan are stitched together through that trailing piece.
+
+static void scan_range_scalar(const char *data, size_t begin, size_t end, Scan_Lines *lines)
+{
+    size_t start = begin;
+
+    while (start < end) {
+        const char *nl = memchr(data + start, '\n', end - start);
+        if (nl == NULL) {
+            break;
+        }
+        const size_t len = (size_t) (nl - data) - start;
+        scan_lines_push(lines, start, len, scan_is_ascii(data + start, len));
+        start += len + 1;
+    }
+
+    scan_lines_push(lines, start, end - start, scan_is_ascii(data + start, end - start));
+}
+
+// Consumes the newline and high bit masks of one block starting at `base`
+static inline void scan_block(Scan_Lines *lines, size_t base, uint64_t newlines, uint64_t high,
+                              size_t *start, bool *ascii)
+{
+    while (newlines != 0) {
+        const unsigned bit = (unsigned) __builtin_ctzll(newlines);
+        const uint64_t below = (1ull << bit) - 1;
+
+        if (high & below) {
+            *ascii = false;
+        }
+        high &= ~below;
+
+        const size_t nl = base + bit;
+        scan_lines_push(lines, *start, nl - *start, *ascii);
+        *start = nl + 1;
+        *ascii = true;
+        newlines &= newlines - 1;
+    }
+
+    if (high != 0) {
+        *ascii = false;
+    }
+}
+
+static void scan_tail(const char *data, size_t i, size_t end, Scan_Lines *lines, size_t start, bool ascii)
+{
+    for (; i < end; ++i) {
+        if (data[i] == '\n') {
+            scan_lines_push(lines, start, i - start, ascii);
+            start = i + 1;
+            ascii = true;
+        } else if (data[i] & 0x80) {
+            ascii = false;
+        }
+    }
+
+    scan_lines_push(lines, start, end - start, ascii);
+}
+
+#ifdef SCAN_X86
+static void scan_range_sse2(const char *data, size_t begin, size_t end, Scan_Lines *lines)
+{
+    const __m128i newline = _mm_set1_epi8('\n');
+    size_t start = begin;
+    bool ascii = true;
+    size_t i = begin;
+
+    for (; i + 16 <= end; i += 16) {
+        const __m128i block = _mm_loadu_si128((const __m128i *) (data + i));
+        const uint64_t newlines = (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(block, newline));
+        const uint64_t high = (uint32_t) _mm_movemask_epi8(block);
+        if ((newlines | high) != 0) {
+            scan_block(lines, i, newlines, high, &start, &ascii);
+        }
+    }
+
+    scan_tail(data, i, end, lines, start, ascii);
+}
+
+__attribute__((target("avx2")))
+static void scan_range_avx2(const char *data, size_t begin, size_t end, Scan_Lines *lines)
+{
+    const __m256i newline = _mm256_set1_epi8('\n');
+    size_t start = begin;
+    bool ascii = true;
+    size_t i = begin;
+
+    for (; i + 64 <= end; i += 64) {
+        const __m256i lo = _mm256_loadu_si256((const __m256i *) (data + i));
+        const __m256i hi = _mm256_loadu_si256((const __m256i *) (data + i + 32));
+        const uint64_t newlines =
+            (uint64_t) (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, newline)) |
+            (uint64_t) (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, newline)) << 32;
+        const uint64_t high =
+            (uint64_t) (uint32_t) _mm256_movemask_epi8(lo) |
+            (uint64_t) (uint32_t) _mm256_movemask_epi8(hi) << 32;
+        if ((newlines | high) != 0) {
+            scan_block(lines, i, newlines, high, &start, &ascii);
+        }
+    }
+
+    scan_tail(data, i, end, lines, start, ascii);
+}
+#endif // SCAN_X86
+
+typedef void (*Scan_Range_Fn)(const char *data, size_t begin, size_t end, Scan_Lines *lines);
+
+static Scan_Range_Fn scan_range_fn(Scan_Impl impl)
+{
+    switch (impl) {
+#ifdef SCAN_X86
+    case SCAN_SSE2: return scan_range_sse2;
+    case SCAN_AVX2: return scan_range_avx2;
+#endif
+    default: return scan_range_scalar;
+    }
+}
+
+const char *scan_impl_name(Scan_Impl impl)
+{
+    switch (impl) {
+    case SCAN_SCALAR: return "scalar";
+    case SCAN_SSE2: return "sse2";
+    case SCAN_AVX2: return "avx2";
+    default: return "unknown";
+    }
+}
+
+bool scan_impl_supported(Scan_Impl impl)
+{
+    switch (impl) {
+    case SCAN_SCALAR: return true;
+#ifdef SCAN_X86
+    case SCAN_SSE2: return __builtin_cpu_supports("sse2");
+    case SCAN_AVX2: return __builtin_cpu_supports("avx2");
+#endif
+    default: return false;
+    }
+}
+
+Scan_Impl scan_best_impl(void)
+{
+    static Scan_Impl best = COUNT_SCAN_IMPLS;
+
+    if (best == COUNT_SCAN_IMPLS) {
+        best = SCAN_SCALAR;
+        for (Scan_Impl impl = SCAN_SCALAR; impl < COUNT_SCAN_IMPLS; ++impl) {
+            if (scan_impl_supported(impl)) {
+                best = impl;
+            }
+        }
+    }
+
+    return best;
+}
+
+void scan_lines_impl(Scan_Impl impl, const char *data, size_t size, Scan_Lines *lines)
+{
+    assert(scan_impl_supported(impl));
+    scan_range_fn(impl)(data, 0, size, lines);
+}
+
+typedef struct {
+    Scan_Range_Fn fn;
+    const char *data;
+    size_t begin;
+    size_t end;
+    Scan_Lines lines;
+} Scan_Job;
+
+static void *scan_job_run(void *arg)
+{
+    Scan_Job *job = arg;
+    job->fn(job->data, job->begin, job->end, &job->lines);
+    return NULL;
+}
+
+void scan_lines_parallel(Scan_Impl impl, const char *data, size_t size, size_t threads, Scan_Lines *lines)
+{
+    if (threads > SCAN_MAX_THREADS) {
+        threads = SCAN_MAX_THREADS;
+    }
+    if (threads <= 1 || size < threads) {
+        scan_lines_impl(impl, data, size, lines);
+        return;
+    }
+
+    Scan_Job jobs[SCAN_MAX_THREADS] = {0};
+    pthread_t workers[SCAN_MAX_THREADS];
+    bool started[SCAN_MAX_THREADS] = {0};
+
+    for (size_t t = 0; t < threads; ++t) {
+        jobs[t] = (Scan_Job) {
+            .fn = scan_range_fn(impl),
+            .data = data,
+            .begin = size / threads * t,
+            .end = t + 1 == threads ? size : size / threads * (t + 1),
+        };
+        // The first range runs on the calling thread
+        if (t > 0) {
+            started[t] = pthread_create(&workers[t], NULL, scan_job_run, &jobs[t]) == 0;
+        }
+    }
+
+    scan_job_run(&jobs[0]);
+
+    // Each range ends in a piece that continues into the next range
+    Scan_Line carry = {0};
+    for (size_t t = 0; t < threads; ++t) {
+        if (t > 0) {
+            if (started[t]) {
+                pthread_join(workers[t], NULL);
+            } else {
+                scan_job_run(&jobs[t]);
+            }
+        }
+
+        Scan_Lines *part = &jobs[t].lines;
+        assert(part->count > 0);
+        for (size_t i = 0; i + 1 < part->count; ++i) {
+            Scan_Line line = part->items[i];
+            if (i == 0 && t > 0) {
+                line.offset = carry.offset;
+                line.len += carry.len;
+                line.ascii = line.ascii && carry.ascii;
+            }
+            scan_lines_push(lines, line.offset, line.len, line.ascii);
+        }
+
+        Scan_Line last = part->items[part->count - 1];
+        if (part->count == 1 && t > 0) {
+            carry.len += last.len;
+            carry.ascii = carry.ascii && last.ascii;
+        } else {
+            carry = last;
+        }
+        scan_lines_free(part);
+    }
+
+    scan_lines_push(lines, carry.offset, carry.len, carry.ascii);
+}
+
+void scan_lines(const char *data, size_t size, Scan_Lines *lines)
+{
+    size_t threads = 1;
+    if (size >= SCAN_PARALLEL_THRESHOLD) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = online > 0 ? (size_t) online : 1;
+    }
+
+    scan_lines_parallel(scan_best_impl(), data, size, threads, lines);
+}
@@ -0,0 +1,46 @@
+#ifndef SCAN_H_
+#define SCAN_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Line found by the scanner: where it starts in the scanned buffer, its length
+// without the '\n' and whether every byte of it is 7-bit ASCII.
+typedef struct {
+    size_t offset;
+    size_t len;
+    bool ascii;
+} Scan_Line;
+
+typedef struct {
+    Scan_Line *items;
+    size_t count;
+    size_t cap;
+} Scan_Lines;
+
+typedef enum {
+    SCAN_SCALAR = 0,
+    SCAN_SSE2,
+    SCAN_AVX2,
+    COUNT_SCAN_IMPLS,
+} Scan_Impl;
+
+// Inputs at least this big are split into ranges indexed by worker threads
+#define SCAN_PARALLEL_THRESHOLD (64 * 1024 * 1024)
+#define SCAN_MAX_THREADS 16
+
+const char *scan_impl_name(Scan_Impl impl);
+bool scan_impl_supported(Scan_Impl impl);
+Scan_Impl scan_best_impl(void);
+
+// Split `data` on '\n' and append one Scan_Line per line to `lines`. Like the
+// editor, the bytes after the last newline always form a final (possibly
+// empty) line.
+void scan_lines(const char *data, size_t size, Scan_Lines *lines);
+void scan_lines_impl(Scan_Impl impl, const char *data, size_t size, Scan_Lines *lines);
+void scan_lines_parallel(Scan_Impl impl, const char *data, size_t size, size_t threads, Scan_Lines *lines);
+void scan_lines_free(Scan_Lines *lines);
+
+bool scan_is_ascii(const char *data, size_t size);
+
+#endif // SCAN_H_
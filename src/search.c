@@ -0,0 +1,606 @@
+#define _DEFAULT_SOURCE
+#include "search.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "prof.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SEARCH_X86
+#include <immintrin.h>
+#endif
+
+#define SEARCH_MATCHES_INIT_CAPACITY 256
+// How much is searched between two looks at the clock
+#define SEARCH_CHECK_BYTES (256 * 1024)
+#define SEARCH_CHECK_MATCHES (16 * 1024)
+
+// The order the parts are searched in
+static const Search_Part search_order[COUNT_SEARCH_PARTS] = {SEARCH_VIEW, SEARCH_AFTER, SEARCH_BEFORE};
+
+static size_t search_literal_scalar(const char *haystack, size_t haystack_len, const char *needle, size_t needle_len)
+{
+    if (needle_len == 0) {
+        return 0;
+    }
+    if (needle_len > haystack_len) {
+        return haystack_len;
+    }
+
+    const char *p = haystack;
+    const char *last = haystack + haystack_len - needle_len;
+    while (p <= last) {
+        p = memchr(p, needle[0], (size_t) (last - p) + 1);
+        if (p == NULL) {
+            break;
+        }
+        if (memcmp(p + 1, needle + 1, needle_len - 1) == 0) {
+            return (size_t) (p - haystack);
+        }
+        p += 1;
+    }
+    return haystack_len;
+}
+
+// Finishes a vectorized search from `i` on
+static size_t search_literal_tail(const char *haystack, size_t haystack_len, size_t i,
+                                  const char *needle, size_t needle_len)
+{
+    const size_t found = search_literal_scalar(haystack + i, haystack_len - i, needle, needle_len);
+    return found == haystack_len - i ? haystack_len : i + found;
+}
+
+#ifdef SEARCH_X86
+static size_t search_literal_sse2(const char *haystack, size_t haystack_len, const char *needle, size_t needle_len)
+{
+    if (needle_len < 2 || needle_len > haystack_len) {
+        return search_literal_scalar(haystack, haystack_len, needle, needle_len);
+    }
+
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[needle_len - 1]);
+
+    size_t i = 0;
+    for (; i + needle_len - 1 + 16 <= haystack_len; i += 16) {
+        const __m128i block_first = _mm_loadu_si128((const __m128i *) (haystack + i));
+        const __m128i block_last = _mm_loadu_si128((const __m128i *) (haystack + i + needle_len - 1));
+        uint32_t mask = (uint32_t) _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(first, block_first),
+                                                                   _mm_cmpeq_epi8(last, block_last)));
+        while (mask != 0) {
+            const size_t at = i + (size_t) __builtin_ctz(mask);
+            if (memcmp(haystack + at + 1, needle + 1, needle_len - 2) == 0) {
+                return at;
+            }
+            mask &= mask - 1;
+        }
+    }
+
+    return search_literal_tail(haystack, haystack_len, i, needle, needle_len);
+}
+
+__attribute__((target("avx2")))
+static size_t search_literal_avx2(const char *haystack, size_t haystack_len, const char *needle, size_t needle_len)
+{
+    if (needle_len < 2 || needle_len > haystack_len) {
+        return search_literal_scalar(haystack, haystack_len, needle, needle_len);
+    }
+
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last = _mm256_set1_epi8(needle[needle_len - 1]);
+
+    size_t i = 0;
+    for (; i + needle_len - 1 + 32 <= haystack_len; i += 32) {
+        const __m256i block_first = _mm256_loadu_si256((const __m256i *) (haystack + i));
+        const __m256i block_last = _mm256_loadu_si256((const __m256i *) (haystack + i + needle_len - 1));
+        uint32_t mask = (uint32_t) _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(first, block_first),
+                                                                         _mm256_cmpeq_epi8(last, block_last)));
+        while (mask != 0) {
+            const size_t at = i + (size_t) __builtin_ctz(mask);
+            if (memcmp(haystack + at + 1, needle + 1, needle_len - 2) == 0) {
+                return at;
+            }
+            mask &= mask - 1;
+        }
+    }
+
+    return search_literal_tail(haystack, haystack_len, i, needle, needle_len);
+}
+#endif // SEARCH_X86
+
+size_t search_literal_impl(Scan_Impl impl, const char *haystack, size_t haystack_len,
+                           const char *needle, size_t needle_len)
+{
+    assert(scan_impl_supported(impl));
+    switch (impl) {
+#ifdef SEARCH_X86
+    case SCAN_SSE2: return search_literal_sse2(haystack, haystack_len, needle, needle_len);
+    case SCAN_AVX2: return search_literal_avx2(haystack, haystack_len, needle, needle_len);
+#endif
+    default: return search_literal_scalar(haystack, haystack_len, needle, needle_len);
+    }
+}
+
+size_t search_literal(const char *haystack, size_t haystack_len, const char *needle, size_t needle_len)
+{
+    return search_literal_impl(scan_best_impl(), haystack, haystack_len, needle, needle_len);
+}
+
+static void search_push(Search_Matches *matches, size_t row, size_t col, size_t len)
+{
+    if (matches->count == matches->cap) {
+        matches->cap = matches->cap == 0 ? SEARCH_MATCHES_INIT_CAPACITY : matches->cap * 2;
+        matches->items = realloc(matches->items, matches->cap * sizeof(matches->items[0]));
+        if (matches->items == NULL) {
+            fprintf(stderr, "ERROR: could not allocate search results\n");
+            exit(1);
+        }
+    }
+
+    matches->items[matches->count++] = (Search_Match) {
+        .row = row,
+        .col = col,
+        .len = len,
+    };
+}
+
+// Keeps a match unless SEARCH_MAX_MATCHES already are, returns false then
+static bool search_found(Search *search, Search_Matches *matches, size_t row, size_t col, size_t len)
+{
+    if (search->capped || search_count(search) >= SEARCH_MAX_MATCHES) {
+        if (!search->capped) {
+            search->capped = true;
+            search->capped_end = row;
+        }
+        return false;
+    }
+    search_push(matches, row, col, len);
+    return true;
+}
+
+static void search_mark_dirty(Search *search, size_t begin, size_t end)
+{
+    if (search->dirty_begin >= search->dirty_end) {
+        search->dirty_begin = begin;
+        search->dirty_end = end;
+        return;
+    }
+    if (begin < search->dirty_begin) search->dirty_begin = begin;
+    if (end > search->dirty_end) search->dirty_end = end;
+}
+
+bool search_take_dirty(Search *search, size_t *begin, size_t *end)
+{
+    if (search->dirty_begin >= search->dirty_end) {
+        return false;
+    }
+    *begin = search->dirty_begin;
+    *end = search->dirty_end;
+    search->dirty_begin = 0;
+    search->dirty_end = 0;
+    return true;
+}
+
+static void search_reset(Search *search)
+{
+    for (size_t i = 0; i < COUNT_SEARCH_PARTS; ++i) {
+        search->parts[i].count = 0;
+    }
+    search->started = false;
+    search->done = false;
+    search->refine = false;
+    search->capped = false;
+    search_mark_dirty(search, 0, EDITOR_DIRTY_END);
+}
+
+// Whether two occurrences of `text` can overlap, i.e. it has a proper prefix
+// that is also a suffix
+static bool search_self_overlaps(const char *text, size_t len)
+{
+    for (size_t k = 1; k < len; ++k) {
+        if (memcmp(text, text + len - k, k) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool search_set_query(Search *search, const char *query, size_t query_len, bool regex_mode)
+{
+    if (search->query != NULL && search->query_len == query_len && search->regex_mode == regex_mode &&
+        memcmp(search->query, query, query_len) == 0) {
+        return search->valid;
+    }
+
+    // Occurrences of a literal that can't overlap itself were all recorded, and
+    // the ones of a longer query starting with it are among them. That holds
+    // halfway through a refine too, for the parts narrowed down and the rest.
+    const bool refine = !regex_mode && !search->regex_mode && search->valid && (search->done || search->refine) &&
+        search->query_len > 0 && query_len > search->query_len &&
+        memcmp(search->query, query, search->query_len) == 0 &&
+        !search_self_overlaps(search->query, search->query_len);
+
+    if (query_len + 1 > search->query_cap) {
+        search->query_cap = query_len + 1;
+        search->query = realloc(search->query, search->query_cap);
+        if (search->query == NULL) {
+            fprintf(stderr, "ERROR: could not allocate search query\n");
+            exit(1);
+        }
+    }
+    memcpy(search->query, query, query_len);
+    search->query[query_len] = '\0';
+    search->query_len = query_len;
+    search->regex_mode = regex_mode;
+
+    if (refine) {
+        // Every match of the longer literal starts where the shorter one matched
+        search->refine = true;
+        search->refine_part = 0;
+        search->refine_next = 0;
+        search->refined.count = 0;
+        search->done = false;
+        search_mark_dirty(search, 0, EDITOR_DIRTY_END);
+    } else {
+        search_reset(search);
+    }
+
+    search->valid = true;
+    if (regex_mode) {
+        search->valid = regex_compile(&search->regex, query, query_len);
+    }
+    return search->valid;
+}
+
+static double search_now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec * 1e3 + (double) ts.tv_nsec / 1e6;
+}
+
+// Narrows the matches down to the longer query until `deadline`, the viewport
+// in full. Returns true once all of them are.
+static bool search_refine(Search *search, const Editor *editor, double deadline)
+{
+    Search_Matches *refined = &search->refined;
+    // The lines stored next to the row of the last match looked at
+    const Line *span = NULL;
+    size_t span_row = 0;
+    size_t span_count = 0;
+
+    for (; search->refine_part < COUNT_SEARCH_PARTS; ++search->refine_part) {
+        const Search_Part part = search_order[search->refine_part];
+        Search_Matches *matches = &search->parts[part];
+        for (; search->refine_next < matches->count; ++search->refine_next) {
+            if (part != SEARCH_VIEW && search->refine_next % SEARCH_CHECK_MATCHES == 0 &&
+                search_now_ms() >= deadline) {
+                return false;
+            }
+
+            Search_Match match = matches->items[search->refine_next];
+            if (span == NULL || match.row < span_row || match.row >= span_row + span_count) {
+                span = lines_span(&editor->lines, match.row, &span_count);
+                span_row = match.row;
+            }
+            const Line *line = &span[match.row - span_row];
+            if (match.col + search->query_len > line->len ||
+                memcmp(line->chars + match.col, search->query, search->query_len) != 0) {
+                continue;
+            }
+            // The longer query may overlap itself, keep the leftmost like a full search would
+            if (refined->count > 0 && refined->items[refined->count - 1].row == match.row &&
+                refined->items[refined->count - 1].col + search->query_len > match.col) {
+                continue;
+            }
+            search_push(refined, match.row, match.col, search->query_len);
+        }
+
+        // The narrowed down matches take the place of the part, whose memory
+        // is reused for the next one
+        const Search_Matches narrowed = *refined;
+        *refined = *matches;
+        *matches = narrowed;
+        refined->count = 0;
+        search->refine_next = 0;
+        search_mark_dirty(search, 0, EDITOR_DIRTY_END);
+    }
+
+    search->refine = false;
+    search->done = true;
+    return true;
+}
+
+static void search_line(Search *search, Search_Matches *matches, size_t row, const Line *line)
+{
+    const size_t before = matches->count;
+
+    if (search->regex_mode) {
+        const Regex *regex = &search->regex;
+        if (regex->literal_len > 0 &&
+            search_literal(line->chars, line->len, regex->literal, regex->literal_len) == line->len) {
+            return;
+        }
+
+        size_t from = 0;
+        size_t begin, end;
+        while (from <= line->len && regex_find(&search->regex, line->chars, line->len, from, &begin, &end)) {
+            if (end > begin) {
+                if (!search_found(search, matches, row, begin, end - begin)) {
+                    break;
+                }
+                from = end;
+            } else {
+                from = end + 1;
+            }
+        }
+    } else {
+        size_t col = 0;
+        while (col + search->query_len <= line->len) {
+            col += search_literal(line->chars + col, line->len - col, search->query, search->query_len);
+            if (col >= line->len) {
+                break;
+            }
+            if (!search_found(search, matches, row, col, search->query_len)) {
+                break;
+            }
+            col += search->query_len;
+        }
+    }
+
+    if (matches->count > before) {
+        search_mark_dirty(search, row, row + 1);
+    }
+}
+
+// The bytes every match contains, or NULL if there are none to look for
+static const char *search_needle(const Search *search, size_t *len)
+{
+    const char *needle = search->query;
+    *len = search->query_len;
+    if (search->regex_mode) {
+        needle = search->regex.literal;
+        *len = search->regex.literal_len;
+    }
+    if (*len == 0 || memchr(needle, '\n', *len) != NULL) {
+        return NULL;
+    }
+    return needle;
+}
+
+// Untouched lines that follow each other in the source are one block of
+// memory with a '\n' between them, which a needle without newlines can be
+// searched for in one go. A literal query is matched right there, a regex is
+// only run on the lines the needle shows up in. A line shortened in place
+// leaves deleted text in the gap instead, the run ends there. Returns how
+// many of `lines` were searched that way.
+static size_t search_source_run(Search *search, Search_Matches *matches, size_t row,
+                                const Line *lines, size_t count)
+{
+    size_t n = 1;
+    while (n < count && lines[n].cap == 0 && lines[n].chars != NULL &&
+           lines[n].chars == lines[n - 1].chars + lines[n - 1].len + 1 &&
+           lines[n - 1].chars[lines[n - 1].len] == '\n') {
+        n += 1;
+    }
+    if (n == 1) {
+        return 0;
+    }
+
+    size_t needle_len = 0;
+    const char *needle = search_needle(search, &needle_len);
+    const char *end = lines[n - 1].chars + lines[n - 1].len;
+    const char *p = lines[0].chars;
+    size_t k = 0;
+    while (p < end) {
+        p += search_literal(p, (size_t) (end - p), needle, needle_len);
+        if (p >= end) {
+            break;
+        }
+        while (p > lines[k].chars + lines[k].len) {
+            k += 1;
+        }
+
+        if (search->regex_mode) {
+            search_line(search, matches, row + k, &lines[k]);
+            if (k + 1 == n || search->capped) {
+                break;
+            }
+            p = lines[k + 1].chars;
+            continue;
+        }
+
+        if (!search_found(search, matches, row + k, (size_t) (p - lines[k].chars), needle_len)) {
+            break;
+        }
+        search_mark_dirty(search, row + k, row + k + 1);
+        p += needle_len;
+    }
+
+    return n;
+}
+
+// Searches up to `count` rows from `row`, returns how many were searched and
+// adds the bytes they held to `bytes`
+static size_t search_rows(Search *search, Search_Matches *matches, const Editor *editor,
+                          size_t row, size_t count, size_t *bytes)
+{
+    size_t span = 0;
+    const Line *lines = lines_span(&editor->lines, row, &span);
+    if (span > count) {
+        span = count;
+    }
+
+    size_t needle_len = 0;
+    const bool whole_source = search_needle(search, &needle_len) != NULL;
+    size_t i = 0;
+    while (i < span && !search->capped) {
+        size_t n = 0;
+        if (whole_source && lines[i].cap == 0 && lines[i].chars != NULL) {
+            n = search_source_run(search, matches, row + i, lines + i, span - i);
+        }
+        if (n == 0) {
+            search_line(search, matches, row + i, &lines[i]);
+            n = 1;
+        }
+        for (size_t j = i; j < i + n; ++j) {
+            // Count the newline too, so runs of empty lines still add up
+            *bytes += lines[j].len + 1;
+        }
+        i += n;
+    }
+    return span;
+}
+
+bool search_step(Search *search, const Editor *editor, size_t view_begin, size_t view_end, double budget_ms)
+{
+    PROF_ZONE("search_step");
+    if (!search->valid || search->query_len == 0) {
+        return true;
+    }
+
+    const size_t rows = editor->lines.len;
+    if (search->started && search->version != editor->version) {
+        // The rows moved under the matches
+        search_reset(search);
+    }
+    const size_t shown_end = view_end < rows ? view_end : rows;
+    if (search->capped && (view_begin < search->view_begin || shown_end > search->capped_end)) {
+        // The viewport left the matches kept, they are looked for again around it
+        search_reset(search);
+    }
+
+    const double deadline = search_now_ms() + budget_ms;
+    if (search->refine && !search_refine(search, editor, deadline)) {
+        return false;
+    }
+    if (search->done) {
+        return true;
+    }
+
+    if (!search->started) {
+        search->view_end = view_end < rows ? view_end : rows;
+        search->view_begin = view_begin < search->view_end ? view_begin : search->view_end;
+        search->part = SEARCH_VIEW;
+        search->next_row = search->view_begin;
+        search->version = editor->version;
+        search->started = true;
+    }
+
+    size_t bytes_since_check = 0;
+
+    while (!search->done) {
+        size_t end = 0;
+        switch (search->part) {
+        case SEARCH_VIEW: end = search->view_end; break;
+        case SEARCH_AFTER: end = rows; break;
+        case SEARCH_BEFORE: end = search->view_begin; break;
+        default: assert(0 && "unreachable");
+        }
+
+        if (search->next_row >= end) {
+            // Viewport, then below it, then above it
+            if (search->part == SEARCH_VIEW) {
+                search->part = SEARCH_AFTER;
+                search->next_row = search->view_end;
+            } else if (search->part == SEARCH_AFTER) {
+                search->part = SEARCH_BEFORE;
+                search->next_row = 0;
+            } else {
+                search->done = true;
+            }
+            continue;
+        }
+
+        size_t bytes = 0;
+        search->next_row += search_rows(search, &search->parts[search->part], editor,
+                                        search->next_row, end - search->next_row, &bytes);
+        if (search->capped) {
+            // Below the viewport the matches kept end where the last one was
+            // found, above it they all are
+            if (search->part == SEARCH_BEFORE || search->capped_end < search->view_end) {
+                search->capped_end = search->part == SEARCH_BEFORE ? rows : search->view_end;
+            }
+            search->done = true;
+            break;
+        }
+
+        bytes_since_check += bytes;
+        if (bytes_since_check >= SEARCH_CHECK_BYTES) {
+            bytes_since_check = 0;
+            // The viewport always gets searched in full
+            if (search->part != SEARCH_VIEW && search_now_ms() >= deadline) {
+                break;
+            }
+        }
+    }
+
+    return search->done;
+}
+
+void search_free(Search *search)
+{
+    for (size_t i = 0; i < COUNT_SEARCH_PARTS; ++i) {
+        free(search->parts[i].items);
+    }
+    free(search->refined.items);
+    free(search->query);
+    regex_free(&search->regex);
+    memset(search, 0, sizeof(*search));
+}
+
+size_t search_count(const Search *search)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < COUNT_SEARCH_PARTS; ++i) {
+        count += search->parts[i].count;
+    }
+    return count;
+}
+
+const Search_Match *search_match_at(const Search *search, size_t index)
+{
+    for (size_t i = 0; i < COUNT_SEARCH_PARTS; ++i) {
+        if (index < search->parts[i].count) {
+            return &search->parts[i].items[index];
+        }
+        index -= search->parts[i].count;
+    }
+    return NULL;
+}
+
+size_t search_lower_bound(const Search *search, size_t row, size_t col)
+{
+    size_t lo = 0;
+    size_t hi = search_count(search);
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+        const Search_Match *match = search_match_at(search, mid);
+        if (match->row < row || (match->row == row && match->col < col)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+const Search_Match *search_next(const Search *search, size_t row, size_t col, bool forward)
+{
+    const size_t count = search_count(search);
+    if (count == 0) {
+        return NULL;
+    }
+
+    if (forward) {
+        const size_t index = search_lower_bound(search, row, col + 1);
+        return search_match_at(search, index < count ? index : 0);
+    }
+
+    const size_t index = search_lower_bound(search, row, col);
+    return search_match_at(search, index > 0 ? index - 1 : count - 1);
+}
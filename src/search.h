@@ -0,0 +1,100 @@
+#ifndef SEARCH_H_
+#define SEARCH_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "editor.h"
+#include "regexp.h"
+#include "scan.h"
+
+typedef struct {
+    size_t row;
+    size_t col;
+    size_t len;
+} Search_Match;
+
+typedef struct {
+    Search_Match *items;
+    size_t count;
+    size_t cap;
+} Search_Matches;
+
+// The document is searched in three row ranges: the viewport first, then
+// everything below it, then everything above. Each range keeps its matches in
+// document order, so before + view + after is always sorted.
+typedef enum {
+    SEARCH_BEFORE = 0,
+    SEARCH_VIEW,
+    SEARCH_AFTER,
+    COUNT_SEARCH_PARTS,
+} Search_Part;
+
+// Matches kept at most. Past that the search stops, the ones kept are then
+// around the viewport, and a viewport that leaves them starts it over there.
+#define SEARCH_MAX_MATCHES (1024 * 1024)
+
+// Incremental search over the lines of an editor. The lines are searched in
+// place, a little more on every search_step, so a huge document never blocks
+// the caller for longer than its time budget.
+typedef struct {
+    char *query;
+    size_t query_len;
+    size_t query_cap;
+    bool regex_mode;
+    Regex regex;
+    bool valid;
+
+    Search_Matches parts[COUNT_SEARCH_PARTS];
+    Search_Part part;
+    size_t view_begin;
+    size_t view_end;
+    size_t next_row;
+    bool started;
+    bool done;
+    // The query grew from a literal whose search had finished, so its matches
+    // only need to be narrowed down instead of searched for again. They are,
+    // a part at a time in search order, into `refined`, which then takes the
+    // place of the part.
+    bool refine;
+    size_t refine_part;
+    size_t refine_next;
+    Search_Matches refined;
+    // SEARCH_MAX_MATCHES were found, the ones kept are of rows
+    // [view_begin, capped_end)
+    bool capped;
+    size_t capped_end;
+
+    // Editor version the matches were found in
+    size_t version;
+
+    // Rows whose highlighting changed since the last search_take_dirty
+    size_t dirty_begin;
+    size_t dirty_end;
+} Search;
+
+// Returns the offset of the first occurrence of `needle` in `haystack`, or
+// `haystack_len` if there is none. Candidates are found by comparing the first
+// and last byte of the needle 16 or 32 positions at a time.
+size_t search_literal(const char *haystack, size_t haystack_len, const char *needle, size_t needle_len);
+size_t search_literal_impl(Scan_Impl impl, const char *haystack, size_t haystack_len,
+                           const char *needle, size_t needle_len);
+
+// Replaces the query. Returns false (and keeps no matches) if it's an invalid
+// regex, see search->regex.error.
+bool search_set_query(Search *search, const char *query, size_t query_len, bool regex_mode);
+// Searches for at most `budget_ms`, starting with rows [view_begin, view_end)
+// the first time it's called for a query. Returns true once everything is done.
+bool search_step(Search *search, const Editor *editor, size_t view_begin, size_t view_end, double budget_ms);
+void search_free(Search *search);
+
+size_t search_count(const Search *search);
+const Search_Match *search_match_at(const Search *search, size_t index);
+// Index of the first match at or after row:col
+size_t search_lower_bound(const Search *search, size_t row, size_t col);
+// Closest match after (or before) row:col, wrapping around the document
+const Search_Match *search_next(const Search *search, size_t row, size_t col, bool forward);
+
+bool search_take_dirty(Search *search, size_t *begin, size_t *end);
+
+#endif // SEARCH_H_
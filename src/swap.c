@@ -0,0 +1,545 @@
+#define _DEFAULT_SOURCE
+#include "swap.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SWAP_MAGIC "GRIVSWAP"
+#define SWAP_VERSION 1
+// The two header copies are in the first page, the ring comes after it
+#define SWAP_HEADER_SIZE 4096
+#define SWAP_HEADER_SLOT 128
+// Size of the marker that sends the reader back to the start of the ring
+#define SWAP_WRAP UINT32_MAX
+#define SWAP_ALIGN 8
+// A kind and up to four varints
+#define SWAP_FIELDS_MAX (1 + 4 * 10)
+
+_Static_assert(sizeof(Swap_Header) <= SWAP_HEADER_SLOT, "the header must fit its slot");
+
+typedef struct {
+    uint32_t size;
+    uint32_t check;
+    uint64_t seq;
+} Swap_Record_Header;
+
+// FNV-1a
+static uint32_t swap_hash(uint32_t hash, const void *data, size_t len)
+{
+    const unsigned char *bytes = data;
+    for (size_t i = 0; i < len; ++i) {
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+#define SWAP_HASH_INIT 2166136261u
+
+static char *swap_strdup(const char *s)
+{
+    char *copy = strdup(s);
+    if (copy == NULL) {
+        fprintf(stderr, "ERROR: could not allocate the swap file path\n");
+        exit(1);
+    }
+    return copy;
+}
+
+// `.NAME.grive-swap` in the directory of `file_path`, and its checkpoints
+static void swap_set_paths(Swap *swap, const char *file_path)
+{
+    const char *slash = strrchr(file_path, '/');
+    const int dir_len = slash != NULL ? (int) (slash - file_path + 1) : 0;
+    const char *name = file_path + dir_len;
+
+    const size_t size = strlen(file_path) + 32;
+    swap->file_path = swap_strdup(file_path);
+    swap->path = malloc(size);
+    for (size_t i = 0; i < SWAP_CHECKPOINTS; ++i) {
+        swap->checkpoint_paths[i] = malloc(size);
+    }
+    if (swap->path == NULL || swap->checkpoint_paths[0] == NULL || swap->checkpoint_paths[1] == NULL) {
+        fprintf(stderr, "ERROR: could not allocate the swap file path\n");
+        exit(1);
+    }
+    snprintf(swap->path, size, "%.*s.%s.grive-swap", dir_len, file_path, name);
+    for (size_t i = 0; i < SWAP_CHECKPOINTS; ++i) {
+        snprintf(swap->checkpoint_paths[i], size, "%s.%zu", swap->path, i);
+    }
+}
+
+static void swap_free_paths(Swap *swap)
+{
+    free(swap->file_path);
+    free(swap->path);
+    for (size_t i = 0; i < SWAP_CHECKPOINTS; ++i) {
+        free(swap->checkpoint_paths[i]);
+    }
+    free(swap->stale_path);
+}
+
+// Records what the file looks like now, to tell later if it was changed
+static void swap_identify_file(Swap *swap)
+{
+    struct stat st;
+    const bool exists = stat(swap->file_path, &st) == 0;
+    swap->header.file_exists = exists;
+    swap->header.file_size = exists ? (uint64_t) st.st_size : 0;
+    swap->header.file_mtime_ns = exists ? (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec : 0;
+}
+
+static bool swap_file_unchanged(const Swap *swap)
+{
+    Swap copy = *swap;
+    swap_identify_file(&copy);
+    return copy.header.file_exists == swap->header.file_exists &&
+           copy.header.file_size == swap->header.file_size &&
+           copy.header.file_mtime_ns == swap->header.file_mtime_ns;
+}
+
+static uint32_t swap_header_check(const Swap_Header *header)
+{
+    Swap_Header copy = *header;
+    copy.check = 0;
+    return swap_hash(SWAP_HASH_INIT, &copy, sizeof(copy));
+}
+
+static bool swap_header_valid(const Swap_Header *header)
+{
+    return memcmp(header->magic, SWAP_MAGIC, sizeof(header->magic)) == 0 &&
+           header->version == SWAP_VERSION && header->check == swap_header_check(header);
+}
+
+// Writes the header over the older of the two copies
+static void swap_write_header(Swap *swap)
+{
+    swap->header.generation += 1;
+    swap->header.check = swap_header_check(&swap->header);
+    memcpy(swap->map + (swap->header.generation % 2) * SWAP_HEADER_SLOT, &swap->header, sizeof(swap->header));
+}
+
+static bool swap_map(Swap *swap, int flags)
+{
+    swap->fd = open(swap->path, O_RDWR | O_CLOEXEC | flags, 0600);
+    if (swap->fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if ((flags & O_CREAT) && ftruncate(swap->fd, SWAP_HEADER_SIZE + SWAP_RING_SIZE) < 0) {
+        close(swap->fd);
+        return false;
+    }
+    if (fstat(swap->fd, &st) < 0 || st.st_size <= SWAP_HEADER_SIZE) {
+        close(swap->fd);
+        return false;
+    }
+
+    void *map = mmap(NULL, (size_t) st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, swap->fd, 0);
+    if (map == MAP_FAILED) {
+        close(swap->fd);
+        return false;
+    }
+    swap->map = map;
+    swap->ring_size = (size_t) st.st_size - SWAP_HEADER_SIZE;
+    return true;
+}
+
+static void swap_unmap(Swap *swap)
+{
+    munmap(swap->map, SWAP_HEADER_SIZE + swap->ring_size);
+    close(swap->fd);
+}
+
+bool swap_create(Swap *swap, const char *file_path)
+{
+    memset(swap, 0, sizeof(*swap));
+    swap_set_paths(swap, file_path);
+    if (!swap_map(swap, O_CREAT | O_TRUNC)) {
+        swap_free_paths(swap);
+        return false;
+    }
+
+    memcpy(swap->header.magic, SWAP_MAGIC, sizeof(swap->header.magic));
+    swap->header.version = SWAP_VERSION;
+    swap->header.ring_size = swap->ring_size;
+    swap->header.base = SWAP_BASE_FILE;
+    swap->header.pid = (int32_t) getpid();
+    swap_identify_file(swap);
+    swap_write_header(swap);
+    for (size_t i = 0; i < SWAP_CHECKPOINTS; ++i) {
+        unlink(swap->checkpoint_paths[i]);
+    }
+    return true;
+}
+
+Swap_Status swap_open(Swap *swap, const char *file_path)
+{
+    memset(swap, 0, sizeof(*swap));
+    swap_set_paths(swap, file_path);
+    if (!swap_map(swap, 0)) {
+        swap_free_paths(swap);
+        return SWAP_MISSING;
+    }
+
+    Swap_Header headers[2];
+    memcpy(headers, swap->map, sizeof(headers[0]));
+    memcpy(headers + 1, swap->map + SWAP_HEADER_SLOT, sizeof(headers[1]));
+    const bool valid[2] = {swap_header_valid(&headers[0]), swap_header_valid(&headers[1])};
+    const size_t newest = valid[1] && (!valid[0] || headers[1].generation > headers[0].generation);
+    swap->header = headers[newest];
+
+    Swap_Status status = SWAP_FOUND;
+    if (!valid[newest] || swap->header.ring_size != swap->ring_size || swap->header.start >= swap->ring_size ||
+        swap->header.base > SWAP_CHECKPOINTS) {
+        status = SWAP_MISSING;
+    } else if (swap->header.pid != (int32_t) getpid() && kill(swap->header.pid, 0) == 0) {
+        status = SWAP_BUSY;
+    } else if (swap->header.base == SWAP_BASE_FILE && !swap_file_unchanged(swap)) {
+        status = SWAP_CHANGED;
+    } else if (swap->header.base != SWAP_BASE_FILE && access(swap_base_path(swap), R_OK) < 0) {
+        status = SWAP_MISSING;
+    }
+    if (status != SWAP_FOUND) {
+        swap_unmap(swap);
+        swap_free_paths(swap);
+        return status;
+    }
+
+    swap->seq = swap->header.seq;
+    swap->write = swap->header.start;
+    swap->header.pid = (int32_t) getpid();
+    swap_write_header(swap);
+    return SWAP_FOUND;
+}
+
+// Gives up after this many journals set aside for the same file
+#define SWAP_ASIDE_MAX 1000
+
+char *swap_set_aside(const char *file_path)
+{
+    Swap swap = {0};
+    swap_set_paths(&swap, file_path);
+
+    // The checkpoints keep their names next to the journal, `~N.0` and `~N.1`
+    const size_t size = strlen(swap.path) + 32;
+    char *aside = malloc(size);
+    char *checkpoint = malloc(size);
+    if (aside == NULL || checkpoint == NULL) {
+        fprintf(stderr, "ERROR: could not allocate the swap file path\n");
+        exit(1);
+    }
+    bool moved = false;
+    for (int n = 1; n <= SWAP_ASIDE_MAX && !moved; ++n) {
+        snprintf(aside, size, "%s~%d", swap.path, n);
+        if (access(aside, F_OK) == 0) {
+            continue;
+        }
+        if (rename(swap.path, aside) < 0) {
+            break;
+        }
+        moved = true;
+        for (size_t i = 0; i < SWAP_CHECKPOINTS; ++i) {
+            snprintf(checkpoint, size, "%s.%zu", aside, i);
+            rename(swap.checkpoint_paths[i], checkpoint);
+        }
+    }
+
+    free(checkpoint);
+    swap_free_paths(&swap);
+    if (!moved) {
+        free(aside);
+        return NULL;
+    }
+    return aside;
+}
+
+const char *swap_base_path(const Swap *swap)
+{
+    return swap_checkpoint_path(swap, swap->header.base);
+}
+
+const char *swap_checkpoint_path(const Swap *swap, uint32_t base)
+{
+    return base == SWAP_BASE_FILE ? swap->file_path : swap->checkpoint_paths[base - SWAP_BASE_CHECKPOINT];
+}
+
+uint32_t swap_free_checkpoint(const Swap *swap)
+{
+    return swap->header.base == SWAP_BASE_CHECKPOINT ? SWAP_BASE_CHECKPOINT + 1 : SWAP_BASE_CHECKPOINT;
+}
+
+static size_t swap_put_varint(unsigned char *out, uint64_t value)
+{
+    size_t n = 0;
+    while (value >= 0x80) {
+        out[n++] = (unsigned char) (value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = (unsigned char) value;
+    return n;
+}
+
+static bool swap_get_varint(const unsigned char **p, const unsigned char *end, uint64_t *value)
+{
+    *value = 0;
+    for (unsigned shift = 0; *p < end && shift < 64; shift += 7) {
+        const unsigned char byte = *(*p)++;
+        *value |= (uint64_t) (byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static uint32_t swap_record_check(uint64_t seq, const void *fields, size_t fields_len, const char *text, size_t text_len)
+{
+    uint32_t hash = swap_hash(SWAP_HASH_INIT, &seq, sizeof(seq));
+    hash = swap_hash(hash, fields, fields_len);
+    return swap_hash(hash, text, text_len);
+}
+
+// Finds room for `size` bytes without touching the records from the base on
+static bool swap_reserve(Swap *swap, size_t size, size_t *at)
+{
+    const size_t start = swap->header.start;
+    const size_t write = swap->write;
+    const size_t ring = swap->ring_size;
+    // The ring is never filled up completely, `write` == `start` means empty
+    if (write >= start) {
+        if (size < ring - write || (size == ring - write && start > 0)) {
+            *at = write;
+            return true;
+        }
+        if (size < start) {
+            const uint32_t wrap = SWAP_WRAP;
+            memcpy(swap->map + SWAP_HEADER_SIZE + write, &wrap, sizeof(wrap));
+            *at = 0;
+            return true;
+        }
+        return false;
+    }
+    if (size < start - write) {
+        *at = write;
+        return true;
+    }
+    return false;
+}
+
+void swap_append(Swap *swap, Undo_Kind kind, size_t row, size_t col, const char *text, size_t len)
+{
+    swap->seq += 1;
+    if (swap->gap) {
+        return;
+    }
+
+    unsigned char fields[SWAP_FIELDS_MAX];
+    size_t fields_len = 0;
+    fields[fields_len++] = (unsigned char) kind;
+    fields_len += swap_put_varint(fields + fields_len, row);
+    fields_len += swap_put_varint(fields + fields_len, col);
+
+    size_t text_len = 0;
+    switch (kind) {
+    case UNDO_INSERT:
+    case UNDO_INSERT_RANGE:
+        fields_len += swap_put_varint(fields + fields_len, len);
+        text_len = len;
+        break;
+    case UNDO_DELETE:
+        fields_len += swap_put_varint(fields + fields_len, len);
+        break;
+    case UNDO_DELETE_RANGE: {
+        // Only where the removed text ended: the lines it went over and the
+        // bytes after its last newline
+        size_t lines = 0;
+        size_t last = len;
+        for (const char *p = text; (p = memchr(p, '\n', (size_t) (text + len - p))) != NULL; ++p) {
+            lines += 1;
+            last = (size_t) (text + len - p) - 1;
+        }
+        fields_len += swap_put_varint(fields + fields_len, lines);
+        fields_len += swap_put_varint(fields + fields_len, last);
+    }
+    break;
+    case UNDO_SPLIT:
+    case UNDO_JOIN:
+        break;
+    }
+
+    const size_t unaligned = sizeof(Swap_Record_Header) + fields_len + text_len;
+    const size_t size = (unaligned + SWAP_ALIGN - 1) / SWAP_ALIGN * SWAP_ALIGN;
+    size_t at = 0;
+    if (size >= SWAP_WRAP || !swap_reserve(swap, size, &at)) {
+        swap->gap = true;
+        return;
+    }
+
+    char *record = swap->map + SWAP_HEADER_SIZE + at;
+    memcpy(record + sizeof(Swap_Record_Header), fields, fields_len);
+    if (text_len > 0) {
+        memcpy(record + sizeof(Swap_Record_Header) + fields_len, text, text_len);
+    }
+    const Swap_Record_Header header = {
+        .size = (uint32_t) size,
+        .check = swap_record_check(swap->seq, fields, fields_len, text, text_len),
+        .seq = swap->seq,
+    };
+    memcpy(record, &header, sizeof(header));
+    swap->write = at + size == swap->ring_size ? 0 : at + size;
+}
+
+// Decodes the record at ring offset `at`, false if it isn't record `seq`
+static bool swap_decode(const Swap *swap, size_t at, uint64_t seq, Swap_Record *record, size_t *size)
+{
+    Swap_Record_Header header;
+    if (at + sizeof(header) > swap->ring_size) {
+        return false;
+    }
+    const char *data = swap->map + SWAP_HEADER_SIZE + at;
+    memcpy(&header, data, sizeof(header));
+    if (header.seq != seq || header.size < sizeof(header) + 3 || header.size > swap->ring_size - at) {
+        return false;
+    }
+
+    const unsigned char *p = (const unsigned char *) data + sizeof(header);
+    const unsigned char *end = (const unsigned char *) data + header.size;
+    uint64_t row, col, a = 0, b = 0;
+    const Undo_Kind kind = (Undo_Kind) *p++;
+    if (!swap_get_varint(&p, end, &row) || !swap_get_varint(&p, end, &col)) {
+        return false;
+    }
+    *record = (Swap_Record) {.kind = kind, .row = row, .col = col};
+    switch (kind) {
+    case UNDO_INSERT:
+    case UNDO_INSERT_RANGE:
+        if (!swap_get_varint(&p, end, &a) || a > (uint64_t) (end - p)) {
+            return false;
+        }
+        record->text = (const char *) p;
+        record->len = a;
+        break;
+    case UNDO_DELETE:
+        if (!swap_get_varint(&p, end, &a)) {
+            return false;
+        }
+        record->len = a;
+        break;
+    case UNDO_DELETE_RANGE:
+        if (!swap_get_varint(&p, end, &a) || !swap_get_varint(&p, end, &b)) {
+            return false;
+        }
+        record->end_row = row + a;
+        record->end_col = a > 0 ? b : col + b;
+        break;
+    case UNDO_SPLIT:
+    case UNDO_JOIN:
+        break;
+    default:
+        return false;
+    }
+
+    const size_t fields_len = (size_t) ((const char *) p - data) - sizeof(header);
+    const size_t text_len = record->text != NULL ? record->len : 0;
+    if (swap_record_check(seq, data + sizeof(header), fields_len, record->text, text_len) != header.check) {
+        return false;
+    }
+    *size = header.size;
+    return true;
+}
+
+bool swap_read(Swap *swap, Swap_Record *record)
+{
+    size_t at = swap->write;
+    uint32_t first = 0;
+    if (at + sizeof(first) <= swap->ring_size) {
+        memcpy(&first, swap->map + SWAP_HEADER_SIZE + at, sizeof(first));
+    }
+    if (first == SWAP_WRAP && at != 0) {
+        at = 0;
+    }
+
+    size_t size = 0;
+    if (!swap_decode(swap, at, swap->seq + 1, record, &size)) {
+        swap->write = at;
+        return false;
+    }
+    swap->read_pos = at;
+    swap->seq += 1;
+    swap->write = at + size == swap->ring_size ? 0 : at + size;
+    return true;
+}
+
+void swap_unread(Swap *swap)
+{
+    assert(swap->seq > swap->header.seq);
+    swap->seq -= 1;
+    swap->write = swap->read_pos;
+}
+
+bool swap_wants_checkpoint(const Swap *swap)
+{
+    const size_t start = swap->header.start;
+    const size_t used = swap->write >= start ? swap->write - start : swap->ring_size - start + swap->write;
+    return swap->gap || used > swap->ring_size / 2 || swap->seq - swap->header.seq >= SWAP_CHECKPOINT_RECORDS;
+}
+
+bool swap_has_edits(const Swap *swap)
+{
+    return swap->header.base != SWAP_BASE_FILE || swap->seq > swap->header.seq || swap->gap;
+}
+
+Swap_Mark swap_mark(Swap *swap, uint32_t base)
+{
+    // Edits after the mark are kept again, the snapshot covers the ones dropped
+    swap->gap = false;
+    return (Swap_Mark) {.seq = swap->seq, .pos = swap->write, .base = base};
+}
+
+void swap_rebase(Swap *swap, Swap_Mark mark)
+{
+    // The records after an older mark may have been written over already
+    if (mark.seq < swap->header.seq) {
+        if (mark.base != SWAP_BASE_FILE && mark.base != swap->header.base) {
+            unlink(swap_checkpoint_path(swap, mark.base));
+        }
+        return;
+    }
+
+    const uint32_t old_base = swap->header.base;
+    swap->header.base = mark.base;
+    swap->header.seq = mark.seq;
+    swap->header.start = mark.pos;
+    if (mark.base == SWAP_BASE_FILE) {
+        swap_identify_file(swap);
+    }
+    swap_write_header(swap);
+    msync(swap->map, SWAP_HEADER_SIZE, MS_ASYNC);
+
+    if (old_base != SWAP_BASE_FILE && old_base != mark.base) {
+        unlink(swap_checkpoint_path(swap, old_base));
+    }
+}
+
+void swap_close(Swap *swap, bool remove)
+{
+    swap_unmap(swap);
+    if (remove) {
+        unlink(swap->path);
+        for (size_t i = 0; i < SWAP_CHECKPOINTS; ++i) {
+            unlink(swap->checkpoint_paths[i]);
+        }
+    }
+    swap_free_paths(swap);
+    memset(swap, 0, sizeof(*swap));
+}
@@ -0,0 +1,146 @@
+#ifndef SWAP_H_
+#define SWAP_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "undo.h"
+
+// Crash journal of the edits of a file, kept next to it in `.NAME.grive-swap`.
+//
+// Every edit is appended as a small binary record to a ring the file is
+// mapped as. Records are written to memory only, the kernel writes them out
+// on its own, so a crash of the process loses nothing and typing never waits
+// for the disk. The records apply to a base: the file as it was on disk, or a
+// checkpoint of the whole text written next to the swap file by a background
+// save. Once a newer base is written the records before it are dropped, which
+// keeps the ring from filling up and replaying short.
+//
+// Every record carries a sequence number and a checksum. Replaying stops at
+// the first one that is missing or was torn by the crash, so what comes back
+// is always the text as it was after some edit.
+
+#define SWAP_RING_SIZE (8 * 1024 * 1024)
+// A checkpoint is wanted once this many records or half of the ring came after the base
+#define SWAP_CHECKPOINT_RECORDS (64 * 1024)
+
+// What the records apply to
+#define SWAP_BASE_FILE 0
+#define SWAP_BASE_CHECKPOINT 1
+#define SWAP_CHECKPOINTS 2
+
+// The valid one of the two copies at the start of the file with the highest
+// `generation` is the current one, so updating it never leaves none
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t check;
+    uint64_t generation;
+    uint64_t ring_size;
+    uint32_t base;
+    // The file as it was when it became the base, to tell it wasn't changed since
+    uint32_t file_exists;
+    uint64_t file_size;
+    int64_t file_mtime_ns;
+    // Records with a higher sequence number go on top of the base, the first
+    // of them at ring offset `start`
+    uint64_t seq;
+    uint64_t start;
+    // The process writing the journal
+    int32_t pid;
+    uint32_t reserved;
+} Swap_Header;
+
+typedef enum {
+    SWAP_MISSING = 0,
+    // Left by a session that didn't end, its records are waiting to be replayed
+    SWAP_FOUND,
+    // The file changed since the journal was written, it can't be replayed on it
+    SWAP_CHANGED,
+    // Another running process journals the file
+    SWAP_BUSY,
+    // The journal couldn't be written or read, edits go without one
+    SWAP_FAILED,
+} Swap_Status;
+
+// An edit as it was recorded, see Undo_Kind
+typedef struct {
+    Undo_Kind kind;
+    size_t row;
+    size_t col;
+    // Inserted text, or how many bytes UNDO_DELETE removed
+    const char *text;
+    size_t len;
+    // Where the text UNDO_DELETE_RANGE removed ended
+    size_t end_row;
+    size_t end_col;
+} Swap_Record;
+
+// Where the journal was at when a new base was snapshotted, and which base
+typedef struct {
+    uint64_t seq;
+    size_t pos;
+    uint32_t base;
+} Swap_Mark;
+
+typedef struct {
+    char *file_path;
+    char *path;
+    char *checkpoint_paths[SWAP_CHECKPOINTS];
+    int fd;
+    char *map;
+    size_t ring_size;
+    Swap_Header header;
+
+    // Sequence number of the last edit and ring offset of the next record
+    uint64_t seq;
+    size_t write;
+    // An edit didn't fit in the ring, the ones after it are of no use until
+    // the next mark
+    bool gap;
+    // The record swap_read returned last
+    size_t read_pos;
+    // Where the journal left for the file before it changed was set aside,
+    // NULL if there was none
+    char *stale_path;
+} Swap;
+
+// Starts an empty journal for `file_path`, on top of the file as it is on disk
+bool swap_create(Swap *swap, const char *file_path);
+// Opens the journal a previous session left for `file_path`. Only SWAP_FOUND
+// leaves it open, the records are then read with swap_read.
+Swap_Status swap_open(Swap *swap, const char *file_path);
+// Moves the journal left for `file_path` and its checkpoints out of the way of
+// a new one, to `.NAME.grive-swap~N` with the first N not taken. Returns where
+// it went, or NULL if it couldn't be moved.
+char *swap_set_aside(const char *file_path);
+// The file the records apply to, the journaled file or a checkpoint
+const char *swap_base_path(const Swap *swap);
+// Reads the next record after the base. Returns false after the last one,
+// appending goes on from there. swap_unread drops the last one read and
+// everything after it, for a record that turned out not to fit the text.
+bool swap_read(Swap *swap, Swap_Record *record);
+void swap_unread(Swap *swap);
+
+// Records an edit, `text` and `len` as undo_push takes them
+void swap_append(Swap *swap, Undo_Kind kind, size_t row, size_t col, const char *text, size_t len);
+
+bool swap_wants_checkpoint(const Swap *swap);
+// True while the journal holds edits the file doesn't have: records after the
+// base, or a checkpoint as the base. Until then the text is the file as
+// `header.file_size` tells.
+bool swap_has_edits(const Swap *swap);
+// Marks the current edit before the text is snapshotted to become `base`:
+// SWAP_BASE_FILE for a save of the file, swap_free_checkpoint for a checkpoint
+Swap_Mark swap_mark(Swap *swap, uint32_t base);
+uint32_t swap_free_checkpoint(const Swap *swap);
+const char *swap_checkpoint_path(const Swap *swap, uint32_t base);
+// The snapshot taken at `mark` is written, the records up to it are dropped.
+// Marks older than the current base are ignored.
+void swap_rebase(Swap *swap, Swap_Mark mark);
+
+// Closes the journal, `remove` deletes it and its checkpoints as well
+void swap_close(Swap *swap, bool remove);
+
+#endif // SWAP_H_
@@ -0,0 +1,265 @@
+#include "undo.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define UNDO_ARENA_INIT_CAPACITY (64 * 1024)
+#define UNDO_RECORDS_INIT_CAPACITY 256
+
+static size_t undo_record_size(size_t len)
+{
+    const size_t align = _Alignof(Undo_Record);
+    return (sizeof(Undo_Record) + len + align - 1) / align * align;
+}
+
+static Undo_Record *undo_record_at(const Undo *undo, size_t index)
+{
+    return (Undo_Record *) (undo->arena + undo->records[index]);
+}
+
+const char *undo_record_text(const Undo_Record *record)
+{
+    return (const char *) (record + 1);
+}
+
+static void undo_reserve(Undo *undo, size_t bytes, size_t records)
+{
+    if (undo->arena_len + bytes > undo->arena_cap) {
+        size_t new_capacity = undo->arena_cap == 0 ? UNDO_ARENA_INIT_CAPACITY : undo->arena_cap;
+        while (new_capacity < undo->arena_len + bytes) {
+            new_capacity *= 2;
+        }
+        undo->arena = realloc(undo->arena, new_capacity);
+        if (undo->arena == NULL) {
+            fprintf(stderr, "ERROR: could not allocate undo journal\n");
+            exit(1);
+        }
+        undo->arena_cap = new_capacity;
+    }
+
+    if (undo->count + records > undo->cap) {
+        size_t new_capacity = undo->cap == 0 ? UNDO_RECORDS_INIT_CAPACITY : undo->cap;
+        while (new_capacity < undo->count + records) {
+            new_capacity *= 2;
+        }
+        undo->records = realloc(undo->records, new_capacity * sizeof(undo->records[0]));
+        if (undo->records == NULL) {
+            fprintf(stderr, "ERROR: could not allocate undo journal\n");
+            exit(1);
+        }
+        undo->cap = new_capacity;
+    }
+}
+
+size_t undo_bytes_used(const Undo *undo)
+{
+    if (undo->first == undo->count) {
+        return 0;
+    }
+    return undo->arena_len - undo->records[undo->first] +
+           (undo->count - undo->first) * sizeof(undo->records[0]);
+}
+
+static void undo_clear(Undo *undo)
+{
+    undo->arena_len = 0;
+    undo->count = 0;
+    undo->first = 0;
+    undo->head = 0;
+    undo->open = false;
+}
+
+static void undo_drop_oldest(Undo *undo)
+{
+    assert(undo->first < undo->head);
+    undo->first += 1;
+
+    // Slide the live records back once half of the journal is dead
+    if (undo->first * 2 >= undo->count) {
+        const size_t base = undo->first < undo->count ? undo->records[undo->first] : undo->arena_len;
+        memmove(undo->arena, undo->arena + base, undo->arena_len - base);
+        undo->arena_len -= base;
+        for (size_t i = undo->first; i < undo->count; ++i) {
+            undo->records[i - undo->first] = undo->records[i] - base;
+        }
+        undo->count -= undo->first;
+        undo->head -= undo->first;
+        undo->first = 0;
+    }
+}
+
+static void undo_enforce_limit(Undo *undo)
+{
+    // The newest record always stays, so the last edit can be undone
+    while (undo_bytes_used(undo) > undo->max_bytes && undo->first + 1 < undo->head) {
+        undo_drop_oldest(undo);
+    }
+}
+
+void undo_set_limit(Undo *undo, size_t max_bytes)
+{
+    undo->max_bytes = max_bytes;
+    undo_enforce_limit(undo);
+}
+
+static bool is_space(char c)
+{
+    return c == ' ' || c == '\t';
+}
+
+// Grows the last record by `len` bytes of text, inserted at byte `at` of it
+static void undo_extend_last(Undo *undo, size_t at, const char *text, size_t len)
+{
+    const size_t offset = undo->records[undo->count - 1];
+    Undo_Record *last = undo_record_at(undo, undo->count - 1);
+    const size_t old_size = undo_record_size(last->len);
+    const size_t new_size = undo_record_size(last->len + len);
+
+    undo_reserve(undo, new_size - old_size, 0);
+    last = undo_record_at(undo, undo->count - 1);
+
+    char *chars = (char *) (last + 1);
+    memmove(chars + at + len, chars + at, last->len - at);
+    memcpy(chars + at, text, len);
+    last->len += len;
+    undo->arena_len = offset + new_size;
+}
+
+static bool undo_try_coalesce(Undo *undo, Undo_Kind kind, size_t row, size_t col,
+                              const char *text, size_t len)
+{
+    if (!undo->open || undo->batching || undo->head != undo->count || undo->head == undo->first) {
+        return false;
+    }
+
+    const Undo_Record *last = undo_record_at(undo, undo->count - 1);
+    if (last->kind != kind || last->row != row || last->len + len > UNDO_COALESCE_MAX) {
+        return false;
+    }
+
+    if (kind == UNDO_INSERT && last->col + last->len == col) {
+        // Typing a blank after a word starts a new record, so undo goes word by word
+        const char *prev = undo_record_text(last);
+        if (len > 0 && is_space(text[0]) && last->len > 0 && !is_space(prev[last->len - 1])) {
+            return false;
+        }
+        undo_extend_last(undo, last->len, text, len);
+        return true;
+    }
+
+    if (kind == UNDO_DELETE && col + len == last->col) {
+        // Backspace: the new bytes come before the ones already removed
+        undo_extend_last(undo, 0, text, len);
+        undo_record_at(undo, undo->count - 1)->col = col;
+        return true;
+    }
+
+    if (kind == UNDO_DELETE && col == last->col) {
+        // Delete: the new bytes come after
+        undo_extend_last(undo, last->len, text, len);
+        return true;
+    }
+
+    return false;
+}
+
+void undo_push(Undo *undo, Undo_Kind kind, size_t row, size_t col,
+               const char *text, size_t len, size_t cursor_row, size_t cursor_col)
+{
+    if (undo->max_bytes == 0) {
+        undo->max_bytes = UNDO_DEFAULT_MAX_BYTES;
+    }
+
+    if (undo_try_coalesce(undo, kind, row, col, text, len)) {
+        undo_enforce_limit(undo);
+        return;
+    }
+
+    // A new edit forgets everything that could have been redone
+    if (undo->head < undo->count) {
+        undo->arena_len = undo->records[undo->head];
+        undo->count = undo->head;
+    }
+
+    const size_t size = undo_record_size(len);
+    if (size + sizeof(undo->records[0]) > undo->max_bytes) {
+        // Too big to ever be kept, and older records can't be replayed past it
+        undo_clear(undo);
+        return;
+    }
+
+    undo_reserve(undo, size, 1);
+    const size_t offset = undo->arena_len;
+    Undo_Record *record = (Undo_Record *) (undo->arena + offset);
+    *record = (Undo_Record) {
+        .kind = kind,
+        .batch = undo->batching && undo->batch_pushed,
+        .len = len,
+        .row = row,
+        .col = col,
+        .cursor_row = cursor_row,
+        .cursor_col = cursor_col,
+    };
+    if (len > 0) {
+        memcpy(record + 1, text, len);
+    }
+
+    undo->arena_len += size;
+    undo->records[undo->count++] = offset;
+    undo->head = undo->count;
+    undo->open = !undo->batching && (kind == UNDO_INSERT || kind == UNDO_DELETE);
+    undo->batch_pushed = undo->batching;
+
+    undo_enforce_limit(undo);
+}
+
+void undo_seal(Undo *undo)
+{
+    undo->open = false;
+}
+
+void undo_batch_begin(Undo *undo)
+{
+    undo->open = false;
+    undo->batching = true;
+    undo->batch_pushed = false;
+}
+
+void undo_batch_end(Undo *undo)
+{
+    undo->batching = false;
+    undo->batch_pushed = false;
+}
+
+const Undo_Record *undo_step_back(Undo *undo)
+{
+    undo->open = false;
+    if (undo->head == undo->first) {
+        return NULL;
+    }
+    undo->head -= 1;
+    return undo_record_at(undo, undo->head);
+}
+
+const Undo_Record *undo_step_forward(Undo *undo)
+{
+    undo->open = false;
+    if (undo->head == undo->count) {
+        return NULL;
+    }
+    return undo_record_at(undo, undo->head++);
+}
+
+bool undo_forward_continues(const Undo *undo)
+{
+    return undo->head < undo->count && undo_record_at(undo, undo->head)->batch;
+}
+
+void undo_free(Undo *undo)
+{
+    free(undo->arena);
+    free(undo->records);
+    memset(undo, 0, sizeof(*undo));
+}
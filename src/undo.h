@@ -0,0 +1,76 @@
+#ifndef UNDO_H_
+#define UNDO_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef enum {
+    UNDO_INSERT = 0,    // `text` was inserted at row:col
+    UNDO_DELETE,        // `text` was removed from row:col
+    UNDO_SPLIT,         // row was split in two at col
+    UNDO_JOIN,          // row + 1 was appended to row, which was col bytes long
+    UNDO_INSERT_RANGE,  // Like UNDO_INSERT and UNDO_DELETE, for `text` that
+    UNDO_DELETE_RANGE,  // may go over several lines
+} Undo_Kind;
+
+// Header of a record in the journal arena, `len` bytes of text follow it.
+// cursor_row:cursor_col is where the cursor was before the edit.
+typedef struct {
+    Undo_Kind kind;
+    // Undone and redone together with the record before it, see undo_batch_begin
+    bool batch;
+    size_t len;
+    size_t row;
+    size_t col;
+    size_t cursor_row;
+    size_t cursor_col;
+} Undo_Record;
+
+// Journal of edits. Records are packed one after another in `arena` and
+// `records` holds their offsets. [first, head) can be undone, [head, count)
+// redone. Once the journal outgrows `max_bytes` the oldest records are dropped.
+typedef struct {
+    char *arena;
+    size_t arena_len;
+    size_t arena_cap;
+
+    size_t *records;
+    size_t count;
+    size_t cap;
+    size_t first;
+    size_t head;
+
+    size_t max_bytes;
+    // Whether the last record may still absorb the next keystroke
+    bool open;
+    // Inside undo_batch_begin/end, and whether a record was pushed since
+    bool batching;
+    bool batch_pushed;
+} Undo;
+
+#define UNDO_DEFAULT_MAX_BYTES (64 * 1024 * 1024)
+// Coalesced records stop growing past this many bytes of text
+#define UNDO_COALESCE_MAX 4096
+
+void undo_set_limit(Undo *undo, size_t max_bytes);
+size_t undo_bytes_used(const Undo *undo);
+void undo_free(Undo *undo);
+
+// Appends an edit, merging typing and backspacing runs into the last record
+void undo_push(Undo *undo, Undo_Kind kind, size_t row, size_t col,
+               const char *text, size_t len, size_t cursor_row, size_t cursor_col);
+// Stops the last record from absorbing further edits
+void undo_seal(Undo *undo);
+// Records pushed until undo_batch_end are one step of undo and redo, like an
+// edit made at every cursor at once. They are never merged with other records.
+void undo_batch_begin(Undo *undo);
+void undo_batch_end(Undo *undo);
+
+// Steps the head, returning the record to revert or reapply (NULL if none)
+const Undo_Record *undo_step_back(Undo *undo);
+const Undo_Record *undo_step_forward(Undo *undo);
+// Whether the record undo_step_forward returns next belongs to the last one
+bool undo_forward_continues(const Undo *undo);
+const char *undo_record_text(const Undo_Record *record);
+
+#endif // UNDO_H_
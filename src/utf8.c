@@ -0,0 +1,116 @@
+#include "utf8.h"
+
+#include <string.h>
+
+size_t utf8_decode(const char *text, size_t len, uint32_t *codepoint)
+{
+    const unsigned char *s = (const unsigned char *) text;
+    if (s[0] < 0x80) {
+        *codepoint = s[0];
+        return 1;
+    }
+
+    size_t n = 0;
+    uint32_t c = 0;
+    uint32_t min = 0;
+    if ((s[0] & 0xE0) == 0xC0) {
+        n = 2; c = s[0] & 0x1F; min = 0x80;
+    } else if ((s[0] & 0xF0) == 0xE0) {
+        n = 3; c = s[0] & 0x0F; min = 0x800;
+    } else if ((s[0] & 0xF8) == 0xF0) {
+        n = 4; c = s[0] & 0x07; min = 0x10000;
+    }
+    if (n == 0 || n > len) {
+        *codepoint = UTF8_REPLACEMENT;
+        return 1;
+    }
+
+    for (size_t i = 1; i < n; ++i) {
+        if ((s[i] & 0xC0) != 0x80) {
+            *codepoint = UTF8_REPLACEMENT;
+            return 1;
+        }
+        c = (c << 6) | (s[i] & 0x3F);
+    }
+
+    // Overlong forms, UTF-16 surrogates and anything past U+10FFFF
+    if (c < min || (c >= 0xD800 && c <= 0xDFFF) || c > 0x10FFFF) {
+        *codepoint = UTF8_REPLACEMENT;
+        return 1;
+    }
+
+    *codepoint = c;
+    return n;
+}
+
+size_t utf8_next(const char *text, size_t len, size_t i)
+{
+    if (i >= len) {
+        return len;
+    }
+    if ((unsigned char) text[i] < 0x80) {
+        return i + 1;
+    }
+    uint32_t codepoint = 0;
+    return i + utf8_decode(text + i, len - i, &codepoint);
+}
+
+size_t utf8_prev(const char *text, size_t len, size_t i)
+{
+    if (i == 0) {
+        return 0;
+    }
+    if (i > len) {
+        return len;
+    }
+
+    // The lead byte is at most 3 continuation bytes back, but only counts if
+    // it decodes up to `i`, otherwise the byte before `i` stands on its own
+    size_t lead = i - 1;
+    while (lead > 0 && i - lead < 4 && ((unsigned char) text[lead] & 0xC0) == 0x80) {
+        lead -= 1;
+    }
+    uint32_t codepoint = 0;
+    if (utf8_decode(text + lead, len - lead, &codepoint) == i - lead) {
+        return lead;
+    }
+    return i - 1;
+}
+
+size_t utf8_floor(const char *text, size_t len, size_t i)
+{
+    if (i >= len) {
+        return len;
+    }
+
+    size_t lead = i;
+    while (lead > 0 && i - lead < 3 && ((unsigned char) text[lead] & 0xC0) == 0x80) {
+        lead -= 1;
+    }
+    uint32_t codepoint = 0;
+    if (lead < i && utf8_decode(text + lead, len - lead, &codepoint) > i - lead) {
+        return lead;
+    }
+    return i;
+}
+
+size_t utf8_count(const char *text, size_t len)
+{
+    size_t count = 0;
+    size_t i = 0;
+    while (i < len) {
+        if (i + 8 <= len) {
+            uint64_t word;
+            memcpy(&word, text + i, sizeof(word));
+            if ((word & 0x8080808080808080ull) == 0) {
+                // Eight ASCII bytes at once
+                count += 8;
+                i += 8;
+                continue;
+            }
+        }
+        i = utf8_next(text, len, i);
+        count += 1;
+    }
+    return count;
+}
@@ -0,0 +1,23 @@
+#ifndef UTF8_H_
+#define UTF8_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define UTF8_REPLACEMENT 0xFFFD
+
+// Decodes the code point at the start of `text`, which must not be empty, and
+// returns how many bytes it took. Malformed or truncated sequences decode to
+// UTF8_REPLACEMENT one byte at a time, so decoding always moves forward.
+size_t utf8_decode(const char *text, size_t len, uint32_t *codepoint);
+
+// Offset of the code point after / before the one at `i` in text[0, len),
+// stepping over exactly what utf8_decode would decode
+size_t utf8_next(const char *text, size_t len, size_t i);
+size_t utf8_prev(const char *text, size_t len, size_t i);
+// Start of the code point byte `i` is part of
+size_t utf8_floor(const char *text, size_t len, size_t i);
+// Code points in text[0, len), as utf8_next counts them
+size_t utf8_count(const char *text, size_t len);
+
+#endif // UTF8_H_